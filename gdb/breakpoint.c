@@ -61,6 +61,8 @@
 #include "valprint.h"
 #include "jit.h"
 #include "xml-syscall.h"
+#include "ax.h"
+#include "ax-gdb.h"
 
 /* readline include files */
 #include "readline/readline.h"
@@ -150,6 +152,9 @@ insertion_state_t;
 
 static int remove_breakpoint (struct bp_location *, insertion_state_t);
 
+static int insert_bp_location (struct bp_location *, struct ui_file *,
+			       int *, int *);
+
 static enum print_stop_action print_it_typical (bpstat);
 
 static enum print_stop_action print_bp_stop_message (bpstat bs);
@@ -195,6 +200,8 @@ static int single_step_breakpoint_inserted_here_p (CORE_ADDR pc);
 
 static void free_bp_location (struct bp_location *loc);
 
+static void update_target_conditions (struct bp_location *bl);
+
 static struct bp_location *allocate_bp_location (struct breakpoint *bpt);
 
 static void update_global_location_list (int);
@@ -582,6 +589,23 @@ get_breakpoint (int num)
 }
 
 
+/* Send the target the conditions of the locations at the addresses of
+   B which are inserted, now that its condition changed.  */
+
+static void
+reinsert_target_conditions (struct breakpoint *b)
+{
+  struct bp_location *bl, *loc;
+
+  if (!target_supports_cond_breakpoints ())
+    return;
+
+  for (bl = b->loc; bl; bl = bl->next)
+    ALL_BP_LOCATIONS (loc)
+      if (loc->address == bl->address)
+	update_target_conditions (loc);
+}
+
 /* condition N EXP -- set break condition of breakpoint N to EXP.  */
 
 static void
@@ -636,6 +660,7 @@ condition_command (char *arg, int from_tty)
 		  error (_("Junk at end of expression"));
 	      }
 	  }
+	reinsert_target_conditions (b);
 	breakpoints_changed ();
 	observer_notify_breakpoint_modified (b->number);
 	return;
@@ -1100,6 +1125,127 @@ should_be_inserted (struct bp_location *bpt)
   return 1;
 }
 
+/* Free the conditions compiled for the target in TGT.  */
+
+static void
+free_target_conditions (struct bp_target_info *tgt)
+{
+  struct agent_expr *aexpr;
+  int ix;
+
+  for (ix = 0; VEC_iterate (agent_expr_p, tgt->conditions, ix, aexpr); ix++)
+    free_agent_expr (aexpr);
+  VEC_free (agent_expr_p, tgt->conditions);
+}
+
+/* Compile the conditions of the breakpoints at BL's address for a
+   target which evaluates them.  Only one location is inserted at an
+   address, and the target reports a hit when any condition holds; so
+   if a location there has no condition, or one which cannot be
+   compiled to an agent expression, the list is left empty, every hit
+   is reported, and GDB evaluates the conditions as it always did.  */
+
+static void
+build_target_condition_list (CORE_ADDR address, struct bp_target_info *tgt)
+{
+  struct bp_location *loc;
+
+  if (!target_supports_cond_breakpoints ())
+    return;
+
+  ALL_BP_LOCATIONS (loc)
+    {
+      struct agent_expr *aexpr = NULL;
+      volatile struct gdb_exception ex;
+
+      /* Duplicates count as well.  */
+      if (loc->address != address
+	  || (loc->loc_type != bp_loc_software_breakpoint
+	      && loc->loc_type != bp_loc_hardware_breakpoint)
+	  || !breakpoint_enabled (loc->owner)
+	  || loc->owner->disposition == disp_del_at_next_stop
+	  || loc->owner->type == bp_tracepoint
+	  || !loc->enabled || loc->shlib_disabled)
+	continue;
+
+      if (loc->cond != NULL)
+	{
+	  TRY_CATCH (ex, RETURN_MASK_ERROR)
+	    {
+	      aexpr = gen_eval_for_expr (loc->address, loc->cond);
+	    }
+	}
+
+      if (aexpr == NULL)
+	{
+	  free_target_conditions (tgt);
+	  return;
+	}
+      VEC_safe_push (agent_expr_p, tgt->conditions, aexpr);
+    }
+}
+
+/* Return non-zero if the condition lists A and B are the same.  */
+
+static int
+target_conditions_equal (VEC(agent_expr_p) *a, VEC(agent_expr_p) *b)
+{
+  struct agent_expr *aexpr, *bexpr;
+  int ix;
+
+  if (VEC_length (agent_expr_p, a) != VEC_length (agent_expr_p, b))
+    return 0;
+
+  for (ix = 0; VEC_iterate (agent_expr_p, a, ix, aexpr); ix++)
+    {
+      bexpr = VEC_index (agent_expr_p, b, ix);
+      if (aexpr->len != bexpr->len
+	  || memcmp (aexpr->buf, bexpr->buf, aexpr->len) != 0)
+	return 0;
+    }
+
+  return 1;
+}
+
+/* If BL is an inserted software breakpoint and the locations at its
+   address no longer have the conditions the target was given, send
+   it the new ones.  Inserting a breakpoint again at the same address
+   replaces its conditions, so it is never out of the target, which
+   matters with threads running in non-stop mode.  */
+
+static void
+update_target_conditions (struct bp_location *bl)
+{
+  struct bp_target_info tgt;
+
+  if (!bl->inserted
+      || bl->loc_type != bp_loc_software_breakpoint
+      || !target_supports_cond_breakpoints ())
+    return;
+
+  tgt = bl->target_info;
+  tgt.placed_address = bl->address;
+  tgt.conditions = NULL;
+  build_target_condition_list (bl->address, &tgt);
+
+  if (target_conditions_equal (tgt.conditions, bl->target_info.conditions))
+    {
+      free_target_conditions (&tgt);
+      return;
+    }
+
+  if (target_insert_breakpoint (bl->gdbarch, &tgt) != 0)
+    {
+      warning (_("Cannot update the conditions of breakpoint %d."),
+	       bl->owner->number);
+      free_target_conditions (&tgt);
+      return;
+    }
+
+  free_target_conditions (&bl->target_info);
+  bl->target_info = tgt;
+}
+
 /* Insert a low-level "breakpoint" of some type.  BPT is the breakpoint.
    Any error messages are printed to TMP_ERROR_STREAM; and DISABLED_BREAKS,
    and HW_BREAKPOINT_ERROR are used to report problems.
@@ -1118,6 +1264,7 @@ insert_bp_location (struct bp_location *bpt,
     return 0;
 
   /* Initialize the target-specific information.  */
+  free_target_conditions (&bpt->target_info);
   memset (&bpt->target_info, 0, sizeof (bpt->target_info));
   bpt->target_info.placed_address = bpt->address;
 
@@ -1186,8 +1333,11 @@ Note: automatically using hardware breakpoints for read-only addresses.\n"));
 	    val = target_insert_hw_breakpoint (bpt->gdbarch,
 					       &bpt->target_info);
 	  else
-	    val = target_insert_breakpoint (bpt->gdbarch,
-					    &bpt->target_info);
+	    {
+	      build_target_condition_list (bpt->address, &bpt->target_info);
+	      val = target_insert_breakpoint (bpt->gdbarch,
+					      &bpt->target_info);
+	    }
 	}
       else
 	{
@@ -4416,6 +4566,8 @@ static void free_bp_location (struct bp_location *loc)
   if (loc->cond)
     xfree (loc->cond);
 
+  free_target_conditions (&loc->target_info);
+
   if (loc->function_name)
     xfree (loc->function_name);
   
@@ -7853,6 +8005,9 @@ update_global_location_list (int should_insert)
 		      {		  
 			loc2->inserted = 1;
 			loc2->target_info = loc->target_info;
+			/* LOC2 owns the conditions now; the target is
+			   given its own below.  */
+			loc->target_info.conditions = NULL;
 			keep_in_target = 1;
 			break;
 		      }
@@ -7909,6 +8064,12 @@ update_global_location_list (int should_insert)
       check_duplicates (b);
     }
 
+  /* Locations added at, or removed from, an address where a
+     breakpoint stays inserted change the conditions it needs.  */
+  if (breakpoints_always_inserted_mode ())
+    ALL_BP_LOCATIONS (loc)
+      update_target_conditions (loc);
+
   if (breakpoints_always_inserted_mode () && should_insert
       && (have_live_inferiors ()
 	  || (gdbarch_has_global_breakpoints (target_gdbarch))))
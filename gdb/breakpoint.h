@@ -172,6 +172,10 @@ enum target_hw_bp_type
   };
 
 
+struct agent_expr;
+typedef struct agent_expr *agent_expr_p;
+DEF_VEC_P(agent_expr_p);
+
 /* Information used by targets to insert and remove breakpoints.  */
 
 struct bp_target_info
@@ -199,6 +203,11 @@ struct bp_target_info
      (e.g. if a remote stub handled the details).  We may still
      need the size to remove the breakpoint safely.  */
   int placed_size;
+
+  /* Conditions, compiled to agent expressions, for a target which can
+     evaluate them itself and only report a hit when one of them is
+     true.  Empty if every hit must be reported.  */
+  VEC(agent_expr_p) *conditions;
 };
 
 /* GDB maintains two types of information about each breakpoint (or
@@ -461,6 +461,40 @@ dcache_update (DCACHE *dcache, CORE_ADDR memaddr, gdb_byte *myaddr, int len)
     dcache_poke_byte (dcache, memaddr + i, myaddr + i);
 }
 
+int
+dcache_line_size (void)
+{
+  return LINE_SIZE;
+}
+
+/* Fill cache lines with the LEN bytes at MYADDR, which the target
+   already sent us as the contents of memory at MEMADDR in thread
+   PTID, e.g. in a stop reply.  Only whole lines are filled; the
+   partial lines at either end are left alone.  */
+
+void
+dcache_prime (DCACHE *dcache, ptid_t ptid, CORE_ADDR memaddr,
+	      const gdb_byte *myaddr, int len)
+{
+  int i;
+
+  if (! ptid_equal (ptid, dcache->ptid))
+    {
+      dcache_invalidate (dcache);
+      dcache->ptid = ptid;
+    }
+
+  for (i = XFORM (LINE_SIZE - XFORM (memaddr)); i + LINE_SIZE <= len;
+       i += LINE_SIZE)
+    {
+      struct dcache_block *db = dcache_hit (dcache, memaddr + i);
+
+      if (db == NULL)
+	db = dcache_alloc (dcache, memaddr + i);
+      memcpy (db->data, myaddr + i, LINE_SIZE);
+    }
+}
+
 static void
 dcache_print_line (int index)
 {
@@ -41,4 +41,10 @@ int dcache_xfer_memory (struct target_ops *ops, DCACHE *cache, CORE_ADDR mem,
 void dcache_update (DCACHE *dcache, CORE_ADDR memaddr, gdb_byte *myaddr,
 		    int len);
 
+/* The size in bytes of a cache line; lines are aligned to it.  */
+int dcache_line_size (void);
+
+void dcache_prime (DCACHE *dcache, ptid_t ptid, CORE_ADDR memaddr,
+		   const gdb_byte *myaddr, int len);
+
 #endif /* DCACHE_H */
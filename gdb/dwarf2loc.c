@@ -144,38 +144,21 @@ dwarf_expr_read_mem (void *baton, gdb_byte *buf, CORE_ADDR addr, size_t len)
   read_memory (addr, buf, len);
 }
 
-/* Using the frame specified in BATON, find the location expression
-   describing the frame base.  Return a pointer to it in START and
-   its length in LENGTH.  */
+/* Find the location expression describing the frame base of
+   FRAMEFUNC at PC.  Return a pointer to it in START and its length in
+   LENGTH.  */
 static void
-dwarf_expr_frame_base (void *baton, gdb_byte **start, size_t * length)
+dwarf_expr_frame_base_1 (struct symbol *framefunc, CORE_ADDR pc,
+			 gdb_byte **start, size_t *length)
 {
-  /* FIXME: cagney/2003-03-26: This code should be using
-     get_frame_base_address(), and then implement a dwarf2 specific
-     this_base method.  */
-  struct symbol *framefunc;
-  struct dwarf_expr_baton *debaton = (struct dwarf_expr_baton *) baton;
-
-  /* Use block_linkage_function, which returns a real (not inlined)
-     function, instead of get_frame_function, which may return an
-     inlined function.  */
-  framefunc = block_linkage_function (get_frame_block (debaton->frame, NULL));
-
-  /* If we found a frame-relative symbol then it was certainly within
-     some function associated with a frame. If we can't find the frame,
-     something has gone wrong.  */
-  gdb_assert (framefunc != NULL);
-
   if (SYMBOL_LOCATION_BATON (framefunc) == NULL)
     *start = NULL;
   else if (SYMBOL_COMPUTED_OPS (framefunc) == &dwarf2_loclist_funcs)
     {
       struct dwarf2_loclist_baton *symbaton;
-      struct frame_info *frame = debaton->frame;
 
       symbaton = SYMBOL_LOCATION_BATON (framefunc);
-      *start = find_location_expression (symbaton, length,
-					 get_frame_address_in_block (frame));
+      *start = find_location_expression (symbaton, length, pc);
     }
   else
     {
@@ -195,6 +178,33 @@ dwarf_expr_frame_base (void *baton, gdb_byte **start, size_t * length)
 	   SYMBOL_NATURAL_NAME (framefunc));
 }
 
+/* Using the frame specified in BATON, find the location expression
+   describing the frame base.  Return a pointer to it in START and
+   its length in LENGTH.  */
+static void
+dwarf_expr_frame_base (void *baton, gdb_byte **start, size_t * length)
+{
+  /* FIXME: cagney/2003-03-26: This code should be using
+     get_frame_base_address(), and then implement a dwarf2 specific
+     this_base method.  */
+  struct symbol *framefunc;
+  struct dwarf_expr_baton *debaton = (struct dwarf_expr_baton *) baton;
+
+  /* Use block_linkage_function, which returns a real (not inlined)
+     function, instead of get_frame_function, which may return an
+     inlined function.  */
+  framefunc = block_linkage_function (get_frame_block (debaton->frame, NULL));
+
+  /* If we found a frame-relative symbol then it was certainly within
+     some function associated with a frame. If we can't find the frame,
+     something has gone wrong.  */
+  gdb_assert (framefunc != NULL);
+
+  dwarf_expr_frame_base_1 (framefunc,
+			   get_frame_address_in_block (debaton->frame),
+			   start, length);
+}
+
 /* Helper function for dwarf2_evaluate_loc_desc.  Computes the CFA for
    the frame in BATON.  */
 
@@ -606,20 +616,26 @@ dwarf2_tracepoint_var_ref (struct symbol *symbol, struct gdbarch *gdbarch,
       && data[0] <= DW_OP_reg31)
     {
       value->kind = axs_lvalue_register;
-      value->u.reg = data[0] - DW_OP_reg0;
+      value->u.reg = gdbarch_dwarf2_reg_to_regnum (gdbarch,
+						   data[0] - DW_OP_reg0);
     }
   else if (data[0] == DW_OP_regx)
     {
       ULONGEST reg;
       read_uleb128 (data + 1, data + size, &reg);
       value->kind = axs_lvalue_register;
-      value->u.reg = reg;
+      value->u.reg = gdbarch_dwarf2_reg_to_regnum (gdbarch, reg);
     }
   else if (data[0] == DW_OP_fbreg)
     {
-      /* And this is worse than just minimal; we should honor the frame base
-	 as above.  */
-      int frame_reg;
+      /* We can only handle a frame base which is a register plus a
+	 constant, at the address the expression is for.  */
+      struct block *b;
+      struct symbol *framefunc;
+      gdb_byte *base_data;
+      size_t base_size;
+      unsigned int base_reg;
+      LONGEST base_offset = 0;
       LONGEST frame_offset;
       gdb_byte *buf_end;
 
@@ -628,10 +644,40 @@ dwarf2_tracepoint_var_ref (struct symbol *symbol, struct gdbarch *gdbarch,
 	error (_("Unexpected opcode after DW_OP_fbreg for symbol \"%s\"."),
 	       SYMBOL_PRINT_NAME (symbol));
 
-      gdbarch_virtual_frame_pointer (gdbarch,
-				     ax->scope, &frame_reg, &frame_offset);
-      ax_reg (ax, frame_reg);
-      ax_const_l (ax, frame_offset);
+      b = block_for_pc (ax->scope);
+      if (b == NULL)
+	error (_("No block found for address %s."),
+	       paddress (gdbarch, ax->scope));
+      framefunc = block_linkage_function (b);
+      if (framefunc == NULL)
+	error (_("No function found for block at %s."),
+	       paddress (gdbarch, ax->scope));
+
+      dwarf_expr_frame_base_1 (framefunc, ax->scope, &base_data, &base_size);
+
+      if (base_size == 1
+	  && base_data[0] >= DW_OP_reg0
+	  && base_data[0] <= DW_OP_reg31)
+	base_reg = base_data[0] - DW_OP_reg0;
+      else if (base_size > 0
+	       && base_data[0] >= DW_OP_breg0
+	       && base_data[0] <= DW_OP_breg31)
+	{
+	  base_reg = base_data[0] - DW_OP_breg0;
+	  buf_end = read_sleb128 (base_data + 1, base_data + base_size,
+				  &base_offset);
+	  if (buf_end != base_data + base_size)
+	    error (_("Unexpected opcode after DW_OP_breg%u "
+		     "in the frame base of \"%s\"."),
+		   base_reg, SYMBOL_PRINT_NAME (framefunc));
+	}
+      else
+	error (_("Unsupported DWARF opcode 0x%x "
+		 "in the frame base of \"%s\"."),
+	       base_data[0], SYMBOL_PRINT_NAME (framefunc));
+
+      ax_reg (ax, gdbarch_dwarf2_reg_to_regnum (gdbarch, base_reg));
+      ax_const_l (ax, base_offset + frame_offset);
       ax_simple (ax, aop_add);
 
       value->kind = axs_lvalue_memory;
@@ -649,7 +695,7 @@ dwarf2_tracepoint_var_ref (struct symbol *symbol, struct gdbarch *gdbarch,
 	error (_("Unexpected opcode after DW_OP_breg%u for symbol \"%s\"."),
 	       reg, SYMBOL_PRINT_NAME (symbol));
 
-      ax_reg (ax, reg);
+      ax_reg (ax, gdbarch_dwarf2_reg_to_regnum (gdbarch, reg));
       ax_const_l (ax, offset);
       ax_simple (ax, aop_add);
 
@@ -0,0 +1,518 @@
+/* Agent expression evaluation for the remote server for GDB.
+   Copyright (C) 2009 Free Software Foundation, Inc.
+
+   This file is part of GDB.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "server.h"
+#include "ax.h"
+
+/* Opcodes, as defined in gdb/ax.h.  */
+
+enum gdb_agent_op
+  {
+    gdb_agent_op_float = 0x01,
+    gdb_agent_op_add = 0x02,
+    gdb_agent_op_sub = 0x03,
+    gdb_agent_op_mul = 0x04,
+    gdb_agent_op_div_signed = 0x05,
+    gdb_agent_op_div_unsigned = 0x06,
+    gdb_agent_op_rem_signed = 0x07,
+    gdb_agent_op_rem_unsigned = 0x08,
+    gdb_agent_op_lsh = 0x09,
+    gdb_agent_op_rsh_signed = 0x0a,
+    gdb_agent_op_rsh_unsigned = 0x0b,
+    gdb_agent_op_trace = 0x0c,
+    gdb_agent_op_trace_quick = 0x0d,
+    gdb_agent_op_log_not = 0x0e,
+    gdb_agent_op_bit_and = 0x0f,
+    gdb_agent_op_bit_or = 0x10,
+    gdb_agent_op_bit_xor = 0x11,
+    gdb_agent_op_bit_not = 0x12,
+    gdb_agent_op_equal = 0x13,
+    gdb_agent_op_less_signed = 0x14,
+    gdb_agent_op_less_unsigned = 0x15,
+    gdb_agent_op_ext = 0x16,
+    gdb_agent_op_ref8 = 0x17,
+    gdb_agent_op_ref16 = 0x18,
+    gdb_agent_op_ref32 = 0x19,
+    gdb_agent_op_ref64 = 0x1a,
+    gdb_agent_op_ref_float = 0x1b,
+    gdb_agent_op_ref_double = 0x1c,
+    gdb_agent_op_ref_long_double = 0x1d,
+    gdb_agent_op_l_to_d = 0x1e,
+    gdb_agent_op_d_to_l = 0x1f,
+    gdb_agent_op_if_goto = 0x20,
+    gdb_agent_op_goto = 0x21,
+    gdb_agent_op_const8 = 0x22,
+    gdb_agent_op_const16 = 0x23,
+    gdb_agent_op_const32 = 0x24,
+    gdb_agent_op_const64 = 0x25,
+    gdb_agent_op_reg = 0x26,
+    gdb_agent_op_end = 0x27,
+    gdb_agent_op_dup = 0x28,
+    gdb_agent_op_pop = 0x29,
+    gdb_agent_op_zero_ext = 0x2a,
+    gdb_agent_op_swap = 0x2b,
+    gdb_agent_op_trace16 = 0x30
+  };
+
+/* The evaluation stack.  GDB sizes its own expressions to fit in
+   this, see the "Agent Expressions" chapter of the manual.  */
+
+#define AGENT_STACK_SIZE 100
+
+/* The number of bytecodes we are willing to execute before deciding
+   the expression loops forever.  */
+
+#define AGENT_MAX_STEPS 100000
+
+struct agent_expr *
+parse_agent_expr (char **actptr, int len)
+{
+  char *act = *actptr;
+  struct agent_expr *aexpr;
+
+  if (len <= 0 || strlen (act) < (size_t) len * 2)
+    return NULL;
+
+  aexpr = xmalloc (sizeof (*aexpr));
+  aexpr->length = len;
+  aexpr->bytes = xmalloc (len);
+  unhexify ((char *) aexpr->bytes, act, len);
+  *actptr = act + len * 2;
+  return aexpr;
+}
+
+void
+free_agent_expr (struct agent_expr *aexpr)
+{
+  if (aexpr != NULL)
+    {
+      free (aexpr->bytes);
+      free (aexpr);
+    }
+}
+
+/* Fetch a big-endian immediate of SIZE bytes at PC.  */
+
+static ULONGEST
+fetch_operand (const unsigned char *pc, int size)
+{
+  ULONGEST val = 0;
+  int i;
+
+  for (i = 0; i < size; i++)
+    val = (val << 8) | pc[i];
+  return val;
+}
+
+/* Read SIZE bytes of inferior memory at ADDR into *VAL, in the
+   inferior's byte order.  */
+
+static int
+read_sized (CORE_ADDR addr, int size, ULONGEST *val)
+{
+  unsigned char buf[8];
+
+  if (read_inferior_memory (addr, buf, size) != 0)
+    return -1;
+
+  switch (size)
+    {
+    case 1:
+      *val = buf[0];
+      break;
+    case 2:
+      {
+	unsigned short v;
+	memcpy (&v, buf, 2);
+	*val = v;
+      }
+      break;
+    case 4:
+      {
+	unsigned int v;
+	memcpy (&v, buf, 4);
+	*val = v;
+      }
+      break;
+    default:
+      {
+	ULONGEST v;
+	memcpy (&v, buf, 8);
+	*val = v;
+      }
+      break;
+    }
+  return 0;
+}
+
+int
+agent_expr_read_register (int regnum, ULONGEST *val)
+{
+  unsigned char buf[8];
+  int size;
+
+  if (regnum < 0 || regnum >= register_count ())
+    return -1;
+
+  size = register_size (regnum);
+  if (size != 1 && size != 2 && size != 4 && size != 8)
+    return -1;
+
+  collect_register (regnum, buf);
+  switch (size)
+    {
+    case 1:
+      *val = buf[0];
+      break;
+    case 2:
+      {
+	unsigned short v;
+	memcpy (&v, buf, 2);
+	*val = v;
+      }
+      break;
+    case 4:
+      {
+	unsigned int v;
+	memcpy (&v, buf, 4);
+	*val = v;
+      }
+      break;
+    default:
+      memcpy (val, buf, 8);
+      break;
+    }
+  return 0;
+}
+
+/* Sign-extend VAL from its low N bits.  */
+
+static ULONGEST
+sign_extend (ULONGEST val, int n)
+{
+  if (n > 0 && n < 64)
+    {
+      ULONGEST mask = (ULONGEST) 1 << (n - 1);
+
+      val &= ((ULONGEST) 1 << n) - 1;
+      val = (val ^ mask) - mask;
+    }
+  return val;
+}
+
+enum eval_result_type
+eval_agent_expr (struct agent_expr *aexpr, agent_trace_fn trace, void *data,
+		 ULONGEST *rslt)
+{
+  ULONGEST stack[AGENT_STACK_SIZE];
+  int sp = 0;
+  int pc = 0;
+  int steps = 0;
+  ULONGEST top = 0;
+  const unsigned char *bytes = aexpr->bytes;
+
+  if (aexpr->length == 0)
+    return expr_eval_empty_expression;
+
+  /* TOP caches the top of the stack; STACK[0 .. SP-1] holds the rest.
+     SP counts every value, including the cached one.  */
+
+#define NEED(n)						\
+  do {							\
+    if (sp < (n))					\
+      return expr_eval_stack_underflow;			\
+  } while (0)
+#define PUSH(v)						\
+  do {							\
+    if (sp >= AGENT_STACK_SIZE)				\
+      return expr_eval_stack_overflow;			\
+    if (sp > 0)						\
+      stack[sp - 1] = top;				\
+    top = (v);						\
+    sp++;						\
+  } while (0)
+#define POP()  (sp--, sp > 0 ? (top = stack[sp - 1]) : 0)
+#define OPERAND(size)					\
+  do {							\
+    if (pc + (size) > aexpr->length)			\
+      return expr_eval_unrecognized_opcode;		\
+  } while (0)
+
+  while (pc < aexpr->length)
+    {
+      enum gdb_agent_op op = bytes[pc++];
+      ULONGEST a, b;
+
+      if (++steps > AGENT_MAX_STEPS)
+	return expr_eval_invalid_goto;
+
+      switch (op)
+	{
+	case gdb_agent_op_add:
+	case gdb_agent_op_sub:
+	case gdb_agent_op_mul:
+	case gdb_agent_op_div_signed:
+	case gdb_agent_op_div_unsigned:
+	case gdb_agent_op_rem_signed:
+	case gdb_agent_op_rem_unsigned:
+	case gdb_agent_op_lsh:
+	case gdb_agent_op_rsh_signed:
+	case gdb_agent_op_rsh_unsigned:
+	case gdb_agent_op_bit_and:
+	case gdb_agent_op_bit_or:
+	case gdb_agent_op_bit_xor:
+	case gdb_agent_op_equal:
+	case gdb_agent_op_less_signed:
+	case gdb_agent_op_less_unsigned:
+	  NEED (2);
+	  b = top;
+	  POP ();
+	  a = top;
+	  switch (op)
+	    {
+	    case gdb_agent_op_add:
+	      a += b;
+	      break;
+	    case gdb_agent_op_sub:
+	      a -= b;
+	      break;
+	    case gdb_agent_op_mul:
+	      a *= b;
+	      break;
+	    case gdb_agent_op_div_signed:
+	      if (b == 0)
+		return expr_eval_divide_by_zero;
+	      a = (LONGEST) a / (LONGEST) b;
+	      break;
+	    case gdb_agent_op_div_unsigned:
+	      if (b == 0)
+		return expr_eval_divide_by_zero;
+	      a /= b;
+	      break;
+	    case gdb_agent_op_rem_signed:
+	      if (b == 0)
+		return expr_eval_divide_by_zero;
+	      a = (LONGEST) a % (LONGEST) b;
+	      break;
+	    case gdb_agent_op_rem_unsigned:
+	      if (b == 0)
+		return expr_eval_divide_by_zero;
+	      a %= b;
+	      break;
+	    case gdb_agent_op_lsh:
+	      a = b >= 64 ? 0 : a << b;
+	      break;
+	    case gdb_agent_op_rsh_signed:
+	      a = (LONGEST) a >> (b >= 64 ? 63 : b);
+	      break;
+	    case gdb_agent_op_rsh_unsigned:
+	      a = b >= 64 ? 0 : a >> b;
+	      break;
+	    case gdb_agent_op_bit_and:
+	      a &= b;
+	      break;
+	    case gdb_agent_op_bit_or:
+	      a |= b;
+	      break;
+	    case gdb_agent_op_bit_xor:
+	      a ^= b;
+	      break;
+	    case gdb_agent_op_equal:
+	      a = (a == b);
+	      break;
+	    case gdb_agent_op_less_signed:
+	      a = ((LONGEST) a < (LONGEST) b);
+	      break;
+	    default:
+	      a = (a < b);
+	      break;
+	    }
+	  top = a;
+	  break;
+
+	case gdb_agent_op_log_not:
+	  NEED (1);
+	  top = !top;
+	  break;
+
+	case gdb_agent_op_bit_not:
+	  NEED (1);
+	  top = ~top;
+	  break;
+
+	case gdb_agent_op_ext:
+	case gdb_agent_op_zero_ext:
+	  OPERAND (1);
+	  NEED (1);
+	  a = bytes[pc++];
+	  if (op == gdb_agent_op_ext)
+	    top = sign_extend (top, a);
+	  else if (a < 64)
+	    top &= ((ULONGEST) 1 << a) - 1;
+	  break;
+
+	case gdb_agent_op_ref8:
+	case gdb_agent_op_ref16:
+	case gdb_agent_op_ref32:
+	case gdb_agent_op_ref64:
+	  NEED (1);
+	  if (read_sized ((CORE_ADDR) top, 1 << (op - gdb_agent_op_ref8),
+			  &top) != 0)
+	    return expr_eval_mem_read_error;
+	  break;
+
+	case gdb_agent_op_if_goto:
+	  OPERAND (2);
+	  NEED (1);
+	  a = top;
+	  POP ();
+	  if (a != 0)
+	    pc = fetch_operand (&bytes[pc], 2);
+	  else
+	    pc += 2;
+	  break;
+
+	case gdb_agent_op_goto:
+	  OPERAND (2);
+	  pc = fetch_operand (&bytes[pc], 2);
+	  break;
+
+	case gdb_agent_op_const8:
+	case gdb_agent_op_const16:
+	case gdb_agent_op_const32:
+	case gdb_agent_op_const64:
+	  {
+	    int size = 1 << (op - gdb_agent_op_const8);
+
+	    OPERAND (size);
+	    PUSH (fetch_operand (&bytes[pc], size));
+	    pc += size;
+	  }
+	  break;
+
+	case gdb_agent_op_reg:
+	  OPERAND (2);
+	  if (agent_expr_read_register (fetch_operand (&bytes[pc], 2), &a) != 0)
+	    return expr_eval_invalid_register;
+	  pc += 2;
+	  PUSH (a);
+	  break;
+
+	case gdb_agent_op_end:
+	  if (sp == 0)
+	    return expr_eval_empty_stack;
+	  *rslt = top;
+	  return expr_eval_no_error;
+
+	case gdb_agent_op_dup:
+	  NEED (1);
+	  PUSH (top);
+	  break;
+
+	case gdb_agent_op_pop:
+	  NEED (1);
+	  POP ();
+	  break;
+
+	case gdb_agent_op_swap:
+	  NEED (2);
+	  a = stack[sp - 2];
+	  stack[sp - 2] = top;
+	  top = a;
+	  break;
+
+	case gdb_agent_op_trace:
+	  /* addr size => */
+	  NEED (2);
+	  b = top;
+	  POP ();
+	  a = top;
+	  POP ();
+	  if (trace != NULL && (*trace) (data, (CORE_ADDR) a, b) != 0)
+	    return expr_eval_trace_error;
+	  break;
+
+	case gdb_agent_op_trace_quick:
+	case gdb_agent_op_trace16:
+	  /* addr => addr */
+	  {
+	    int size = op == gdb_agent_op_trace16 ? 2 : 1;
+
+	    OPERAND (size);
+	    NEED (1);
+	    b = fetch_operand (&bytes[pc], size);
+	    pc += size;
+	    if (trace != NULL && (*trace) (data, (CORE_ADDR) top, b) != 0)
+	      return expr_eval_trace_error;
+	  }
+	  break;
+
+	case gdb_agent_op_float:
+	case gdb_agent_op_ref_float:
+	case gdb_agent_op_ref_double:
+	case gdb_agent_op_ref_long_double:
+	case gdb_agent_op_l_to_d:
+	case gdb_agent_op_d_to_l:
+	  return expr_eval_unhandled_opcode;
+
+	default:
+	  return expr_eval_unrecognized_opcode;
+	}
+    }
+
+#undef NEED
+#undef PUSH
+#undef POP
+#undef OPERAND
+
+  /* Ran off the end without an `end' bytecode.  */
+  return expr_eval_invalid_goto;
+}
+
+const char *
+eval_result_name (enum eval_result_type result)
+{
+  switch (result)
+    {
+    case expr_eval_no_error:
+      return "no error";
+    case expr_eval_empty_expression:
+      return "empty expression";
+    case expr_eval_empty_stack:
+      return "empty stack";
+    case expr_eval_stack_overflow:
+      return "stack overflow";
+    case expr_eval_stack_underflow:
+      return "stack underflow";
+    case expr_eval_unhandled_opcode:
+      return "unhandled opcode";
+    case expr_eval_unrecognized_opcode:
+      return "unrecognized opcode";
+    case expr_eval_divide_by_zero:
+      return "divide by zero";
+    case expr_eval_invalid_goto:
+      return "invalid goto";
+    case expr_eval_invalid_register:
+      return "invalid register";
+    case expr_eval_mem_read_error:
+      return "memory read error";
+    case expr_eval_trace_error:
+      return "trace error";
+    }
+  return "unknown error";
+}
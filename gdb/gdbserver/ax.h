@@ -0,0 +1,79 @@
+/* Agent expression evaluation for the remote server for GDB.
+   Copyright (C) 2009 Free Software Foundation, Inc.
+
+   This file is part of GDB.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef AX_H
+#define AX_H
+
+/* A compiled agent expression, as sent by GDB in hex form (see
+   "Agent Expressions" in the GDB manual).  */
+
+struct agent_expr
+{
+  int length;
+  unsigned char *bytes;
+};
+
+/* The outcome of evaluating an agent expression.  */
+
+enum eval_result_type
+  {
+    expr_eval_no_error,
+    expr_eval_empty_expression,
+    expr_eval_empty_stack,
+    expr_eval_stack_overflow,
+    expr_eval_stack_underflow,
+    expr_eval_unhandled_opcode,
+    expr_eval_unrecognized_opcode,
+    expr_eval_divide_by_zero,
+    expr_eval_invalid_goto,
+    expr_eval_invalid_register,
+    expr_eval_mem_read_error,
+    expr_eval_trace_error
+  };
+
+/* Called for the trace, trace_quick and trace16 bytecodes to record
+   LEN bytes of target memory starting at ADDR.  DATA is the pointer
+   passed to eval_agent_expr.  Return zero on success.  */
+
+typedef int (*agent_trace_fn) (void *data, CORE_ADDR addr, ULONGEST len);
+
+/* Parse a hex-encoded expression of LEN bytes at *ACTPTR, leaving
+   *ACTPTR just past it.  Return NULL if the encoding is malformed.  */
+
+struct agent_expr *parse_agent_expr (char **actptr, int len);
+
+void free_agent_expr (struct agent_expr *aexpr);
+
+/* Evaluate AEXPR against the registers and memory of the current
+   inferior.  On success store the value left on top of the stack in
+   *RSLT.  Trace bytecodes call TRACE, or are ignored if it is NULL.
+   Never throws; errors are reported through the return value.  */
+
+enum eval_result_type eval_agent_expr (struct agent_expr *aexpr,
+				       agent_trace_fn trace, void *data,
+				       ULONGEST *rslt);
+
+const char *eval_result_name (enum eval_result_type result);
+
+/* Fetch register REGNUM of the current inferior into *VAL, as the
+   reg bytecode does.  Return -1 if there is no such register or it
+   does not fit.  */
+
+int agent_expr_read_register (int regnum, ULONGEST *val);
+
+#endif /* AX_H */
@@ -437,6 +437,7 @@ void
 remove_process (struct process_info *process)
 {
   clear_symbol_cache (&process->symbol_cache);
+  tracepoint_remove_process (process);
   free_all_breakpoints (process);
   remove_inferior (&all_processes, &process->head);
   free (process);
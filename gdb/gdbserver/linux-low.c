@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sched.h>
 #include <ctype.h>
 #include <pwd.h>
@@ -248,6 +249,7 @@ linux_add_process (int pid, int attached)
 
   proc = add_process (pid, attached);
   proc->private = xcalloc (1, sizeof (*proc->private));
+  proc->private->mem_fd = -1;
 
   if (the_low_target.new_process != NULL)
     proc->private->arch_private = the_low_target.new_process ();
@@ -261,6 +263,8 @@ linux_add_process (int pid, int attached)
 static void
 linux_remove_process (struct process_info *process)
 {
+  if (process->private->mem_fd != -1)
+    close (process->private->mem_fd);
   free (process->private->arch_private);
   free (process->private);
   remove_process (process);
@@ -1174,7 +1178,12 @@ linux_wait_for_event_1 (ptid_t ptid, int *wstat, int options)
 	  continue;
 	}
 
-      bp_status = check_breakpoints (stop_pc);
+      /* A single-step that merely lands on a GDB breakpoint has not
+	 hit it yet; report the step and leave the breakpoint alone.  */
+      if (event_child->stepping && gdb_breakpoint_here (stop_pc))
+	bp_status = 0;
+      else
+	bp_status = check_breakpoints (stop_pc);
 
       if (bp_status != 0)
 	{
@@ -1191,12 +1200,12 @@ linux_wait_for_event_1 (ptid_t ptid, int *wstat, int options)
 	     loop instead of simply replacing the breakpoint right away,
 	     in order to not lose signals sent to the thread that hit the
 	     breakpoint.  Unfortunately this increases the window where another
-	     thread could sneak past the removed breakpoint.  For the current
-	     use of server-side breakpoints (thread creation) this is
-	     acceptable; but it needs to be considered before this breakpoint
-	     mechanism can be used in more general ways.  For some breakpoints
-	     it may be necessary to stop all other threads, but that should
-	     be avoided where possible.
+	     thread could sneak past the removed breakpoint.  For our own
+	     breakpoints (thread creation) this is acceptable.  A GDB
+	     breakpoint whose conditions are false is only stepped over
+	     here in a process with a single thread; with more, it is
+	     reported, so that GDB steps over it with all threads stopped
+	     (see check_breakpoints).
 
 	     If breakpoint_reinsert_addr is NULL, that means that we can
 	     use PTRACE_SINGLESTEP on this platform.  Uninsert the breakpoint,
@@ -1206,10 +1215,11 @@ linux_wait_for_event_1 (ptid_t ptid, int *wstat, int options)
 	     our temporary breakpoint, create it, and continue executing this
 	     process.  */
 
-	  /* NOTE: we're lifting breakpoints in non-stop mode.  This
-	     is currently only used for thread event breakpoints, so
-	     it isn't that bad as long as we have PTRACE_EVENT_CLONE
-	     events.  */
+	  /* NOTE: we're lifting breakpoints in non-stop mode.  This is
+	     only done for thread event breakpoints, which isn't that bad
+	     as long as we have PTRACE_EVENT_CLONE events, and for GDB
+	     breakpoints in single-threaded processes, where there is no
+	     other thread to miss them.  */
 	  if (bp_status == 2)
 	    /* No need to reinsert.  */
 	    linux_resume_one_lwp (event_child, 0, 0, NULL);
@@ -2314,6 +2324,107 @@ linux_store_registers (int regno)
 }
 
 
+/* Transfer LEN bytes between MEMADDR in the inferior and READBUF or
+   WRITEBUF through /proc/LWP/mem, in a single system call.  The
+   descriptor is kept open in the process's private data until the
+   process goes away.  It is opened through the current LWP, since the
+   thread group leader may have exited; when the LWP it was opened
+   through has gone, or the process has exec'd, nothing can be
+   transferred through it, so it is reopened once.  Return 0 if the
+   whole block was transferred.  */
+
+static int
+linux_proc_mem_xfer (CORE_ADDR memaddr, unsigned char *readbuf,
+		     const unsigned char *writebuf, int len)
+{
+  struct process_info_private *priv = current_process ()->private;
+  int attempt;
+
+  for (attempt = 0; attempt < 2; attempt++)
+    {
+      int fd = priv->mem_fd;
+      ssize_t n;
+
+      if (fd == -1)
+	{
+	  char filename[64];
+
+	  sprintf (filename, "/proc/%ld/mem",
+		   lwpid_of (get_thread_lwp (current_inferior)));
+	  fd = open (filename, O_RDWR | O_LARGEFILE);
+	  if (fd == -1)
+	    /* Kernels before 2.6.39 don't allow writing.  */
+	    fd = open (filename, O_RDONLY | O_LARGEFILE);
+	  if (fd == -1)
+	    return -1;
+	  priv->mem_fd = fd;
+	}
+
+      /* pread64 and pwrite64 are 64-bit safe even on 32-bit platforms
+	 (for instance, SPARC debugging a SPARC64 application).  */
+      if (readbuf != NULL)
+#ifdef HAVE_PREAD64
+	n = pread64 (fd, readbuf, len, memaddr);
+#else
+	n = (lseek (fd, memaddr, SEEK_SET) == -1) ? -1 : read (fd, readbuf, len);
+#endif
+      else
+#ifdef HAVE_PWRITE64
+	n = pwrite64 (fd, writebuf, len, memaddr);
+#else
+	n = (lseek (fd, memaddr, SEEK_SET) == -1) ? -1 : write (fd, writebuf, len);
+#endif
+
+      if (n == len)
+	return 0;
+
+      /* An address the process doesn't map fails with EIO.  Nothing
+	 at all is transferred once the address space the descriptor
+	 was opened on is gone.  */
+      if (n != 0)
+	break;
+      close (fd);
+      priv->mem_fd = -1;
+    }
+
+  return -1;
+}
+
+/* Transfer LEN bytes between MEMADDR in the inferior and READBUF or
+   WRITEBUF with process_vm_readv or process_vm_writev (Linux 3.2),
+   which need no descriptor.  They honour the page protections, so
+   writing breakpoints to text fails here.  Return 0 if the whole block
+   was transferred.  */
+
+static int
+linux_vm_xfer (int pid, CORE_ADDR memaddr, unsigned char *readbuf,
+	       const unsigned char *writebuf, int len)
+{
+#if defined (SYS_process_vm_readv) && defined (SYS_process_vm_writev)
+  static int process_vm_failed;
+  struct iovec local, remote;
+  long n;
+
+  if (process_vm_failed)
+    return -1;
+
+  local.iov_base = readbuf != NULL ? readbuf : (void *) writebuf;
+  local.iov_len = len;
+  remote.iov_base = (void *) (unsigned long) memaddr;
+  remote.iov_len = len;
+
+  errno = 0;
+  n = syscall (readbuf != NULL ? SYS_process_vm_readv : SYS_process_vm_writev,
+	       pid, &local, 1UL, &remote, 1UL, 0UL);
+  if (n == len)
+    return 0;
+  if (errno == ENOSYS)
+    process_vm_failed = 1;
+#endif
+
+  return -1;
+}
+
 /* Copy LEN bytes from inferior's memory starting at MEMADDR
    to debugger memory starting at MYADDR.  */
 
@@ -2330,39 +2441,14 @@ linux_read_memory (CORE_ADDR memaddr, unsigned char *myaddr, int len)
   /* Allocate buffer of that many longwords.  */
   register PTRACE_XFER_TYPE *buffer
     = (PTRACE_XFER_TYPE *) alloca (count * sizeof (PTRACE_XFER_TYPE));
-  int fd;
-  char filename[64];
   int pid = lwpid_of (get_thread_lwp (current_inferior));
 
-  /* Try using /proc.  Don't bother for one word.  */
-  if (len >= 3 * sizeof (long))
-    {
-      /* We could keep this file open and cache it - possibly one per
-	 thread.  That requires some juggling, but is even faster.  */
-      sprintf (filename, "/proc/%d/mem", pid);
-      fd = open (filename, O_RDONLY | O_LARGEFILE);
-      if (fd == -1)
-	goto no_proc;
-
-      /* If pread64 is available, use it.  It's faster if the kernel
-	 supports it (only one syscall), and it's 64-bit safe even on
-	 32-bit platforms (for instance, SPARC debugging a SPARC64
-	 application).  */
-#ifdef HAVE_PREAD64
-      if (pread64 (fd, myaddr, len, memaddr) != len)
-#else
-      if (lseek (fd, memaddr, SEEK_SET) == -1 || read (fd, memaddr, len) != len)
-#endif
-	{
-	  close (fd);
-	  goto no_proc;
-	}
-
-      close (fd);
-      return 0;
-    }
+  /* A single system call moves the whole block, where ptrace takes one
+     per word.  */
+  if (linux_vm_xfer (pid, memaddr, myaddr, NULL, len) == 0
+      || linux_proc_mem_xfer (memaddr, myaddr, NULL, len) == 0)
+    return 0;
 
- no_proc:
   /* Read all the longwords */
   for (i = 0; i < count; i++, addr += sizeof (PTRACE_XFER_TYPE))
     {
@@ -2412,6 +2498,12 @@ linux_write_memory (CORE_ADDR memaddr, const unsigned char *myaddr, int len)
 	       val, (long)memaddr);
     }
 
+  /* /proc/LWP/mem writes through the page protections, like ptrace
+     does, so try it first.  */
+  if (linux_proc_mem_xfer (memaddr, NULL, myaddr, len) == 0
+      || linux_vm_xfer (pid, memaddr, NULL, myaddr, len) == 0)
+    return 0;
+
   /* Fill start and end extra bytes of buffer with existing memory data.  */
 
   buffer[0] = ptrace (PTRACE_PEEKTEXT, pid, (PTRACE_ARG3_TYPE) addr, 0);
@@ -2698,11 +2790,20 @@ linux_read_auxv (CORE_ADDR offset, unsigned char *myaddr, unsigned int len)
 
 /* These breakpoint and watchpoint related wrapper functions simply
    pass on the function call if the target has registered a
-   corresponding function.  */
+   corresponding function.  Software breakpoints are handled
+   generically in mem-break.c, so that their conditions can be
+   evaluated here.  */
 
 static int
 linux_insert_point (char type, CORE_ADDR addr, int len)
 {
+  if (type == '0')
+    {
+      int ret = set_gdb_breakpoint_at (addr);
+      if (ret != 1)
+	return ret;
+    }
+
   if (the_low_target.insert_point != NULL)
     return the_low_target.insert_point (type, addr, len);
   else
@@ -2713,6 +2814,13 @@ linux_insert_point (char type, CORE_ADDR addr, int len)
 static int
 linux_remove_point (char type, CORE_ADDR addr, int len)
 {
+  if (type == '0')
+    {
+      int ret = delete_gdb_breakpoint_at (addr);
+      if (ret != 1)
+	return ret;
+    }
+
   if (the_low_target.remove_point != NULL)
     return the_low_target.remove_point (type, addr, len);
   else
@@ -3040,6 +3148,30 @@ linux_supports_multi_process (void)
   return 1;
 }
 
+static CORE_ADDR
+linux_read_pc (void)
+{
+  if (the_low_target.get_pc == NULL)
+    return 0;
+
+  return (*the_low_target.get_pc) ();
+}
+
+static void
+linux_write_pc (CORE_ADDR pc)
+{
+  if (the_low_target.set_pc != NULL)
+    (*the_low_target.set_pc) (pc);
+}
+
+static int
+linux_supports_conditional_breakpoints (void)
+{
+  /* Only possible if the architecture gave us a breakpoint to insert
+     and a way to find the stop PC.  */
+  return the_low_target.breakpoint != NULL && the_low_target.get_pc != NULL;
+}
+
 
 /* Enumerate spufs IDs for process PID.  */
 static int
@@ -3171,7 +3303,10 @@ static struct target_ops linux_target_ops = {
   linux_supports_non_stop,
   linux_async,
   linux_start_non_stop,
-  linux_supports_multi_process
+  linux_supports_multi_process,
+  linux_supports_conditional_breakpoints,
+  linux_read_pc,
+  linux_write_pc
 };
 
 static void
@@ -57,6 +57,9 @@ struct process_info_private
   /* Connection to the libthread_db library.  */
   td_thragent_t *thread_agent;
 
+  /* Cached descriptor of /proc/LWP/mem for memory transfers, or -1.  */
+  int mem_fd;
+
   /* Arch-specific additions.  */
   struct arch_process_info *arch_private;
 };
@@ -20,12 +20,21 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include "server.h"
+#include "ax.h"
 
 const unsigned char *breakpoint_data;
 int breakpoint_len;
 
 #define MAX_BREAKPOINT_LEN 8
 
+/* A condition GDB asked us to evaluate for one of its breakpoints.  */
+
+struct point_cond_list
+{
+  struct agent_expr *cond;
+  struct point_cond_list *next;
+};
+
 struct breakpoint
 {
   struct breakpoint *next;
@@ -42,85 +51,257 @@ struct breakpoint
 
   /* Function to call when we hit this breakpoint.  If it returns 1,
      the breakpoint will be deleted; 0, it will be reinserted for
-     another round.  */
+     another round.  NULL for breakpoints inserted on behalf of GDB
+     with a Z0 packet.  */
   int (*handler) (CORE_ADDR);
+
+  /* For GDB breakpoints, the conditions sent along with the Z0
+     packet.  The hit is reported if any of them is true; if there
+     are none, every hit is reported.  */
+  struct point_cond_list *cond_list;
 };
 
-void
-set_breakpoint_at (CORE_ADDR where, int (*handler) (CORE_ADDR))
+static struct breakpoint *
+find_breakpoint_at (CORE_ADDR where)
+{
+  struct process_info *proc = current_process ();
+  struct breakpoint *bp = proc->breakpoints;
+
+  while (bp != NULL)
+    {
+      if (bp->pc == where)
+	return bp;
+      bp = bp->next;
+    }
+
+  return NULL;
+}
+
+static struct breakpoint *
+find_gdb_breakpoint_at (CORE_ADDR where)
 {
   struct process_info *proc = current_process ();
   struct breakpoint *bp;
 
-  if (breakpoint_data == NULL)
-    error ("Target does not support breakpoints.");
+  for (bp = proc->breakpoints; bp != NULL; bp = bp->next)
+    if (bp->pc == where && bp->handler == NULL)
+      return bp;
+
+  return NULL;
+}
+
+static struct breakpoint *
+set_breakpoint (CORE_ADDR where, int (*handler) (CORE_ADDR))
+{
+  struct process_info *proc = current_process ();
+  struct breakpoint *bp, *other;
 
   bp = xmalloc (sizeof (struct breakpoint));
   memset (bp, 0, sizeof (struct breakpoint));
 
-  (*the_target->read_memory) (where, bp->old_data,
-			      breakpoint_len);
-  (*the_target->write_memory) (where, breakpoint_data,
-			       breakpoint_len);
+  /* Several breakpoints may share an address; only the first one
+     touches memory, the others inherit its shadow contents.  */
+  other = find_breakpoint_at (where);
+  if (other != NULL)
+    {
+      memcpy (bp->old_data, other->old_data, breakpoint_len);
+      bp->reinserting = other->reinserting;
+    }
+  else
+    {
+      (*the_target->read_memory) (where, bp->old_data,
+				  breakpoint_len);
+      (*the_target->write_memory) (where, breakpoint_data,
+				   breakpoint_len);
+    }
 
   bp->pc = where;
   bp->handler = handler;
 
   bp->next = proc->breakpoints;
   proc->breakpoints = bp;
+  return bp;
+}
+
+void
+set_breakpoint_at (CORE_ADDR where, int (*handler) (CORE_ADDR))
+{
+  if (breakpoint_data == NULL)
+    error ("Target does not support breakpoints.");
+
+  set_breakpoint (where, handler);
+}
+
+static void
+free_breakpoint_conditions (struct breakpoint *bp)
+{
+  struct point_cond_list *cond, *next;
+
+  for (cond = bp->cond_list; cond != NULL; cond = next)
+    {
+      next = cond->next;
+      free_agent_expr (cond->cond);
+      free (cond);
+    }
+  bp->cond_list = NULL;
 }
 
 static void
 delete_breakpoint (struct breakpoint *bp)
 {
   struct process_info *proc = current_process ();
-  struct breakpoint *cur;
+  struct breakpoint **link, *cur;
 
-  if (proc->breakpoints == bp)
+  for (link = &proc->breakpoints; *link != NULL; link = &(*link)->next)
+    if (*link == bp)
+      break;
+
+  if (*link == NULL)
     {
-      proc->breakpoints = bp->next;
-      (*the_target->write_memory) (bp->pc, bp->old_data,
-				   breakpoint_len);
-      free (bp);
+      warning ("Could not find breakpoint in list.");
       return;
     }
-  cur = proc->breakpoints;
-  while (cur->next)
-    {
-      if (cur->next == bp)
-	{
-	  cur->next = bp->next;
-	  (*the_target->write_memory) (bp->pc, bp->old_data,
-				       breakpoint_len);
-	  free (bp);
-	  return;
-	}
-    }
-  warning ("Could not find breakpoint in list.");
+  *link = bp->next;
+
+  /* Only restore the original contents once the last breakpoint at
+     this address is gone, and forget any pending reinsertion of
+     this one.  */
+  if (find_breakpoint_at (bp->pc) == NULL)
+    (*the_target->write_memory) (bp->pc, bp->old_data,
+				 breakpoint_len);
+  for (cur = proc->breakpoints; cur != NULL; cur = cur->next)
+    if (cur->breakpoint_to_reinsert == bp)
+      cur->breakpoint_to_reinsert = NULL;
+
+  free_breakpoint_conditions (bp);
+  free (bp);
 }
 
-static struct breakpoint *
-find_breakpoint_at (CORE_ADDR where)
+void
+delete_breakpoint_at (CORE_ADDR addr)
 {
   struct process_info *proc = current_process ();
-  struct breakpoint *bp = proc->breakpoints;
+  struct breakpoint *bp;
 
-  while (bp != NULL)
+  /* Leave GDB's breakpoints at ADDR alone.  */
+  for (bp = proc->breakpoints; bp != NULL; bp = bp->next)
+    if (bp->pc == addr && bp->handler != NULL)
+      {
+	delete_breakpoint (bp);
+	return;
+      }
+}
+
+int
+set_gdb_breakpoint_at (CORE_ADDR where)
+{
+  struct breakpoint *bp;
+  unsigned char buf[MAX_BREAKPOINT_LEN];
+
+  if (breakpoint_data == NULL)
+    return 1;
+
+  /* GDB sends a fresh Z0 whenever the conditions of a breakpoint
+     change; start over with an empty condition list.  */
+  bp = find_gdb_breakpoint_at (where);
+  if (bp != NULL)
     {
-      if (bp->pc == where)
-	return bp;
-      bp = bp->next;
+      free_breakpoint_conditions (bp);
+      return 0;
     }
 
-  return NULL;
+  if ((*the_target->read_memory) (where, buf, breakpoint_len) != 0)
+    return -1;
+
+  set_breakpoint (where, NULL);
+  return 0;
 }
 
-void
-delete_breakpoint_at (CORE_ADDR addr)
+int
+delete_gdb_breakpoint_at (CORE_ADDR addr)
 {
-  struct breakpoint *bp = find_breakpoint_at (addr);
-  if (bp != NULL)
-    delete_breakpoint (bp);
+  struct breakpoint *bp;
+
+  if (breakpoint_data == NULL)
+    return 1;
+
+  bp = find_gdb_breakpoint_at (addr);
+  if (bp == NULL)
+    return -1;
+
+  delete_breakpoint (bp);
+  return 0;
+}
+
+int
+gdb_breakpoint_here (CORE_ADDR where)
+{
+  return find_gdb_breakpoint_at (where) != NULL;
+}
+
+int
+add_breakpoint_condition (CORE_ADDR addr, char **condition)
+{
+  struct breakpoint *bp = find_gdb_breakpoint_at (addr);
+  struct point_cond_list *new_cond, **link;
+  struct agent_expr *cond;
+  char *actparm = *condition;
+  ULONGEST len;
+
+  if (bp == NULL || *actparm != 'X')
+    return -1;
+
+  actparm = unpack_varlen_hex (actparm + 1, &len);
+  if (*actparm != ',')
+    return -1;
+  actparm++;
+
+  cond = parse_agent_expr (&actparm, len);
+  if (cond == NULL)
+    return -1;
+
+  new_cond = xmalloc (sizeof (*new_cond));
+  new_cond->cond = cond;
+  new_cond->next = NULL;
+
+  for (link = &bp->cond_list; *link != NULL; link = &(*link)->next)
+    ;
+  *link = new_cond;
+
+  *condition = actparm;
+  return 0;
+}
+
+/* Return non-zero if a hit of GDB breakpoint BP should be reported.
+   An expression we cannot evaluate counts as true, so that GDB gets
+   to decide.  */
+
+static int
+gdb_condition_true (struct breakpoint *bp)
+{
+  struct point_cond_list *cond;
+
+  if (bp->cond_list == NULL)
+    return 1;
+
+  for (cond = bp->cond_list; cond != NULL; cond = cond->next)
+    {
+      ULONGEST value = 0;
+      enum eval_result_type err;
+
+      err = eval_agent_expr (cond->cond, NULL, NULL, &value);
+      if (err != expr_eval_no_error)
+	{
+	  if (debug_threads)
+	    fprintf (stderr, "Condition at 0x%08lx failed: %s\n",
+		     (long) bp->pc, eval_result_name (err));
+	  return 1;
+	}
+      if (value != 0)
+	return 1;
+    }
+
+  return 0;
 }
 
 static int
@@ -132,13 +313,13 @@ reinsert_breakpoint_handler (CORE_ADDR stop_pc)
   if (stop_bp == NULL)
     error ("lost the stopping breakpoint.");
 
+  /* The original breakpoint may have been removed by GDB while we
+     were stepping over it.  */
   orig_bp = stop_bp->breakpoint_to_reinsert;
   if (orig_bp == NULL)
-    error ("no breakpoint to reinsert");
+    return 1;
 
-  (*the_target->write_memory) (orig_bp->pc, breakpoint_data,
-			       breakpoint_len);
-  orig_bp->reinserting = 0;
+  reinsert_breakpoint (orig_bp->pc);
   return 1;
 }
 
@@ -158,9 +339,7 @@ reinsert_breakpoint_by_bp (CORE_ADDR stop_pc, CORE_ADDR stop_at)
     error ("Could not find breakpoint in list (reinserting by breakpoint).");
   bp->breakpoint_to_reinsert = orig_bp;
 
-  (*the_target->write_memory) (orig_bp->pc, orig_bp->old_data,
-			       breakpoint_len);
-  orig_bp->reinserting = 1;
+  uninsert_breakpoint (stop_pc);
 }
 
 void
@@ -174,7 +353,9 @@ uninsert_breakpoint (CORE_ADDR stopped_at)
 
   (*the_target->write_memory) (bp->pc, bp->old_data,
 			       breakpoint_len);
-  bp->reinserting = 1;
+  for (; bp != NULL; bp = bp->next)
+    if (bp->pc == stopped_at)
+      bp->reinserting = 1;
 }
 
 void
@@ -182,21 +363,37 @@ reinsert_breakpoint (CORE_ADDR stopped_at)
 {
   struct breakpoint *bp;
 
+  /* GDB may have removed the breakpoint while we were stepping
+     over it; then there is nothing left to put back.  */
   bp = find_breakpoint_at (stopped_at);
   if (bp == NULL)
-    error ("Could not find breakpoint in list (uninserting).");
+    return;
   if (! bp->reinserting)
     error ("Breakpoint already inserted at reinsert time.");
 
   (*the_target->write_memory) (bp->pc, breakpoint_data,
 			       breakpoint_len);
-  bp->reinserting = 0;
+  for (; bp != NULL; bp = bp->next)
+    if (bp->pc == stopped_at)
+      bp->reinserting = 0;
+}
+
+/* find_inferior callback: is ENTRY a thread of the same process as the
+   thread ARG, other than ARG itself?  */
+
+static int
+other_thread_of_process_p (struct inferior_list_entry *entry, void *arg)
+{
+  struct inferior_list_entry *self = arg;
+
+  return (entry != self
+	  && ptid_get_pid (entry->id) == ptid_get_pid (self->id));
 }
 
 int
 check_breakpoints (CORE_ADDR stop_pc)
 {
-  struct breakpoint *bp;
+  struct breakpoint *bp, *next, *gdb_bp = NULL;
 
   bp = find_breakpoint_at (stop_pc);
   if (bp == NULL)
@@ -207,11 +404,32 @@ check_breakpoints (CORE_ADDR stop_pc)
       return 0;
     }
 
-  if ((*bp->handler) (bp->pc))
+  for (; bp != NULL; bp = next)
     {
-      delete_breakpoint (bp);
-      return 2;
+      next = bp->next;
+      if (bp->pc != stop_pc)
+	continue;
+
+      if (bp->handler == NULL)
+	gdb_bp = bp;
+      else if ((*bp->handler) (bp->pc))
+	delete_breakpoint (bp);
     }
+
+  /* Report GDB breakpoints unless all of their conditions are known
+     to be false; then step over them silently, like our own.  Stepping
+     over lifts the breakpoint while the other threads of the process
+     keep running, and one of them could pass it with a true condition
+     unseen; so if there are any, report the hit, and let GDB evaluate
+     the conditions and step over with all threads stopped.  */
+  if (gdb_bp != NULL
+      && (find_inferior (&all_threads, other_thread_of_process_p,
+			 current_inferior) != NULL
+	  || gdb_condition_true (gdb_bp)))
+    return 0;
+
+  if (find_breakpoint_at (stop_pc) == NULL)
+    return 2;
   else
     return 1;
 }
@@ -316,6 +534,7 @@ free_all_breakpoints (struct process_info *proc)
     {
       bp = proc->breakpoints;
       proc->breakpoints = bp->next;
+      free_breakpoint_conditions (bp);
       free (bp);
     }
 }
@@ -35,6 +35,30 @@ void set_breakpoint_at (CORE_ADDR where,
 
 void delete_breakpoint_at (CORE_ADDR addr);
 
+/* Insert a breakpoint at WHERE on behalf of GDB (a Z0 packet).
+   Hits are reported to GDB unless the breakpoint has conditions
+   attached and all of them evaluate to false.  Inserting again at
+   the same address drops the previous conditions.  Return 0 on
+   success, 1 if breakpoints are not supported, -1 on error.  */
+
+int set_gdb_breakpoint_at (CORE_ADDR where);
+
+/* Remove the GDB breakpoint at ADDR (a z0 packet).  Return values
+   are as for set_gdb_breakpoint_at.  */
+
+int delete_gdb_breakpoint_at (CORE_ADDR addr);
+
+/* Return non-zero if GDB has a breakpoint inserted at WHERE.  */
+
+int gdb_breakpoint_here (CORE_ADDR where);
+
+/* Parse an agent expression condition of the form "X<len>,<hex>" at
+   *CONDITION and attach it to the GDB breakpoint at ADDR.  On success
+   return 0 and leave *CONDITION just past the expression; otherwise
+   return -1.  */
+
+int add_breakpoint_condition (CORE_ADDR addr, char **condition);
+
 /* Create a reinsertion breakpoint at STOP_AT for the breakpoint
    currently at STOP_PC (and temporarily remove the breakpoint at
    STOP_PC).  */
@@ -213,6 +213,25 @@ register_size (int n)
   return reg_defs[n].size / 8;
 }
 
+int
+register_count (void)
+{
+  return num_registers;
+}
+
+int
+register_cache_size (void)
+{
+  return register_bytes;
+}
+
+void
+collect_registers (unsigned char *buf)
+{
+  memcpy (buf, get_regcache (current_inferior, 1)->registers,
+	  register_bytes);
+}
+
 static unsigned char *
 register_data (int n, int fetch)
 {
@@ -49,6 +49,16 @@ struct reg *find_register_by_number (int n);
 
 int register_size (int n);
 
+/* Return the number of registers in the current target description.  */
+
+int register_count (void);
+
+/* Return the size of the raw register cache, and copy it to BUF.  */
+
+int register_cache_size (void);
+
+void collect_registers (unsigned char *buf);
+
 int find_regno (const char *name);
 
 /* The following two variables are set by auto-generated
@@ -21,6 +21,7 @@
 #include "server.h"
 #include "terminal.h"
 #include "target.h"
+#include "ax.h"
 #include <stdio.h>
 #include <string.h>
 #if HAVE_SYS_IOCTL_H
@@ -93,6 +94,11 @@ struct ui_file *gdb_stdlog;
 
 static int remote_desc = INVALID_DESCRIPTOR;
 
+/* Input from GDB that has been read but not consumed yet.  */
+static unsigned char readchar_buf[BUFSIZ];
+static int readchar_bufcnt = 0;
+static unsigned char *readchar_bufp;
+
 /* FIXME headerize? */
 extern int using_threads;
 extern int debug_threads;
@@ -102,6 +108,34 @@ int noack_mode = 0;
 /* If true, then we tell GDB to use noack mode by default.  */
 int transport_is_reliable = 0;
 
+/* What GDB asked us to include in every 'T' stop reply on top of
+   gdbserver_expedite_regs, with the QStopExpedite packet.  Sending it
+   up front saves GDB the 'g' and 'm' round trips it would otherwise
+   make right after each stop.  */
+
+/* The most ranges, and the most bytes per range, that we accept.  */
+#define MAX_STOP_EXPEDITE_RANGES 8
+#define MAX_STOP_EXPEDITE_BYTES 4096
+
+/* A block of memory around the value of register REGNO, widened
+   outwards to a multiple of ALIGN bytes.  */
+
+struct stop_expedite_range
+{
+  int regno;
+  ULONGEST before;
+  ULONGEST after;
+  ULONGEST align;
+};
+
+/* If true, send every register rather than just the expedited
+   ones.  */
+static int stop_expedite_all_regs;
+
+static struct stop_expedite_range
+  stop_expedite_ranges[MAX_STOP_EXPEDITE_RANGES];
+static int stop_expedite_num_ranges;
+
 #ifdef USE_WIN32API
 # define read(fd, buf, len) recv (fd, (char *) buf, len, 0)
 # define write(fd, buf, len) send (fd, (char *) buf, len, 0)
@@ -292,6 +326,7 @@ void
 remote_close (void)
 {
   delete_file_handler (remote_desc);
+  readchar_bufcnt = 0;
 
 #ifdef USE_WIN32API
   closesocket (remote_desc);
@@ -892,18 +927,14 @@ initialize_async_io (void)
 static int
 readchar (void)
 {
-  static unsigned char buf[BUFSIZ];
-  static int bufcnt = 0;
-  static unsigned char *bufp;
+  if (readchar_bufcnt-- > 0)
+    return *readchar_bufp++;
 
-  if (bufcnt-- > 0)
-    return *bufp++;
+  readchar_bufcnt = read (remote_desc, readchar_buf, sizeof (readchar_buf));
 
-  bufcnt = read (remote_desc, buf, sizeof (buf));
-
-  if (bufcnt <= 0)
+  if (readchar_bufcnt <= 0)
     {
-      if (bufcnt == 0)
+      if (readchar_bufcnt == 0)
 	fprintf (stderr, "readchar: Got EOF\n");
       else
 	perror ("readchar");
@@ -911,9 +942,21 @@ readchar (void)
       return -1;
     }
 
-  bufp = buf;
-  bufcnt--;
-  return *bufp++;
+  readchar_bufp = readchar_buf;
+  readchar_bufcnt--;
+  return *readchar_bufp++;
+}
+
+/* Return true if the start of another packet from GDB is already in
+   our input buffer.  GDB may send several packets before reading the
+   replies (see PipelinedReads in handle_query), and the event loop
+   only wakes us up for input that is still waiting in the kernel.  */
+
+int
+remote_input_pending (void)
+{
+  return (readchar_bufcnt > 0
+	  && memchr (readchar_bufp, '$', readchar_bufcnt) != NULL);
 }
 
 /* Read a packet from the remote machine, with error checking,
@@ -1069,6 +1112,160 @@ outreg (int regno, char *buf)
   return buf;
 }
 
+/* Parse the body of a QStopExpedite packet: a ';'-separated list of
+   "regs" and "mem:REGNO,BEFORE,AFTER,ALIGN" items, all numbers in
+   hex.  An empty list turns the extra stop reply data off.  Return 0
+   on success; on error, return -1 and leave the settings alone.  */
+
+int
+handle_stop_expedite_packet (char *p)
+{
+  struct stop_expedite_range ranges[MAX_STOP_EXPEDITE_RANGES];
+  int all_regs = 0;
+  int num_ranges = 0;
+
+  while (*p != '\0')
+    {
+      if (strncmp (p, "regs", 4) == 0)
+	{
+	  all_regs = 1;
+	  p += 4;
+	}
+      else if (strncmp (p, "mem:", 4) == 0)
+	{
+	  struct stop_expedite_range *range;
+	  ULONGEST regno;
+
+	  if (num_ranges == MAX_STOP_EXPEDITE_RANGES)
+	    return -1;
+	  range = &ranges[num_ranges++];
+
+	  p = unpack_varlen_hex (p + 4, &regno);
+	  if (*p++ != ',')
+	    return -1;
+	  p = unpack_varlen_hex (p, &range->before);
+	  if (*p++ != ',')
+	    return -1;
+	  p = unpack_varlen_hex (p, &range->after);
+	  if (*p++ != ',')
+	    return -1;
+	  p = unpack_varlen_hex (p, &range->align);
+
+	  /* ALIGN must be a power of two, and the widened range must
+	     still fit in MAX_STOP_EXPEDITE_BYTES.  */
+	  if (range->align == 0
+	      || (range->align & (range->align - 1)) != 0
+	      || range->before > MAX_STOP_EXPEDITE_BYTES
+	      || range->after > MAX_STOP_EXPEDITE_BYTES
+	      || (range->before + range->after + 2 * range->align
+		  > MAX_STOP_EXPEDITE_BYTES))
+	    return -1;
+	  range->regno = regno;
+	}
+      else
+	return -1;
+
+      if (*p == ';')
+	p++;
+      else if (*p != '\0')
+	return -1;
+    }
+
+  stop_expedite_all_regs = all_regs;
+  memcpy (stop_expedite_ranges, ranges, num_ranges * sizeof (ranges[0]));
+  stop_expedite_num_ranges = num_ranges;
+  return 0;
+}
+
+/* Write a "mem:ADDR,CONTENTS;" stop reply field for the LEN bytes at
+   MYADDR, read from ADDR, into BUF.  Return the new end of BUF.  */
+
+static char *
+outmem_1 (char *buf, CORE_ADDR addr, unsigned char *myaddr, int len)
+{
+  sprintf (buf, "mem:%s,", paddress (addr));
+  buf += strlen (buf);
+  convert_int_to_ascii (myaddr, buf, len);
+  buf += 2 * len;
+  *buf++ = ';';
+
+  return buf;
+}
+
+/* Write the contents of the LEN bytes at ADDR into BUF as "mem:"
+   fields, and return the new end of BUF.  LEN is a multiple of ALIGN;
+   if the whole block can't be read, fall back to reading it ALIGN
+   bytes at a time and leave out the pieces that fail.  */
+
+static char *
+outmem (char *buf, CORE_ADDR addr, int len, int align)
+{
+  unsigned char data[MAX_STOP_EXPEDITE_BYTES];
+  int run_start = -1;
+  int offset;
+
+  if (read_inferior_memory (addr, data, len) == 0)
+    return outmem_1 (buf, addr, data, len);
+
+  for (offset = 0; offset < len; offset += align)
+    {
+      if (read_inferior_memory (addr + offset, data + offset, align) == 0)
+	{
+	  if (run_start < 0)
+	    run_start = offset;
+	}
+      else if (run_start >= 0)
+	{
+	  buf = outmem_1 (buf, addr + run_start, data + run_start,
+			  offset - run_start);
+	  run_start = -1;
+	}
+    }
+
+  if (run_start >= 0)
+    buf = outmem_1 (buf, addr + run_start, data + run_start,
+		    len - run_start);
+
+  return buf;
+}
+
+/* Write the memory ranges requested with QStopExpedite for the
+   current inferior into BUF, using at most ROOM characters.  Return
+   the new end of BUF.  */
+
+static char *
+outmem_ranges (char *buf, int room)
+{
+  char *start = buf;
+  int i;
+
+  for (i = 0; i < stop_expedite_num_ranges; i++)
+    {
+      struct stop_expedite_range *range = &stop_expedite_ranges[i];
+      CORE_ADDR lo, hi;
+      ULONGEST val;
+      int len;
+
+      if (agent_expr_read_register (range->regno, &val) != 0)
+	continue;
+
+      lo = (val - range->before) & ~(range->align - 1);
+      hi = (val + range->after + range->align - 1) & ~(range->align - 1);
+      if (hi <= lo)
+	continue;
+      len = hi - lo;
+
+      /* Each byte takes two characters, plus the field's own
+	 overhead.  Stop rather than overflow the packet.  */
+      if ((buf - start) + 2 * len + 32 > room)
+	break;
+
+      buf = outmem (buf, lo, len, range->align);
+    }
+
+  return buf;
+}
+
 void
 new_thread_notify (int id)
 {
@@ -1116,6 +1313,7 @@ prepare_resume_reply (char *buf, ptid_t ptid,
       {
 	struct thread_info *saved_inferior;
 	const char **regp;
+	char *start = buf;
 
 	sprintf (buf, "T%02x", status->value.sig);
 	buf += strlen (buf);
@@ -1146,11 +1344,26 @@ prepare_resume_reply (char *buf, ptid_t ptid,
 	    *buf++ = ';';
 	  }
 
-	while (*regp)
+	/* Send every register if GDB asked for them and they fit,
+	   leaving room for the trailing fields.  */
+	if (stop_expedite_all_regs
+	    && (2 * register_cache_size () + 6 * register_count ()
+		< PBUFSIZ - 128 - (buf - start)))
 	  {
-	    buf = outreg (find_regno (*regp), buf);
-	    regp ++;
+	    int regno;
+
+	    for (regno = 0; regno < register_count (); regno++)
+	      buf = outreg (regno, buf);
 	  }
+	else
+	  while (*regp)
+	    {
+	      buf = outreg (find_regno (*regp), buf);
+	      regp ++;
+	    }
+
+	if (stop_expedite_num_ranges > 0)
+	  buf = outmem_ranges (buf, PBUFSIZ - 128 - (buf - start));
 	*buf = '\0';
 
 	/* Formerly, if the debugger had not used any thread features
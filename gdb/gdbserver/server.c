@@ -213,7 +213,7 @@ send_next_stop_reply (char *own_buf)
     write_ok (own_buf);
 }
 
-static int
+int
 target_running (void)
 {
   return all_threads.head != NULL;
@@ -374,6 +374,10 @@ write_qxfer_response (char *buf, const void *data, int len, int is_more)
 void
 handle_general_set (char *own_buf)
 {
+  if (strncmp ("QT", own_buf, 2) == 0
+      && handle_tracepoint_general_set (own_buf))
+    return;
+
   if (strncmp ("QPassSignals:", own_buf, strlen ("QPassSignals:")) == 0)
     {
       int numsigs = (int) TARGET_SIGNAL_LAST, i;
@@ -399,6 +403,15 @@ handle_general_set (char *own_buf)
       return;
     }
 
+  if (strncmp (own_buf, "QStopExpedite:", strlen ("QStopExpedite:")) == 0)
+    {
+      if (handle_stop_expedite_packet (own_buf + strlen ("QStopExpedite:")))
+	write_enn (own_buf);
+      else
+	write_ok (own_buf);
+      return;
+    }
+
   if (strcmp (own_buf, "QStartNoAckMode") == 0)
     {
       if (remote_debug)
@@ -687,6 +700,9 @@ handle_query (char *own_buf, int packet_len, int *new_packet_len_p)
       return;
     }
 
+  if (strncmp ("qT", own_buf, 2) == 0 && handle_tracepoint_query (own_buf))
+    return;
+
   if (strcmp ("qSymbol::", own_buf) == 0)
     {
       if (target_running () && the_target->look_up_symbols != NULL)
@@ -1103,6 +1119,18 @@ handle_query (char *own_buf, int packet_len, int *new_packet_len_p)
       if (the_target->qxfer_siginfo != NULL)
 	strcat (own_buf, ";qXfer:siginfo:read+;qXfer:siginfo:write+");
 
+      if (target_supports_conditional_breakpoints ())
+	{
+	  strcat (own_buf, ";ConditionalBreakpoints+");
+	  strcat (own_buf, ";ConditionalTracepoints+");
+	}
+
+      strcat (own_buf, ";QStopExpedite+");
+
+      /* handle_serial_event copes with GDB sending more memory reads
+	 before it has read our replies.  */
+      strcat (own_buf, ";PipelinedReads+");
+
       /* We always report qXfer:features:read, as targets may
 	 install XML files on a subsequent call to arch_setup.
 	 If we reported to GDB on startup that we don't support
@@ -2122,6 +2150,7 @@ main (int argc, char *argv[])
       noack_mode = 0;
       multi_process = 0;
       non_stop = 0;
+      handle_stop_expedite_packet ("");
 
       remote_open (port);
 
@@ -2327,10 +2356,19 @@ process_serial_event (void)
     case 'g':
       require_running (own_buf);
       set_desired_inferior (1);
-      registers_to_string (own_buf);
+      if (current_traceframe >= 0)
+	traceframe_registers_to_string (own_buf);
+      else
+	registers_to_string (own_buf);
       break;
     case 'G':
       require_running (own_buf);
+      if (current_traceframe >= 0)
+	{
+	  /* Trace frames are read-only.  */
+	  write_enn (own_buf);
+	  break;
+	}
       set_desired_inferior (1);
       registers_from_string (&own_buf[1]);
       write_ok (own_buf);
@@ -2338,7 +2376,9 @@ process_serial_event (void)
     case 'm':
       require_running (own_buf);
       decode_m_packet (&own_buf[1], &mem_addr, &len);
-      if (read_inferior_memory (mem_addr, mem_buf, len) == 0)
+      if ((current_traceframe >= 0
+	   ? traceframe_read_memory (mem_addr, mem_buf, len)
+	   : read_inferior_memory (mem_addr, mem_buf, len)) == 0)
 	convert_int_to_ascii (mem_buf, own_buf, len);
       else
 	write_enn (own_buf);
@@ -2346,7 +2386,8 @@ process_serial_event (void)
     case 'M':
       require_running (own_buf);
       decode_M_packet (&own_buf[1], &mem_addr, &len, mem_buf);
-      if (write_inferior_memory (mem_addr, mem_buf, len) == 0)
+      if (current_traceframe < 0
+	  && write_inferior_memory (mem_addr, mem_buf, len) == 0)
 	write_ok (own_buf);
       else
 	write_enn (own_buf);
@@ -2355,6 +2396,7 @@ process_serial_event (void)
       require_running (own_buf);
       if (decode_X_packet (&own_buf[1], packet_len - 1,
 			   &mem_addr, &len, mem_buf) < 0
+	  || current_traceframe >= 0
 	  || write_inferior_memory (mem_addr, mem_buf, len) != 0)
 	write_enn (own_buf);
       else
@@ -2411,7 +2453,24 @@ process_serial_event (void)
 	  case '4': /* access watchpoint */
 	    require_running (own_buf);
 	    if (insert && the_target->insert_point != NULL)
-	      res = (*the_target->insert_point) (type, addr, len);
+	      {
+		res = (*the_target->insert_point) (type, addr, len);
+
+		/* Software breakpoints may carry conditions for us
+		   to evaluate: ";X<len>,<hex>", repeated.  */
+		if (res == 0 && type == '0'
+		    && target_supports_conditional_breakpoints ())
+		  while (*dataptr == ';')
+		    {
+		      dataptr++;
+		      if (add_breakpoint_condition (addr, &dataptr) != 0)
+			{
+			  (*the_target->remove_point) (type, addr, len);
+			  res = -1;
+			  break;
+			}
+		    }
+	      }
 	    else if (!insert && the_target->remove_point != NULL)
 	      res = (*the_target->remove_point) (type, addr, len);
 	    break;
@@ -2542,12 +2601,17 @@ handle_serial_event (int err, gdb_client_data client_data)
   if (debug_threads)
     fprintf (stderr, "handling possible serial event\n");
 
-  /* Really handle it.  */
-  process_serial_event ();
+  /* Really handle it, along with any further packets that arrived
+     with it.  */
+  do
+    {
+      process_serial_event ();
 
-  /* Be sure to not change the selected inferior behind GDB's back.
-     Important in the non-stop mode asynchronous protocol.  */
-  set_desired_inferior (1);
+      /* Be sure to not change the selected inferior behind GDB's back.
+	 Important in the non-stop mode asynchronous protocol.  */
+      set_desired_inferior (1);
+    }
+  while (remote_input_pending ());
 }
 
 /* Event-loop callback for target events.  */
@@ -85,6 +85,7 @@ typedef unsigned char gdb_byte;
    least the size of a (void *).  */
 typedef long long CORE_ADDR;
 
+typedef long long LONGEST;
 typedef unsigned long long ULONGEST;
 
 /* The ptid struct is a collection of the various "ids" necessary
@@ -295,6 +296,7 @@ extern void add_file_handler (int fd, handler_func *proc,
 extern void start_event_loop (void);
 
 /* Functions from server.c.  */
+extern int target_running (void);
 extern void handle_serial_event (int err, gdb_client_data client_data);
 extern void handle_target_event (int err, gdb_client_data client_data);
 
@@ -303,6 +305,15 @@ extern void push_event (ptid_t ptid, struct target_waitstatus *status);
 /* Functions from hostio.c.  */
 extern int handle_vFile (char *, int, int *);
 
+/* Functions from tracepoint.c.  */
+extern int current_traceframe;
+
+int handle_tracepoint_general_set (char *own_buf);
+int handle_tracepoint_query (char *own_buf);
+void tracepoint_remove_process (struct process_info *process);
+void traceframe_registers_to_string (char *buf);
+int traceframe_read_memory (CORE_ADDR addr, unsigned char *buf, int len);
+
 /* Functions from hostio-errno.c.  */
 extern void hostio_last_error_from_errno (char *own_buf);
 
@@ -320,6 +331,7 @@ int putpkt (char *buf);
 int putpkt_binary (char *buf, int len);
 int putpkt_notif (char *buf);
 int getpkt (char *buf);
+int remote_input_pending (void);
 void remote_open (char *name);
 void remote_close (void);
 void write_ok (char *buf);
@@ -334,6 +346,7 @@ void new_thread_notify (int id);
 void dead_thread_notify (int id);
 void prepare_resume_reply (char *buf, ptid_t ptid,
 			   struct target_waitstatus *status);
+int handle_stop_expedite_packet (char *p);
 
 const char *decode_address_to_semicolon (CORE_ADDR *addrp, const char *start);
 void decode_address (CORE_ADDR *addrp, const char *start, int len);
@@ -353,6 +366,7 @@ int decode_search_memory_packet (const char *buf, int packet_len,
 
 int unhexify (char *bin, const char *hex, int count);
 int hexify (char *hex, const char *bin, int count);
+char *unpack_varlen_hex (char *buff, ULONGEST *result);
 int remote_escape_output (const gdb_byte *buffer, int len,
 			  gdb_byte *out_buf, int *out_len,
 			  int out_maxlen);
@@ -401,6 +415,7 @@ void buffer_xml_printf (struct buffer *buffer, const char *format, ...)
 /* Functions from utils.c */
 
 void *xmalloc (size_t) ATTR_MALLOC;
+void *xrealloc (void *, size_t);
 void *xcalloc (size_t, size_t) ATTR_MALLOC;
 char *xstrdup (const char *) ATTR_MALLOC;
 void freeargv (char **argv);
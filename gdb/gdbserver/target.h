@@ -279,6 +279,15 @@ struct target_ops
 
   /* Returns true if the target supports multi-process debugging.  */
   int (*supports_multi_process) (void);
+
+  /* Returns true if the target can evaluate agent expression
+     conditions attached to Z0 breakpoints.  */
+  int (*supports_conditional_breakpoints) (void);
+
+  /* Read and write the PC of the current inferior, through its
+     register cache.  */
+  CORE_ADDR (*read_pc) (void);
+  void (*write_pc) (CORE_ADDR pc);
 };
 
 extern struct target_ops *the_target;
@@ -319,6 +328,10 @@ void set_target_ops (struct target_ops *);
   (the_target->supports_multi_process ? \
    (*the_target->supports_multi_process) () : 0)
 
+#define target_supports_conditional_breakpoints() \
+  (the_target->supports_conditional_breakpoints ? \
+   (*the_target->supports_conditional_breakpoints) () : 0)
+
 /* Start non-stop mode, returns 0 on success, -1 on failure.   */
 
 int start_non_stop (int nonstop);
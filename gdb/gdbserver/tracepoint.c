@@ -0,0 +1,1028 @@
+/* Tracepoint code for remote server for GDB.
+   Copyright (C) 2009 Free Software Foundation, Inc.
+
+   This file is part of GDB.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "server.h"
+#include "ax.h"
+
+/* This file implements the target side of GDB's tracepoint packets
+   (see "Tracepoint Packets" in the GDB manual).  Tracepoints are
+   gdbserver breakpoints: when one is hit, its condition is evaluated
+   and its actions are collected into a trace frame right away, in
+   the event loop, and the thread is stepped over the breakpoint and
+   resumed without GDB ever hearing about the stop.
+
+   Trace frames are kept in a circular buffer; when it is full, the
+   oldest frames are discarded to make room.  A frame is a header
+   followed by blocks:
+
+     'R' <raw register cache contents>
+     'M' <CORE_ADDR address> <unsigned int length> <LENGTH bytes>
+
+   All registers are recorded in every frame, so that GDB can always
+   find the frame's PC; the register mask GDB sends is not needed.
+   Block and frame headers are copied in and out with memcpy, as the
+   buffer makes no alignment guarantees.  */
+
+/* Size of the trace buffer.  */
+
+#define TRACE_BUFFER_SIZE (5 * 1024 * 1024)
+
+struct tracepoint_action
+{
+  struct tracepoint_action *next;
+
+  /* 'M' to collect a memory range, 'X' to evaluate an expression,
+     'R' to collect registers (which we always do anyway).  */
+  char type;
+
+  /* For 'M': the register holding the base address, or -1 if
+     OFFSET is an absolute address; and the length to collect.  */
+  int basereg;
+  ULONGEST offset;
+  ULONGEST length;
+
+  /* For 'X'.  */
+  struct agent_expr *expr;
+};
+
+struct tracepoint
+{
+  struct tracepoint *next;
+
+  /* The number GDB assigned.  */
+  int number;
+
+  CORE_ADDR address;
+  int enabled;
+
+  /* Stop the trace experiment after this many hits; zero means
+     never.  */
+  ULONGEST pass_count;
+  ULONGEST hit_count;
+
+  /* Collect only if this is true, when non-NULL.  */
+  struct agent_expr *cond;
+
+  struct tracepoint_action *actions;
+};
+
+struct traceframe_header
+{
+  /* Number of the tracepoint which collected this frame, and where
+     it is.  */
+  int tpnum;
+  CORE_ADDR pc;
+
+  /* Size of the blocks following this header.  */
+  unsigned int data_size;
+};
+
+/* Read-only memory regions (from QTro); when looking at a trace
+   frame, memory in these is read from the live process.  */
+
+struct readonly_region
+{
+  struct readonly_region *next;
+  CORE_ADDR start;
+  CORE_ADDR end;
+};
+
+static struct tracepoint *tracepoints;
+static struct readonly_region *readonly_regions;
+
+/* True if the trace experiment is running.  */
+static int tracing;
+
+/* True if the tracepoint breakpoints are inserted.  They stay so for
+   a while after a pass count stops the experiment: each one deletes
+   itself when next hit, and QTStop removes the rest.  */
+static int tracepoint_breakpoints_inserted;
+
+/* The process the tracepoint breakpoints were inserted in.  */
+static struct process_info *tracing_process;
+
+/* The frame GDB is looking at, or -1 if it is looking at the live
+   process.  */
+int current_traceframe = -1;
+
+/* The circular trace buffer.  Frames live in [START, FREE) when WRAP
+   is NULL; otherwise in [START, WRAP) followed by [LO, FREE).  */
+
+static unsigned char *trace_buffer_lo;
+static unsigned char *trace_buffer_hi;
+static unsigned char *trace_buffer_start;
+static unsigned char *trace_buffer_free;
+static unsigned char *trace_buffer_wrap;
+
+/* Frames currently in the buffer, and ever created.  Frames are
+   numbered from the oldest one still in the buffer, so that GDB's
+   "tfind start" (QTFrame:0) finds it even after the buffer wraps;
+   the numbers shift down as old frames are discarded.  */
+static int traceframe_count;
+static int traceframes_created;
+
+/* Where a frame is assembled before it is copied into the buffer.  */
+static unsigned char *frame_scratch;
+static unsigned int frame_scratch_size;
+static unsigned int frame_scratch_used;
+
+static void
+clear_trace_buffer (void)
+{
+  if (trace_buffer_lo == NULL)
+    {
+      trace_buffer_lo = xmalloc (TRACE_BUFFER_SIZE);
+      trace_buffer_hi = trace_buffer_lo + TRACE_BUFFER_SIZE;
+    }
+
+  trace_buffer_start = trace_buffer_free = trace_buffer_lo;
+  trace_buffer_wrap = NULL;
+  traceframe_count = 0;
+  traceframes_created = 0;
+}
+
+static unsigned int
+traceframe_size (unsigned char *frame)
+{
+  struct traceframe_header hdr;
+
+  memcpy (&hdr, frame, sizeof (hdr));
+  return sizeof (hdr) + hdr.data_size;
+}
+
+/* Return the frame after FRAME in the buffer.  */
+
+static unsigned char *
+next_traceframe (unsigned char *frame)
+{
+  frame += traceframe_size (frame);
+  if (frame == trace_buffer_wrap)
+    frame = trace_buffer_lo;
+  return frame;
+}
+
+/* Discard the oldest frame in the buffer.  */
+
+static void
+discard_oldest_traceframe (void)
+{
+  trace_buffer_start += traceframe_size (trace_buffer_start);
+  if (trace_buffer_start == trace_buffer_wrap)
+    {
+      trace_buffer_start = trace_buffer_lo;
+      trace_buffer_wrap = NULL;
+    }
+
+  /* Keep the frame GDB is looking at selected; if it was this one,
+     GDB is back to the live process.  */
+  if (current_traceframe >= 0)
+    current_traceframe--;
+
+  if (--traceframe_count == 0)
+    {
+      trace_buffer_start = trace_buffer_free = trace_buffer_lo;
+      trace_buffer_wrap = NULL;
+    }
+}
+
+/* Return space for a frame of SIZE bytes, discarding old frames as
+   needed, or NULL if it can never fit.  */
+
+static unsigned char *
+allocate_traceframe (unsigned int size)
+{
+  unsigned char *frame;
+
+  if (size > TRACE_BUFFER_SIZE)
+    return NULL;
+
+  for (;;)
+    {
+      if (trace_buffer_wrap == NULL)
+	{
+	  if ((unsigned int) (trace_buffer_hi - trace_buffer_free) >= size)
+	    break;
+
+	  /* No room at the top; continue at the bottom.  */
+	  if (traceframe_count == 0)
+	    {
+	      trace_buffer_start = trace_buffer_free = trace_buffer_lo;
+	      continue;
+	    }
+	  trace_buffer_wrap = trace_buffer_free;
+	  trace_buffer_free = trace_buffer_lo;
+	}
+
+      if ((unsigned int) (trace_buffer_start - trace_buffer_free) >= size)
+	break;
+      discard_oldest_traceframe ();
+    }
+
+  frame = trace_buffer_free;
+  trace_buffer_free += size;
+  traceframe_count++;
+  traceframes_created++;
+  return frame;
+}
+
+/* Return frame number NUM, or NULL if it is not in the buffer.  */
+
+static unsigned char *
+find_traceframe (int num)
+{
+  unsigned char *frame;
+
+  if (num < 0 || num >= traceframe_count)
+    return NULL;
+
+  for (frame = trace_buffer_start; num > 0; num--)
+    frame = next_traceframe (frame);
+  return frame;
+}
+
+/* Find the block of type TYPE in FRAME, starting after block PREV
+   (or at the first one if PREV is NULL).  */
+
+static unsigned char *
+traceframe_find_block (unsigned char *frame, char type, unsigned char *prev)
+{
+  struct traceframe_header hdr;
+  unsigned char *block, *end;
+
+  memcpy (&hdr, frame, sizeof (hdr));
+  block = frame + sizeof (hdr);
+  end = block + hdr.data_size;
+
+  while (block < end)
+    {
+      unsigned char *this_block = block;
+
+      switch (*block)
+	{
+	case 'R':
+	  block += 1 + register_cache_size ();
+	  break;
+	case 'M':
+	  {
+	    unsigned int len;
+
+	    memcpy (&len, block + 1 + sizeof (CORE_ADDR), sizeof (len));
+	    block += 1 + sizeof (CORE_ADDR) + sizeof (len) + len;
+	  }
+	  break;
+	default:
+	  warning ("Bad trace frame block type '%c'", *block);
+	  return NULL;
+	}
+
+      if (*this_block == type && this_block > prev)
+	return this_block;
+    }
+
+  return NULL;
+}
+
+static unsigned char *
+reserve_frame_scratch (unsigned int size)
+{
+  unsigned char *p;
+
+  if (frame_scratch_used + size > frame_scratch_size)
+    {
+      frame_scratch_size = 2 * (frame_scratch_used + size);
+      frame_scratch = xrealloc (frame_scratch, frame_scratch_size);
+    }
+
+  p = frame_scratch + frame_scratch_used;
+  frame_scratch_used += size;
+  return p;
+}
+
+/* Record LEN bytes of memory at ADDR in the frame being assembled.
+   Memory that cannot be read is silently left out.  Also used as
+   the callback for the agent expression trace bytecodes.  */
+
+static int
+collect_memory (void *data, CORE_ADDR addr, ULONGEST len)
+{
+  unsigned char *block;
+  unsigned int ulen = len;
+
+  if (len == 0 || ulen != len || ulen > TRACE_BUFFER_SIZE)
+    return 0;
+
+  block = reserve_frame_scratch (1 + sizeof (addr) + sizeof (ulen) + ulen);
+  if (read_inferior_memory (addr, block + 1 + sizeof (addr) + sizeof (ulen),
+			    ulen) != 0)
+    {
+      frame_scratch_used -= 1 + sizeof (addr) + sizeof (ulen) + ulen;
+      return 0;
+    }
+
+  block[0] = 'M';
+  memcpy (block + 1, &addr, sizeof (addr));
+  memcpy (block + 1 + sizeof (addr), &ulen, sizeof (ulen));
+  return 0;
+}
+
+/* Assemble a trace frame for TPOINT, hit at STOP_PC, and store it in
+   the trace buffer.  */
+
+static void
+collect_traceframe (struct tracepoint *tpoint, CORE_ADDR stop_pc)
+{
+  struct traceframe_header hdr;
+  struct tracepoint_action *action;
+  unsigned char *frame;
+
+  frame_scratch_used = 0;
+  reserve_frame_scratch (sizeof (hdr));
+
+  /* The registers, with the PC set to where the tracepoint is even
+     on targets which report the address after the breakpoint.  */
+  {
+    unsigned char *block = reserve_frame_scratch (1 + register_cache_size ());
+    CORE_ADDR pc = 0;
+
+    block[0] = 'R';
+    if (the_target->read_pc != NULL)
+      {
+	pc = (*the_target->read_pc) ();
+	if (pc != stop_pc)
+	  (*the_target->write_pc) (stop_pc);
+      }
+    collect_registers (block + 1);
+    if (the_target->read_pc != NULL && pc != stop_pc)
+      (*the_target->write_pc) (pc);
+  }
+
+  for (action = tpoint->actions; action != NULL; action = action->next)
+    switch (action->type)
+      {
+      case 'M':
+	{
+	  ULONGEST base = 0;
+
+	  if (action->basereg != -1
+	      && agent_expr_read_register (action->basereg, &base) != 0)
+	    break;
+	  collect_memory (NULL, (CORE_ADDR) (base + action->offset),
+			  action->length);
+	}
+	break;
+
+      case 'X':
+	{
+	  ULONGEST value;
+	  enum eval_result_type err;
+
+	  err = eval_agent_expr (action->expr, collect_memory, NULL, &value);
+	  if (err != expr_eval_no_error && debug_threads)
+	    fprintf (stderr, "Tracepoint %d expression failed: %s\n",
+		     tpoint->number, eval_result_name (err));
+	}
+	break;
+      }
+
+  hdr.tpnum = tpoint->number;
+  hdr.pc = tpoint->address;
+  hdr.data_size = frame_scratch_used - sizeof (hdr);
+  memcpy (frame_scratch, &hdr, sizeof (hdr));
+
+  frame = allocate_traceframe (frame_scratch_used);
+  if (frame == NULL)
+    {
+      warning ("Trace frame for tracepoint %d too large (%u bytes)",
+	       tpoint->number, frame_scratch_used);
+      return;
+    }
+  memcpy (frame, frame_scratch, frame_scratch_used);
+}
+
+/* The handler for the breakpoints implementing the tracepoints at
+   STOP_PC.  */
+
+static int
+tracepoint_handler (CORE_ADDR stop_pc)
+{
+  struct tracepoint *tpoint;
+
+  /* The experiment was stopped by a pass count; remove ourselves.  */
+  if (!tracing)
+    return 1;
+
+  for (tpoint = tracepoints; tpoint != NULL && tracing; tpoint = tpoint->next)
+    {
+      if (tpoint->address != stop_pc || !tpoint->enabled)
+	continue;
+
+      if (tpoint->cond != NULL)
+	{
+	  ULONGEST value = 1;
+	  enum eval_result_type err;
+
+	  err = eval_agent_expr (tpoint->cond, NULL, NULL, &value);
+	  if (err != expr_eval_no_error)
+	    {
+	      if (debug_threads)
+		fprintf (stderr, "Tracepoint %d condition failed: %s\n",
+			 tpoint->number, eval_result_name (err));
+	      continue;
+	    }
+	  if (value == 0)
+	    continue;
+	}
+
+      collect_traceframe (tpoint, stop_pc);
+
+      tpoint->hit_count++;
+      if (tpoint->pass_count != 0 && tpoint->hit_count >= tpoint->pass_count)
+	{
+	  if (debug_threads)
+	    fprintf (stderr, "Tracepoint %d passcount reached; "
+		     "stopping trace.\n", tpoint->number);
+	  tracing = 0;
+	}
+    }
+
+  return !tracing;
+}
+
+static struct tracepoint *
+find_tracepoint (int number, CORE_ADDR address)
+{
+  struct tracepoint *tpoint;
+
+  for (tpoint = tracepoints; tpoint != NULL; tpoint = tpoint->next)
+    if (tpoint->number == number && tpoint->address == address)
+      return tpoint;
+
+  return NULL;
+}
+
+static void
+free_tracepoint (struct tracepoint *tpoint)
+{
+  struct tracepoint_action *action, *next;
+
+  for (action = tpoint->actions; action != NULL; action = next)
+    {
+      next = action->next;
+      free_agent_expr (action->expr);
+      free (action);
+    }
+  free_agent_expr (tpoint->cond);
+  free (tpoint);
+}
+
+/* Insert or remove the breakpoints for all enabled tracepoints, one
+   per address.  */
+
+static void
+set_tracepoint_breakpoints (int insert)
+{
+  struct tracepoint *tpoint, *other;
+
+  for (tpoint = tracepoints; tpoint != NULL; tpoint = tpoint->next)
+    {
+      if (!tpoint->enabled)
+	continue;
+
+      for (other = tracepoints; other != tpoint; other = other->next)
+	if (other->enabled && other->address == tpoint->address)
+	  break;
+      if (other != tpoint)
+	continue;
+
+      if (insert)
+	set_breakpoint_at (tpoint->address, tracepoint_handler);
+      else
+	delete_breakpoint_at (tpoint->address);
+    }
+}
+
+static void
+stop_tracing (void)
+{
+  if (tracepoint_breakpoints_inserted && target_running ())
+    set_tracepoint_breakpoints (0);
+  tracepoint_breakpoints_inserted = 0;
+  tracing = 0;
+  tracing_process = NULL;
+}
+
+/* PROCESS is gone, and its breakpoints with it.  If the trace
+   experiment was running in it, it is over; the frames stay in the
+   buffer for GDB to look at.  */
+
+void
+tracepoint_remove_process (struct process_info *process)
+{
+  if (process != tracing_process)
+    return;
+
+  tracepoint_breakpoints_inserted = 0;
+  tracing = 0;
+  tracing_process = NULL;
+}
+
+/* Parse the tracepoint actions at *PACKET into TPOINT.  Return -1 on
+   error.  */
+
+static int
+add_tracepoint_actions (struct tracepoint *tpoint, char *packet)
+{
+  struct tracepoint_action **link, **first;
+  char *p = packet;
+
+  for (link = &tpoint->actions; *link != NULL; link = &(*link)->next)
+    ;
+  first = link;
+
+  while (*p != '\0' && *p != '-')
+    {
+      struct tracepoint_action *action;
+      ULONGEST val;
+
+      action = xmalloc (sizeof (*action));
+      memset (action, 0, sizeof (*action));
+      action->type = *p++;
+
+      switch (action->type)
+	{
+	case 'R':
+	  /* The register mask; we collect all of them anyway.  */
+	  p = unpack_varlen_hex (p, &val);
+	  break;
+
+	case 'M':
+	  if (*p == '-')
+	    {
+	      p = unpack_varlen_hex (p + 1, &val);
+	      action->basereg = -1;
+	    }
+	  else
+	    {
+	      p = unpack_varlen_hex (p, &val);
+	      action->basereg = val;
+	    }
+	  if (*p++ != ',')
+	    goto bad;
+	  p = unpack_varlen_hex (p, &action->offset);
+	  if (*p++ != ',')
+	    goto bad;
+	  p = unpack_varlen_hex (p, &action->length);
+	  break;
+
+	case 'X':
+	  p = unpack_varlen_hex (p, &val);
+	  if (*p++ != ',')
+	    goto bad;
+	  action->expr = parse_agent_expr (&p, val);
+	  if (action->expr == NULL)
+	    goto bad;
+	  break;
+
+	default:
+	  /* Including 'S', while-stepping actions: we do not step
+	     the inferior on our own to collect them.  */
+	  goto bad;
+	}
+
+      *link = action;
+      link = &action->next;
+      continue;
+
+    bad:
+      free (action);
+
+      /* Drop what this packet added, GDB will not use the
+	 tracepoint anyway.  */
+      while (*first != NULL)
+	{
+	  action = *first;
+	  *first = action->next;
+	  free_agent_expr (action->expr);
+	  free (action);
+	}
+      return -1;
+    }
+
+  return 0;
+}
+
+/* QTDP:N:ADDR:ENA:STEP:PASS[:XLEN,COND][-]
+   QTDP:-N:ADDR:ACTIONS[-]  */
+
+static void
+cmd_qtdp (char *own_buf)
+{
+  char *p = own_buf + strlen ("QTDP:");
+  ULONGEST num, addr, step, pass;
+  struct tracepoint *tpoint;
+  int more_actions = 0;
+
+  if (tracing)
+    {
+      write_enn (own_buf);
+      return;
+    }
+
+  if (*p == '-')
+    {
+      more_actions = 1;
+      p++;
+    }
+
+  p = unpack_varlen_hex (p, &num);
+  if (*p++ != ':')
+    goto bad;
+  p = unpack_varlen_hex (p, &addr);
+  if (*p++ != ':')
+    goto bad;
+
+  if (more_actions)
+    {
+      tpoint = find_tracepoint (num, addr);
+      if (tpoint == NULL || add_tracepoint_actions (tpoint, p) != 0)
+	goto bad;
+      write_ok (own_buf);
+      return;
+    }
+
+  tpoint = xmalloc (sizeof (*tpoint));
+  memset (tpoint, 0, sizeof (*tpoint));
+  tpoint->number = num;
+  tpoint->address = addr;
+  tpoint->enabled = (*p == 'E');
+  p++;
+  if (*p++ != ':')
+    goto bad_free;
+  p = unpack_varlen_hex (p, &step);
+  if (*p++ != ':')
+    goto bad_free;
+  p = unpack_varlen_hex (p, &pass);
+  tpoint->pass_count = pass;
+
+  if (*p == ':' && p[1] == 'X')
+    {
+      ULONGEST len;
+
+      if (!target_supports_conditional_breakpoints ())
+	goto bad_free;
+
+      p = unpack_varlen_hex (p + 2, &len);
+      if (*p++ != ',')
+	goto bad_free;
+      tpoint->cond = parse_agent_expr (&p, len);
+      if (tpoint->cond == NULL)
+	goto bad_free;
+    }
+
+  if (*p != '\0' && *p != '-')
+    goto bad_free;
+
+  /* GDB re-downloads all tracepoints on every tstart; replace any
+     earlier definition.  */
+  {
+    struct tracepoint **link;
+
+    for (link = &tracepoints; *link != NULL; link = &(*link)->next)
+      if ((*link)->number == tpoint->number
+	  && (*link)->address == tpoint->address)
+	{
+	  struct tracepoint *old = *link;
+
+	  *link = old->next;
+	  free_tracepoint (old);
+	  break;
+	}
+
+    /* Keep them in the order GDB sent them.  */
+    for (link = &tracepoints; *link != NULL; link = &(*link)->next)
+      ;
+    *link = tpoint;
+  }
+
+  write_ok (own_buf);
+  return;
+
+ bad_free:
+  free_tracepoint (tpoint);
+ bad:
+  write_enn (own_buf);
+}
+
+/* QTro:START1,END1:START2,END2...  */
+
+static void
+cmd_qtro (char *own_buf)
+{
+  char *p = own_buf + strlen ("QTro");
+  struct readonly_region *r;
+
+  while (readonly_regions != NULL)
+    {
+      r = readonly_regions;
+      readonly_regions = r->next;
+      free (r);
+    }
+
+  while (*p == ':')
+    {
+      ULONGEST start, end;
+
+      p = unpack_varlen_hex (p + 1, &start);
+      if (*p++ != ',')
+	break;
+      p = unpack_varlen_hex (p, &end);
+
+      r = xmalloc (sizeof (*r));
+      r->start = start;
+      r->end = end;
+      r->next = readonly_regions;
+      readonly_regions = r;
+    }
+
+  write_ok (own_buf);
+}
+
+/* Reply to a QTFrame search with the frame found (or not).  */
+
+static void
+select_traceframe (char *own_buf, int num)
+{
+  unsigned char *frame = find_traceframe (num);
+  struct traceframe_header hdr;
+
+  if (frame == NULL)
+    {
+      current_traceframe = -1;
+      strcpy (own_buf, "F-1");
+      return;
+    }
+
+  memcpy (&hdr, frame, sizeof (hdr));
+  current_traceframe = num;
+  sprintf (own_buf, "F%xT%x", num, hdr.tpnum);
+}
+
+/* QTFrame:N, QTFrame:pc:ADDR, QTFrame:tdp:N, QTFrame:range:LO:HI,
+   QTFrame:outside:LO:HI.  The searches start after the currently
+   selected frame.  */
+
+static void
+cmd_qtframe (char *own_buf)
+{
+  char *p = own_buf + strlen ("QTFrame:");
+  enum { by_pc, by_tdp, in_range, outside_range } kind;
+  ULONGEST lo = 0, hi = 0;
+  int num;
+
+  if (strncmp (p, "pc:", 3) == 0)
+    {
+      kind = by_pc;
+      unpack_varlen_hex (p + 3, &lo);
+    }
+  else if (strncmp (p, "tdp:", 4) == 0)
+    {
+      kind = by_tdp;
+      unpack_varlen_hex (p + 4, &lo);
+    }
+  else if (strncmp (p, "range:", 6) == 0
+	   || strncmp (p, "outside:", 8) == 0)
+    {
+      kind = *p == 'r' ? in_range : outside_range;
+      p = unpack_varlen_hex (strchr (p, ':') + 1, &lo);
+      if (*p++ != ':')
+	{
+	  write_enn (own_buf);
+	  return;
+	}
+      unpack_varlen_hex (p, &hi);
+    }
+  else
+    {
+      ULONGEST n;
+
+      unpack_varlen_hex (p, &n);
+      /* GDB sends -1 as 32 bits.  */
+      select_traceframe (own_buf, (int) n);
+      return;
+    }
+
+  for (num = current_traceframe + 1; num < traceframe_count; num++)
+    {
+      unsigned char *frame = find_traceframe (num);
+      struct traceframe_header hdr;
+      CORE_ADDR pc;
+
+      memcpy (&hdr, frame, sizeof (hdr));
+      pc = hdr.pc;
+
+      if ((kind == by_pc && pc == lo)
+	  || (kind == by_tdp && hdr.tpnum == (int) lo)
+	  || (kind == in_range && pc >= lo && pc <= hi)
+	  || (kind == outside_range && (pc < lo || pc > hi)))
+	{
+	  select_traceframe (own_buf, num);
+	  return;
+	}
+    }
+
+  select_traceframe (own_buf, -1);
+}
+
+/* qTStatus.  TFRAMES is the number of frames in the buffer, which
+   QTFrame numbers 0 to TFRAMES - 1; TCREATED also counts the frames
+   discarded when the buffer wrapped.  */
+
+static void
+cmd_qtstatus (char *own_buf)
+{
+  unsigned int free_space;
+
+  if (trace_buffer_lo == NULL)
+    free_space = TRACE_BUFFER_SIZE;
+  else if (trace_buffer_wrap == NULL)
+    free_space = (trace_buffer_hi - trace_buffer_free)
+      + (trace_buffer_start - trace_buffer_lo);
+  else
+    free_space = trace_buffer_start - trace_buffer_free;
+
+  sprintf (own_buf, "T%d;tframes:%x;tcreated:%x;tfree:%x;tsize:%x",
+	   tracing ? 1 : 0, traceframe_count, traceframes_created,
+	   free_space, TRACE_BUFFER_SIZE);
+}
+
+int
+handle_tracepoint_general_set (char *own_buf)
+{
+  if (strcmp (own_buf, "QTinit") == 0)
+    {
+      stop_tracing ();
+      while (tracepoints != NULL)
+	{
+	  struct tracepoint *tpoint = tracepoints;
+
+	  tracepoints = tpoint->next;
+	  free_tracepoint (tpoint);
+	}
+      clear_trace_buffer ();
+      current_traceframe = -1;
+      write_ok (own_buf);
+      return 1;
+    }
+
+  if (strncmp (own_buf, "QTDP:", strlen ("QTDP:")) == 0)
+    {
+      cmd_qtdp (own_buf);
+      return 1;
+    }
+
+  if (strncmp (own_buf, "QTro", strlen ("QTro")) == 0)
+    {
+      cmd_qtro (own_buf);
+      return 1;
+    }
+
+  if (strcmp (own_buf, "QTStart") == 0)
+    {
+      struct tracepoint *tpoint;
+
+      if (!target_running () || tracing)
+	{
+	  write_enn (own_buf);
+	  return 1;
+	}
+
+      stop_tracing ();
+      clear_trace_buffer ();
+      current_traceframe = -1;
+      for (tpoint = tracepoints; tpoint != NULL; tpoint = tpoint->next)
+	tpoint->hit_count = 0;
+      set_tracepoint_breakpoints (1);
+      tracepoint_breakpoints_inserted = 1;
+      tracing_process = current_process ();
+      tracing = 1;
+      write_ok (own_buf);
+      return 1;
+    }
+
+  if (strcmp (own_buf, "QTStop") == 0)
+    {
+      stop_tracing ();
+      write_ok (own_buf);
+      return 1;
+    }
+
+  if (strncmp (own_buf, "QTFrame:", strlen ("QTFrame:")) == 0)
+    {
+      cmd_qtframe (own_buf);
+      return 1;
+    }
+
+  return 0;
+}
+
+int
+handle_tracepoint_query (char *own_buf)
+{
+  if (strcmp (own_buf, "qTStatus") == 0)
+    {
+      cmd_qtstatus (own_buf);
+      return 1;
+    }
+
+  return 0;
+}
+
+void
+traceframe_registers_to_string (char *buf)
+{
+  unsigned char *frame = find_traceframe (current_traceframe);
+  unsigned char *block = NULL;
+
+  if (frame != NULL)
+    block = traceframe_find_block (frame, 'R', NULL);
+
+  if (block != NULL)
+    convert_int_to_ascii (block + 1, buf, register_cache_size ());
+  else
+    {
+      memset (buf, 'x', 2 * register_cache_size ());
+      buf[2 * register_cache_size ()] = '\0';
+    }
+}
+
+int
+traceframe_read_memory (CORE_ADDR addr, unsigned char *buf, int len)
+{
+  unsigned char *frame = find_traceframe (current_traceframe);
+
+  if (frame == NULL)
+    return -1;
+
+  while (len > 0)
+    {
+      unsigned char *block = NULL;
+      struct readonly_region *r;
+      int chunk = 0;
+
+      /* Collected memory first...  */
+      while ((block = traceframe_find_block (frame, 'M', block)) != NULL)
+	{
+	  CORE_ADDR start;
+	  unsigned int blen;
+
+	  memcpy (&start, block + 1, sizeof (start));
+	  memcpy (&blen, block + 1 + sizeof (start), sizeof (blen));
+	  if (addr >= start && addr < start + blen)
+	    {
+	      chunk = start + blen - addr;
+	      if (chunk > len)
+		chunk = len;
+	      memcpy (buf, block + 1 + sizeof (start) + sizeof (blen)
+		      + (addr - start), chunk);
+	      break;
+	    }
+	}
+
+      /* ... then the parts of the program which cannot have changed.  */
+      if (chunk == 0)
+	for (r = readonly_regions; r != NULL; r = r->next)
+	  if (addr >= r->start && addr < r->end)
+	    {
+	      chunk = r->end - addr;
+	      if (chunk > len)
+		chunk = len;
+	      if (read_inferior_memory (addr, buf, chunk) != 0)
+		return -1;
+	      break;
+	    }
+
+      if (chunk == 0)
+	return -1;
+
+      addr += chunk;
+      buf += chunk;
+      len -= chunk;
+    }
+
+  return 0;
+}
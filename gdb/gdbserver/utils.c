@@ -57,6 +57,23 @@ xmalloc (size_t size)
   return newmem;
 }
 
+/* Reallocate memory without fail.
+   If realloc fails, this will print a message to stderr and exit.  */
+
+void *
+xrealloc (void *ptr, size_t size)
+{
+  void *newmem;
+
+  if (size == 0)
+    size = 1;
+  newmem = ptr != NULL ? realloc (ptr, size) : malloc (size);
+  if (!newmem)
+    malloc_failure (size);
+
+  return newmem;
+}
+
 /* Allocate memory without fail and set it to zero.
    If malloc fails, this will print a message to stderr and exit.  */
 
@@ -114,6 +114,69 @@ static SIM_DESC gdbsim_desc = 0;
    inferior_ptid.  */
 static ptid_t remote_sim_ptid;
 
+/* Simulators of several processors show them as threads, processor N
+   with the tid of remote_sim_ptid plus N.  The entry points are
+   optional: other simulators do not define them.  */
+#ifdef __GNUC__
+#pragma weak sim_processor_count
+#pragma weak sim_select_processor
+#pragma weak sim_stopped_processor
+#define SIM_HAS_PROCESSORS (sim_processor_count != NULL)
+#else
+#define SIM_HAS_PROCESSORS 0
+#define sim_processor_count(sd) 1
+#define sim_select_processor(sd, n)
+#define sim_stopped_processor(sd) 0
+#endif
+
+/* Likewise, simulators may implement data watchpoints; GDB falls back
+   to software watchpoints for those which do not.  */
+#ifdef __GNUC__
+#pragma weak sim_insert_watchpoint
+#pragma weak sim_remove_watchpoint
+#pragma weak sim_stopped_data_address
+#define SIM_HAS_WATCHPOINTS (sim_insert_watchpoint != NULL)
+#else
+#define SIM_HAS_WATCHPOINTS 0
+#define sim_insert_watchpoint(sd, addr, len, type) -1
+#define sim_remove_watchpoint(sd, addr, len, type) -1
+#define sim_stopped_data_address(sd, addr) 0
+#endif
+
+/* Number of processors added as threads.  */
+static int gdbsim_processors = 1;
+
+static ptid_t
+gdbsim_processor_ptid (int n)
+{
+  return ptid_build (ptid_get_pid (remote_sim_ptid), 0,
+		     ptid_get_tid (remote_sim_ptid) + n);
+}
+
+/* Processor number of PTID, or -1.  */
+
+static int
+gdbsim_ptid_processor (ptid_t ptid)
+{
+  int n = ptid_get_tid (ptid) - ptid_get_tid (remote_sim_ptid);
+
+  if (ptid_get_pid (ptid) != ptid_get_pid (remote_sim_ptid)
+      || n < 0 || n >= gdbsim_processors)
+    return -1;
+  return n;
+}
+
+/* Make the processor of PTID the one the simulator works on.  */
+
+static void
+gdbsim_select_processor (ptid_t ptid)
+{
+  int n = gdbsim_ptid_processor (ptid);
+
+  if (SIM_HAS_PROCESSORS && n >= 0 && gdbsim_desc != NULL)
+    sim_select_processor (gdbsim_desc, n);
+}
+
 static void
 dump_mem (char *buf, int len)
 {
@@ -282,6 +345,8 @@ gdbsim_fetch_register (struct target_ops *ops,
       return;
     }
 
+  gdbsim_select_processor (inferior_ptid);
+
   switch (gdbarch_register_sim_regno (gdbarch, regno))
     {
     case LEGACY_SIM_REGNO_IGNORE:
@@ -350,7 +415,9 @@ gdbsim_store_register (struct target_ops *ops,
 	gdbsim_store_register (ops, regcache, regno);
       return;
     }
-  else if (gdbarch_register_sim_regno (gdbarch, regno) >= 0)
+
+  gdbsim_select_processor (inferior_ptid);
+  if (gdbarch_register_sim_regno (gdbarch, regno) >= 0)
     {
       char tmp[MAX_REGISTER_SIZE];
       int nr_bytes;
@@ -425,6 +492,39 @@ gdbsim_load (char *args, int fromtty)
 }
 
 
+/* Add a thread for each processor of the simulator.  */
+
+static void
+gdbsim_find_new_threads (struct target_ops *ops)
+{
+  int n;
+
+  if (gdbsim_desc == NULL
+      || ptid_get_pid (inferior_ptid) != ptid_get_pid (remote_sim_ptid))
+    return;
+
+  gdbsim_processors = SIM_HAS_PROCESSORS
+		      ? sim_processor_count (gdbsim_desc) : 1;
+  for (n = 0; n < gdbsim_processors; n++)
+    if (!in_thread_list (gdbsim_processor_ptid (n)))
+      {
+	if (n == 0)
+	  add_thread_silent (gdbsim_processor_ptid (n));
+	else
+	  add_thread (gdbsim_processor_ptid (n));
+      }
+}
+
+static void
+gdbsim_delete_threads (void)
+{
+  int n;
+
+  for (n = 0; n < gdbsim_processors; n++)
+    delete_thread_silent (gdbsim_processor_ptid (n));
+  gdbsim_processors = 1;
+}
+
 /* Start an inferior process and set inferior_ptid to its pid.
    EXEC_FILE is the file to run.
    ARGS is a string containing the arguments to the program.
@@ -450,7 +550,7 @@ gdbsim_create_inferior (struct target_ops *target, char *exec_file, char *args,
 		     (exec_file ? exec_file : "(NULL)"),
 		     args);
 
-  if (ptid_equal (inferior_ptid, remote_sim_ptid))
+  if (ptid_get_pid (inferior_ptid) == ptid_get_pid (remote_sim_ptid))
     gdbsim_kill (target);
   remove_breakpoints ();
   init_wait_for_inferior ();
@@ -473,6 +573,7 @@ gdbsim_create_inferior (struct target_ops *target, char *exec_file, char *args,
   inferior_ptid = remote_sim_ptid;
   add_inferior_silent (ptid_get_pid (inferior_ptid));
   add_thread_silent (inferior_ptid);
+  gdbsim_find_new_threads (target);
 
   insert_breakpoints ();	/* Needed to get correct instruction in cache */
 
@@ -578,7 +679,7 @@ gdbsim_close (int quitting)
 
   end_callbacks ();
   generic_mourn_inferior ();
-  delete_thread_silent (remote_sim_ptid);
+  gdbsim_delete_threads ();
   delete_inferior_silent (ptid_get_pid (remote_sim_ptid));
 }
 
@@ -613,12 +714,16 @@ static void
 gdbsim_resume (struct target_ops *ops,
 	       ptid_t ptid, int step, enum target_signal siggnal)
 {
-  if (!ptid_equal (inferior_ptid, remote_sim_ptid))
+  if (ptid_get_pid (inferior_ptid) != ptid_get_pid (remote_sim_ptid))
     error (_("The program is not being run."));
 
   if (remote_debug)
     printf_filtered ("gdbsim_resume: step %d, signal %d\n", step, siggnal);
 
+  /* A step moves the current thread only.  */
+  if (step)
+    gdbsim_select_processor (inferior_ptid);
+
   resume_siggnal = siggnal;
   resume_step = step;
 }
@@ -731,9 +836,63 @@ gdbsim_wait (struct target_ops *ops,
       break;
     }
 
+  if (SIM_HAS_PROCESSORS && gdbsim_processors > 1)
+    return gdbsim_processor_ptid (sim_stopped_processor (gdbsim_desc));
+
   return inferior_ptid;
 }
 
+/* Hardware watchpoints, when the simulator has them.  */
+
+static int
+gdbsim_can_use_hw_breakpoint (int type, int cnt, int othertype)
+{
+  if (!SIM_HAS_WATCHPOINTS || gdbsim_desc == 0)
+    return 0;
+
+  return (type == bp_hardware_watchpoint || type == bp_read_watchpoint
+	  || type == bp_access_watchpoint);
+}
+
+static int
+gdbsim_insert_watchpoint (CORE_ADDR addr, int len, int type)
+{
+  if (!SIM_HAS_WATCHPOINTS || gdbsim_desc == 0)
+    return -1;
+
+  return sim_insert_watchpoint (gdbsim_desc, addr, len, type);
+}
+
+static int
+gdbsim_remove_watchpoint (CORE_ADDR addr, int len, int type)
+{
+  if (!SIM_HAS_WATCHPOINTS || gdbsim_desc == 0)
+    return -1;
+
+  return sim_remove_watchpoint (gdbsim_desc, addr, len, type);
+}
+
+static int
+gdbsim_stopped_data_address (struct target_ops *ops, CORE_ADDR *addr_p)
+{
+  SIM_ADDR addr;
+
+  if (!SIM_HAS_WATCHPOINTS || gdbsim_desc == 0
+      || !sim_stopped_data_address (gdbsim_desc, &addr))
+    return 0;
+
+  *addr_p = addr;
+  return 1;
+}
+
+static int
+gdbsim_stopped_by_watchpoint (void)
+{
+  CORE_ADDR addr;
+
+  return gdbsim_stopped_data_address (&current_target, &addr);
+}
+
 /* Get ready to modify the registers array.  On machines which store
    individual registers, this doesn't need to do anything.  On machines
    which store all the registers in one fell swoop, this makes sure
@@ -819,7 +978,7 @@ gdbsim_mourn_inferior (struct target_ops *target)
 
   remove_breakpoints ();
   generic_mourn_inferior ();
-  delete_thread_silent (remote_sim_ptid);
+  gdbsim_delete_threads ();
 }
 
 /* Pass the command argument through to the simulator verbatim.  The
@@ -856,8 +1015,8 @@ simulator_command (char *args, int from_tty)
 static int
 gdbsim_thread_alive (struct target_ops *ops, ptid_t ptid)
 {
-  if (ptid_equal (ptid, remote_sim_ptid))
-    /* The simulators' task is always alive.  */
+  if (gdbsim_ptid_processor (ptid) >= 0)
+    /* The simulators' processors are always alive.  */
     return 1;
 
   return 0;
@@ -871,6 +1030,13 @@ gdbsim_pid_to_str (struct target_ops *ops, ptid_t ptid)
 {
   static char buf[64];
 
+  int n = gdbsim_ptid_processor (ptid);
+
+  if (n >= 0 && gdbsim_processors > 1)
+    {
+      xsnprintf (buf, sizeof buf, "Processor %d", n);
+      return buf;
+    }
   if (ptid_equal (remote_sim_ptid, ptid))
     {
       xsnprintf (buf, sizeof buf, "Thread <main>");
@@ -902,12 +1068,19 @@ init_gdbsim_ops (void)
   gdbsim_ops.to_files_info = gdbsim_files_info;
   gdbsim_ops.to_insert_breakpoint = memory_insert_breakpoint;
   gdbsim_ops.to_remove_breakpoint = memory_remove_breakpoint;
+  gdbsim_ops.to_can_use_hw_breakpoint = gdbsim_can_use_hw_breakpoint;
+  gdbsim_ops.to_insert_watchpoint = gdbsim_insert_watchpoint;
+  gdbsim_ops.to_remove_watchpoint = gdbsim_remove_watchpoint;
+  gdbsim_ops.to_stopped_by_watchpoint = gdbsim_stopped_by_watchpoint;
+  gdbsim_ops.to_stopped_data_address = gdbsim_stopped_data_address;
+  gdbsim_ops.to_have_continuable_watchpoint = 1;
   gdbsim_ops.to_kill = gdbsim_kill;
   gdbsim_ops.to_load = gdbsim_load;
   gdbsim_ops.to_create_inferior = gdbsim_create_inferior;
   gdbsim_ops.to_mourn_inferior = gdbsim_mourn_inferior;
   gdbsim_ops.to_stop = gdbsim_stop;
   gdbsim_ops.to_thread_alive = gdbsim_thread_alive;
+  gdbsim_ops.to_find_new_threads = gdbsim_find_new_threads;
   gdbsim_ops.to_pid_to_str = gdbsim_pid_to_str;
   gdbsim_ops.to_stratum = process_stratum;
   gdbsim_ops.to_has_all_memory = default_child_has_all_memory;
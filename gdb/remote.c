@@ -62,6 +62,8 @@
 #include "gdb_stat.h"
 
 #include "memory-map.h"
+#include "dcache.h"
+#include "ax.h"
 
 /* The size to align memory write packets, when practical.  The protocol
    does not guarantee any alignment, and gdb will generate short
@@ -1002,6 +1004,9 @@ enum {
   PACKET_ConditionalTracepoints,
   PACKET_bc,
   PACKET_bs,
+  PACKET_ConditionalBreakpoints,
+  PACKET_QStopExpedite,
+  PACKET_PipelinedReads,
   PACKET_MAX
 };
 
@@ -1351,6 +1356,84 @@ remote_pass_signals (void)
     }
 }
 
+/* How many bytes of memory from the stack pointer outwards, and from
+   the PC onwards, to have the stub send with every stop reply, and
+   whether to have it send all registers.  */
+
+static int stop_reply_stack_bytes = 256;
+static int stop_reply_code_bytes = 0;
+static int stop_reply_all_registers = 1;
+
+static char *last_stop_expedite_packet;
+
+/* If 'QStopExpedite' is supported, tell the remote stub what to send
+   along with each stop reply, so that the registers and memory GDB
+   looks at right after a stop (e.g. to unwind the innermost frame
+   after a single-step) are already there without further round
+   trips.  The memory lands in the target dcache.  */
+
+static void
+remote_stop_expedite (void)
+{
+  struct gdbarch *gdbarch = target_gdbarch;
+  struct remote_arch_state *rsa;
+  char *expedite_packet, *p;
+  int regnum;
+
+  if (remote_protocol_packets[PACKET_QStopExpedite].support == PACKET_DISABLE)
+    return;
+
+  rsa = get_remote_arch_state ();
+  expedite_packet = xmalloc (128);
+  strcpy (expedite_packet, "QStopExpedite:");
+  p = expedite_packet + strlen (expedite_packet);
+
+  if (stop_reply_all_registers)
+    p += sprintf (p, "regs;");
+
+  regnum = gdbarch_sp_regnum (gdbarch);
+  if (stop_reply_stack_bytes > 0
+      && regnum >= 0 && regnum < gdbarch_num_regs (gdbarch))
+    {
+      /* The interesting part of the stack is the one already in
+	 use, on the far side of the stack pointer from where it
+	 grows.  */
+      if (gdbarch_inner_than (gdbarch, 1, 2))
+	p += sprintf (p, "mem:%s,0,%x,%x;",
+		      phex_nz (rsa->regs[regnum].pnum, 0),
+		      stop_reply_stack_bytes, dcache_line_size ());
+      else
+	p += sprintf (p, "mem:%s,%x,0,%x;",
+		      phex_nz (rsa->regs[regnum].pnum, 0),
+		      stop_reply_stack_bytes, dcache_line_size ());
+    }
+
+  regnum = gdbarch_pc_regnum (gdbarch);
+  if (stop_reply_code_bytes > 0
+      && regnum >= 0 && regnum < gdbarch_num_regs (gdbarch))
+    p += sprintf (p, "mem:%s,0,%x,%x;",
+		  phex_nz (rsa->regs[regnum].pnum, 0),
+		  stop_reply_code_bytes, dcache_line_size ());
+
+  /* Drop the trailing separator.  */
+  if (p[-1] == ';')
+    *--p = '\0';
+
+  if (!last_stop_expedite_packet
+      || strcmp (last_stop_expedite_packet, expedite_packet))
+    {
+      struct remote_state *rs = get_remote_state ();
+
+      putpkt (expedite_packet);
+      getpkt (&rs->buf, &rs->buf_size, 0);
+      packet_ok (rs->buf, &remote_protocol_packets[PACKET_QStopExpedite]);
+      xfree (last_stop_expedite_packet);
+      last_stop_expedite_packet = expedite_packet;
+    }
+  else
+    xfree (expedite_packet);
+}
+
 /* If PTID is MAGIC_NULL_PTID, don't set any thread.  If PTID is
    MINUS_ONE_PTID, set the thread to -1, so the stub returns the
    thread.  If GEN is set, set the general thread, if not, then set
@@ -3057,6 +3140,12 @@ static struct protocol_feature remote_protocol_features[] = {
     PACKET_bc },
   { "ReverseStep", PACKET_DISABLE, remote_supported_packet,
     PACKET_bs },
+  { "ConditionalBreakpoints", PACKET_DISABLE, remote_supported_packet,
+    PACKET_ConditionalBreakpoints },
+  { "QStopExpedite", PACKET_DISABLE, remote_supported_packet,
+    PACKET_QStopExpedite },
+  { "PipelinedReads", PACKET_DISABLE, remote_supported_packet,
+    PACKET_PipelinedReads },
 };
 
 static void
@@ -3233,6 +3322,10 @@ remote_open_1 (char *name, int from_tty, struct target_ops *target, int extended
   xfree (last_pass_packet);
   last_pass_packet = NULL;
 
+  /* Likewise for the stop reply contents.  */
+  xfree (last_stop_expedite_packet);
+  last_stop_expedite_packet = NULL;
+
   remote_fileio_reset ();
   reopen_exec_file ();
   reread_symbols ();
@@ -3806,6 +3899,9 @@ remote_resume (struct target_ops *ops,
   /* Update the inferior on signals to silently pass, if they've changed.  */
   remote_pass_signals ();
 
+  /* Likewise for what to send along with the next stop reply.  */
+  remote_stop_expedite ();
+
   /* The vCont packet doesn't need to specify threads via Hc.  */
   /* No reverse support (yet) for vCont.  */
   if (execution_direction != EXEC_REVERSE)
@@ -4137,6 +4233,17 @@ typedef struct cached_reg
 
 DEF_VEC_O(cached_reg_t);
 
+/* A block of target memory sent along with a stop reply.  */
+
+typedef struct cached_mem
+{
+  CORE_ADDR addr;
+  int len;
+  gdb_byte *data;
+} cached_mem_t;
+
+DEF_VEC_O(cached_mem_t);
+
 struct stop_reply
 {
   struct stop_reply *next;
@@ -4147,6 +4254,8 @@ struct stop_reply
 
   VEC(cached_reg_t) *regcache;
 
+  VEC(cached_mem_t) *memory;
+
   int stopped_by_watchpoint_p;
   CORE_ADDR watch_data_address;
 
@@ -4170,7 +4279,13 @@ stop_reply_xfree (struct stop_reply *r)
 {
   if (r != NULL)
     {
+      cached_mem_t *mem;
+      int ix;
+
       VEC_free (cached_reg_t, r->regcache);
+      for (ix = 0; VEC_iterate (cached_mem_t, r->memory, ix, mem); ix++)
+	xfree (mem->data);
+      VEC_free (cached_mem_t, r->memory);
       xfree (r);
     }
 }
@@ -4315,6 +4430,7 @@ remote_parse_stop_reply (char *buf, struct stop_reply *event)
   event->replay_event = 0;
   event->stopped_by_watchpoint_p = 0;
   event->regcache = NULL;
+  event->memory = NULL;
 
   switch (buf[0])
     {
@@ -4377,6 +4493,27 @@ Packet: '%s'\n"),
 		  event->solibs_changed = 1;
 		  p = p_temp;
 		}
+	      else if (strncmp (p, "mem", p1 - p) == 0)
+		{
+		  cached_mem_t cached_mem;
+
+		  p = unpack_varlen_hex (++p1, &addr);
+		  if (*p != ',')
+		    error (_("Malformed packet(c) (missing comma): %s\n\
+Packet: '%s'\n"),
+			   p, buf);
+		  p++;
+
+		  p_temp = strchr (p, ';');
+		  if (p_temp == NULL)
+		    p_temp = p + strlen (p);
+
+		  cached_mem.addr = (CORE_ADDR) addr;
+		  cached_mem.len = (p_temp - p) / 2;
+		  cached_mem.data = xmalloc (cached_mem.len);
+		  p += 2 * hex2bin (p, cached_mem.data, cached_mem.len);
+		  VEC_safe_push (cached_mem_t, event->memory, &cached_mem);
+		}
 	      else if (strncmp (p, "replaylog", p1 - p) == 0)
 		{
 		  /* NO_HISTORY event.
@@ -4623,6 +4760,18 @@ process_stop_reply (struct stop_reply *stop_reply,
 	  VEC_free (cached_reg_t, stop_reply->regcache);
 	}
 
+      /* Expedited memory.  */
+      if (stop_reply->memory)
+	{
+	  cached_mem_t *mem;
+	  int ix;
+
+	  for (ix = 0;
+	       VEC_iterate (cached_mem_t, stop_reply->memory, ix, mem);
+	       ix++)
+	    target_dcache_prime (ptid, mem->addr, mem->data, mem->len);
+	}
+
       remote_stopped_by_watchpoint_p = stop_reply->stopped_by_watchpoint_p;
       remote_watch_data_address = stop_reply->watch_data_address;
 
@@ -5655,6 +5804,127 @@ remote_write_bytes (CORE_ADDR memaddr, const gdb_byte *myaddr, int len)
 				 memaddr, myaddr, len, packet_format[0], 1);
 }
 
+/* Send the request for the TODO bytes of memory at MEMADDR, without
+   waiting for the reply.  */
+
+static void
+remote_send_read_bytes (CORE_ADDR memaddr, int todo)
+{
+  struct remote_state *rs = get_remote_state ();
+  char *p;
+
+  /* construct "m"<memaddr>","<len>" */
+  /* sprintf (rs->buf, "m%lx,%x", (unsigned long) memaddr, todo); */
+  memaddr = remote_address_masked (memaddr);
+  p = rs->buf;
+  *p++ = 'm';
+  p += hexnumstr (p, (ULONGEST) memaddr);
+  *p++ = ',';
+  p += hexnumstr (p, (ULONGEST) todo);
+  *p = '\0';
+
+  putpkt (rs->buf);
+}
+
+/* Decode the reply to a request for TODO bytes of memory into MYADDR.
+   Return the number of bytes it held, or -1 if the stub reported an
+   error.  */
+
+static int
+remote_read_bytes_reply (gdb_byte *myaddr, int todo)
+{
+  struct remote_state *rs = get_remote_state ();
+
+  if (rs->buf[0] == 'E'
+      && isxdigit (rs->buf[1]) && isxdigit (rs->buf[2])
+      && rs->buf[3] == '\0')
+    return -1;
+
+  /* Reply describes memory byte by byte,
+     each byte encoded as two hex characters.  */
+  return hex2bin (rs->buf, myaddr, todo);
+}
+
+/* How many memory read requests remote_read_bytes may have
+   outstanding at once.  */
+
+static int memory_read_pipeline_depth = 8;
+
+/* Read LEN bytes at MEMADDR into MYADDR in pieces of CHUNK bytes,
+   keeping up to MEMORY_READ_PIPELINE_DEPTH requests outstanding rather
+   than waiting for each reply before sending the next request.  This
+   makes large reads limited by the bandwidth of the link instead of
+   its latency.  The stub answers requests in the order they were
+   sent, so each reply belongs to the oldest request still
+   outstanding.
+
+   Only usable in no-ack mode: otherwise putpkt would be waiting for
+   an ack while replies to earlier requests arrive, and would throw
+   them away.
+
+   Returns the number of bytes read, which stops short at the first
+   error or short reply, or 0 for error.  */
+
+static int
+remote_read_bytes_pipelined (CORE_ADDR memaddr, gdb_byte *myaddr, int len,
+			     int chunk)
+{
+  struct remote_state *rs = get_remote_state ();
+  int requested = 0;		/* Bytes asked for so far.  */
+  int received = 0;		/* Bytes from replies handled so far.  */
+  int in_flight = 0;		/* Requests whose reply is pending.  */
+  int failed = 0;		/* Whether a reply was an error.  */
+  int done = 0;			/* Whether to stop asking for more.  */
+
+  while (1)
+    {
+      int todo, i;
+
+      /* Keep the pipeline full.  */
+      while (!done && in_flight < memory_read_pipeline_depth
+	     && requested < len)
+	{
+	  todo = min (len - requested, chunk);
+	  remote_send_read_bytes (memaddr + requested, todo);
+	  requested += todo;
+	  in_flight++;
+	}
+
+      if (in_flight == 0)
+	break;
+
+      getpkt (&rs->buf, &rs->buf_size, 0);
+      in_flight--;
+
+      /* Once a read has failed or come back short, the remaining
+	 replies still have to be drained from the link, but their
+	 contents are not contiguous with what we have.  */
+      if (done)
+	continue;
+
+      todo = min (len - received, chunk);
+      i = remote_read_bytes_reply (myaddr + received, todo);
+      if (i < 0)
+	{
+	  failed = 1;
+	  done = 1;
+	}
+      else
+	{
+	  received += i;
+	  if (i < todo)
+	    done = 1;
+	}
+    }
+
+  /* As in remote_read_bytes, an error reply maps to EIO.  Report it
+     only if nothing could be read; otherwise return the bytes we got,
+     and let the caller come back for the rest.  */
+  if (failed && received == 0)
+    errno = EIO;
+  return received;
+}
+
 /* Read memory data directly from the remote machine.
    This does not use the data cache; the data cache uses this.
    MEMADDR is the address in the remote memory space.
@@ -5684,31 +5954,27 @@ remote_read_bytes (CORE_ADDR memaddr, gdb_byte *myaddr, int len)
   /* The packet buffer will be large enough for the payload;
      get_memory_packet_size ensures this.  */
 
+  if (len > max_buf_size / 2
+      && rs->noack_mode
+      && memory_read_pipeline_depth > 1
+      && (remote_protocol_packets[PACKET_PipelinedReads].support
+	  == PACKET_ENABLE))
+    return remote_read_bytes_pipelined (memaddr, myaddr, len,
+					max_buf_size / 2);
+
   origlen = len;
   while (len > 0)
     {
-      char *p;
       int todo;
       int i;
 
       todo = min (len, max_buf_size / 2);	/* num bytes that will fit */
 
-      /* construct "m"<memaddr>","<len>" */
-      /* sprintf (rs->buf, "m%lx,%x", (unsigned long) memaddr, todo); */
-      memaddr = remote_address_masked (memaddr);
-      p = rs->buf;
-      *p++ = 'm';
-      p += hexnumstr (p, (ULONGEST) memaddr);
-      *p++ = ',';
-      p += hexnumstr (p, (ULONGEST) todo);
-      *p = '\0';
-
-      putpkt (rs->buf);
+      remote_send_read_bytes (memaddr, todo);
       getpkt (&rs->buf, &rs->buf_size, 0);
 
-      if (rs->buf[0] == 'E'
-	  && isxdigit (rs->buf[1]) && isxdigit (rs->buf[2])
-	  && rs->buf[3] == '\0')
+      i = remote_read_bytes_reply (myaddr, todo);
+      if (i < 0)
 	{
 	  /* There is no correspondance between what the remote
 	     protocol uses for errors and errno codes.  We would like
@@ -5719,11 +5985,7 @@ remote_read_bytes (CORE_ADDR memaddr, gdb_byte *myaddr, int len)
 	  return 0;
 	}
 
-      /* Reply describes memory byte by byte,
-         each byte encoded as two hex characters.  */
-
-      p = rs->buf;
-      if ((i = hex2bin (p, myaddr, todo)) < todo)
+      if (i < todo)
 	{
 	  /* Reply is short.  This means that we were able to read
 	     only part of what we wanted to.  */
@@ -6807,6 +7069,44 @@ extended_remote_create_inferior (struct target_ops *ops,
 }
 
 
+/* Conditions travel with Z0 packets, so there are none to send once
+   those are known not to work.  */
+
+static int
+remote_supports_cond_breakpoints (void)
+{
+  return (remote_protocol_packets[PACKET_ConditionalBreakpoints].support
+	  == PACKET_ENABLE
+	  && remote_protocol_packets[PACKET_Z0].support != PACKET_DISABLE);
+}
+
+/* Append the conditions of BP_TGT to the Z0 packet ending at P, as
+   ";X<len>,<bytecode>" each, for the stub to evaluate.  If they don't
+   fit in a packet, the stub gets none and reports every hit.  */
+
+static void
+remote_add_target_conditions (char *p, struct bp_target_info *bp_tgt)
+{
+  char *end = get_remote_state ()->buf + get_remote_packet_size ();
+  char *start = p;
+  struct agent_expr *aexpr;
+  int ix;
+
+  if (!remote_supports_cond_breakpoints ())
+    return;
+
+  for (ix = 0; VEC_iterate (agent_expr_p, bp_tgt->conditions, ix, aexpr); ix++)
+    {
+      if (p + 2 * aexpr->len + 16 > end)
+	{
+	  *start = '\0';
+	  return;
+	}
+      p += sprintf (p, ";X%x,", aexpr->len);
+      p += 2 * bin2hex (aexpr->buf, p, aexpr->len);
+    }
+}
+
 /* Insert a breakpoint.  On targets that have software breakpoint
    support, we ask the remote target to do the work; on targets
    which don't, we insert a traditional memory breakpoint.  */
@@ -6837,7 +7137,8 @@ remote_insert_breakpoint (struct gdbarch *gdbarch,
       *(p++) = ',';
       addr = (ULONGEST) remote_address_masked (addr);
       p += hexnumstr (p, addr);
-      sprintf (p, ",%d", bpsize);
+      p += sprintf (p, ",%d", bpsize);
+      remote_add_target_conditions (p, bp_tgt);
 
       putpkt (rs->buf);
       getpkt (&rs->buf, &rs->buf_size, 0);
@@ -8855,6 +9156,7 @@ Specify the serial device it is connected to\n\
   remote_ops.to_terminal_ours = remote_terminal_ours;
   remote_ops.to_supports_non_stop = remote_supports_non_stop;
   remote_ops.to_supports_multi_process = remote_supports_multi_process;
+  remote_ops.to_supports_cond_breakpoints = remote_supports_cond_breakpoints;
 }
 
 /* Set up the extended remote vector by making a copy of the standard
@@ -9112,6 +9414,15 @@ further restriction and ``limit'' to enable that restriction."),
 	   _("Show the maximum number of bytes per memory-read packet."),
 	   &remote_show_cmdlist);
 
+  add_setshow_zinteger_cmd ("memory-read-pipeline-depth", no_class,
+			    &memory_read_pipeline_depth, _("\
+Set the maximum number of memory-read packets sent ahead of their replies."), _("\
+Show the maximum number of memory-read packets sent ahead of their replies."), _("\
+Only used in no-ack mode, with a target that supports pipelined reads.\n\
+Specify 0 or 1 to wait for each reply before sending the next packet."),
+			    NULL, NULL, /* FIXME: i18n: */
+			    &remote_set_cmdlist, &remote_show_cmdlist);
+
   add_setshow_zinteger_cmd ("hardware-watchpoint-limit", no_class,
 			    &remote_hw_watchpoint_limit, _("\
 Set the maximum number of target hardware watchpoints."), _("\
@@ -9127,6 +9438,32 @@ Specify a negative limit for unlimited."),
 			    NULL, NULL, /* FIXME: i18n: The maximum number of target hardware breakpoints is %s.  */
 			    &remote_set_cmdlist, &remote_show_cmdlist);
 
+  add_setshow_zinteger_cmd ("stop-reply-stack-bytes", no_class,
+			    &stop_reply_stack_bytes, _("\
+Set the number of stack bytes the target sends with each stop reply."), _("\
+Show the number of stack bytes the target sends with each stop reply."), _("\
+Only used if the target supports the QStopExpedite packet.  The bytes\n\
+start at the stack pointer and go towards the part of the stack in use.\n\
+Specify zero to not send any."),
+			    NULL, NULL, /* FIXME: i18n: */
+			    &remote_set_cmdlist, &remote_show_cmdlist);
+  add_setshow_zinteger_cmd ("stop-reply-code-bytes", no_class,
+			    &stop_reply_code_bytes, _("\
+Set the number of code bytes the target sends with each stop reply."), _("\
+Show the number of code bytes the target sends with each stop reply."), _("\
+Only used if the target supports the QStopExpedite packet.  The bytes\n\
+start at the PC, and are only used if the memory region holding them is\n\
+cached (see \"help mem\").  Specify zero to not send any."),
+			    NULL, NULL, /* FIXME: i18n: */
+			    &remote_set_cmdlist, &remote_show_cmdlist);
+  add_setshow_boolean_cmd ("stop-reply-all-registers", no_class,
+			   &stop_reply_all_registers, _("\
+Set whether the target sends all registers with each stop reply."), _("\
+Show whether the target sends all registers with each stop reply."), _("\
+Only used if the target supports the QStopExpedite packet."),
+			   NULL, NULL, /* FIXME: i18n: */
+			   &remote_set_cmdlist, &remote_show_cmdlist);
+
   add_setshow_integer_cmd ("remoteaddresssize", class_obscure,
 			   &remote_address_size, _("\
 Set the maximum size of the address (in bits) in a memory packet."), _("\
@@ -9244,6 +9581,15 @@ Show the maximum size of the address (in bits) in a memory packet."), NULL,
   add_packet_config_cmd (&remote_protocol_packets[PACKET_ConditionalTracepoints],
 			 "ConditionalTracepoints", "conditional-tracepoints", 0);
 
+  add_packet_config_cmd (&remote_protocol_packets[PACKET_ConditionalBreakpoints],
+			 "ConditionalBreakpoints", "conditional-breakpoints", 0);
+
+  add_packet_config_cmd (&remote_protocol_packets[PACKET_QStopExpedite],
+			 "QStopExpedite", "stop-expedite", 0);
+
+  add_packet_config_cmd (&remote_protocol_packets[PACKET_PipelinedReads],
+			 "PipelinedReads", "pipelined-reads", 0);
+
   /* Keep the old ``set remote Z-packet ...'' working.  Each individual
      Z sub-packet has its own set and show commands, but users may
      have sets to this variable in their .gdbinit files (or in their
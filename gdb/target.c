@@ -250,6 +250,17 @@ target_dcache_invalidate (void)
   dcache_invalidate (target_dcache);
 }
 
+/* Prime the target dcache.  This is only worth doing if the stack
+   cache is on, as otherwise nothing reads the cache back.  */
+
+void
+target_dcache_prime (ptid_t ptid, CORE_ADDR memaddr,
+		     const gdb_byte *myaddr, int len)
+{
+  if (stack_cache_enabled_p)
+    dcache_prime (target_dcache, ptid, memaddr, myaddr, len);
+}
+
 /* The user just typed 'target' without the name of a target.  */
 
 static void
@@ -681,6 +692,7 @@ update_current_target (void)
       INHERIT (to_get_ada_task_ptid, t);
       /* Do not inherit to_search_memory.  */
       INHERIT (to_supports_multi_process, t);
+      INHERIT (to_supports_cond_breakpoints, t);
       INHERIT (to_magic, t);
       /* Do not inherit to_memory_map.  */
       /* Do not inherit to_flash_erase.  */
@@ -829,6 +841,9 @@ update_current_target (void)
   de_fault (to_supports_multi_process,
 	    (int (*) (void))
 	    return_zero);
+  de_fault (to_supports_cond_breakpoints,
+	    (int (*) (void))
+	    return_zero);
 #undef de_fault
 
   /* Finally, position the target-stack beneath the squashed
@@ -564,6 +564,10 @@ struct target_ops
        simultaneously?  */
     int (*to_supports_multi_process) (void);
 
+    /* Can this target evaluate breakpoint conditions, passed in
+       bp_target_info, and only report the hits where they hold?  */
+    int (*to_supports_cond_breakpoints) (void);
+
     /* Determine current architecture of thread PTID.
 
        The target is supposed to determine the architecture of the code where
@@ -691,9 +695,19 @@ extern void target_store_registers (struct regcache *regcache, int regs);
 #define	target_supports_multi_process()	\
      (*current_target.to_supports_multi_process) ()
 
+/* Returns true if this target evaluates breakpoint conditions.  */
+
+#define	target_supports_cond_breakpoints()	\
+     (*current_target.to_supports_cond_breakpoints) ()
+
 /* Invalidate all target dcaches.  */
 extern void target_dcache_invalidate (void);
 
+/* Seed the target dcache with LEN bytes of memory at MEMADDR that the
+   target has already sent for thread PTID.  */
+extern void target_dcache_prime (ptid_t ptid, CORE_ADDR memaddr,
+				 const gdb_byte *myaddr, int len);
+
 extern int target_read_string (CORE_ADDR, char **, int, int *);
 
 extern int target_read_memory (CORE_ADDR memaddr, gdb_byte *myaddr, int len);
@@ -268,6 +268,30 @@ enum sim_stop { sim_running, sim_polling, sim_exited, sim_stopped, sim_signalled
 void sim_stop_reason PARAMS ((SIM_DESC sd, enum sim_stop *reason, int *sigrc));
 
 
+/* Simulators of several processors may provide these; GDB shows each
+   processor as a thread.  SIM_PROCESSOR_COUNT returns the number of
+   processors, SIM_SELECT_PROCESSOR makes processor N (counting from 0)
+   the one whose registers are read and written and which is single
+   stepped, and SIM_STOPPED_PROCESSOR returns the processor whose stop
+   sim_stop_reason() reports.  */
+
+int sim_processor_count PARAMS ((SIM_DESC sd));
+void sim_select_processor PARAMS ((SIM_DESC sd, int n));
+int sim_stopped_processor PARAMS ((SIM_DESC sd));
+
+
+/* Simulators may also provide data watchpoints.  TYPE is 0 for writes,
+   1 for reads and 2 for both.  SIM_INSERT_WATCHPOINT and
+   SIM_REMOVE_WATCHPOINT return 0 on success.  SIM_STOPPED_DATA_ADDRESS
+   returns non-zero if the last stop was caused by a watchpoint.  In that
+   case it stores in *ADDR the address accessed.  A watchpoint triggers
+   after the instruction making the access has completed.  */
+
+int sim_insert_watchpoint PARAMS ((SIM_DESC sd, SIM_ADDR addr, int len, int type));
+int sim_remove_watchpoint PARAMS ((SIM_DESC sd, SIM_ADDR addr, int len, int type));
+int sim_stopped_data_address PARAMS ((SIM_DESC sd, SIM_ADDR *addr));
+
+
 /* Passthru for other commands that the simulator might support.
    Simulators should be prepared to deal with any combination of NULL
    or empty CMD. */
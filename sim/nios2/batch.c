@@ -0,0 +1,560 @@
+/**
+ * @file batch.c
+ * @brief Batch runner of test programs for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "bfd.h"
+#include "gdb/callback.h"
+#include "gdb/signals.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * nios2-batch runs many test programs without GDB.  Each test runs in a
+ * worker process of its own, forked from a runner which has never opened
+ * the simulator, so every test starts from a clean simulator and a crash
+ * only fails that test.  Up to -j workers run at a time.  A test passes
+ * when the program exits (NIOS2_SYS__EXIT) with status 0.  The limits on
+ * instructions and host time stop the simulation with sim_stop().
+ *
+ * The limits and the counts are those of core 0.
+ */
+
+#define OUTPUT_MAX  (64 * 1024)   /* console output kept for the report */
+
+enum test_status
+  {
+    TEST_PASS,
+    TEST_FAIL,        /* exited with a nonzero status */
+    TEST_TIMEOUT,
+    TEST_INSN_LIMIT,
+    TEST_ERROR,       /* not loaded, stopped by a signal, or crashed */
+  };
+
+static const char *const status_names[] =
+  {
+    "pass", "fail", "timeout", "insn-limit", "error",
+  };
+
+/* what a worker sends back through its pipe */
+struct test_result
+  {
+    int status;
+    int code;           /* exit status, or signal for TEST_ERROR */
+    unsigned64 insns;
+    unsigned64 cycles;
+    double seconds;
+  };
+
+struct test
+  {
+    const char *prog;
+    struct test_result result;
+    char *output;
+    int done;
+  };
+
+struct worker
+  {
+    pid_t pid;
+    int test;
+    int pipe;           /* read end of the result pipe */
+    FILE *output;       /* console output of the worker */
+  };
+
+static struct test *tests;
+static int test_count;
+
+static int jobs = 1;
+static int shard_index, shard_count = 1;
+static unsigned64 max_insns;
+static unsigned timeout;
+static const char *junit_file;
+static const char *json_file;
+static int quiet;
+static char **sim_argv;
+static int sim_argc;
+
+static double
+now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Worker side
+ */
+static SIM_DESC worker_sd;
+static struct test_result worker_result;
+static int worker_pipe;
+static int worker_stopped;
+static double worker_start;
+
+static void
+worker_report(void)
+{
+  fflush(stdout);
+  fflush(stderr);
+  if (write(worker_pipe, &worker_result, sizeof(worker_result)) < 0)
+    _exit(1);
+}
+
+static void
+worker_timeout(int sig)
+{
+  if (!worker_stopped)
+    {
+      /* the interpreter stops at the end of the current block */
+      worker_stopped = TEST_TIMEOUT;
+      sim_stop(worker_sd);
+      alarm(2);
+      return;
+    }
+
+  /* did not stop: give up on this test */
+  worker_result.status = TEST_TIMEOUT;
+  worker_result.seconds = now() - worker_start;
+  worker_report();
+  _exit(0);
+}
+
+/* cycles never fall behind instructions, so an event that many cycles
+   away cannot come after the limit */
+static void
+worker_insn_limit(void *data, unsigned64 when)
+{
+  if (cpu.insns < max_insns)
+    {
+      nios2_events_schedule(when + (max_insns - cpu.insns), worker_insn_limit, NULL);
+      return;
+    }
+
+  worker_stopped = TEST_INSN_LIMIT;
+  sim_stop(worker_sd);
+}
+
+static void
+worker_run(const char *prog)
+{
+  struct test_result *r = &worker_result;
+  enum sim_stop reason;
+  int sigrc;
+  bfd *abfd;
+
+  worker_start = now();
+  r->status = TEST_ERROR;
+
+  abfd = bfd_openr(prog, 0);
+  if (abfd == NULL || !bfd_check_format(abfd, bfd_object))
+    {
+      fprintf(stderr, "%s: not an object file\n", prog);
+      return;
+    }
+
+  default_callback.init(&default_callback);
+  sim_argv[sim_argc] = NULL;
+  worker_sd = sim_open(SIM_OPEN_STANDALONE, &default_callback, abfd, sim_argv);
+  if (worker_sd == 0)
+    return;
+
+  if (sim_load(worker_sd, (char *) prog, abfd, 0) != SIM_RC_OK)
+    return;
+  sim_create_inferior(worker_sd, abfd, NULL, NULL);
+
+  if (max_insns)
+    nios2_events_schedule(cpu.cycles + max_insns, worker_insn_limit, NULL);
+  if (timeout)
+    {
+      signal(SIGALRM, worker_timeout);
+      alarm(timeout);
+    }
+
+  sim_resume(worker_sd, 0, 0);
+  alarm(0);
+  sim_stop_reason(worker_sd, &reason, &sigrc);
+
+  r->insns = cpu.insns;
+  r->cycles = cpu.cycles;
+  r->code = sigrc;
+  if (reason == sim_exited)
+    r->status = (sigrc == 0) ? TEST_PASS : TEST_FAIL;
+  else if (worker_stopped && sigrc == TARGET_SIGNAL_INT)
+    r->status = worker_stopped;
+
+  sim_close(worker_sd, 0);
+}
+
+/*
+ * Runner side
+ */
+static void
+worker_start_test(struct worker *w, int test)
+{
+  int fds[2];
+
+  w->test = test;
+  w->output = tmpfile();
+  if (w->output == NULL || pipe(fds) < 0)
+    {
+      perror("nios2-batch");
+      exit(2);
+    }
+
+  fflush(stdout);
+  fflush(stderr);
+  w->pid = fork();
+  if (w->pid < 0)
+    {
+      perror("nios2-batch: fork");
+      exit(2);
+    }
+
+  if (w->pid == 0)
+    {
+      close(fds[0]);
+      worker_pipe = fds[1];
+      dup2(fileno(w->output), 1);
+      dup2(fileno(w->output), 2);
+      worker_run(tests[test].prog);
+      worker_result.seconds = now() - worker_start;
+      worker_report();
+      _exit(0);
+    }
+
+  close(fds[1]);
+  w->pipe = fds[0];
+}
+
+static void
+worker_finish(struct worker *w, int wstatus)
+{
+  struct test *t = &tests[w->test];
+  long length;
+
+  if (read(w->pipe, &t->result, sizeof(t->result)) != sizeof(t->result))
+    {
+      /* the worker crashed */
+      memset(&t->result, 0, sizeof(t->result));
+      t->result.status = TEST_ERROR;
+      t->result.code = WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : -1;
+    }
+  close(w->pipe);
+
+  /* the worker wrote through a descriptor sharing the file offset */
+  fseek(w->output, 0, SEEK_END);
+  length = ftell(w->output);
+  if (length > OUTPUT_MAX)
+    length = OUTPUT_MAX;
+  t->output = (char *) malloc(length + 1);
+  rewind(w->output);
+  length = fread(t->output, 1, length, w->output);
+  t->output[length] = 0;
+  fclose(w->output);
+  t->done = 1;
+
+  if (!quiet)
+    printf("%-10s %s (%llu insns, %.3fs)\n", status_names[t->result.status],
+           t->prog, (unsigned long long) t->result.insns, t->result.seconds);
+  w->pid = 0;
+}
+
+static void
+run_tests(void)
+{
+  struct worker *workers;
+  int next = 0, running = 0, i;
+
+  workers = (struct worker *) calloc(jobs, sizeof(*workers));
+  for (;;)
+    {
+      pid_t pid;
+      int wstatus;
+
+      for (i = 0; i < jobs && next < test_count; ++i)
+        if (workers[i].pid == 0)
+          {
+            /* tests of other shards are left out */
+            while (next < test_count && next % shard_count != shard_index)
+              ++next;
+            if (next == test_count)
+              break;
+            worker_start_test(&workers[i], next++);
+            ++running;
+          }
+
+      if (running == 0)
+        break;
+
+      pid = wait(&wstatus);
+      if (pid < 0)
+        break;
+      for (i = 0; i < jobs; ++i)
+        if (workers[i].pid == pid)
+          {
+            worker_finish(&workers[i], wstatus);
+            --running;
+          }
+    }
+
+  free(workers);
+}
+
+/*
+ * Reports
+ */
+static void
+put_escaped(FILE *fp, const char *s, int xml)
+{
+  for (; *s; ++s)
+    {
+      unsigned char c = *s;
+
+      if (xml && c == '<')
+        fputs("&lt;", fp);
+      else if (xml && c == '>')
+        fputs("&gt;", fp);
+      else if (xml && c == '&')
+        fputs("&amp;", fp);
+      else if (xml && c == '"')
+        fputs("&quot;", fp);
+      else if (xml && c < 0x20 && c != '\n' && c != '\t')
+        fputc('?', fp);   /* not allowed in XML 1.0 */
+      else if (!xml && (c == '"' || c == '\\'))
+        fprintf(fp, "\\%c", c);
+      else if (!xml && c == '\n')
+        fputs("\\n", fp);
+      else if (!xml && c < 0x20)
+        fprintf(fp, "\\u%04x", c);
+      else
+        fputc(c, fp);
+    }
+}
+
+static void
+write_junit(const char *path, int counts[], int done, double seconds)
+{
+  FILE *fp = fopen(path, "w");
+  int i;
+
+  if (fp == NULL)
+    {
+      perror(path);
+      return;
+    }
+
+  fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(fp, "<testsuite name=\"nios2-sim\" tests=\"%d\" failures=\"%d\" errors=\"%d\" time=\"%.3f\">\n",
+          done, counts[TEST_FAIL] + counts[TEST_TIMEOUT] + counts[TEST_INSN_LIMIT],
+          counts[TEST_ERROR], seconds);
+
+  for (i = 0; i < test_count; ++i)
+    {
+      struct test *t = &tests[i];
+
+      if (!t->done)
+        continue;
+
+      fprintf(fp, "  <testcase classname=\"nios2-sim\" name=\"");
+      put_escaped(fp, t->prog, 1);
+      fprintf(fp, "\" time=\"%.3f\">\n", t->result.seconds);
+      fprintf(fp, "    <properties><property name=\"instructions\" value=\"%llu\"/>"
+                  "<property name=\"cycles\" value=\"%llu\"/></properties>\n",
+              (unsigned long long) t->result.insns,
+              (unsigned long long) t->result.cycles);
+      if (t->result.status == TEST_ERROR)
+        fprintf(fp, "    <error message=\"error (%d)\"/>\n", t->result.code);
+      else if (t->result.status != TEST_PASS)
+        fprintf(fp, "    <failure message=\"%s (%d)\"/>\n",
+                status_names[t->result.status], t->result.code);
+      if (t->output[0])
+        {
+          fprintf(fp, "    <system-out>");
+          put_escaped(fp, t->output, 1);
+          fprintf(fp, "</system-out>\n");
+        }
+      fprintf(fp, "  </testcase>\n");
+    }
+
+  fprintf(fp, "</testsuite>\n");
+  fclose(fp);
+}
+
+static void
+write_json(const char *path, int counts[], double seconds)
+{
+  FILE *fp = fopen(path, "w");
+  const char *sep = "";
+  int i;
+
+  if (fp == NULL)
+    {
+      perror(path);
+      return;
+    }
+
+  fprintf(fp, "{\n  \"tests\": [");
+  for (i = 0; i < test_count; ++i)
+    {
+      struct test *t = &tests[i];
+
+      if (!t->done)
+        continue;
+
+      fprintf(fp, "%s\n    {\"name\": \"", sep);
+      put_escaped(fp, t->prog, 0);
+      fprintf(fp, "\", \"status\": \"%s\", \"code\": %d, \"instructions\": %llu, "
+                  "\"cycles\": %llu, \"time\": %.3f, \"output\": \"",
+              status_names[t->result.status], t->result.code,
+              (unsigned long long) t->result.insns,
+              (unsigned long long) t->result.cycles, t->result.seconds);
+      put_escaped(fp, t->output, 0);
+      fprintf(fp, "\"}");
+      sep = ",";
+    }
+
+  fprintf(fp, "\n  ],\n  \"summary\": {");
+  for (i = TEST_PASS; i <= TEST_ERROR; ++i)
+    fprintf(fp, "\"%s\": %d, ", status_names[i], counts[i]);
+  fprintf(fp, "\"time\": %.3f}\n}\n", seconds);
+  fclose(fp);
+}
+
+/*
+ * Options
+ */
+static void
+usage(int status)
+{
+  fprintf(status ? stderr : stdout,
+  "Usage: nios2-batch [OPTION]... PROGRAM...\n"
+  "Run each PROGRAM in the simulator and report how it exited.\n\n"
+  "  -j N             run N programs at a time (default 1)\n"
+  "  --shard=I/N      run only the programs whose index modulo N is I\n"
+  "  --list=FILE      read more programs from FILE, one per line\n"
+  "  --max-insns=N    stop a program after N instructions\n"
+  "  --timeout=SEC    stop a program after SEC seconds\n"
+  "  --sim=OPTION     pass OPTION to the simulator (as \"target sim OPTION\")\n"
+  "  --junit=FILE     write a JUnit XML report\n"
+  "  --json=FILE      write a JSON report\n"
+  "  --quiet          no line for each program\n");
+  exit(status);
+}
+
+static void
+add_test(const char *prog)
+{
+  tests = (struct test *) realloc(tests, sizeof(*tests) * (test_count + 1));
+  memset(&tests[test_count], 0, sizeof(*tests));
+  tests[test_count++].prog = prog;
+}
+
+static void
+add_list(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  char buf[1024];
+
+  if (fp == NULL)
+    {
+      perror(path);
+      exit(2);
+    }
+
+  while (fgets(buf, sizeof(buf), fp))
+    {
+      buf[strcspn(buf, "\r\n")] = 0;
+      if (buf[0] && buf[0] != '#')
+        add_test(strdup(buf));
+    }
+  fclose(fp);
+}
+
+int
+main(int argc, char **argv)
+{
+  int counts[TEST_ERROR + 1] = { 0 };
+  double start;
+  int i, done = 0;
+
+  sim_argv = (char **) calloc(argc + 1, sizeof(*sim_argv));
+  sim_argv[sim_argc++] = argv[0];
+
+  for (i = 1; i < argc; ++i)
+    {
+      const char *a = argv[i];
+
+      if (strcmp(a, "-j") == 0 && i + 1 < argc)
+        jobs = atoi(argv[++i]);
+      else if (strncmp(a, "-j", 2) == 0 && a[2])
+        jobs = atoi(a + 2);
+      else if (strncmp(a, "--shard=", 8) == 0)
+        {
+          if (sscanf(a + 8, "%d/%d", &shard_index, &shard_count) != 2 ||
+              shard_count <= 0 || shard_index < 0 || shard_index >= shard_count)
+            usage(2);
+        }
+      else if (strncmp(a, "--list=", 7) == 0)
+        add_list(a + 7);
+      else if (strncmp(a, "--max-insns=", 12) == 0)
+        max_insns = strtoull(a + 12, NULL, 0);
+      else if (strncmp(a, "--timeout=", 10) == 0)
+        timeout = strtoul(a + 10, NULL, 0);
+      else if (strncmp(a, "--sim=", 6) == 0)
+        sim_argv[sim_argc++] = argv[i] + 6;
+      else if (strncmp(a, "--junit=", 8) == 0)
+        junit_file = a + 8;
+      else if (strncmp(a, "--json=", 7) == 0)
+        json_file = a + 7;
+      else if (strcmp(a, "--quiet") == 0)
+        quiet = 1;
+      else if (strcmp(a, "--help") == 0)
+        usage(0);
+      else if (a[0] == '-')
+        usage(2);
+      else
+        add_test(a);
+    }
+
+  if (test_count == 0 || jobs <= 0)
+    usage(2);
+
+  bfd_init();
+  start = now();
+  run_tests();
+
+  for (i = 0; i < test_count; ++i)
+    if (tests[i].done)
+      {
+        ++counts[tests[i].result.status];
+        ++done;
+      }
+
+  printf("%d passed, %d failed, %d timed out, %d over the instruction limit, %d errors\n",
+         counts[TEST_PASS], counts[TEST_FAIL], counts[TEST_TIMEOUT],
+         counts[TEST_INSN_LIMIT], counts[TEST_ERROR]);
+
+  if (junit_file)
+    write_junit(junit_file, counts, done, now() - start);
+  if (json_file)
+    write_json(json_file, counts, now() - start);
+
+  return (counts[TEST_PASS] == done) ? 0 : 1;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
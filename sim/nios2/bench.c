@@ -0,0 +1,813 @@
+/**
+ * @file bench.c
+ * @brief Throughput benchmark of NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "bfd.h"
+#include "gdb/callback.h"
+#include "gdb/signals.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+typedef unsigned32 uint32_t;
+#include "asm_nios2.h"
+
+/*
+ * nios2-bench measures the throughput of the interpreter ("make bench").
+ * The kernels are assembled here with asm_nios2.h, so no cross toolchain
+ * is needed, and written to a small ELF file loaded like any program.
+ * Each run of a kernel is a process of its own forked from the runner;
+ * the best of --repeat runs is reported:
+ *
+ *   MIPS           guest instructions per host microsecond of sim_resume()
+ *   host cyc/insn  host cycles per guest instruction (time stamp counter
+ *                  of x86 hosts, "-" elsewhere)
+ *   max RSS        peak resident memory of the process running the kernel
+ *
+ * The guest instruction counts do not depend on the host.  --baseline
+ * compares a run with the --json report of an earlier one and fails if a
+ * kernel became slower than --tolerance or executed a different number of
+ * instructions.
+ */
+
+#define CODE_MAX    4096        /* words of code */
+#define DATA_ADDR   0x4000      /* initialized data, after the code */
+#define DATA_SIZE   0x1000
+#define BUF_ADDR    0x100000    /* buffers in the heap */
+#define BUF_SIZE    0x4000
+#define TIMER_ADDR  0x10000000
+#define STACK_TOP   0x08000000
+
+/* registers */
+#define ZERO  0
+#define SP    27
+#define RA    31
+
+struct kernel
+  {
+    const char *name;
+    const char *description;
+    void (*build)(unsigned32 iterations);
+    unsigned32 iterations;
+  };
+
+/* what a run sends back through its pipe */
+struct bench_result
+  {
+    int ok;
+    unsigned64 insns;
+    unsigned64 cycles;
+    double seconds;
+    unsigned64 host_cycles;
+  };
+
+struct bench
+  {
+    const struct kernel *kernel;
+    struct bench_result best;
+    long maxrss;          /* KiB */
+    int runs;
+    int failed;
+  };
+
+static uint32_t code[CODE_MAX];
+static int ncode;
+static unsigned char data[DATA_SIZE];
+
+static int repeat = 3;
+static double scale = 1.0;
+static const char *json_file;
+static const char *baseline_file;
+static double tolerance = 10.0;
+static char **sim_argv;
+static int sim_argc;
+
+static double
+now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static unsigned64
+host_cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  unsigned lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((unsigned64) hi << 32) | lo;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * Assembler
+ */
+static void
+put16(unsigned char *p, unsigned32 v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void
+put32(unsigned char *p, unsigned32 v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+/* a function, not a macro: the offset of a branch is computed from
+   ncode before the instruction is stored */
+static void
+emit(uint32_t insn)
+{
+  code[ncode++] = insn;
+}
+
+/* offset of a branch at from to to (both word indexes) */
+#define REL(from, to) (((to) - (from) - 1) * 4)
+
+static void
+emit_li(int reg, unsigned32 value)
+{
+  emit(NIOS2_movhi(reg, (value + 0x8000) >> 16));
+  emit(NIOS2_addi(reg, reg, value & 0xffff));
+}
+
+static void
+emit_exit(void)
+{
+  emit(NIOS2_movi(4, 0));
+  emit(NIOS2_ori(0, 0, NIOS2_SYS_MAGIC));
+  emit(NIOS2_ori(0, 0, NIOS2_SYS__EXIT));
+}
+
+/* a pseudo random sequence which is the same on every host */
+static unsigned32
+lcg(unsigned32 *x)
+{
+  *x = *x * 1103515245u + 12345u;
+  return *x >> 16;
+}
+
+/*
+ * Kernels; r16 counts the iterations down
+ */
+
+/* Dhrystone-like: record copy, procedure call, string compare, mul/div */
+static void
+build_dhrystone(unsigned32 iterations)
+{
+  static const char str[] = "DHRYSTONE PROGRAM, SOME STRING";
+  int loop, cmp, done, proc, fix;
+
+  memcpy(data, str, sizeof(str));
+  memcpy(data + 64, str, sizeof(str));
+
+  emit_li(SP, STACK_TOP - 16);
+  emit_li(16, iterations);
+  emit_li(17, DATA_ADDR);
+  emit(NIOS2_movi(18, 7));
+  fix = ncode;
+  emit(0);                        /* br loop */
+
+  proc = ncode;
+  emit(NIOS2_addi(SP, SP, -8));
+  emit(NIOS2_stw(RA, 4, SP));
+  emit(NIOS2_stw(16, 0, SP));
+  emit(NIOS2_muli(2, 4, 3));
+  emit(NIOS2_addi(2, 2, 7));
+  emit(NIOS2_srai(3, 2, 1));
+  emit(NIOS2_xor(2, 2, 3));
+  emit(NIOS2_ldw(16, 0, SP));
+  emit(NIOS2_ldw(RA, 4, SP));
+  emit(NIOS2_addi(SP, SP, 8));
+  emit(NIOS2_ret());
+
+  loop = ncode;
+  code[fix] = NIOS2_br(REL(fix, loop));
+  for (fix = 0; fix < 8; ++fix)
+    {
+      emit(NIOS2_ldw(2, 128 + fix * 4, 17));
+      emit(NIOS2_stw(2, 160 + fix * 4, 17));
+    }
+  emit(NIOS2_mov(4, 16));
+  emit(NIOS2_call(proc));
+  emit(NIOS2_stw(2, 128, 17));
+
+  emit(NIOS2_mov(5, 17));
+  emit(NIOS2_addi(6, 17, 64));
+  cmp = ncode;
+  emit(NIOS2_ldbu(7, 0, 5));
+  emit(NIOS2_ldbu(8, 0, 6));
+  fix = ncode;
+  emit(0);                        /* bne r7, r8, done */
+  emit(NIOS2_addi(5, 5, 1));
+  emit(NIOS2_addi(6, 6, 1));
+  emit(NIOS2_bne(7, ZERO, REL(ncode, cmp)));
+  done = ncode;
+  code[fix] = NIOS2_bne(7, 8, REL(fix, done));
+
+  emit(NIOS2_mul(9, 16, 16));
+  emit(NIOS2_div(10, 9, 18));
+  emit(NIOS2_sub(11, 9, 10));
+  emit(NIOS2_stw(11, 192, 17));
+  emit(NIOS2_subi(16, 16, 1));
+  emit(NIOS2_bne(16, ZERO, REL(ncode, loop)));
+  emit_exit();
+}
+
+/* word copy unrolled by four, then a byte copy of the first KiB */
+static void
+build_memcpy(unsigned32 iterations)
+{
+  int outer, inner;
+
+  emit_li(16, iterations);
+  outer = ncode;
+  emit_li(4, BUF_ADDR);
+  emit_li(5, BUF_ADDR + BUF_SIZE);
+  emit_li(6, BUF_ADDR + BUF_SIZE);
+  inner = ncode;
+  emit(NIOS2_ldw(7, 0, 4));
+  emit(NIOS2_ldw(8, 4, 4));
+  emit(NIOS2_ldw(9, 8, 4));
+  emit(NIOS2_ldw(10, 12, 4));
+  emit(NIOS2_stw(7, 0, 5));
+  emit(NIOS2_stw(8, 4, 5));
+  emit(NIOS2_stw(9, 8, 5));
+  emit(NIOS2_stw(10, 12, 5));
+  emit(NIOS2_addi(4, 4, 16));
+  emit(NIOS2_addi(5, 5, 16));
+  emit(NIOS2_bltu(4, 6, REL(ncode, inner)));
+
+  emit_li(4, BUF_ADDR);
+  emit_li(6, BUF_ADDR + 1024);
+  inner = ncode;
+  emit(NIOS2_ldbu(7, 0, 4));
+  emit(NIOS2_stb(7, BUF_SIZE, 4));
+  emit(NIOS2_addi(4, 4, 1));
+  emit(NIOS2_bltu(4, 6, REL(ncode, inner)));
+
+  emit(NIOS2_subi(16, 16, 1));
+  emit(NIOS2_bne(16, ZERO, REL(ncode, outer)));
+  emit_exit();
+}
+
+/* state machine driven by a random sequence: a jump table of eight
+   states, each with a data dependent branch */
+static void
+build_branchy(unsigned32 iterations)
+{
+  int loop, join, skip[8], next[8], fix[8], i;
+
+  emit_li(16, iterations);
+  emit_li(20, 1103515245);
+  emit_li(21, 12345);
+  emit_li(22, DATA_ADDR);
+  emit(NIOS2_movi(2, 1));
+  emit(NIOS2_movi(5, 0));
+
+  loop = ncode;
+  emit(NIOS2_mul(2, 2, 20));
+  emit(NIOS2_add(2, 2, 21));
+  emit(NIOS2_srli(3, 2, 29));
+  emit(NIOS2_add(5, 5, 3));
+  emit(NIOS2_andi(5, 5, 7));
+  emit(NIOS2_slli(6, 5, 2));
+  emit(NIOS2_add(6, 6, 22));
+  emit(NIOS2_ldw(6, 0, 6));
+  emit(NIOS2_jmp(6));
+
+  for (i = 0; i < 8; ++i)
+    {
+      put32(data + i * 4, ncode * 4);
+      emit(NIOS2_andi(7, 2, 0x100 << i));
+      skip[i] = ncode;
+      emit(0);                    /* beq r7, zero, next */
+      emit(NIOS2_addi(8 + (i & 3), 8 + (i & 3), i + 1));
+      next[i] = ncode;
+      emit(NIOS2_cmplti(7, 3, i));
+      fix[i] = ncode;
+      emit(0);                    /* br join */
+    }
+
+  join = ncode;
+  for (i = 0; i < 8; ++i)
+    {
+      code[skip[i]] = NIOS2_beq(7, ZERO, REL(skip[i], next[i]));
+      code[fix[i]] = NIOS2_br(REL(fix[i], join));
+    }
+  emit(NIOS2_add(12, 12, 7));
+  emit(NIOS2_subi(16, 16, 1));
+  emit(NIOS2_bne(16, ZERO, REL(ncode, loop)));
+  emit_exit();
+}
+
+/* CoreMark-like bitwise CRC-32 of 256 random bytes */
+static void
+build_crc(unsigned32 iterations)
+{
+  unsigned32 x = 1;
+  int outer, byte, bit, fix, i;
+
+  for (i = 0; i < 256; ++i)
+    data[i] = lcg(&x);
+
+  emit_li(16, iterations);
+  emit_li(9, 0xedb88320);
+  emit(NIOS2_movi(2, -1));
+  outer = ncode;
+  emit_li(4, DATA_ADDR);
+  emit(NIOS2_addi(5, 4, 256));
+  byte = ncode;
+  emit(NIOS2_ldbu(6, 0, 4));
+  emit(NIOS2_xor(2, 2, 6));
+  emit(NIOS2_movi(7, 8));
+  bit = ncode;
+  emit(NIOS2_andi(8, 2, 1));
+  emit(NIOS2_srli(2, 2, 1));
+  fix = ncode;
+  emit(0);                        /* beq r8, zero, skip */
+  emit(NIOS2_xor(2, 2, 9));
+  code[fix] = NIOS2_beq(8, ZERO, REL(fix, ncode));
+  emit(NIOS2_subi(7, 7, 1));
+  emit(NIOS2_bne(7, ZERO, REL(ncode, bit)));
+  emit(NIOS2_addi(4, 4, 1));
+  emit(NIOS2_bne(4, 5, REL(ncode, byte)));
+  emit(NIOS2_subi(16, 16, 1));
+  emit(NIOS2_bne(16, ZERO, REL(ncode, outer)));
+  emit_exit();
+}
+
+/* polling the status of an interval timer which times out every 64
+   cycles, as a driver waiting for a device does */
+static void
+build_mmio(unsigned32 iterations)
+{
+  int poll;
+
+  emit_li(16, iterations);
+  emit_li(20, TIMER_ADDR);
+  emit(NIOS2_movi(2, 63));
+  emit(NIOS2_stwio(2, 8, 20));    /* periodl */
+  emit(NIOS2_stwio(ZERO, 12, 20));  /* periodh */
+  emit(NIOS2_movi(2, 6));
+  emit(NIOS2_stwio(2, 4, 20));    /* control: CONT | START */
+  poll = ncode;
+  emit(NIOS2_ldwio(2, 0, 20));
+  emit(NIOS2_andi(2, 2, 1));
+  emit(NIOS2_beq(2, ZERO, REL(ncode, poll)));
+  emit(NIOS2_stwio(ZERO, 0, 20)); /* clear TO */
+  emit(NIOS2_subi(16, 16, 1));
+  emit(NIOS2_bne(16, ZERO, REL(ncode, poll)));
+  emit_exit();
+}
+
+static const struct kernel kernels[] =
+  {
+    { "dhrystone", "record copy, call, string compare, mul/div",
+      build_dhrystone, 250000 },
+    { "memcpy", "16 KiB word copy and 1 KiB byte copy",
+      build_memcpy, 4000 },
+    { "branchy", "state machine with a jump table and random branches",
+      build_branchy, 2500000 },
+    { "crc", "bitwise CRC-32 of 256 bytes",
+      build_crc, 4000 },
+    { "mmio", "polling the status of an interval timer",
+      build_mmio, 500000 },
+  };
+
+#define KERNEL_COUNT  (sizeof(kernels) / sizeof(*kernels))
+
+/* an ELF file with a single loadable section of the code and the data at
+   address 0 */
+static int
+write_elf(const char *path)
+{
+  static const char shstrtab[] = "\0.text\0.shstrtab";
+  enum
+    {
+      PH_OFF = 52,
+      TEXT_OFF = 0x100,
+      STR_OFF = TEXT_OFF + DATA_ADDR + DATA_SIZE,
+      SH_OFF = (STR_OFF + sizeof(shstrtab) + 3) & ~3,
+      FILE_SIZE = SH_OFF + 3 * 40,
+    };
+  unsigned char *elf, *eh, *ph, *sh;
+  FILE *fp;
+  int i, ok;
+
+  elf = (unsigned char *) calloc(1, FILE_SIZE);
+  if (elf == NULL)
+    return -1;
+
+  eh = elf;
+  memcpy(eh, "\177ELF\001\001\001", 7);   /* ELFCLASS32, ELFDATA2LSB */
+  put16(eh + 16, 2);              /* ET_EXEC */
+  put16(eh + 18, 113);            /* EM_ALTERA_NIOS2 */
+  put32(eh + 20, 1);              /* EV_CURRENT */
+  put32(eh + 28, PH_OFF);
+  put32(eh + 32, SH_OFF);
+  put16(eh + 40, 52);
+  put16(eh + 42, 32);
+  put16(eh + 44, 1);
+  put16(eh + 46, 40);
+  put16(eh + 48, 3);
+  put16(eh + 50, 2);              /* .shstrtab */
+
+  ph = elf + PH_OFF;
+  put32(ph + 0, 1);               /* PT_LOAD */
+  put32(ph + 4, TEXT_OFF);
+  put32(ph + 16, DATA_ADDR + DATA_SIZE);
+  put32(ph + 20, DATA_ADDR + DATA_SIZE);
+  put32(ph + 24, 7);              /* PF_R | PF_W | PF_X */
+  put32(ph + 28, 4);
+
+  for (i = 0; i < ncode; ++i)
+    put32(elf + TEXT_OFF + i * 4, code[i]);
+  memcpy(elf + TEXT_OFF + DATA_ADDR, data, DATA_SIZE);
+  memcpy(elf + STR_OFF, shstrtab, sizeof(shstrtab));
+
+  sh = elf + SH_OFF + 40;         /* .text */
+  put32(sh + 0, 1);
+  put32(sh + 4, 1);               /* SHT_PROGBITS */
+  put32(sh + 8, 7);               /* SHF_WRITE | SHF_ALLOC | SHF_EXECINSTR */
+  put32(sh + 16, TEXT_OFF);
+  put32(sh + 20, DATA_ADDR + DATA_SIZE);
+  put32(sh + 32, 4);
+  sh += 40;                       /* .shstrtab */
+  put32(sh + 0, 7);
+  put32(sh + 4, 3);               /* SHT_STRTAB */
+  put32(sh + 16, STR_OFF);
+  put32(sh + 20, sizeof(shstrtab));
+  put32(sh + 32, 1);
+
+  fp = fopen(path, "wb");
+  ok = fp && fwrite(elf, 1, FILE_SIZE, fp) == FILE_SIZE;
+  if (fp && fclose(fp) != 0)
+    ok = 0;
+  free(elf);
+  return ok ? 0 : -1;
+}
+
+/*
+ * Runs
+ */
+static void
+run_kernel(const char *prog, struct bench_result *r)
+{
+  enum sim_stop reason;
+  SIM_DESC sd;
+  unsigned64 c0;
+  double t0;
+  int sigrc;
+  bfd *abfd;
+
+  abfd = bfd_openr(prog, 0);
+  if (abfd == NULL || !bfd_check_format(abfd, bfd_object))
+    return;
+
+  default_callback.init(&default_callback);
+  sim_argv[sim_argc] = NULL;
+  sd = sim_open(SIM_OPEN_STANDALONE, &default_callback, abfd, sim_argv);
+  if (sd == 0)
+    return;
+  /* the device after the image, not to move the heap past it */
+  if (sim_load(sd, (char *) prog, abfd, 0) != SIM_RC_OK ||
+      avm_add_device("timer", "bench_timer", TIMER_ADDR, -1) == NULL)
+    return;
+  sim_create_inferior(sd, abfd, NULL, NULL);
+
+  t0 = now();
+  c0 = host_cycles();
+  sim_resume(sd, 0, 0);
+  r->host_cycles = host_cycles() - c0;
+  r->seconds = now() - t0;
+  sim_stop_reason(sd, &reason, &sigrc);
+
+  r->insns = cpu.insns;
+  r->cycles = cpu.cycles;
+  r->ok = (reason == sim_exited && sigrc == 0);
+  sim_close(sd, 0);
+}
+
+/* one run in a process of its own; returns 0 on success */
+static int
+run_once(const char *prog, struct bench_result *r, long *maxrss)
+{
+  struct rusage ru;
+  int fds[2], wstatus;
+  pid_t pid;
+
+  memset(r, 0, sizeof(*r));
+  if (pipe(fds) < 0)
+    return -1;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid < 0)
+    return -1;
+
+  if (pid == 0)
+    {
+      /* the simulator talks about the memory it adds */
+      if (freopen("/dev/null", "w", stdout) == NULL)
+        _exit(1);
+      close(fds[0]);
+      run_kernel(prog, r);
+      if (write(fds[1], r, sizeof(*r)) < 0)
+        _exit(1);
+      _exit(0);
+    }
+
+  close(fds[1]);
+  if (read(fds[0], r, sizeof(*r)) != sizeof(*r))
+    r->ok = 0;
+  close(fds[0]);
+  if (wait4(pid, &wstatus, 0, &ru) < 0)
+    return -1;
+  *maxrss = ru.ru_maxrss;
+  return r->ok ? 0 : -1;
+}
+
+static void
+run_bench(struct bench *b, const char *prog)
+{
+  int i;
+
+  for (i = 0; i < repeat; ++i)
+    {
+      struct bench_result r;
+      long maxrss = 0;
+
+      if (run_once(prog, &r, &maxrss) < 0)
+        {
+          b->failed = 1;
+          return;
+        }
+      if (b->runs > 0 && r.insns != b->best.insns)
+        fprintf(stderr, "nios2-bench: %s: instruction count differs between runs\n",
+                b->kernel->name);
+      if (b->runs == 0 || r.seconds < b->best.seconds)
+        b->best = r;
+      if (maxrss > b->maxrss)
+        b->maxrss = maxrss;
+      ++b->runs;
+    }
+}
+
+static double
+mips(const struct bench *b)
+{
+  return b->best.seconds > 0 ? b->best.insns / b->best.seconds / 1e6 : 0;
+}
+
+/*
+ * Reports
+ */
+static void
+print_bench(const struct bench *b)
+{
+  if (b->failed)
+    {
+      printf("%-10s failed\n", b->kernel->name);
+      return;
+    }
+
+  printf("%-10s %12llu %12llu %8.3f %8.1f ", b->kernel->name,
+         (unsigned long long) b->best.insns, (unsigned long long) b->best.cycles,
+         b->best.seconds, mips(b));
+  if (b->best.host_cycles)
+    printf("%10.1f", (double) b->best.host_cycles / b->best.insns);
+  else
+    printf("%10s", "-");
+  printf(" %8ld\n", b->maxrss);
+}
+
+static void
+write_json(const char *path, const struct bench *benches, int count, double geomean)
+{
+  FILE *fp = fopen(path, "w");
+  const char *sep = "";
+  int i;
+
+  if (fp == NULL)
+    {
+      perror(path);
+      return;
+    }
+
+  /* one kernel per line, as read back by --baseline */
+  fprintf(fp, "{\n  \"kernels\": [");
+  for (i = 0; i < count; ++i)
+    {
+      const struct bench *b = &benches[i];
+
+      if (b->failed)
+        continue;
+      fprintf(fp, "%s\n    {\"name\": \"%s\", \"instructions\": %llu, \"cycles\": %llu, "
+                  "\"time\": %.6f, \"mips\": %.3f, \"host_cycles_per_insn\": %.3f, "
+                  "\"max_rss_kib\": %ld}",
+              sep, b->kernel->name, (unsigned long long) b->best.insns,
+              (unsigned long long) b->best.cycles, b->best.seconds, mips(b),
+              b->best.host_cycles ? (double) b->best.host_cycles / b->best.insns : 0.0,
+              b->maxrss);
+      sep = ",";
+    }
+  fprintf(fp, "\n  ],\n  \"geomean_mips\": %.3f\n}\n", geomean);
+  fclose(fp);
+}
+
+/* returns the number of kernels which regressed against the baseline */
+static int
+compare_baseline(const char *path, const struct bench *benches, int count)
+{
+  FILE *fp = fopen(path, "r");
+  char buf[512];
+  int regressions = 0;
+
+  if (fp == NULL)
+    {
+      perror(path);
+      return 1;
+    }
+
+  while (fgets(buf, sizeof(buf), fp))
+    {
+      unsigned long long insns;
+      char name[64];
+      double old;
+      int i;
+
+      if (sscanf(buf, " {\"name\": \"%63[^\"]\", \"instructions\": %llu, \"cycles\": %*u, "
+                      "\"time\": %*f, \"mips\": %lf", name, &insns, &old) != 3)
+        continue;
+
+      for (i = 0; i < count; ++i)
+        {
+          const struct bench *b = &benches[i];
+
+          if (strcmp(b->kernel->name, name) != 0 || b->failed)
+            continue;
+          if (b->best.insns != insns)
+            {
+              printf("%-10s executed %llu instructions instead of %llu\n",
+                     name, (unsigned long long) b->best.insns, insns);
+              ++regressions;
+            }
+          else if (mips(b) < old * (1 - tolerance / 100))
+            {
+              printf("%-10s %.1f MIPS, %.1f%% slower than %.1f\n",
+                     name, mips(b), (1 - mips(b) / old) * 100, old);
+              ++regressions;
+            }
+        }
+    }
+
+  fclose(fp);
+  return regressions;
+}
+
+/*
+ * Options
+ */
+static void
+usage(int status)
+{
+  unsigned i;
+
+  fprintf(status ? stderr : stdout,
+  "Usage: nios2-bench [OPTION]... [KERNEL]...\n"
+  "Measure the throughput of the simulator on each KERNEL (default all).\n\n"
+  "  --repeat=N       run each kernel N times and report the best (default 3)\n"
+  "  --scale=F        run F times as many iterations\n"
+  "  --sim=OPTION     pass OPTION to the simulator (as \"target sim OPTION\")\n"
+  "  --json=FILE      write a JSON report\n"
+  "  --baseline=FILE  fail if slower than the JSON report FILE\n"
+  "  --tolerance=PCT  slowdown allowed by --baseline (default 10)\n\n"
+  "Kernels:\n");
+  for (i = 0; i < KERNEL_COUNT; ++i)
+    fprintf(status ? stderr : stdout, "  %-16s %s\n",
+            kernels[i].name, kernels[i].description);
+  exit(status);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct bench benches[KERNEL_COUNT];
+  char prog[] = "/tmp/nios2-benchXXXXXX";
+  double logsum = 0;
+  int count = 0, measured = 0, failed = 0, i, fd;
+  unsigned k;
+
+  sim_argv = (char **) calloc(argc + 1, sizeof(*sim_argv));
+  sim_argv[sim_argc++] = argv[0];
+  memset(benches, 0, sizeof(benches));
+
+  for (i = 1; i < argc; ++i)
+    {
+      const char *a = argv[i];
+
+      if (strncmp(a, "--repeat=", 9) == 0)
+        repeat = atoi(a + 9);
+      else if (strncmp(a, "--scale=", 8) == 0)
+        scale = atof(a + 8);
+      else if (strncmp(a, "--sim=", 6) == 0)
+        sim_argv[sim_argc++] = argv[i] + 6;
+      else if (strncmp(a, "--json=", 7) == 0)
+        json_file = a + 7;
+      else if (strncmp(a, "--baseline=", 11) == 0)
+        baseline_file = a + 11;
+      else if (strncmp(a, "--tolerance=", 12) == 0)
+        tolerance = atof(a + 12);
+      else if (strcmp(a, "--help") == 0)
+        usage(0);
+      else if (a[0] == '-')
+        usage(2);
+      else
+        {
+          for (k = 0; k < KERNEL_COUNT; ++k)
+            if (strcmp(kernels[k].name, a) == 0)
+              break;
+          if (k == KERNEL_COUNT)
+            usage(2);
+          benches[count++].kernel = &kernels[k];
+        }
+    }
+
+  if (repeat <= 0 || scale <= 0)
+    usage(2);
+  if (count == 0)
+    for (k = 0; k < KERNEL_COUNT; ++k)
+      benches[count++].kernel = &kernels[k];
+
+  fd = mkstemp(prog);
+  if (fd < 0)
+    {
+      perror("nios2-bench");
+      return 2;
+    }
+  close(fd);
+
+  bfd_init();
+  printf("%-10s %12s %12s %8s %8s %10s %8s\n", "kernel", "guest insns",
+         "guest cycles", "seconds", "MIPS", "host cyc/i", "RSS KiB");
+  for (i = 0; i < count; ++i)
+    {
+      struct bench *b = &benches[i];
+      unsigned32 iterations = b->kernel->iterations * scale;
+
+      ncode = 0;
+      memset(data, 0, sizeof(data));
+      b->kernel->build(iterations ? iterations : 1);
+      if (write_elf(prog) != 0)
+        {
+          perror(prog);
+          break;
+        }
+
+      run_bench(b, prog);
+      print_bench(b);
+      if (b->failed)
+        ++failed;
+      else
+        {
+          logsum += log(mips(b));
+          ++measured;
+        }
+    }
+  unlink(prog);
+
+  if (measured)
+    printf("geometric mean: %.1f MIPS\n", exp(logsum / measured));
+  if (json_file)
+    write_json(json_file, benches, count, measured ? exp(logsum / measured) : 0);
+  if (baseline_file)
+    failed += compare_baseline(baseline_file, benches, count);
+
+  return failed ? 1 : 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
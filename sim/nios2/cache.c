@@ -0,0 +1,351 @@
+/**
+ * @file cache.c
+ * @brief Instruction and data cache models for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * The caches only model timing: memory is always coherent, and a cache
+ * keeps the tags, valid and dirty bits needed to count hits, misses and
+ * write-backs.  Each miss costs the memory latency plus one cycle per
+ * word of the line, each dirty line written back one cycle per word.
+ * The data cache is write-back with write allocation, as on Nios II/f.
+ *
+ * Accesses with the 0x80000000 bit or through ld*io/st*io bypass the data
+ * cache.  The instruction cache is looked up once per line a translated
+ * block runs through, at the end of the block.
+ *
+ * Each core has caches of its own; "sim cache" sets up those of the core
+ * selected with "sim smp core".
+ */
+
+#define CACHE_VALID     1u
+#define CACHE_DIRTY     2u
+
+typedef struct
+  {
+    const char *name;
+    unsigned32 size;          /* 0: disabled */
+    unsigned32 line;
+    unsigned32 ways;
+    unsigned32 sets;
+    unsigned32 *tags;         /* [set][way] line address | flags, MRU first */
+    unsigned64 accesses;
+    unsigned64 misses;
+    unsigned64 writebacks;
+    unsigned64 bypasses;
+    unsigned64 *region_misses;
+    int regions;
+  }
+cache_t;
+
+static NIOS2_PER_CORE cache_t icache = { "icache" };
+static NIOS2_PER_CORE cache_t dcache = { "dcache" };
+static unsigned32 mem_latency = 10;
+
+NIOS2_PER_CORE int nios2_icache_enabled;
+NIOS2_PER_CORE int nios2_dcache_enabled;
+
+static void
+cache_invalidate_all(cache_t *c)
+{
+  if (c->tags)
+    memset(c->tags, 0, c->sets * c->ways * sizeof(*c->tags));
+}
+
+static void
+cache_clear_stats(cache_t *c)
+{
+  c->accesses = 0;
+  c->misses = 0;
+  c->writebacks = 0;
+  c->bypasses = 0;
+  if (c->region_misses)
+    memset(c->region_misses, 0, c->regions * sizeof(*c->region_misses));
+}
+
+static int
+cache_configure(cache_t *c, unsigned32 size, unsigned32 line, unsigned32 ways)
+{
+  if (size == 0)
+    {
+      free(c->tags);
+      c->tags = NULL;
+      c->size = 0;
+      return 0;
+    }
+
+  if (line < 4 || (line & (line - 1)) || ways == 0 ||
+      size % (line * ways) || ((size / line / ways) & (size / line / ways - 1)))
+    {
+      sim_printf("invalid %s geometry: size %u, line %u, %u way(s)\n",
+        c->name, size, line, ways);
+      return 1;
+    }
+
+  free(c->tags);
+  c->size = size;
+  c->line = line;
+  c->ways = ways;
+  c->sets = size / line / ways;
+  c->tags = (unsigned32 *) calloc(c->sets * c->ways, sizeof(*c->tags));
+  cache_clear_stats(c);
+  return 0;
+}
+
+static void
+cache_count_miss(cache_t *c, SIM_ADDR mem)
+{
+  int region = avm_section_index(mem);
+
+  ++c->misses;
+  if (region < 0)
+    return;
+
+  if (region >= c->regions)
+    {
+      c->region_misses = (unsigned64 *) realloc(c->region_misses,
+        (region + 1) * sizeof(*c->region_misses));
+      memset(c->region_misses + c->regions, 0,
+        (region + 1 - c->regions) * sizeof(*c->region_misses));
+      c->regions = region + 1;
+    }
+
+  ++c->region_misses[region];
+}
+
+static unsigned32 *
+cache_set(cache_t *c, SIM_ADDR mem)
+{
+  return c->tags + ((mem / c->line) & (c->sets - 1)) * c->ways;
+}
+
+/* look up one line; returns the penalty in cycles */
+static unsigned32
+cache_access(cache_t *c, SIM_ADDR mem, int write)
+{
+  unsigned32 tag = mem & ~(c->line - 1);
+  unsigned32 *set = cache_set(c, mem);
+  unsigned32 way, entry, cycles = 0;
+
+  ++c->accesses;
+  for (way = 0; way < c->ways; ++way)
+    if ((set[way] & ~(c->line - 1)) == tag && (set[way] & CACHE_VALID))
+      break;
+
+  if (way < c->ways)
+    entry = set[way];
+  else
+    {
+      /* miss: refill the least recently used way */
+      way = c->ways - 1;
+      if ((set[way] & (CACHE_VALID | CACHE_DIRTY)) == (CACHE_VALID | CACHE_DIRTY))
+        {
+          ++c->writebacks;
+          cycles += c->line / 4;
+        }
+      cache_count_miss(c, mem);
+      cycles += mem_latency + c->line / 4;
+      entry = tag | CACHE_VALID;
+    }
+
+  if (write)
+    entry |= CACHE_DIRTY;
+
+  /* move to the most recently used position */
+  memmove(set + 1, set, way * sizeof(*set));
+  set[0] = entry;
+  return cycles;
+}
+
+unsigned32
+nios2_dcache_access(SIM_ADDR mem, int write, int flags)
+{
+  if ((flags & AVM_NOCACHE) || (mem & 0x80000000u))
+    {
+      ++dcache.bypasses;
+      return mem_latency;
+    }
+
+  return cache_access(&dcache, mem, write);
+}
+
+unsigned32
+nios2_icache_fetch(SIM_ADDR mem, unsigned32 length)
+{
+  unsigned32 cycles = 0;
+  SIM_ADDR end = mem + length;
+
+  if (mem & 0x80000000u)
+    return 0;   /* the instruction master has no bypass */
+
+  for (mem &= ~(icache.line - 1); mem < end; mem += icache.line)
+    cycles += cache_access(&icache, mem, 0);
+
+  return cycles;
+}
+
+/* the data cache management instructions; Nios II caches are direct
+   mapped, so the ops working by index act on the whole set here */
+void
+nios2_dcache_op(int op, SIM_ADDR mem)
+{
+  unsigned32 *set, way;
+
+  if (!nios2_dcache_enabled)
+    return;
+
+  mem &= ~0x80000000u;
+  set = cache_set(&dcache, mem);
+  for (way = 0; way < dcache.ways; ++way)
+    {
+      unsigned32 entry = set[way];
+
+      if ((op == NIOS2_DCACHE_FLUSHDA || op == NIOS2_DCACHE_INITDA) &&
+          !((entry & CACHE_VALID) &&
+            (entry & ~(dcache.line - 1)) == (mem & ~(dcache.line - 1))))
+        continue;   /* by address: only the line holding mem */
+
+      if ((op == NIOS2_DCACHE_FLUSHD || op == NIOS2_DCACHE_FLUSHDA) &&
+          (entry & (CACHE_VALID | CACHE_DIRTY)) == (CACHE_VALID | CACHE_DIRTY))
+        ++dcache.writebacks;
+
+      set[way] = 0;
+    }
+}
+
+/* flushi and initi: invalidate the line selected by the index */
+void
+nios2_icache_op(SIM_ADDR mem)
+{
+  unsigned32 *set, way;
+
+  if (!nios2_icache_enabled)
+    return;
+
+  set = cache_set(&icache, mem & ~0x80000000u);
+  for (way = 0; way < icache.ways; ++way)
+    set[way] = 0;
+}
+
+void
+nios2_cache_reset(void)
+{
+  cache_invalidate_all(&icache);
+  cache_invalidate_all(&dcache);
+  cache_clear_stats(&icache);
+  cache_clear_stats(&dcache);
+}
+
+static void
+cache_info(cache_t *c)
+{
+  if (c->size == 0)
+    {
+      sim_printf("%s: disabled\n", c->name);
+      return;
+    }
+
+  sim_printf("%s: %u bytes, %u-byte lines, %u way(s)\n", c->name, c->size, c->line, c->ways);
+  sim_printf("  accesses %llu, misses %llu (%.2f%%)",
+    (unsigned long long) c->accesses, (unsigned long long) c->misses,
+    c->accesses ? c->misses * 100.0 / c->accesses : 0.0);
+  if (c == &dcache)
+    sim_printf(", write-backs %llu, bypassed %llu",
+      (unsigned long long) c->writebacks, (unsigned long long) c->bypasses);
+  sim_printf("\n");
+}
+
+void
+nios2_cache_info(void)
+{
+  const char *name;
+  SIM_ADDR base, end;
+  unsigned64 loads, stores;
+  int i;
+
+  if (!nios2_icache_enabled && !nios2_dcache_enabled)
+    return;
+
+  cache_info(&icache);
+  cache_info(&dcache);
+
+  sim_printf("  misses by region:\n     icache      dcache  range                  name\n");
+  for (i = 0; avm_section_stats(i, &name, &base, &end, &loads, &stores); ++i)
+    {
+      unsigned64 im = (i < icache.regions) ? icache.region_misses[i] : 0;
+      unsigned64 dm = (i < dcache.regions) ? dcache.region_misses[i] : 0;
+
+      if (im || dm)
+        sim_printf("%11llu %11llu  0x%08x-0x%08x  %s\n",
+          (unsigned long long) im, (unsigned long long) dm, base, end - 1, name);
+    }
+}
+
+int
+cache_command(int argc, char *argv[])
+{
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of cache commands:\n\n"
+      "icache -- Configure the instruction cache (icache SIZE [LINE [WAYS]], 0 to disable)\n"
+      "dcache -- Configure the data cache (dcache SIZE [LINE [WAYS]], 0 to disable)\n"
+      "latency -- Set the memory latency of a line fill in cycles\n"
+      "info -- Show cache statistics\n"
+      );
+      return 0;
+    }
+
+  if (strcmp(argv[1], "icache") == 0 || strcmp(argv[1], "dcache") == 0)
+    {
+      cache_t *c = (argv[1][0] == 'i') ? &icache : &dcache;
+
+      if (argc >= 3 && argc <= 5)
+        {
+          unsigned32 size = strtoul(argv[2], NULL, 0);
+          unsigned32 line = (argc > 3) ? strtoul(argv[3], NULL, 0) : 32;
+          unsigned32 ways = (argc > 4) ? strtoul(argv[4], NULL, 0) : 1;
+
+          cache_configure(c, size, line, ways);
+          nios2_icache_enabled = (icache.size != 0);
+          nios2_dcache_enabled = (dcache.size != 0);
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "latency") == 0)
+    {
+      if (argc == 3)
+        {
+          mem_latency = strtoul(argv[2], NULL, 0);
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "info") == 0)
+    {
+      if (argc == 2)
+        {
+          cache_info(&icache);
+          cache_info(&dcache);
+          return 0;
+        }
+    }
+  else
+    return 1;
+
+  sim_printf("wrong number of options for cache %s\n", argv[1]);
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -0,0 +1,226 @@
+/**
+ * @file custom.c
+ * @brief Custom instruction plug-ins for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * The custom instructions claimed by the plug-ins are kept in a table
+ * indexed by N, which the interpreter looks up directly: a custom
+ * instruction costs one indirect call.  See nios2-custom.h for the
+ * interface of the plug-ins.
+ */
+#define CUSTOM_PLUGINS_MAX  16
+
+nios2_custom_slot_t nios2_custom_table[256];
+
+static struct
+  {
+    void *handle;
+    char *path;
+  }
+plugins[CUSTOM_PLUGINS_MAX];
+static int plugin_count;
+
+static int
+custom_register(nios2_custom_host_t *host, unsigned int n,
+                nios2_custom_handler_t *handler, void *priv,
+                unsigned int latency)
+{
+  nios2_custom_slot_t *s;
+
+  if (n > 255 || handler == NULL)
+    return -1;
+
+  s = &nios2_custom_table[n];
+  if (s->handler)
+    {
+      sim_printf("custom instruction %u is already taken by %s\n",
+        n, plugins[s->plugin].path);
+      return -1;
+    }
+
+  s->handler = handler;
+  s->priv = priv;
+  s->latency = latency ? latency : 1;
+  s->plugin = plugin_count;
+  return 0;
+}
+
+static nios2_custom_host_t custom_host =
+  {
+    NIOS2_CUSTOM_ABI_VERSION,
+    custom_register,
+    sim_printf,
+  };
+
+/* cycles of custom instruction n for the timing model (1 if unclaimed) */
+unsigned32
+nios2_custom_latency(unsigned32 n)
+{
+  return nios2_custom_table[n & 0xff].handler ? nios2_custom_table[n & 0xff].latency : 1;
+}
+
+static void
+custom_drop(int plugin)
+{
+  int n;
+
+  for (n = 0; n < 256; ++n)
+    if (nios2_custom_table[n].handler && nios2_custom_table[n].plugin == plugin)
+      memset(&nios2_custom_table[n], 0, sizeof(nios2_custom_table[n]));
+}
+
+static int
+custom_load(const char *path, const char *args)
+{
+#ifdef HAVE_DLFCN_H
+  void *handle;
+  nios2_custom_init_t *init;
+
+  if (plugin_count == CUSTOM_PLUGINS_MAX)
+    {
+      sim_printf("too many custom instruction plug-ins\n");
+      return 1;
+    }
+
+  handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL)
+    {
+      sim_printf("%s\n", dlerror());
+      return 1;
+    }
+
+  init = (nios2_custom_init_t *) dlsym(handle, "nios2_custom_init");
+  if (init == NULL)
+    {
+      sim_printf("%s: no nios2_custom_init()\n", path);
+      dlclose(handle);
+      return 1;
+    }
+
+  if (init(&custom_host, args ? args : "") != 0)
+    {
+      sim_printf("%s: initialization failed\n", path);
+      custom_drop(plugin_count);
+      dlclose(handle);
+      return 1;
+    }
+
+  plugins[plugin_count].handle = handle;
+  plugins[plugin_count].path = strdup(path);
+  ++plugin_count;
+
+  /* block costs are computed at translation */
+  nios2_decode_flush();
+  return 0;
+#else
+  sim_printf("plug-ins are not supported on this host\n");
+  return 1;
+#endif
+}
+
+void
+nios2_custom_clear(void)
+{
+  int i;
+
+  memset(nios2_custom_table, 0, sizeof(nios2_custom_table));
+  for (i = 0; i < plugin_count; ++i)
+    {
+#ifdef HAVE_DLFCN_H
+      dlclose(plugins[i].handle);
+#endif
+      free(plugins[i].path);
+    }
+
+  plugin_count = 0;
+  nios2_decode_flush();
+}
+
+static void
+custom_list(void)
+{
+  int i, n;
+
+  for (i = 0; i < plugin_count; ++i)
+    {
+      sim_printf("%s:", plugins[i].path);
+      for (n = 0; n < 256; ++n)
+        if (nios2_custom_table[n].handler && nios2_custom_table[n].plugin == i)
+          sim_printf(" %d(%u)", n, nios2_custom_table[n].latency);
+      sim_printf("\n");
+    }
+}
+
+int
+custom_command(int argc, char *argv[])
+{
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of custom instruction commands:\n\n"
+      "load -- Load a plug-in (load FILE [ARGS])\n"
+      "list -- Show the plug-ins and their instructions N(cycles)\n"
+      "clear -- Unload all plug-ins\n"
+      );
+      return 0;
+    }
+
+  if (strcmp(argv[1], "load") == 0)
+    {
+      if (argc >= 3)
+        {
+          /* the rest of the line goes to the plug-in */
+          char args[256];
+          int i;
+
+          args[0] = 0;
+          for (i = 3; i < argc; ++i)
+            {
+              if (i > 3)
+                strncat(args, " ", sizeof(args) - strlen(args) - 1);
+              strncat(args, argv[i], sizeof(args) - strlen(args) - 1);
+            }
+          custom_load(argv[2], args);
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "list") == 0)
+    {
+      if (argc == 2)
+        {
+          custom_list();
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "clear") == 0)
+    {
+      if (argc == 2)
+        {
+          nios2_custom_clear();
+          return 0;
+        }
+    }
+  else
+    return 1;
+
+  sim_printf("wrong number of options for custom %s\n", argv[1]);
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
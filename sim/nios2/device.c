@@ -0,0 +1,705 @@
+/**
+ * @file device.c
+ * @brief Avalon-MM slave peripherals for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * Device framework
+ *
+ * A device occupies an I/O section of the Avalon address space (see
+ * avm_add_io()).  Its pages are never mapped to host memory, so every
+ * access reaches avm_access() and is dispatched here, while RAM keeps
+ * its fast path.  Register files are made of 32-bit words; narrower
+ * accesses are handed to the model with a byte-lane mask.
+ */
+
+static avm_device_t *devices;
+
+/*
+ * Interrupt controller
+ *
+ * The internal interrupt controller of Nios II: irq lines are level
+ * sensitive and ipending shows the asserted lines masked by ienable.
+ */
+void
+nios2_update_ipending(void)
+{
+  cpu.regs.ipending = cpu.irq_lines & cpu.regs.ienable;
+  if (cpu.regs.ipending)
+    nios2_check_interrupt();
+}
+
+void
+nios2_set_irq(int irq, int level)
+{
+  if (irq < 0 || irq > 31)
+    return;
+
+  if (level)
+    cpu.irq_lines |= (1u << irq);
+  else
+    cpu.irq_lines &= ~(1u << irq);
+
+  nios2_update_ipending();
+}
+
+static void
+device_irq(avm_device_t *dev, int level)
+{
+  nios2_smp_set_irq(dev->core, dev->irq, level);
+}
+
+int
+avm_device_access(avm_device_t *dev, unsigned32 offset, unsigned char *buf, int length, int write)
+{
+  int done = 0;
+
+  while (done < length)
+    {
+      unsigned32 reg = (offset + done) / 4;
+      int lane = (offset + done) & 3;
+      int len = 4 - lane;
+      unsigned32 value = 0, mask = 0;
+      int j;
+
+      if (len > length - done)
+        len = length - done;
+
+      for (j = 0; j < len; ++j)
+        {
+          value |= (unsigned32) buf[done + j] << ((lane + j) * 8);
+          mask |= 0xffu << ((lane + j) * 8);
+        }
+
+      if (write)
+        dev->cls->write(dev, reg, value, mask);
+      else
+        {
+          value = dev->cls->read(dev, reg);
+          for (j = 0; j < len; ++j)
+            buf[done + j] = value >> ((lane + j) * 8);
+        }
+
+      done += len;
+    }
+
+  return done;
+}
+
+/*
+ * JTAG UART (altera_avalon_jtag_uart)
+ *
+ * The write FIFO drains to the GDB console at once, so WSPACE is always
+ * full.  Characters given by "device input" are queued in the read FIFO.
+ */
+#define JTAG_UART_FIFO_SIZE     64
+#define JTAG_UART_DATA_RVALID   (1u<<15)
+#define JTAG_UART_CONTROL_RE    (1u<<0)
+#define JTAG_UART_CONTROL_WE    (1u<<1)
+#define JTAG_UART_CONTROL_RI    (1u<<8)
+#define JTAG_UART_CONTROL_WI    (1u<<9)
+#define JTAG_UART_CONTROL_AC    (1u<<10)
+
+struct jtag_uart_t
+  {
+    unsigned32 control;
+    unsigned32 rcount;
+    unsigned32 rhead;
+    unsigned char rfifo[JTAG_UART_FIFO_SIZE];
+  };
+
+static void
+jtag_uart_update(avm_device_t *dev)
+{
+  struct jtag_uart_t *u = (struct jtag_uart_t *) dev->priv;
+
+  device_irq(dev, ((u->control & JTAG_UART_CONTROL_RE) && u->rcount > 0) ||
+                  (u->control & JTAG_UART_CONTROL_WE));
+}
+
+static void
+jtag_uart_reset(avm_device_t *dev)
+{
+  struct jtag_uart_t *u = (struct jtag_uart_t *) dev->priv;
+
+  u->control = 0;
+  u->rcount = 0;
+  u->rhead = 0;
+  jtag_uart_update(dev);
+}
+
+static unsigned32
+jtag_uart_read(avm_device_t *dev, unsigned32 reg)
+{
+  struct jtag_uart_t *u = (struct jtag_uart_t *) dev->priv;
+  unsigned32 value;
+
+  switch (reg)
+    {
+      case 0:   /* data */
+        if (u->rcount == 0)
+          return 0;
+        value = u->rfifo[u->rhead];
+        u->rhead = (u->rhead + 1) % JTAG_UART_FIFO_SIZE;
+        --u->rcount;
+        jtag_uart_update(dev);
+        return value | JTAG_UART_DATA_RVALID | (u->rcount << 16);
+      case 1:   /* control */
+        value = u->control | JTAG_UART_CONTROL_WI | (JTAG_UART_FIFO_SIZE << 16);
+        if (u->rcount > 0)
+          value |= JTAG_UART_CONTROL_RI;
+        return value;
+    }
+
+  return 0;
+}
+
+static void
+jtag_uart_write(avm_device_t *dev, unsigned32 reg, unsigned32 value, unsigned32 mask)
+{
+  struct jtag_uart_t *u = (struct jtag_uart_t *) dev->priv;
+
+  switch (reg)
+    {
+      case 0:   /* data */
+        if (mask & 0xff)
+          {
+            sim_printf("%c", value & 0xff);
+            u->control |= JTAG_UART_CONTROL_AC;
+          }
+        break;
+      case 1:   /* control */
+        if (mask & 0xff)
+          u->control = (u->control & ~0xffu) |
+            (value & (JTAG_UART_CONTROL_RE | JTAG_UART_CONTROL_WE));
+        if ((mask & 0xff00) && (value & JTAG_UART_CONTROL_AC))
+          u->control &= ~JTAG_UART_CONTROL_AC;
+        jtag_uart_update(dev);
+        break;
+    }
+}
+
+static void
+jtag_uart_input(avm_device_t *dev, const char *arg)
+{
+  struct jtag_uart_t *u = (struct jtag_uart_t *) dev->priv;
+
+  for (; *arg && u->rcount < JTAG_UART_FIFO_SIZE; ++arg, ++u->rcount)
+    u->rfifo[(u->rhead + u->rcount) % JTAG_UART_FIFO_SIZE] = *arg;
+
+  jtag_uart_update(dev);
+}
+
+/*
+ * Interval timer (altera_avalon_timer, 32-bit counter)
+ *
+ * The counter runs at the CPU clock.  It is not stepped; instead the
+ * timeout is scheduled as an event and the current count derived from
+ * its time whenever software looks.
+ */
+#define TIMER_STATUS_TO       (1u<<0)
+#define TIMER_STATUS_RUN      (1u<<1)
+#define TIMER_CONTROL_ITO     (1u<<0)
+#define TIMER_CONTROL_CONT    (1u<<1)
+#define TIMER_CONTROL_START   (1u<<2)
+#define TIMER_CONTROL_STOP    (1u<<3)
+
+struct timer_t
+  {
+    unsigned32 status;
+    unsigned32 control;
+    unsigned32 period;
+    unsigned32 counter;   /* while stopped */
+    unsigned32 snap;
+    unsigned64 timeout;   /* while running */
+    nios2_event_t *event;
+  };
+
+static unsigned32
+timer_count(struct timer_t *t)
+{
+  if (!(t->status & TIMER_STATUS_RUN))
+    return t->counter;
+
+  return (unsigned32) (t->timeout - cpu.cycles - 1);
+}
+
+static void
+timer_update(avm_device_t *dev)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  device_irq(dev, (t->status & TIMER_STATUS_TO) && (t->control & TIMER_CONTROL_ITO));
+}
+
+static nios2_event_handler_t timer_expire;
+
+static void
+timer_start(avm_device_t *dev)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  t->status |= TIMER_STATUS_RUN;
+  t->timeout = cpu.cycles + t->counter + 1;
+  t->event = nios2_events_schedule(t->timeout, timer_expire, dev);
+}
+
+static void
+timer_stop(avm_device_t *dev)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  t->counter = timer_count(t);
+  t->status &= ~TIMER_STATUS_RUN;
+  if (t->event)
+    nios2_events_deschedule(t->event);
+  t->event = NULL;
+}
+
+static void
+timer_reset(avm_device_t *dev)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  t->status = 0;
+  t->control = 0;
+  t->period = 0xffffffff;
+  t->counter = t->period;
+  t->snap = 0;
+  t->event = NULL;  /* the event queue is emptied on reset */
+  timer_update(dev);
+}
+
+static void
+timer_expire(void *data, unsigned64 now)
+{
+  avm_device_t *dev = (avm_device_t *) data;
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  /* the registers may be accessed by another core meanwhile */
+  nios2_smp_lock();
+  t->event = NULL;
+  t->status |= TIMER_STATUS_TO;
+  if (t->control & TIMER_CONTROL_CONT)
+    {
+      /* reload without losing the cycles past the timeout */
+      t->timeout += (unsigned64) t->period + 1;
+      if (t->timeout <= now)
+        t->timeout = now + 1;
+      t->event = nios2_events_schedule(t->timeout, timer_expire, dev);
+    }
+  else
+    {
+      t->counter = t->period;
+      t->status &= ~TIMER_STATUS_RUN;
+    }
+
+  timer_update(dev);
+  nios2_smp_unlock();
+}
+
+/* the event of a running timer does not survive the snapshot */
+static void
+timer_restore(avm_device_t *dev)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  t->event = NULL;
+  if (t->status & TIMER_STATUS_RUN)
+    t->event = nios2_events_schedule(t->timeout, timer_expire, dev);
+}
+
+static unsigned32
+timer_read(avm_device_t *dev, unsigned32 reg)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  switch (reg)
+    {
+      case 0: return t->status;
+      case 1: return t->control & (TIMER_CONTROL_ITO | TIMER_CONTROL_CONT);
+      case 2: return t->period & 0xffff;
+      case 3: return t->period >> 16;
+      case 4: return t->snap & 0xffff;
+      case 5: return t->snap >> 16;
+    }
+
+  return 0;
+}
+
+static void
+timer_write(avm_device_t *dev, unsigned32 reg, unsigned32 value, unsigned32 mask)
+{
+  struct timer_t *t = (struct timer_t *) dev->priv;
+
+  switch (reg)
+    {
+      case 0:   /* status: any write clears TO */
+        t->status &= ~TIMER_STATUS_TO;
+        break;
+      case 1:   /* control */
+        t->control = value & (TIMER_CONTROL_ITO | TIMER_CONTROL_CONT);
+        if ((value & TIMER_CONTROL_STOP) && (t->status & TIMER_STATUS_RUN))
+          timer_stop(dev);
+        else if ((value & TIMER_CONTROL_START) && !(t->status & TIMER_STATUS_RUN))
+          timer_start(dev);
+        break;
+      case 2:   /* periodl */
+      case 3:   /* periodh */
+        if (t->status & TIMER_STATUS_RUN)
+          timer_stop(dev);
+        if (reg == 2)
+          t->period = (t->period & 0xffff0000u) | (value & 0xffff);
+        else
+          t->period = (t->period & 0xffff) | (value << 16);
+        t->counter = t->period;
+        break;
+      case 4:   /* snapl */
+      case 5:   /* snaph */
+        t->snap = timer_count(t);
+        break;
+    }
+
+  timer_update(dev);
+}
+
+/*
+ * Parallel I/O (altera_avalon_pio)
+ *
+ * The input port is driven by "device input"; any change of an input bit
+ * is captured in edgecapture.
+ */
+struct pio_t
+  {
+    unsigned32 in;
+    unsigned32 out;
+    unsigned32 direction;
+    unsigned32 irqmask;
+    unsigned32 edgecapture;
+  };
+
+static void
+pio_update(avm_device_t *dev)
+{
+  struct pio_t *p = (struct pio_t *) dev->priv;
+
+  device_irq(dev, (p->edgecapture & p->irqmask) != 0);
+}
+
+static void
+pio_reset(avm_device_t *dev)
+{
+  struct pio_t *p = (struct pio_t *) dev->priv;
+
+  p->out = 0;
+  p->direction = 0;
+  p->irqmask = 0;
+  p->edgecapture = 0;
+  pio_update(dev);
+}
+
+static unsigned32
+pio_read(avm_device_t *dev, unsigned32 reg)
+{
+  struct pio_t *p = (struct pio_t *) dev->priv;
+
+  switch (reg)
+    {
+      case 0: return (p->in & ~p->direction) | (p->out & p->direction);
+      case 1: return p->direction;
+      case 2: return p->irqmask;
+      case 3: return p->edgecapture;
+    }
+
+  return 0;
+}
+
+static void
+pio_write(avm_device_t *dev, unsigned32 reg, unsigned32 value, unsigned32 mask)
+{
+  struct pio_t *p = (struct pio_t *) dev->priv;
+
+  switch (reg)
+    {
+      case 0: p->out = (p->out & ~mask) | (value & mask); break;
+      case 1: p->direction = (p->direction & ~mask) | (value & mask); break;
+      case 2: p->irqmask = (p->irqmask & ~mask) | (value & mask); break;
+      case 3: p->edgecapture = 0; break;
+      case 4: p->out |= value & mask; break;
+      case 5: p->out &= ~(value & mask); break;
+    }
+
+  pio_update(dev);
+}
+
+static void
+pio_input(avm_device_t *dev, const char *arg)
+{
+  struct pio_t *p = (struct pio_t *) dev->priv;
+  unsigned32 in = strtoul(arg, NULL, 0);
+
+  p->edgecapture |= (p->in ^ in);
+  p->in = in;
+  pio_update(dev);
+}
+
+/*
+ * Hardware mutex (altera_avalon_mutex)
+ *
+ * The mutex register holds OWNER (bits 31:16) and VALUE (bits 15:0).  A
+ * write takes effect only if the mutex is free (VALUE is 0) or OWNER
+ * matches the owner written, so that a core claims it by writing its id
+ * with a nonzero value and reading back.  Device accesses are serialized
+ * between the cores, which makes this test and set atomic.
+ */
+#define MUTEX_RESET_BIT   (1u<<0)
+
+struct mutex_t
+  {
+    unsigned32 mutex;
+    unsigned32 reset;
+  };
+
+static void
+mutex_reset(avm_device_t *dev)
+{
+  struct mutex_t *m = (struct mutex_t *) dev->priv;
+
+  m->mutex = 0;
+  m->reset = MUTEX_RESET_BIT;
+}
+
+static unsigned32
+mutex_read(avm_device_t *dev, unsigned32 reg)
+{
+  struct mutex_t *m = (struct mutex_t *) dev->priv;
+
+  return reg == 0 ? m->mutex : m->reset;
+}
+
+static void
+mutex_write(avm_device_t *dev, unsigned32 reg, unsigned32 value, unsigned32 mask)
+{
+  struct mutex_t *m = (struct mutex_t *) dev->priv;
+
+  if (reg == 0)
+    {
+      value = (m->mutex & ~mask) | (value & mask);
+      if ((m->mutex & 0xffff) == 0 || (m->mutex >> 16) == (value >> 16))
+        m->mutex = value;
+    }
+  else if (reg == 1 && (value & mask & MUTEX_RESET_BIT))
+    m->reset = 0;   /* write 1 to clear */
+}
+
+static const avm_device_class_t device_classes[] =
+  {
+    { "jtag_uart", 8, sizeof(struct jtag_uart_t),
+      jtag_uart_reset, jtag_uart_read, jtag_uart_write, jtag_uart_input },
+    { "timer", 32, sizeof(struct timer_t),
+      timer_reset, timer_read, timer_write, NULL, timer_restore },
+    { "pio", 32, sizeof(struct pio_t),
+      pio_reset, pio_read, pio_write, pio_input },
+    { "mutex", 8, sizeof(struct mutex_t),
+      mutex_reset, mutex_read, mutex_write },
+  };
+
+avm_device_t *
+avm_add_device(const char *type, const char *name, SIM_ADDR base, int irq)
+{
+  const avm_device_class_t *cls;
+  avm_device_t *dev;
+  int i;
+
+  for (i = 0, cls = NULL; i < sizeof(device_classes) / sizeof(*device_classes); ++i)
+    if (strcmp(device_classes[i].type, type) == 0)
+      cls = &device_classes[i];
+
+  if (cls == NULL)
+    {
+      sim_printf("unknown device type: %s\n", type);
+      return NULL;
+    }
+
+  dev = (avm_device_t *) malloc(sizeof(*dev) + strlen(name));
+  dev->cls = cls;
+  dev->base = base;
+  dev->irq = irq;
+  dev->core = 0;
+  dev->priv = calloc(1, cls->priv_size);
+  dev->saved = NULL;
+  strcpy(dev->name, name);
+
+  if (avm_add_io(name, base, cls->size, dev) == 0)
+    {
+      sim_printf("cannot map device \"%s\" at 0x%x\n", name, base);
+      free(dev->priv);
+      free(dev);
+      return NULL;
+    }
+
+  dev->next = devices;
+  devices = dev;
+  cls->reset(dev);
+  return dev;
+}
+
+void
+avm_reset_devices(void)
+{
+  avm_device_t *dev;
+  int i;
+
+  for (i = 0; i < nios2_smp_cores; ++i)
+    nios2_smp_cpu(i)->irq_lines = 0;
+  for (dev = devices; dev; dev = dev->next)
+    dev->cls->reset(dev);
+}
+
+void
+avm_clear_devices(void)
+{
+  avm_device_t *dev, *next;
+
+  for (dev = devices; dev; dev = next)
+    {
+      next = dev->next;
+      free(dev->priv);
+      free(dev->saved);
+      free(dev);
+    }
+
+  devices = NULL;
+}
+
+void
+avm_save_devices(void)
+{
+  avm_device_t *dev;
+
+  for (dev = devices; dev; dev = dev->next)
+    {
+      if (dev->saved == NULL)
+        dev->saved = malloc(dev->cls->priv_size);
+      memcpy(dev->saved, dev->priv, dev->cls->priv_size);
+    }
+}
+
+/* the event queue must have been emptied; devices added after the
+   snapshot keep their state, but lose their events as well */
+void
+avm_restore_devices(void)
+{
+  avm_device_t *dev;
+
+  for (dev = devices; dev; dev = dev->next)
+    {
+      if (dev->saved)
+        memcpy(dev->priv, dev->saved, dev->cls->priv_size);
+      if (dev->cls->restore)
+        dev->cls->restore(dev);
+    }
+}
+
+static avm_device_t *
+find_device(const char *name)
+{
+  avm_device_t *dev;
+
+  for (dev = devices; dev; dev = dev->next)
+    if (strcmp(dev->name, name) == 0)
+      return dev;
+
+  return NULL;
+}
+
+int
+device_command(int argc, char *argv[])
+{
+  avm_device_t *dev;
+  char *at;
+  int core;
+
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of device commands:\n\n"
+      "add <type> <name> <base> [irq[@core]] -- Add a peripheral (jtag_uart, timer,\n"
+      "  pio, mutex); the irq goes to core 0 unless given\n"
+      "list -- List peripherals\n"
+      "input <name> <data> -- Feed characters (jtag_uart) or input bits (pio)\n"
+      );
+      return 0;
+    }
+
+  if (strcmp(argv[1], "add") == 0)
+    {
+      if (argc < 5 || argc > 6)
+        {
+          sim_printf("usage: device add <type> <name> <base> [irq[@core]]\n");
+          return 0;
+        }
+
+      core = 0;
+      if (argc > 5 && (at = strchr(argv[5], '@')) != NULL)
+        {
+          core = strtol(at + 1, NULL, 0);
+          if (core < 0 || core >= nios2_smp_cores)
+            {
+              sim_printf("no such core: %d\n", core);
+              return 0;
+            }
+        }
+
+      dev = avm_add_device(argv[2], argv[3], strtoul(argv[4], NULL, 0),
+                           argc > 5 ? strtol(argv[5], NULL, 0) : -1);
+      if (dev)
+        dev->core = core;
+      return 0;
+    }
+  else if (strcmp(argv[1], "list") == 0)
+    {
+      for (dev = devices; dev; dev = dev->next)
+        {
+          sim_printf("%-16s %-10s 0x%08x-0x%08x", dev->name, dev->cls->type,
+                     dev->base, dev->base + dev->cls->size - 1);
+          if (dev->irq >= 0)
+            sim_printf(" irq %d", dev->irq);
+          if (dev->irq >= 0 && nios2_smp_cores > 1)
+            sim_printf("@%d", dev->core);
+          sim_printf("\n");
+        }
+      return 0;
+    }
+  else if (strcmp(argv[1], "input") == 0)
+    {
+      if (argc != 4)
+        {
+          sim_printf("usage: device input <name> <data>\n");
+          return 0;
+        }
+
+      dev = find_device(argv[2]);
+      if (dev == NULL || dev->cls->input == NULL)
+        sim_printf("no input for device: %s\n", argv[2]);
+      else
+        dev->cls->input(dev, argv[3]);
+      return 0;
+    }
+
+  return 1;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
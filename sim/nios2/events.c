@@ -0,0 +1,175 @@
+/**
+ * @file events.c
+ * @brief Event queue for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * Events are kept in a list sorted by the CPU clock tick they are due
+ * at, in the manner of sim/common/sim-events.c.  The interpreter only
+ * compares cpu.cycles with nios2_next_event at the end of each block, so
+ * nothing is polled per instruction.  A pending interrupt is looked at
+ * only when the interrupt state may have changed: nios2_check_interrupt()
+ * pulls the next event boundary forward to "now".
+ *
+ * Each core has a queue of its own, and an event is scheduled on the
+ * queue of the core which runs the code scheduling it; with several
+ * cores, the queues are changed under nios2_smp_lock() since a device
+ * may cancel an event from another core.
+ */
+
+struct nios2_event
+  {
+    unsigned64 time;
+    nios2_event_handler_t *handler;
+    void *data;
+    nios2_event_t **queue;  /* of the core it was scheduled on */
+    nios2_event_t *next;
+  };
+
+static NIOS2_PER_CORE nios2_event_t *queue;
+static NIOS2_PER_CORE int irq_check;
+static nios2_event_t *free_events;
+
+NIOS2_PER_CORE unsigned64 nios2_next_event = ~(unsigned64) 0;
+
+static void
+update_next_event(void)
+{
+  if (irq_check)
+    nios2_next_event = 0;
+  else if (queue)
+    nios2_next_event = queue->time;
+  else
+    nios2_next_event = ~(unsigned64) 0;
+}
+
+nios2_event_t *
+nios2_events_schedule(unsigned64 time, nios2_event_handler_t *handler, void *data)
+{
+  nios2_event_t *ev, **p;
+
+  nios2_smp_lock();
+  if (free_events)
+    {
+      ev = free_events;
+      free_events = ev->next;
+    }
+  else
+    ev = (nios2_event_t *) malloc(sizeof(*ev));
+
+  ev->time = time;
+  ev->handler = handler;
+  ev->data = data;
+  ev->queue = &queue;
+
+  /* events due at the same time run in the order they were scheduled */
+  for (p = &queue; *p && (*p)->time <= time; p = &(*p)->next)
+    ;
+  ev->next = *p;
+  *p = ev;
+
+  update_next_event();
+  nios2_smp_unlock();
+  return ev;
+}
+
+void
+nios2_events_deschedule(nios2_event_t *ev)
+{
+  nios2_event_t **p;
+
+  nios2_smp_lock();
+  for (p = ev->queue; *p; p = &(*p)->next)
+    if (*p == ev)
+      {
+        *p = ev->next;
+        ev->next = free_events;
+        free_events = ev;
+        break;
+      }
+
+  /* another core finds out at its next event, which comes no later */
+  if (ev->queue == &queue)
+    update_next_event();
+  nios2_smp_unlock();
+}
+
+void
+nios2_check_interrupt(void)
+{
+  irq_check = 1;
+  nios2_next_event = 0;
+}
+
+void
+nios2_events_process(void)
+{
+  if (nios2_smp_cores > 1)
+    nios2_smp_poll();
+
+  nios2_smp_lock();
+  while (queue && queue->time <= cpu.cycles)
+    {
+      nios2_event_t *ev = queue;
+
+      queue = ev->next;
+      /* handlers may wait for the other cores (see smp.c); until the
+         handler returns, ev is on no list, so no core can reuse it and
+         a late nios2_events_deschedule() of it finds nothing to unlink */
+      nios2_smp_unlock();
+      ev->handler(ev->data, cpu.cycles);
+      nios2_smp_lock();
+      ev->next = free_events;
+      free_events = ev;
+    }
+  nios2_smp_unlock();
+
+  if (irq_check)
+    {
+      irq_check = 0;
+      if ((cpu.regs.status & NIOS2_STATUS_PIE) && cpu.regs.ipending)
+        nios2_exception(NIOS2_EXCEPTION_INTERRUPT, cpu.regs.pc + 4);
+    }
+
+  nios2_smp_lock();
+  update_next_event();
+  nios2_smp_unlock();
+}
+
+void
+nios2_events_clear(void)
+{
+  nios2_smp_lock();
+  while (queue)
+    {
+      nios2_event_t *ev = queue;
+
+      queue = ev->next;
+      free(ev);
+    }
+
+  while (free_events)
+    {
+      nios2_event_t *ev = free_events;
+
+      free_events = ev->next;
+      free(ev);
+    }
+
+  irq_check = 0;
+  update_next_event();
+  nios2_smp_unlock();
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
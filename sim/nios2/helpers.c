@@ -0,0 +1,373 @@
+/**
+ * @file helpers.c
+ * @brief Native execution of libgcc arithmetic helpers for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "libiberty.h"
+#include "bfd.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * Without hwdiv/hwmul, gcc calls __divsi3 and friends, whose shift and
+ * subtract loops can take most of the simulated time.  When enabled
+ * ("sim helpers on"), a call to one of them found in the symbols of the
+ * program is done by the host instead, leaving the result in r2 and
+ * returning to ra.
+ *
+ * The path through the libgcc routines (lib2-divmod.c and lib2-mul.c)
+ * only depends on the signs of the operands, the number of shift steps
+ * and the number of quotient (or multiplier) bits set.  The first call
+ * with each such signature is interpreted, and the instructions and
+ * cycles it takes are recorded; later calls with the same signature are
+ * charged the recorded figures.  So the counts stay the same as without
+ * helpers for the timing models with a fixed cost per path; with the
+ * branch predictor of /f or with caches they are an approximation.
+ *
+ * The routines only leave r2 to the caller: the other caller-saved
+ * registers they clobber are left alone, and breakpoints inside them are
+ * not hit on native calls.
+ */
+enum helper_kind
+  {
+    HELPER_DIVSI3,
+    HELPER_MODSI3,
+    HELPER_UDIVSI3,
+    HELPER_UMODSI3,
+    HELPER_MULSI3,
+    HELPER_COUNT
+  };
+
+static const char *const helper_names[HELPER_COUNT] =
+  {
+    "__divsi3", "__modsi3", "__udivsi3", "__umodsi3", "__mulsi3",
+  };
+
+/* signature: exit of the shift loop, 2 sign bits, 6 bits of step count
+   and 6 bits of set bits */
+#define SIGNATURE_BITS  15
+
+typedef struct
+  {
+    unsigned32 insns;   /* 0: not measured yet */
+    unsigned32 cycles;
+  }
+helper_cost_t;
+
+static struct
+  {
+    SIM_ADDR addr;      /* 0: not in the program */
+    helper_cost_t *costs;
+    unsigned64 calls;
+  }
+helpers[HELPER_COUNT];
+
+/* the call being measured */
+static NIOS2_PER_CORE struct
+  {
+    int helper;
+    unsigned32 signature;
+    unsigned32 sp;
+    unsigned64 insns;
+    unsigned64 cycles;
+  }
+pending;
+
+static const nios2_timing_t *costs_model;
+static unsigned64 calibrations;
+
+int nios2_helpers_enabled;
+NIOS2_PER_CORE unsigned32 nios2_helper_return = 1;   /* never a valid (aligned) PC */
+
+/* udivmodsi4() of libgcc, also counting its steps */
+static unsigned32
+udivmod(unsigned32 num, unsigned32 den, int modwanted, unsigned32 *psig)
+{
+  unsigned32 bit = 1, res = 0, shifts = 0, sets = 0;
+
+  while (den < num && bit && !(den & 0x80000000u))
+    {
+      den <<= 1;
+      bit <<= 1;
+      ++shifts;
+    }
+  if (den < num)
+    *psig |= 1u << 14;  /* stopped by the top bit */
+
+  while (bit)
+    {
+      if (num >= den)
+        {
+          num -= den;
+          res |= bit;
+          ++sets;
+        }
+      bit >>= 1;
+      den >>= 1;
+    }
+
+  *psig |= (shifts << 6) | sets;
+  return modwanted ? num : res;
+}
+
+static unsigned32
+helper_eval(int helper, unsigned32 a, unsigned32 b, unsigned32 *psig)
+{
+  unsigned32 res, sig = 0;
+
+  switch (helper)
+    {
+      case HELPER_DIVSI3:
+      case HELPER_MODSI3:
+        {
+          int neg = 0;
+
+          if ((signed32) a < 0)
+            {
+              a = -a;
+              neg = !neg;
+              sig |= 1u << 12;
+            }
+          if ((signed32) b < 0)
+            {
+              b = -b;
+              if (helper == HELPER_DIVSI3)
+                neg = !neg;
+              sig |= 1u << 13;
+            }
+          res = udivmod(a, b, helper == HELPER_MODSI3, &sig);
+          if (neg)
+            res = -res;
+          break;
+        }
+      case HELPER_UDIVSI3:
+      case HELPER_UMODSI3:
+        res = udivmod(a, b, helper == HELPER_UMODSI3, &sig);
+        break;
+      default:  /* HELPER_MULSI3 */
+        {
+          unsigned32 cnt = a, steps = 0, sets = 0;
+
+          for (; cnt; cnt >>= 1)
+            {
+              ++steps;
+              sets += cnt & 1;
+            }
+          sig = (steps << 6) | sets;
+          res = a * b;
+          break;
+        }
+    }
+
+  *psig = sig;
+  return res;
+}
+
+static void
+helpers_clear_costs(void)
+{
+  int i;
+
+  for (i = 0; i < HELPER_COUNT; ++i)
+    if (helpers[i].costs)
+      memset(helpers[i].costs, 0, sizeof(helper_cost_t) << SIGNATURE_BITS);
+
+  costs_model = nios2_timing;
+}
+
+/* index + 1 of the helper at pc, 0 if none */
+int
+nios2_helper_at(SIM_ADDR pc)
+{
+  int i;
+
+  if (!nios2_helpers_enabled)
+    return 0;
+
+  for (i = 0; i < HELPER_COUNT; ++i)
+    if (helpers[i].addr == pc && pc != 0)
+      return i + 1;
+
+  return 0;
+}
+
+/* called by the interpreter at the start of a block which is a helper
+   (helper != 0) or which is the return of the call being measured;
+   returns nonzero if the call has been done natively */
+int
+nios2_helper_hook(int helper)
+{
+  unsigned32 signature, result;
+  helper_cost_t *cost;
+
+  if (cpu.regs.pc == nios2_helper_return && cpu.regs.sp == pending.sp)
+    {
+      cost = &helpers[pending.helper].costs[pending.signature];
+      /* insns last: another core takes the cost once it is nonzero */
+      cost->cycles = cpu.cycles - pending.cycles;
+      cost->insns = cpu.insns - pending.insns;
+      nios2_helper_return = 1;
+      ++calibrations;
+    }
+
+  if (helper == 0 || nios2_helper_return != 1)
+    return 0;   /* nested calls are interpreted while measuring */
+
+  --helper;
+  if (costs_model != nios2_timing)
+    helpers_clear_costs();
+
+  result = helper_eval(helper, cpu.regs.r4, cpu.regs.r5, &signature);
+  cost = &helpers[helper].costs[signature];
+  if (cost->insns == 0)
+    {
+      /* measure this one */
+      pending.helper = helper;
+      pending.signature = signature;
+      pending.sp = cpu.regs.sp;
+      pending.insns = cpu.insns;
+      pending.cycles = cpu.cycles;
+      nios2_helper_return = cpu.regs.ra;
+      return 0;
+    }
+
+  cpu.regs.r2 = result;
+  cpu.regs.pc = cpu.regs.ra;
+  cpu.insns += cost->insns;
+  cpu.cycles += cost->cycles;
+  ++helpers[helper].calls;
+  return 1;
+}
+
+/* an exception taken while measuring would be counted in the call */
+void
+nios2_helpers_cancel(void)
+{
+  nios2_helper_return = 1;
+}
+
+/* look for the helpers in the program */
+void
+nios2_helpers_load(struct bfd *abfd)
+{
+  asymbol **syms;
+  long size, n, i;
+  int j;
+
+  for (j = 0; j < HELPER_COUNT; ++j)
+    {
+      helpers[j].addr = 0;
+      helpers[j].calls = 0;
+    }
+  nios2_helper_return = 1;
+  calibrations = 0;
+  helpers_clear_costs();
+  if (nios2_helpers_enabled)
+    nios2_decode_flush();
+
+  if (abfd == NULL || !(bfd_get_file_flags(abfd) & HAS_SYMS))
+    return;
+
+  size = bfd_get_symtab_upper_bound(abfd);
+  if (size <= 0)
+    return;
+
+  syms = (asymbol **) malloc(size);
+  n = bfd_canonicalize_symtab(abfd, syms);
+  for (i = 0; i < n; ++i)
+    {
+      asymbol *sym = syms[i];
+
+      if (!(sym->section->flags & SEC_CODE) || !(sym->flags & BSF_GLOBAL))
+        continue;
+
+      for (j = 0; j < HELPER_COUNT; ++j)
+        if (strcmp(bfd_asymbol_name(sym), helper_names[j]) == 0)
+          helpers[j].addr = bfd_asymbol_value(sym);
+    }
+
+  free(syms);
+}
+
+void
+nios2_helpers_enable(int enable)
+{
+  int i;
+
+  for (i = 0; i < HELPER_COUNT && enable; ++i)
+    if (helpers[i].costs == NULL)
+      helpers[i].costs = (helper_cost_t *)
+        calloc(1 << SIGNATURE_BITS, sizeof(helper_cost_t));
+
+  nios2_helpers_enabled = enable;
+  nios2_helper_return = 1;
+
+  /* blocks are marked at translation */
+  nios2_decode_flush();
+}
+
+void
+nios2_helpers_info(void)
+{
+  unsigned64 calls = 0;
+  int i;
+
+  if (!nios2_helpers_enabled)
+    return;
+
+  for (i = 0; i < HELPER_COUNT; ++i)
+    calls += helpers[i].calls;
+
+  sim_printf("native helper calls: %llu (%llu measured)\n",
+    (unsigned long long) calls, (unsigned long long) calibrations);
+}
+
+int
+helpers_command(int argc, char *argv[])
+{
+  int i;
+
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of helper commands:\n\n"
+      "on -- Run libgcc division and multiply routines natively\n"
+      "off -- Interpret them (default)\n"
+      "info -- Show the routines found and the native calls\n"
+      );
+      return 0;
+    }
+
+  if (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0
+      && strcmp(argv[1], "info") != 0)
+    return 1;
+
+  if (argc != 2)
+    {
+      sim_printf("wrong number of options for helpers %s\n", argv[1]);
+      return 0;
+    }
+
+  if (strcmp(argv[1], "info") == 0)
+    {
+      sim_printf("native helpers: %s\n", nios2_helpers_enabled ? "on" : "off");
+      for (i = 0; i < HELPER_COUNT; ++i)
+        if (helpers[i].addr)
+          sim_printf("  %-10s 0x%08x %llu call(s)\n", helper_names[i],
+            (unsigned int) helpers[i].addr, (unsigned long long) helpers[i].calls);
+    }
+  else
+    nios2_helpers_enable(strcmp(argv[1], "on") == 0);
+
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -1,12 +1,84 @@
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
-__attribute__((naked)) int write(int file, char *ptr, int len)
+#undef errno
+extern int errno;
+
+/*
+ * "ori r0, r0, 0xcafe" followed by "ori r0, r0, <call>" asks the simulator
+ * for a host call.  Arguments are in r4-r6; the result comes back in r2
+ * and the errno in r3 (the upper half of a 64-bit return value).  r2 is
+ * preset to -1 so that the call fails on real hardware.  params is the
+ * parameter list of the call.
+ */
+#define SIM_CALL(name, magic, params) \
+	__attribute__((naked)) static long long __sim_##name params \
+	{ \
+		__asm__( \
+		"movi r2, -1\n\t" \
+		"movi r3, 88\n\t"	/* ENOSYS */ \
+		"ori r0, r0, 0xcafe\n\t" \
+		"ori r0, r0, " #magic "\n\t" \
+		"ret" \
+		); \
+	}
+
+#define SIM_RESULT(r) \
+	do { \
+		if ((int) (r) == -1) \
+			errno = (int) ((r) >> 32); \
+		return (int) (r); \
+	} while (0)
+
+SIM_CALL(write, 0x0001, (int file, char *ptr, int len))
+SIM_CALL(read, 0x0002, (int file, char *ptr, int len))
+SIM_CALL(open, 0x0003, (const char *path, int flags, int mode))
+SIM_CALL(close, 0x0004, (int file))
+SIM_CALL(lseek, 0x0005, (int file, int offset, int whence))
+SIM_CALL(fstat, 0x0006, (int file, struct stat *st))
+SIM_CALL(gettimeofday, 0x0007, (struct timeval *tv, void *tz))
+
+int write(int file, char *ptr, int len)
 {
-	__asm__(
-	"movi r2, -1\n\t"
-	"ori r0, r0, 0xcafe\n\t"
-	"ori r0, r0, 0x0001\n\t"
-	"ret"
-	);
+	long long r = __sim_write(file, ptr, len);
+	SIM_RESULT(r);
+}
+
+int read(int file, char *ptr, int len)
+{
+	long long r = __sim_read(file, ptr, len);
+	SIM_RESULT(r);
+}
+
+int open(const char *path, int flags, int mode)
+{
+	long long r = __sim_open(path, flags, mode);
+	SIM_RESULT(r);
+}
+
+int close(int file)
+{
+	long long r = __sim_close(file);
+	SIM_RESULT(r);
+}
+
+int lseek(int file, int offset, int whence)
+{
+	long long r = __sim_lseek(file, offset, whence);
+	SIM_RESULT(r);
+}
+
+int fstat(int file, struct stat *st)
+{
+	long long r = __sim_fstat(file, st);
+	SIM_RESULT(r);
+}
+
+int gettimeofday(struct timeval *tv, void *tz)
+{
+	long long r = __sim_gettimeofday(tv, tz);
+	SIM_RESULT(r);
 }
 
 __attribute__((naked)) void _exit(int exitcode)
@@ -17,4 +89,3 @@ __attribute__((naked)) void _exit(int exitcode)
 	);
 	while(1);
 }
-
@@ -0,0 +1,329 @@
+/**
+ * @file hostio.c
+ * @brief Host I/O system calls for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "gdb/callback.h"
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * A program calls the host through a magic "ori r0,r0,0xcafe" followed
+ * by "ori r0,r0,NIOS2_SYS_xxx" (see hook_sim_nios2.c), with the arguments
+ * in r4-r6.  The result is returned in r2, and the target errno in r3
+ * when the call fails.
+ *
+ * Files are handled by the host callback (sim/common/callback.c), which
+ * maps target file descriptors and open flags.  read and write move data
+ * straight between the file and the host memory behind the guest pages;
+ * runs of pages backed by the same section are passed in one call.  Only
+ * pages without a fast mapping (I/O, code or snapshot-clean pages) go
+ * through avm_read()/avm_write() and a bounce buffer.
+ *
+ * Console output is collected in a buffer, which is handed to GDB when it
+ * fills up, before reading the console and when the simulator stops.
+ */
+#define CONSOLE_BUFFER_SIZE   4096
+#define BOUNCE_BUFFER_SIZE    AVM_PAGE_SIZE
+
+/* the call numbers are the magics */
+static CB_TARGET_DEFS_MAP nios2_syscall_map[] =
+  {
+    { CB_SYS_write, NIOS2_SYS_WRITE },
+    { CB_SYS_read, NIOS2_SYS_READ },
+    { CB_SYS_open, NIOS2_SYS_OPEN },
+    { CB_SYS_close, NIOS2_SYS_CLOSE },
+    { CB_SYS_lseek, NIOS2_SYS_LSEEK },
+    { CB_SYS_fstat, NIOS2_SYS_FSTAT },
+    { -1, -1 }
+  };
+
+/* struct stat of newlib */
+static const char nios2_stat_map[] =
+  "st_dev,2:st_ino,2:st_mode,4:st_nlink,2:st_uid,2:st_gid,2:st_rdev,2:"
+  "st_size,4:st_atime,4:space,4:st_mtime,4:space,4:st_ctime,4:space,4:"
+  "st_blksize,4:st_blocks,4:space,8";
+
+static host_callback *hostio_cb;
+static char console[CONSOLE_BUFFER_SIZE];
+static int console_length;
+
+void
+nios2_hostio_init(host_callback *cb)
+{
+  hostio_cb = cb;
+  console_length = 0;
+  if (cb)
+    {
+      cb->syscall_map = nios2_syscall_map;
+      cb->stat_map = nios2_stat_map;
+      cb->target_endian = BFD_ENDIAN_LITTLE;
+    }
+}
+
+void
+nios2_hostio_flush(void)
+{
+  if (console_length == 0)
+    return;
+
+  hostio_cb->write_stdout(hostio_cb, console, console_length);
+  hostio_cb->flush_stdout(hostio_cb);
+  console_length = 0;
+}
+
+static int
+console_write(const char *buf, int len)
+{
+  if (console_length + len > CONSOLE_BUFFER_SIZE)
+    nios2_hostio_flush();
+
+  if (len >= CONSOLE_BUFFER_SIZE)
+    {
+      len = hostio_cb->write_stdout(hostio_cb, buf, len);
+      hostio_cb->flush_stdout(hostio_cb);
+      return len;
+    }
+
+  memcpy(console + console_length, buf, len);
+  console_length += len;
+  return len;
+}
+
+static int
+host_read(int file, unsigned char *buf, int len)
+{
+  if (cb_is_stdin(hostio_cb, file))
+    return hostio_cb->read_stdin(hostio_cb, (char *) buf, len);
+
+  return hostio_cb->read(hostio_cb, file, (char *) buf, len);
+}
+
+/* errno of the last callback, already in target terms */
+static int
+host_errno(void)
+{
+  return hostio_cb->get_errno(hostio_cb);
+}
+
+/* host memory of the guest pages from ptr on, as long as they are
+   contiguous, up to len bytes; NULL if the first page is not mapped */
+static unsigned char *
+hostio_map(SIM_ADDR ptr, int len, int write, int *plen)
+{
+  avm_page_t *p = AVM_PAGE(ptr);
+  unsigned char *host = write ? p->write : p->read;
+  int n;
+
+  if (host == NULL)
+    return NULL;
+
+  host += ptr & AVM_PAGE_MASK;
+  n = AVM_PAGE_SIZE - (ptr & AVM_PAGE_MASK);
+  while (n < len)
+    {
+      p = AVM_PAGE(ptr + n);
+      if ((write ? p->write : p->read) != host + n)
+        break;
+      n += AVM_PAGE_SIZE;
+    }
+
+  *plen = (n < len) ? n : len;
+  return host;
+}
+
+int
+sim_sys_write(int file, SIM_ADDR ptr, int len)
+{
+  unsigned char bounce[BOUNCE_BUFFER_SIZE];
+  int console_out = cb_is_stdout(hostio_cb, file);
+  int done = 0;
+
+  while (done < len)
+    {
+      int n, result;
+      unsigned char *host = hostio_map(ptr + done, len - done, 0, &n);
+
+      if (host == NULL)
+        {
+          n = len - done;
+          if (n > BOUNCE_BUFFER_SIZE - ((ptr + done) & AVM_PAGE_MASK))
+            n = BOUNCE_BUFFER_SIZE - ((ptr + done) & AVM_PAGE_MASK);
+          n = avm_read(ptr + done, bounce, n, AVM_DATA);
+          if (n <= 0)
+            break;
+          host = bounce;
+        }
+
+      if (console_out)
+        result = console_write((char *) host, n);
+      else
+        {
+          /* keep the console in order with stderr */
+          nios2_hostio_flush();
+          result = hostio_cb->write(hostio_cb, file, (char *) host, n);
+        }
+
+      if (result < 0)
+        return done ? done : -1;
+      done += result;
+      if (result < n)
+        break;
+    }
+
+  return done;
+}
+
+int
+sim_sys_read(int file, SIM_ADDR ptr, int len)
+{
+  unsigned char bounce[BOUNCE_BUFFER_SIZE];
+  int done = 0;
+
+  nios2_hostio_flush();
+  while (done < len)
+    {
+      int n, result;
+      unsigned char *host = hostio_map(ptr + done, len - done, 1, &n);
+
+      if (host)
+        result = host_read(file, host, n);
+      else
+        {
+          n = len - done;
+          if (n > BOUNCE_BUFFER_SIZE - ((ptr + done) & AVM_PAGE_MASK))
+            n = BOUNCE_BUFFER_SIZE - ((ptr + done) & AVM_PAGE_MASK);
+          result = host_read(file, bounce, n);
+          if (result > 0)
+            result = avm_write(ptr + done, bounce, result, AVM_DATA);
+        }
+
+      if (result < 0)
+        return done ? done : -1;
+      done += result;
+      /* a short count ends the read (end of file, or a console line) */
+      if (result < n)
+        break;
+    }
+
+  return done;
+}
+
+static int
+syscall_read_mem(host_callback *cb, struct cb_syscall *sc,
+                 unsigned long taddr, char *buf, int bytes)
+{
+  return avm_read(taddr, (unsigned char *) buf, bytes, AVM_DATA);
+}
+
+static int
+syscall_write_mem(host_callback *cb, struct cb_syscall *sc,
+                  unsigned long taddr, const char *buf, int bytes)
+{
+  return avm_write(taddr, (unsigned char *) buf, bytes, AVM_DATA);
+}
+
+/* the calls without bulk data go through cb_syscall() */
+static int
+hostio_syscall(int func, unsigned32 *perr)
+{
+  CB_SYSCALL sc;
+
+  CB_SYSCALL_INIT(&sc);
+  sc.func = func;
+  sc.arg1 = cpu.regs.gpr[4];
+  sc.arg2 = cpu.regs.gpr[5];
+  sc.arg3 = cpu.regs.gpr[6];
+  sc.read_mem = syscall_read_mem;
+  sc.write_mem = syscall_write_mem;
+  cb_syscall(hostio_cb, &sc);
+  *perr = sc.errcode;
+  return sc.result;
+}
+
+static int
+hostio_gettimeofday(SIM_ADDR tv, unsigned32 *perr)
+{
+  struct timeval now;
+  unsigned char buf[8];
+  int i;
+
+  gettimeofday(&now, NULL);
+  for (i = 0; i < 4; ++i)
+    {
+      buf[i] = (unsigned32) now.tv_sec >> (i * 8);
+      buf[i + 4] = (unsigned32) now.tv_usec >> (i * 8);
+    }
+
+  if (tv && avm_write(tv, buf, sizeof(buf), AVM_DATA) != sizeof(buf))
+    {
+      *perr = cb_host_to_target_errno(hostio_cb, EFAULT);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* r4-r6: arguments, r2: result, r3: errno */
+void
+sim_sys_call(int magic)
+{
+  unsigned32 *r = cpu.regs.gpr;
+  unsigned32 err = 0;
+  int result;
+
+  if (hostio_cb == NULL)
+    return;
+
+  /* the console buffer and the host callbacks are shared */
+  nios2_smp_lock();
+  switch (magic)
+    {
+      case NIOS2_SYS_WRITE:
+        result = sim_sys_write(r[4], r[5], r[6]);
+        if (result < 0)
+          err = host_errno();
+        break;
+      case NIOS2_SYS_READ:
+        result = sim_sys_read(r[4], r[5], r[6]);
+        if (result < 0)
+          err = host_errno();
+        break;
+      case NIOS2_SYS_OPEN:
+        result = hostio_syscall(NIOS2_SYS_OPEN, &err);
+        break;
+      case NIOS2_SYS_CLOSE:
+        result = hostio_syscall(NIOS2_SYS_CLOSE, &err);
+        break;
+      case NIOS2_SYS_LSEEK:
+        result = hostio_syscall(NIOS2_SYS_LSEEK, &err);
+        break;
+      case NIOS2_SYS_FSTAT:
+        result = hostio_syscall(NIOS2_SYS_FSTAT, &err);
+        break;
+      case NIOS2_SYS_GETTIMEOFDAY:
+        result = hostio_gettimeofday(r[4], &err);
+        break;
+      default:
+        nios2_smp_unlock();
+        return;
+    }
+  nios2_smp_unlock();
+
+  r[2] = result;
+  if (result == -1)
+    r[3] = err;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -5,6 +5,8 @@
  */
 
 #include "config.h"
+#include <stdlib.h>
+#include <string.h>
 #include "gdb/callback.h"
 #include "gdb/signals.h"
 #include "libiberty.h"
@@ -18,7 +20,443 @@
 typedef unsigned32 uint32_t;
 #include "asm_nios2.h"
 
-nios2_cpu_t cpu;
+NIOS2_PER_CORE nios2_cpu_t cpu;
+
+/*
+ * Threaded dispatch
+ *
+ * With GCC, every decoded instruction carries the address of its handler
+ * label in nios2_interpret() and control jumps straight from one handler
+ * to the next (computed goto).  Other compilers fall back to the switch.
+ */
+#ifndef WITH_THREADED_DISPATCH
+#ifdef __GNUC__
+#define WITH_THREADED_DISPATCH  1
+#else
+#define WITH_THREADED_DISPATCH  0
+#endif
+#endif
+
+/* dispatch table index: OP for I/J-type, 0x40|OPX for R-type */
+#define NIOS2_DISPATCH_SIZE       0x80
+#define NIOS2_DISPATCH_INDEX(opcode) \
+  (NIOS2_GET_OP(opcode) == 0x3a ? 0x40 | NIOS2_GET_OPX(opcode) : NIOS2_GET_OP(opcode))
+
+/*
+ * Translated basic blocks
+ *
+ * A block is a run of pre-decoded instructions starting at the PC it is
+ * keyed by and ending at the first instruction which may leave the
+ * sequential flow (branches, call/ret, bret/eret, trap/break, wrctl and
+ * the system call ori).  Each op keeps the raw instruction word together with
+ * the dispatch key, the handler and the operand fields already extracted,
+ * so running a block costs neither avm_read() nor any bit slicing.
+ *
+ * Blocks live in a direct-mapped table of each core, allocated on the
+ * heap by the first nios2_decode_flush() (there is one in nios2_reset()).
+ * Writes to memory go through nios2_decode_invalidate(), which drops
+ * every block overlapping the written range; a coarse bitmap of the
+ * memory blocks were built from keeps that check to a single bit test
+ * for plain data stores.  Pages holding translated code lose their fast
+ * write mapping (see avm_protect_code()) so that stores to them reach
+ * the slow path.
+ */
+#define NIOS2_BLOCK_MAX_INSNS     32
+#define NIOS2_BLOCK_CACHE_BITS    11
+#define NIOS2_BLOCK_CACHE_SIZE    (1u << NIOS2_BLOCK_CACHE_BITS)
+#define NIOS2_BLOCK_CACHE_MASK    (NIOS2_BLOCK_CACHE_SIZE - 1)
+#define NIOS2_DECODE_INVALID_PC   1u  /* never a valid (aligned) PC */
+
+#define NIOS2_CODE_MAP_SHIFT      10
+#define NIOS2_CODE_MAP_SIZE       ((0x80000000u >> NIOS2_CODE_MAP_SHIFT) / 8)
+#define CODE_MAP_BYTE(addr) \
+  cpu.decode->code_map[((addr) & 0x7fffffffu) >> (NIOS2_CODE_MAP_SHIFT + 3)]
+#define CODE_MAP_BIT(addr) \
+  (1u << (((addr) >> NIOS2_CODE_MAP_SHIFT) & 7))
+
+typedef struct
+  {
+    unsigned32 pc;
+    unsigned32 insn;    /* raw instruction word */
+    unsigned32 opcode;  /* dispatch key: NIOS2_OP() | NIOS2_OPX() */
+    unsigned8 a, b, c, imm5;
+    unsigned8 cycles;   /* timing model cost, including stalls */
+    signed32 simm;      /* sign-extended IMM16 */
+    unsigned32 uimm;    /* zero-extended IMM16 */
+    unsigned32 imm26;
+    void *handler;      /* label in nios2_interpret() (threaded dispatch) */
+  }
+nios2_decoded_t;
+
+typedef struct
+  {
+    unsigned32 pc;      /* tag: address of the first instruction */
+    unsigned32 ppc;     /* tag: physical address of it (index, code map) */
+    unsigned32 count;
+    unsigned32 cycles;  /* sum of ops[].cycles */
+    unsigned32 branch;  /* ends with a conditional branch for the predictor */
+    unsigned32 *prof;   /* execution counters of ops[] (profiling) */
+    unsigned32 hits;    /* complete runs not yet added to prof[] */
+    int helper;         /* nios2_helper_at(pc) */
+    nios2_decoded_t ops[NIOS2_BLOCK_MAX_INSNS];
+  }
+nios2_block_t;
+
+struct nios2_decode_cache
+  {
+    nios2_block_t blocks[NIOS2_BLOCK_CACHE_SIZE];
+    unsigned8 code_map[NIOS2_CODE_MAP_SIZE];
+  };
+
+static int
+decode_insn(nios2_decoded_t *d, unsigned32 pc, unsigned32 ppc)
+{
+  unsigned32 i;
+
+  if (avm_read(ppc, (unsigned char *) &i, 4, AVM_INSTRUCTION) != 4)
+    return 1; /* instruction fetch failed */
+
+  i = LE2H4(i);
+
+  d->pc = pc;
+  d->insn = i;
+  d->opcode = NIOS2_OP(NIOS2_GET_OP(i));
+  if (d->opcode == NIOS2_OP(0x3a))
+    d->opcode |= NIOS2_OPX(NIOS2_GET_OPX(i));
+  d->a = NIOS2_GET_A(i);
+  d->b = NIOS2_GET_B(i);
+  d->c = NIOS2_GET_C(i);
+  d->imm5 = NIOS2_GET_IMM5(i);
+  d->simm = (signed16) NIOS2_GET_IMM16(i);
+  d->uimm = NIOS2_GET_IMM16(i);
+  d->imm26 = NIOS2_GET_IMM26(i);
+  d->handler = NULL;
+  return 0;
+}
+
+static int
+decode_ends_block(const nios2_decoded_t *d)
+{
+  switch (d->opcode)
+    {
+      case NIOS2_OP(0x00):                  /* call */
+      case NIOS2_OP(0x01):                  /* jmpi */
+      case NIOS2_OP(0x06):                  /* br */
+      case NIOS2_OP(0x0e):                  /* bge */
+      case NIOS2_OP(0x16):                  /* blt */
+      case NIOS2_OP(0x1e):                  /* bne */
+      case NIOS2_OP(0x26):                  /* beq */
+      case NIOS2_OP(0x2e):                  /* bgeu */
+      case NIOS2_OP(0x36):                  /* bltu */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x01):  /* eret */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x05):  /* ret */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x09):  /* bret */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x0d):  /* jmp */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x1d):  /* callr */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x2d):  /* trap */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x2e):  /* wrctl */
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x34):  /* break */
+        return 1;
+      case NIOS2_OP(0x14):                  /* ori */
+        /* system calls may stop the simulation */
+        return (d->a == 0 && d->b == 0);
+    }
+
+  return 0;
+}
+
+/*
+ * Profiling counts executions per instruction in arrays hanging off the
+ * pages (see avm_profile_counters()).  A block only bumps its own hit
+ * count when it runs to the end; the hits are added to the counters of
+ * every op when the block is dropped, or before a report, so the cost
+ * is one increment per block.  Blocks do not cross pages while
+ * profiling, so that prof[] is contiguous, nor while the MMU or the MPU
+ * translates, so that only the first instruction needs a translation.
+ */
+
+/* prof[] is in the pages, which the cores share */
+static inline void
+profile_add(unsigned32 *counter, unsigned32 n)
+{
+#ifdef HAVE_PTHREAD_H
+  if (nios2_smp_cores > 1)
+    {
+      __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+      return;
+    }
+#endif
+  *counter += n;
+}
+
+static inline void
+block_profile(nios2_block_t *blk, unsigned32 count)
+{
+  unsigned32 n;
+
+  if (count == blk->count)
+    ++blk->hits;
+  else
+    for (n = 0; n < count; ++n)
+      profile_add(&blk->prof[n], 1);
+}
+
+static void
+block_retire(nios2_block_t *blk)
+{
+  unsigned32 n;
+
+  if (blk->prof && blk->hits)
+    for (n = 0; n < blk->count; ++n)
+      profile_add(&blk->prof[n], blk->hits);
+
+  blk->hits = 0;
+  blk->pc = NIOS2_DECODE_INVALID_PC;
+}
+
+/*
+ * Timing
+ *
+ * The cost of each op is fixed when the block is translated: the issue
+ * cycles given by the timing model plus the stall waiting for the result
+ * of an earlier op of the block (dependencies across blocks are not
+ * tracked).  Only the outcome of the final conditional branch is left to
+ * run time.
+ */
+static int
+insn_is_cond_branch(unsigned32 opcode)
+{
+  switch (opcode)
+    {
+      case NIOS2_OP(0x0e): case NIOS2_OP(0x16): case NIOS2_OP(0x1e):
+      case NIOS2_OP(0x26): case NIOS2_OP(0x2e): case NIOS2_OP(0x36):
+        return 1;
+    }
+
+  return 0;
+}
+
+/* registers read (bit mask) and written (0 if none) by an op */
+static unsigned32
+insn_regs(const nios2_decoded_t *d, unsigned32 *dest)
+{
+  if (NIOS2_GET_OP(d->opcode) == 0x3a)
+    {
+      *dest = d->c;
+      return (1u << d->a) | (1u << d->b);
+    }
+
+  switch (d->opcode)
+    {
+      case NIOS2_OP(0x00): case NIOS2_OP(0x01):           /* call, jmpi */
+        *dest = (d->opcode == NIOS2_OP(0x00)) ? 31 : 0;
+        return 0;
+      case NIOS2_OP(0x05): case NIOS2_OP(0x0d): case NIOS2_OP(0x15):
+      case NIOS2_OP(0x25): case NIOS2_OP(0x2d): case NIOS2_OP(0x35):
+      case NIOS2_OP(0x06): case NIOS2_OP(0x0e): case NIOS2_OP(0x16):
+      case NIOS2_OP(0x1e): case NIOS2_OP(0x26): case NIOS2_OP(0x2e):
+      case NIOS2_OP(0x36):                                /* stores, branches */
+        *dest = 0;
+        return (1u << d->a) | (1u << d->b);
+      case NIOS2_OP(0x13): case NIOS2_OP(0x1b): case NIOS2_OP(0x33):
+      case NIOS2_OP(0x3b):                                /* cache ops */
+        *dest = 0;
+        return 1u << d->a;
+      case NIOS2_OP(0x32):                                /* custom */
+        *dest = (d->insn & NIOS2_CUSTOM_WRITERC) ? d->c : 0;
+        return ((d->insn & NIOS2_CUSTOM_READRA) ? 1u << d->a : 0) |
+               ((d->insn & NIOS2_CUSTOM_READRB) ? 1u << d->b : 0);
+    }
+
+  *dest = d->b;
+  return 1u << d->a;
+}
+
+static void
+block_timing(nios2_block_t *blk)
+{
+  unsigned32 ready[32];   /* time at which each register can be used */
+  unsigned32 now = 0, n, r;
+
+  memset(ready, 0, sizeof(ready));
+  blk->cycles = 0;
+  for (n = 0; n < blk->count; ++n)
+    {
+      nios2_decoded_t *d = &blk->ops[n];
+      unsigned32 src, dest, stall = 0;
+      int latency, cost;
+
+      cost = nios2_timing->cost(d->opcode, d->insn, &latency);
+      src = insn_regs(d, &dest) & ~1u;
+      for (r = 1; src; ++r)
+        if (src & (1u << r))
+          {
+            src &= ~(1u << r);
+            if (ready[r] > now + stall)
+              stall = ready[r] - now;
+          }
+
+      now += stall + cost;
+      if (dest)
+        ready[dest] = now + latency;
+      d->cycles = (stall + cost > 255) ? 255 : stall + cost;
+      blk->cycles += d->cycles;
+    }
+
+  blk->branch = nios2_timing->branch &&
+                insn_is_cond_branch(blk->ops[blk->count - 1].opcode);
+}
+
+/* cycles of the first count ops */
+static unsigned32
+block_cycles(const nios2_block_t *blk, unsigned32 count)
+{
+  unsigned32 n, cycles = 0;
+
+  if (count == blk->count)
+    return blk->cycles;
+
+  for (n = 0; n < count; ++n)
+    cycles += blk->ops[n].cycles;
+
+  return cycles;
+}
+
+/* pc: virtual address, ppc: physical address (the same without MMU/MPU) */
+static nios2_block_t *
+block_lookup(unsigned32 pc, unsigned32 ppc, void **dispatch_table)
+{
+  nios2_block_t *blk = &cpu.decode->blocks[(ppc >> 2) & NIOS2_BLOCK_CACHE_MASK];
+  nios2_decoded_t *d;
+  unsigned32 addr;
+
+  if (blk->pc == pc && blk->ppc == ppc)
+    return blk;
+
+  block_retire(blk);
+  blk->prof = nios2_profiling ? avm_profile_counters(ppc) : NULL;
+  blk->count = 0;
+  for (d = blk->ops; blk->count < NIOS2_BLOCK_MAX_INSNS; ++d)
+    {
+      if (decode_insn(d, pc + blk->count * 4, ppc + blk->count * 4))
+        break;
+
+      if (dispatch_table)
+        d->handler = dispatch_table[NIOS2_DISPATCH_INDEX(d->opcode)];
+
+      ++blk->count;
+      if (decode_ends_block(d))
+        break;
+      if ((blk->prof || nios2_mmu_active) &&
+          ((ppc + blk->count * 4) & AVM_PAGE_MASK) == 0)
+        break;
+    }
+
+  if (blk->count == 0)
+    return NULL;  /* instruction fetch failed */
+
+  blk->pc = pc;
+  blk->ppc = ppc;
+  blk->helper = nios2_helper_at(pc);
+  block_timing(blk);
+
+  /* a block spans two code map granules (and pages) at most */
+  nios2_smp_lock();
+  addr = ppc;
+  CODE_MAP_BYTE(addr) |= CODE_MAP_BIT(addr);
+  avm_protect_code(addr);
+  addr = ppc + blk->count * 4 - 1;
+  CODE_MAP_BYTE(addr) |= CODE_MAP_BIT(addr);
+  avm_protect_code(addr);
+  nios2_smp_unlock();
+
+  return blk;
+}
+
+void
+nios2_decode_flush(void)
+{
+  unsigned32 n;
+
+  if (cpu.decode == NULL)
+    cpu.decode = (struct nios2_decode_cache *) calloc(1, sizeof(*cpu.decode));
+
+  for (n = 0; n < NIOS2_BLOCK_CACHE_SIZE; ++n)
+    block_retire(&cpu.decode->blocks[n]);
+
+  memset(cpu.decode->code_map, 0, sizeof(cpu.decode->code_map));
+
+  /* the pages may still hold the code of another core; a flush made
+     between runs is for all of them */
+  if (nios2_smp_cores == 1)
+    avm_unprotect_code();
+  else if (nios2_core_id == 0 && !nios2_smp_running)
+    nios2_smp_flush_others();
+}
+
+/* drop the blocks of this core only (see nios2_smp_code_written()) */
+void
+nios2_decode_invalidate_local(SIM_ADDR mem, int length)
+{
+  unsigned32 addr, end;
+
+  if (length <= 0 || cpu.decode == NULL)
+    return;
+
+  if ((unsigned32) length >= NIOS2_BLOCK_CACHE_SIZE * 4)
+    {
+      for (addr = 0; addr < NIOS2_BLOCK_CACHE_SIZE; ++addr)
+        block_retire(&cpu.decode->blocks[addr]);
+      memset(cpu.decode->code_map, 0, sizeof(cpu.decode->code_map));
+      return;
+    }
+
+  /* blocks are indexed by the physical fetch address, which may carry
+     the 0x80000000 no-cache bit */
+  mem &= ~0x80000000u;
+  end = mem + length;
+
+  for (addr = mem & ~((1u << NIOS2_CODE_MAP_SHIFT) - 1); addr < end;
+       addr += 1u << NIOS2_CODE_MAP_SHIFT)
+    if (CODE_MAP_BYTE(addr) & CODE_MAP_BIT(addr))
+      break;
+
+  if (addr >= end)
+    return; /* no code in this range */
+
+  /* any block overlapping [mem, end) starts at most
+     NIOS2_BLOCK_MAX_INSNS - 1 instructions before mem */
+  addr = mem & ~3u;
+  if (addr >= (NIOS2_BLOCK_MAX_INSNS - 1) * 4)
+    addr -= (NIOS2_BLOCK_MAX_INSNS - 1) * 4;
+  else
+    addr = 0;
+
+  for (; addr < end; addr += 4)
+    {
+      nios2_block_t *blk = &cpu.decode->blocks[(addr >> 2) & NIOS2_BLOCK_CACHE_MASK];
+
+      if (blk->pc != NIOS2_DECODE_INVALID_PC &&
+          (blk->ppc & ~0x80000000u) == addr && addr + blk->count * 4 > mem)
+        block_retire(blk);
+    }
+}
+
+/* the thread of the core is going away */
+void
+nios2_decode_release(void)
+{
+  free(cpu.decode);
+  cpu.decode = NULL;
+}
+
+void
+nios2_decode_invalidate(SIM_ADDR mem, int length)
+{
+  nios2_decode_invalidate_local(mem, length);
+  if (nios2_smp_cores > 1 && length > 0)
+    nios2_smp_code_written(mem, length);
+}
 
 int
 nios2_reset(void)
@@ -36,7 +474,7 @@ nios2_reset(void)
   cpu.regs.bstatus = 0;
   cpu.regs.ienable = 0;
   cpu.regs.ipending = 0;
-  cpu.regs.cpuid = cpu.features.cpuid;
+  cpu.regs.cpuid = cpu.features.cpuid + nios2_core_id;
   cpu.regs.ctl6 = 0xffffffff;
   cpu.regs.exception = 0;
   if (cpu.features.mmu)
@@ -66,6 +504,14 @@ nios2_reset(void)
       cpu.regs.mpuacc = 0xffffffff;
     }
 
+  cpu.cycles = 0;
+  cpu.insns = 0;
+  nios2_timing_reset();
+  nios2_cache_reset();
+  nios2_events_clear();
+  nios2_mmu_reset();
+  nios2_decode_flush();
+
   /* jump to reset vector */
   cpu.regs.pc = cpu.features.reset_addr;
 
@@ -74,14 +520,137 @@ nios2_reset(void)
   return 1;
 }
 
+/*
+ * Exceptions and control registers
+ *
+ * Interrupts are not polled by the interpreter.  Anything which may make
+ * an interrupt takable (an irq line, ienable, status.PIE) calls
+ * nios2_check_interrupt(), and the event queue enters the handler at the
+ * next block boundary.
+ */
+void
+nios2_exception(unsigned32 cause, unsigned32 ea)
+{
+  unsigned32 addr = cpu.features.exception_addr;
+
+  if (cpu.features.mmu)
+    {
+      int tlb = (cause >= NIOS2_EXCEPTION_TLB_MISS &&
+                 cause <= NIOS2_EXCEPTION_TLB_WRITE);
+
+      if (cause == NIOS2_EXCEPTION_TLB_MISS && (cpu.regs.status & NIOS2_STATUS_EH))
+        {
+          /* double TLB miss: ea and estatus still point to the first one */
+          cpu.regs.tlbmisc |= NIOS2_TLBMISC_DBL;
+          cpu.regs.exception = cause << NIOS2_EXCEPTION_CAUSE_SHIFT;
+          nios2_helpers_cancel();
+          btrace_record(cpu.regs.pc, addr);
+          cpu.regs.pc = addr;
+          return;
+        }
+
+      if (tlb && !(cpu.regs.status & NIOS2_STATUS_EH))
+        cpu.regs.tlbmisc |= NIOS2_TLBMISC_WE;
+      if (cause == NIOS2_EXCEPTION_TLB_MISS)
+        {
+          cpu.regs.tlbmisc &= ~NIOS2_TLBMISC_DBL;
+          addr = cpu.features.fast_tlb_miss_addr;
+        }
+    }
+
+  cpu.regs.estatus = cpu.regs.status;
+  cpu.regs.status &= ~(NIOS2_STATUS_PIE | NIOS2_STATUS_U);
+  if (cpu.features.mmu)
+    cpu.regs.status |= NIOS2_STATUS_EH;
+  cpu.regs.ea = ea;
+  cpu.regs.exception = cause << NIOS2_EXCEPTION_CAUSE_SHIFT;
+  nios2_helpers_cancel();
+  btrace_record(cpu.regs.pc, addr);
+  cpu.regs.pc = addr;
+}
+
+void
+nios2_write_ctl(int n, unsigned32 value)
+{
+  switch (n)
+    {
+      case 0:   /* status */
+        cpu.regs.status = value;
+        if (value & NIOS2_STATUS_PIE)
+          nios2_check_interrupt();
+        break;
+      case 1:   /* estatus */
+      case 2:   /* bstatus */
+        cpu.regs.array[SIM_NIOS2_STATUS_REGNUM + n] = value;
+        break;
+      case 3:   /* ienable */
+        cpu.regs.ienable = value;
+        nios2_update_ipending();
+        break;
+      case 8:   /* pteaddr */
+      case 9:   /* tlbacc */
+      case 10:  /* tlbmisc */
+      case 13:  /* config */
+      case 14:  /* mpubase */
+      case 15:  /* mpuacc */
+        nios2_mmu_write_ctl(n, value);
+        break;
+      default:  /* ipending, cpuid, exception, badaddr and reserved ones */
+        break;
+    }
+}
+
+static const char *const exception_names[] =
+  {
+    NULL, NULL, NULL, NULL,
+    "unimplemented_instruction",
+    "illegal_instruction_format",
+    "misaligned_data_address",
+    "misaligned_destination_address",
+    NULL, NULL,
+    "supervisor_only_instruction",
+  };
+
+#if WITH_THREADED_DISPATCH
+#define INSN_I(op)    insn_##op
+#define INSN_R(opx)   insn_0x3a_##opx
+#define DISPATCH()    goto *d->handler
+#else
+#define INSN_I(op)    case NIOS2_OP(op)
+#define INSN_R(opx)   case NIOS2_OP(0x3a)|NIOS2_OPX(opx)
+#define DISPATCH()    goto dispatch
+#endif
+
+/* translate the data address a for the access, or raise the fault */
+#define TRANSLATE_DATA(access) \
+  do \
+    { \
+      if (nios2_mmu_active && (c = nios2_translate(a, access, &a)) != 0) \
+        goto mmu_fault; \
+    } \
+  while (0)
+
+/* finish the current instruction and run the next one in the block */
+#define NEXT_INSN \
+  do \
+    { \
+      cpu.regs.zero = 0; \
+      if (++d == end) \
+        goto block_end; \
+      nextpc = d->pc + 4; \
+      DISPATCH(); \
+    } \
+  while (0)
+
 int
 nios2_interpret(int step)
 {
-  unsigned32 i, a, b, c;
-  unsigned32 opcode;
-  unsigned32 nextpc;
+  unsigned32 a, b, c;
+  unsigned32 nextpc, ppc;
+  nios2_block_t *blk;
+  nios2_decoded_t *d, *end;
+  void **table = NULL;
   int flags;
-  int magic;
   union {
     unsigned32  wu;
     signed32    w;
@@ -91,6 +660,37 @@ nios2_interpret(int step)
     signed8     b;
   } buf;
 
+#if WITH_THREADED_DISPATCH
+  static void *dispatch_table[NIOS2_DISPATCH_SIZE];
+  static int dispatch_ready;
+
+  if (!dispatch_ready)
+    {
+      int n;
+
+      for (n = 0; n < NIOS2_DISPATCH_SIZE; ++n)
+        dispatch_table[n] = &&unimplemented_instruction;
+#define I(op)   dispatch_table[op] = &&INSN_I(op);
+#define R(opx)  dispatch_table[0x40 | opx] = &&INSN_R(opx);
+      /* keep in sync with the handlers below */
+      R(0x31) I(0x04) R(0x0e) I(0x2c) I(0x0c) I(0x26) I(0x0e) I(0x2e)
+      I(0x16) I(0x36) I(0x1e) I(0x06) R(0x34) R(0x09) I(0x00) R(0x1d)
+      R(0x20) I(0x20) R(0x08) I(0x08) R(0x28) I(0x28) R(0x10) I(0x10)
+      R(0x30) I(0x30) R(0x18) I(0x18) R(0x25) R(0x24) R(0x01) R(0x0d)
+      I(0x01) I(0x07) I(0x27) I(0x03) I(0x23) I(0x0f) I(0x2f) I(0x0b)
+      I(0x2b) I(0x17) I(0x37) R(0x27) I(0x24) R(0x1f) R(0x17) R(0x07)
+      R(0x1c) R(0x06) R(0x16) I(0x34) I(0x14) R(0x05) R(0x03) R(0x02)
+      R(0x0b) R(0x13) R(0x12) R(0x3b) R(0x3a) R(0x1b) R(0x1a) I(0x05)
+      I(0x25) I(0x0d) I(0x2d) I(0x15) I(0x35) R(0x39) R(0x2d) R(0x1e)
+      I(0x3c) I(0x1c) R(0x26) R(0x2e) I(0x3b) I(0x1b) R(0x0c) R(0x04)
+      R(0x36) I(0x33) I(0x13) R(0x29) I(0x32)
+#undef I
+#undef R
+      dispatch_ready = 1;
+    }
+  table = dispatch_table;
+#endif
+
   if (step)
     {
       cpu.state = sim_stopped;
@@ -98,92 +698,107 @@ nios2_interpret(int step)
     }
   else
     cpu.state = sim_running;
-
-  magic = 0;
+  cpu.watch_hit = 0;
 
   do
     {
-      nextpc = cpu.regs.pc;
+      ppc = cpu.regs.pc;
+      if (nios2_mmu_active &&
+          (c = nios2_translate(cpu.regs.pc, NIOS2_ACCESS_FETCH, &ppc)) != 0)
+        {
+          nios2_exception(c, cpu.regs.pc + 4);
+          continue;
+        }
 
-      if (avm_read(nextpc, (unsigned char *) &i, 4, AVM_INSTRUCTION) != 4)
+      blk = block_lookup(cpu.regs.pc, ppc, table);
+      if (blk == NULL)
         {
-          sim_printf("instruction fetch failed (@%08x)\n", nextpc);
+          sim_printf("instruction fetch failed (@%08x)\n", cpu.regs.pc);
           return 0; /* instruction fetch failed */
         }
 
-      i = LE2H4(i);
-
-      opcode = NIOS2_OP(NIOS2_GET_OP(i));
-      if (opcode == NIOS2_OP(0x3a))
-        opcode |= NIOS2_OPX(NIOS2_GET_OPX(i));
-
-      // sim_printf("@%08x (%08x) op=0x%02x, opx=0x%02x\n", nextpc, i, NIOS2_GET_OP(opcode), NIOS2_GET_OPX(opcode));
+      if ((blk->helper || cpu.regs.pc == nios2_helper_return)
+          && nios2_helper_hook(blk->helper))
+        {
+          /* done natively, now at the return address */
+          if (cpu.cycles >= nios2_next_event)
+            nios2_events_process();
+          continue;
+        }
 
-      nextpc += 4;
-      switch(opcode)
+      d = blk->ops;
+      end = d + (step ? 1 : blk->count);
+      nextpc = d->pc + 4;
+#if WITH_THREADED_DISPATCH
+      DISPATCH();
+#else
+dispatch:
+      switch (d->opcode)
         {
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x31):  /* add c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] + cpu.regs.gpr[NIOS2_GET_B(i)];
-            break;
-          case NIOS2_OP(0x04):                  /* addi b,a,sv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] + (signed16) NIOS2_GET_IMM16(i);
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x0e):  /* and c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] & cpu.regs.gpr[NIOS2_GET_B(i)];
-            break;
-          case NIOS2_OP(0x2c):                  /* andhi b,a,sv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] & (NIOS2_GET_IMM16(i) << 16);
-            break;
-          case NIOS2_OP(0x0c):                  /* andi b,a,sv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] & NIOS2_GET_IMM16(i);
-            break;
-          case NIOS2_OP(0x26):                  /* beq a,b,sv */
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] == cpu.regs.gpr[NIOS2_GET_B(i)])
+#endif
+          INSN_R(0x31):   /* add c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              cpu.regs.gpr[d->a] + cpu.regs.gpr[d->b];
+            NEXT_INSN;
+          INSN_I(0x04):   /* addi b,a,sv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] + d->simm;
+            NEXT_INSN;
+          INSN_R(0x0e):   /* and c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              cpu.regs.gpr[d->a] & cpu.regs.gpr[d->b];
+            NEXT_INSN;
+          INSN_I(0x2c):   /* andhi b,a,sv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] & (d->uimm << 16);
+            NEXT_INSN;
+          INSN_I(0x0c):   /* andi b,a,sv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] & d->uimm;
+            NEXT_INSN;
+          INSN_I(0x26):   /* beq a,b,sv */
+            if (cpu.regs.gpr[d->a] == cpu.regs.gpr[d->b])
               goto branch;
-            break;
-          case NIOS2_OP(0x0e):                  /* bge a,b,sv */
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] >=
-                (signed32) cpu.regs.gpr[NIOS2_GET_B(i)])
+            NEXT_INSN;
+          INSN_I(0x0e):   /* bge a,b,sv */
+            if ((signed32) cpu.regs.gpr[d->a] >=
+                (signed32) cpu.regs.gpr[d->b])
               goto branch;
-            break;
-          case NIOS2_OP(0x2e):                  /* bgeu a,b,sv */
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] >= cpu.regs.gpr[NIOS2_GET_B(i)])
+            NEXT_INSN;
+          INSN_I(0x2e):   /* bgeu a,b,sv */
+            if (cpu.regs.gpr[d->a] >= cpu.regs.gpr[d->b])
               goto branch;
-            break;
-          case NIOS2_OP(0x16):                  /* blt a,b,sv */
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] <
-                (signed32) cpu.regs.gpr[NIOS2_GET_B(i)])
+            NEXT_INSN;
+          INSN_I(0x16):   /* blt a,b,sv */
+            if ((signed32) cpu.regs.gpr[d->a] <
+                (signed32) cpu.regs.gpr[d->b])
               goto branch;
-            break;
-          case NIOS2_OP(0x36):                  /* bltu a,b,sv */
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] < cpu.regs.gpr[NIOS2_GET_B(i)])
+            NEXT_INSN;
+          INSN_I(0x36):   /* bltu a,b,sv */
+            if (cpu.regs.gpr[d->a] < cpu.regs.gpr[d->b])
               goto branch;
-            break;
-          case NIOS2_OP(0x1e):                  /* bne a,b,sv */
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] != cpu.regs.gpr[NIOS2_GET_B(i)])
+            NEXT_INSN;
+          INSN_I(0x1e):   /* bne a,b,sv */
+            if (cpu.regs.gpr[d->a] != cpu.regs.gpr[d->b])
               goto branch;
-            break;
-          case NIOS2_OP(0x06):                  /* br sv */
-            if (NIOS2_GET_A(i) != 0 || NIOS2_GET_B(i) != 0)
+            NEXT_INSN;
+          INSN_I(0x06):   /* br sv */
+            if (d->a != 0 || d->b != 0)
               goto illegal_instruction_format;
 branch:
-            nextpc += (signed16) NIOS2_GET_IMM16(i);
-            if (nextpc & 3)
+            a = nextpc + d->simm;
+            if (a & 3)
               goto misaligned_destination_address;
+            nextpc = a;
 branch_trace:
-            btrace_record(cpu.regs.pc, nextpc);
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x34):  /* break imm5 */
-            if (NIOS2_GET_A(i) != 0 || NIOS2_GET_B(i) != 0 || NIOS2_GET_C(i) != 0x1e)
+            btrace_record(d->pc, nextpc);
+            NEXT_INSN;
+          INSN_R(0x34):   /* break imm5 */
+            if (d->a != 0 || d->b != 0 || d->c != 0x1e)
               goto illegal_instruction_format;
             // cpu.regs.bstatus = cpu.regs.status;
             // cpu.regs.status &= ~(NIOS2_STATUS_PIE | NIOS2_STATUS_U);
@@ -191,10 +806,10 @@ branch_trace:
             // nextpc = cpu.features.break_addr;
             cpu.state = sim_stopped;
             cpu.signal = TARGET_SIGNAL_TRAP;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x09):  /* bret */
-            if (NIOS2_GET_A(i) != 0x1e || NIOS2_GET_B(i) != 0 ||
-                NIOS2_GET_C(i) != 0 || NIOS2_GET_IMM5(i) != 0)
+            NEXT_INSN;
+          INSN_R(0x09):   /* bret */
+            if (d->a != 0x1e || d->b != 0 ||
+                d->c != 0 || d->imm5 != 0)
               goto illegal_instruction_format;
             a = cpu.regs.ba;
             if (a & 3)
@@ -202,133 +817,148 @@ branch_trace:
             if (cpu.regs.status & NIOS2_STATUS_U)
               goto supervisor_only_instruction;
             cpu.regs.status = cpu.regs.bstatus;
+            if (cpu.regs.status & NIOS2_STATUS_PIE)
+              nios2_check_interrupt();
             nextpc = a;
             goto branch_trace;
-          case NIOS2_OP(0x00):                  /* call imm26 */
+          INSN_I(0x00):   /* call imm26 */
             cpu.regs.ra = nextpc;
-            nextpc = NIOS2_GET_IMM26(i) * 4;
+            nextpc = d->imm26 * 4;
             goto branch_trace;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x1d):  /* callr a */
-            if (NIOS2_GET_B(i) != 0 || NIOS2_GET_C(i) != 0x1f || NIOS2_GET_IMM5(i) != 0)
+          INSN_R(0x1d):   /* callr a */
+            if (d->b != 0 || d->c != 0x1f || d->imm5 != 0)
               goto illegal_instruction_format;
-            a = cpu.regs.gpr[NIOS2_GET_A(i)];
+            a = cpu.regs.gpr[d->a];
             if (a & 3)
               goto misaligned_destination_address;
             cpu.regs.ra = nextpc;
             nextpc = a;
             goto branch_trace;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x20):  /* cmpeq c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+          INSN_R(0x20):   /* cmpeq c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] == cpu.regs.gpr[NIOS2_GET_B(i)])
+            if (cpu.regs.gpr[d->a] == cpu.regs.gpr[d->b])
               c = 1;
             else
               c = 0;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x20):                  /* cmpeqi b,a,sv */
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] ==
-                (signed16) NIOS2_GET_IMM16(i))
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_I(0x20):   /* cmpeqi b,a,sv */
+            if ((signed32) cpu.regs.gpr[d->a] ==
+                d->simm)
               b = 1;
             else
               b = 0;
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x08):  /* cmpge c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+            cpu.regs.gpr[d->b] = b;
+            NEXT_INSN;
+          INSN_R(0x08):   /* cmpge c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] >=
-                (signed32) cpu.regs.gpr[NIOS2_GET_B(i)])
+            if ((signed32) cpu.regs.gpr[d->a] >=
+                (signed32) cpu.regs.gpr[d->b])
               c = 1;
             else
               c = 0;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x08):                  /* cmpgei b,a,sv */
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] >=
-                (signed16) NIOS2_GET_IMM16(i))
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_I(0x08):   /* cmpgei b,a,sv */
+            if ((signed32) cpu.regs.gpr[d->a] >=
+                d->simm)
               b = 1;
             else
               b = 0;
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x28):  /* cmpgeu c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+            cpu.regs.gpr[d->b] = b;
+            NEXT_INSN;
+          INSN_R(0x28):   /* cmpgeu c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] >= cpu.regs.gpr[NIOS2_GET_B(i)])
+            if (cpu.regs.gpr[d->a] >= cpu.regs.gpr[d->b])
               c = 1;
             else
               c = 0;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x28):                  /* cmpgeui b,a,sv */
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] >= NIOS2_GET_IMM16(i))
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_I(0x28):   /* cmpgeui b,a,sv */
+            if (cpu.regs.gpr[d->a] >= d->uimm)
               b = 1;
             else
               b = 0;
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x10):  /* cmplt c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+            cpu.regs.gpr[d->b] = b;
+            NEXT_INSN;
+          INSN_R(0x10):   /* cmplt c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] <
-                (signed32) cpu.regs.gpr[NIOS2_GET_B(i)])
+            if ((signed32) cpu.regs.gpr[d->a] <
+                (signed32) cpu.regs.gpr[d->b])
               c = 1;
             else
               c = 0;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x10):                  /* cmplti b,a,sv */
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] <
-                (signed16) NIOS2_GET_IMM16(i))
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_I(0x10):   /* cmplti b,a,sv */
+            if ((signed32) cpu.regs.gpr[d->a] <
+                d->simm)
               b = 1;
             else
               b = 0;
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x30):  /* cmpltu c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+            cpu.regs.gpr[d->b] = b;
+            NEXT_INSN;
+          INSN_R(0x30):   /* cmpltu c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] < cpu.regs.gpr[NIOS2_GET_B(i)])
+            if (cpu.regs.gpr[d->a] < cpu.regs.gpr[d->b])
               c = 1;
             else
               c = 0;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x30):                  /* cmpltui b,a,sv */
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] < NIOS2_GET_IMM16(i))
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_I(0x30):   /* cmpltui b,a,sv */
+            if (cpu.regs.gpr[d->a] < d->uimm)
               b = 1;
             else
               b = 0;
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x18):  /* cmpne c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+            cpu.regs.gpr[d->b] = b;
+            NEXT_INSN;
+          INSN_R(0x18):   /* cmpne c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            if (cpu.regs.gpr[NIOS2_GET_A(i)] != cpu.regs.gpr[NIOS2_GET_B(i)])
+            if (cpu.regs.gpr[d->a] != cpu.regs.gpr[d->b])
               c = 1;
             else
               c = 0;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x18):                  /* cmpnei b,a,sv */
-            if ((signed32) cpu.regs.gpr[NIOS2_GET_A(i)] !=
-                (signed16) NIOS2_GET_IMM16(i))
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_I(0x18):   /* cmpnei b,a,sv */
+            if ((signed32) cpu.regs.gpr[d->a] !=
+                d->simm)
               b = 1;
             else
               b = 0;
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          /* TODO: custom */
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x25):  /* div c,a,b */
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x24):  /* divu c,a,b */
+            cpu.regs.gpr[d->b] = b;
+            NEXT_INSN;
+          INSN_I(0x32):   /* custom n,c,a,b */
+            {
+              const nios2_custom_slot_t *s =
+                &nios2_custom_table[NIOS2_CUSTOM_N(d->insn)];
+
+              if (s->handler == NULL)
+                goto unimplemented_instruction;
+              c = s->handler(s->priv, d->insn,
+                (d->insn & NIOS2_CUSTOM_READRA) ? cpu.regs.gpr[d->a] : 0,
+                (d->insn & NIOS2_CUSTOM_READRB) ? cpu.regs.gpr[d->b] : 0);
+              if (d->insn & NIOS2_CUSTOM_WRITERC)
+                cpu.regs.gpr[d->c] = c;
+            }
+            NEXT_INSN;
+          INSN_R(0x25):   /* div c,a,b */
+          INSN_R(0x24):   /* divu c,a,b */
             if (!cpu.features.hwdiv)
               goto unimplemented_instruction;
-            if (NIOS2_GET_IMM5(i) != 0)
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            a = cpu.regs.gpr[NIOS2_GET_A(i)];
-            b = cpu.regs.gpr[NIOS2_GET_B(i)];
-            if (opcode & NIOS2_OPX(1))
+            a = cpu.regs.gpr[d->a];
+            b = cpu.regs.gpr[d->b];
+            if (d->opcode & NIOS2_OPX(1))
               {
                 /* signed */
                 if (b == 0)
@@ -346,11 +976,11 @@ branch_trace:
                 else
                   c = a / b;
               }
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x01):  /* eret */
-            if (NIOS2_GET_A(i) != 0x1d || NIOS2_GET_B(i) != 0x1e ||
-                NIOS2_GET_C(i) != 0 || NIOS2_GET_IMM5(i) != 0)
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_R(0x01):   /* eret */
+            if (d->a != 0x1d || d->b != 0x1e ||
+                d->c != 0 || d->imm5 != 0)
               goto illegal_instruction_format;
             a = cpu.regs.ea;
             if (a & 3)
@@ -358,135 +988,180 @@ branch_trace:
             if (cpu.regs.status & NIOS2_STATUS_U)
               goto supervisor_only_instruction;
             cpu.regs.status = cpu.regs.estatus;
+            if (cpu.regs.status & NIOS2_STATUS_PIE)
+              nios2_check_interrupt();
             nextpc = a;
             goto branch_trace;
-          /* TODO: flushd */
-          /* TODO: flushda */
-          /* TODO: flushi */
-          /* TODO: flushp */
-          /* TODO: initd */
-          /* TODO: initda */
-          /* TODO: initi */
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x0d):  /* jmp a */
-            if (NIOS2_GET_B(i) != 0 || NIOS2_GET_C(i) != 0 || NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            a = cpu.regs.gpr[NIOS2_GET_A(i)];
+          INSN_I(0x3b):   /* flushd sv(a) */
+            nios2_dcache_op(NIOS2_DCACHE_FLUSHD, cpu.regs.gpr[d->a] + d->simm);
+            NEXT_INSN;
+          INSN_I(0x1b):   /* flushda sv(a) */
+            nios2_dcache_op(NIOS2_DCACHE_FLUSHDA, cpu.regs.gpr[d->a] + d->simm);
+            NEXT_INSN;
+          INSN_R(0x0c):   /* flushi a */
+            if (d->b != 0 || d->c != 0 || d->imm5 != 0)
+              goto illegal_instruction_format;
+            nios2_icache_op(cpu.regs.gpr[d->a]);
+            NEXT_INSN;
+          INSN_R(0x04):   /* flushp */
+          INSN_R(0x36):   /* sync */
+            if (d->a != 0 || d->b != 0 || d->c != 0 || d->imm5 != 0)
+              goto illegal_instruction_format;
+            NEXT_INSN;
+          INSN_I(0x33):   /* initd sv(a) */
+            if (cpu.regs.status & NIOS2_STATUS_U)
+              goto supervisor_only_instruction;
+            nios2_dcache_op(NIOS2_DCACHE_INITD, cpu.regs.gpr[d->a] + d->simm);
+            NEXT_INSN;
+          INSN_I(0x13):   /* initda sv(a) */
+            if (cpu.regs.status & NIOS2_STATUS_U)
+              goto supervisor_only_instruction;
+            nios2_dcache_op(NIOS2_DCACHE_INITDA, cpu.regs.gpr[d->a] + d->simm);
+            NEXT_INSN;
+          INSN_R(0x29):   /* initi a */
+            if (d->b != 0 || d->c != 0 || d->imm5 != 0)
+              goto illegal_instruction_format;
+            if (cpu.regs.status & NIOS2_STATUS_U)
+              goto supervisor_only_instruction;
+            nios2_icache_op(cpu.regs.gpr[d->a]);
+            NEXT_INSN;
+          INSN_R(0x0d):   /* jmp a */
+            if (d->b != 0 || d->c != 0 || d->imm5 != 0)
+              goto illegal_instruction_format;
+            a = cpu.regs.gpr[d->a];
             if (a & 3)
               goto misaligned_destination_address;
             nextpc = a;
             goto branch_trace;
-          case NIOS2_OP(0x01):                  /* jmpi imm26 */
-            nextpc = NIOS2_GET_IMM26(i) * 4;
+          INSN_I(0x01):   /* jmpi imm26 */
+            nextpc = d->imm26 * 4;
             goto branch_trace;
-          case NIOS2_OP(0x07):                  /* ldb b,sv(a) */
-          case NIOS2_OP(0x27):                  /* ldbio b,sv(a) */
-          case NIOS2_OP(0x03):                  /* ldbu b,sv(a) */
-          case NIOS2_OP(0x23):                  /* ldbuio b,sv(a) */
-          case NIOS2_OP(0x0f):                  /* ldh b,sv(a) */
-          case NIOS2_OP(0x2f):                  /* ldhio b,sv(a) */
-          case NIOS2_OP(0x0b):                  /* ldhu b,sv(a) */
-          case NIOS2_OP(0x2b):                  /* ldhuio b,sv(a) */
-          case NIOS2_OP(0x17):                  /* ldw b,sv(a) */
-          case NIOS2_OP(0x37):                  /* ldwio b,sv(a) */
-            if (opcode & NIOS2_OP(0x10))
-              c = 4;
-            else if (opcode & NIOS2_OP(0x08))
-              c = 2;
-            else
-              c = 1;
-
-            a = cpu.regs.gpr[NIOS2_GET_A(i)] + (signed16) NIOS2_GET_IMM16(i);
-            if ((a & (c - 1)) != 0)
+          INSN_I(0x07):   /* ldb b,sv(a) */
+          INSN_I(0x27):   /* ldbio b,sv(a) */
+          INSN_I(0x03):   /* ldbu b,sv(a) */
+          INSN_I(0x23):   /* ldbuio b,sv(a) */
+            a = cpu.regs.gpr[d->a] + d->simm;
+            TRANSLATE_DATA(NIOS2_ACCESS_READ);
+            flags = (d->opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0;
+            if (avm_load8(a, &buf.bu, flags) != 1)
+              goto load_failed;
+            b = (d->opcode & NIOS2_OP(0x04)) ? (signed8) buf.b : buf.bu;
+            goto load_done;
+          INSN_I(0x0f):   /* ldh b,sv(a) */
+          INSN_I(0x2f):   /* ldhio b,sv(a) */
+          INSN_I(0x0b):   /* ldhu b,sv(a) */
+          INSN_I(0x2b):   /* ldhuio b,sv(a) */
+            a = cpu.regs.gpr[d->a] + d->simm;
+            if ((a & 1) != 0)
               goto misaligned_data_address;
-
-            flags = AVM_DATA | ((opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0);
-            if (avm_read(a, (unsigned char *) &buf, c, AVM_DATA | flags) != c)
-              /* TODO: data access failed */
-              b = 0xffffffff;
-            else if (c == 1)
-              b = (opcode & NIOS2_OP(0x04)) ? (signed8) buf.b : buf.bu;
-            else if (c == 2)
-              b = (opcode & NIOS2_OP(0x04)) ? (signed16) buf.h : buf.hu;
-            else
-              b = buf.wu;
-
-            cpu.regs.gpr[NIOS2_GET_B(i)] = b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x27):  /* mul c,a,b */
+            TRANSLATE_DATA(NIOS2_ACCESS_READ);
+            flags = (d->opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0;
+            if (avm_load16(a, &buf.hu, flags) != 2)
+              goto load_failed;
+            b = (d->opcode & NIOS2_OP(0x04)) ? (signed16) buf.h : buf.hu;
+            goto load_done;
+          INSN_I(0x17):   /* ldw b,sv(a) */
+          INSN_I(0x37):   /* ldwio b,sv(a) */
+            a = cpu.regs.gpr[d->a] + d->simm;
+            if ((a & 3) != 0)
+              goto misaligned_data_address;
+            TRANSLATE_DATA(NIOS2_ACCESS_READ);
+            flags = (d->opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0;
+            if (avm_load32(a, &buf.wu, flags) != 4)
+              goto load_failed;
+            b = buf.wu;
+            goto load_done;
+load_failed:
+            /* TODO: data access failed */
+            cpu.regs.gpr[d->b] = 0xffffffff;
+            NEXT_INSN;
+load_done:
+            cpu.regs.gpr[d->b] = b;
+            if (nios2_dcache_enabled)
+              cpu.cycles += nios2_dcache_access(a, 0, flags);
+            if (cpu.state != sim_running)
+              end = d + 1;  /* stopped by a watchpoint */
+            NEXT_INSN;
+          INSN_R(0x27):   /* mul c,a,b */
             if (!cpu.features.hwmul)
               goto unimplemented_instruction;
-            if (NIOS2_GET_IMM5(i) != 0)
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] * cpu.regs.gpr[NIOS2_GET_B(i)];
-            break;
-          case NIOS2_OP(0x24):                  /* muli b,a,sv */
+            cpu.regs.gpr[d->c] =
+              cpu.regs.gpr[d->a] * cpu.regs.gpr[d->b];
+            NEXT_INSN;
+          INSN_I(0x24):   /* muli b,a,sv */
             if (!cpu.features.hwmul)
               goto unimplemented_instruction;
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] * (signed16) NIOS2_GET_IMM16(i);
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x1f):  /* mulxss c,a,b */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] * d->simm;
+            NEXT_INSN;
+          INSN_R(0x1f):   /* mulxss c,a,b */
             if (!cpu.features.hwmulx)
               goto unimplemented_instruction;
-            if (NIOS2_GET_IMM5(i) != 0)
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              ((signed64) cpu.regs.gpr[NIOS2_GET_A(i)] *
-                (signed32) cpu.regs.gpr[NIOS2_GET_B(i)]) >> 32;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x17):  /* mulxsu c,a,b */
+            cpu.regs.gpr[d->c] =
+              ((signed64) cpu.regs.gpr[d->a] *
+                (signed32) cpu.regs.gpr[d->b]) >> 32;
+            NEXT_INSN;
+          INSN_R(0x17):   /* mulxsu c,a,b */
             if (!cpu.features.hwmulx)
               goto unimplemented_instruction;
-            if (NIOS2_GET_IMM5(i) != 0)
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              ((signed64) cpu.regs.gpr[NIOS2_GET_A(i)] *
-                (unsigned32) cpu.regs.gpr[NIOS2_GET_B(i)]) >> 32;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x07):  /* mulxuu c,a,b */
+            cpu.regs.gpr[d->c] =
+              ((signed64) cpu.regs.gpr[d->a] *
+                (unsigned32) cpu.regs.gpr[d->b]) >> 32;
+            NEXT_INSN;
+          INSN_R(0x07):   /* mulxuu c,a,b */
             if (!cpu.features.hwmulx)
               goto unimplemented_instruction;
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              ((unsigned64) cpu.regs.gpr[NIOS2_GET_A(i)] *
-                (unsigned32) cpu.regs.gpr[NIOS2_GET_B(i)]) >> 32;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x1c):  /* nextpc c */
-            if (NIOS2_GET_A(i) != 0 || NIOS2_GET_B(i) != 0 || NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = nextpc;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x06):  /* nor c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              ~(cpu.regs.gpr[NIOS2_GET_A(i)] | cpu.regs.gpr[NIOS2_GET_B(i)]);
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x16):  /* or c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] | cpu.regs.gpr[NIOS2_GET_B(i)];
-            break;
-          case NIOS2_OP(0x34):                  /* orhi b,a,uv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] | (NIOS2_GET_IMM16(i) << 16);
-            break;
-          case NIOS2_OP(0x14):                  /* ori b,a,uv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] | NIOS2_GET_IMM16(i);
-            if (NIOS2_GET_B(i) != 0 || NIOS2_GET_A(i) != 0)
-              break;
-            magic = NIOS2_GET_IMM16(i);
-            switch(magic)
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              ((unsigned64) cpu.regs.gpr[d->a] *
+                (unsigned32) cpu.regs.gpr[d->b]) >> 32;
+            NEXT_INSN;
+          INSN_R(0x1c):   /* nextpc c */
+            if (d->a != 0 || d->b != 0 || d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] = nextpc;
+            NEXT_INSN;
+          INSN_R(0x06):   /* nor c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              ~(cpu.regs.gpr[d->a] | cpu.regs.gpr[d->b]);
+            NEXT_INSN;
+          INSN_R(0x16):   /* or c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              cpu.regs.gpr[d->a] | cpu.regs.gpr[d->b];
+            NEXT_INSN;
+          INSN_I(0x34):   /* orhi b,a,uv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] | (d->uimm << 16);
+            NEXT_INSN;
+          INSN_I(0x14):   /* ori b,a,uv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] | d->uimm;
+            if (d->b != 0 || d->a != 0)
+              NEXT_INSN;
+            switch(d->uimm)
               {
-                case NIOS2_SYS_MAGIC:
-                  goto keep_magic;
                 case NIOS2_SYS_WRITE:
-                  /* r4: file, r5: ptr, r6: len */
-                  cpu.regs.gpr[2] = sim_sys_write(cpu.regs.gpr[4], cpu.regs.gpr[5], cpu.regs.gpr[6]);
+                case NIOS2_SYS_READ:
+                case NIOS2_SYS_OPEN:
+                case NIOS2_SYS_CLOSE:
+                case NIOS2_SYS_LSEEK:
+                case NIOS2_SYS_FSTAT:
+                case NIOS2_SYS_GETTIMEOFDAY:
+                  /* r4-r6: arguments, r2: result, r3: errno */
+                  sim_sys_call(d->uimm);
+                  if (blk->pc == NIOS2_DECODE_INVALID_PC)
+                    end = d + 1;  /* read over this block */
                   break;
                 case NIOS2_SYS__EXIT:
                   /* r4: exitcode */
@@ -494,121 +1169,137 @@ branch_trace:
                   cpu.state = sim_exited;
                   break;
               }
-            break;
-          /* TODO: rdctl */
+            NEXT_INSN;
+          INSN_R(0x26):   /* rdctl c,ctlN */
+            if (d->a != 0 || d->b != 0)
+              goto illegal_instruction_format;
+            if (cpu.regs.status & NIOS2_STATUS_U)
+              goto supervisor_only_instruction;
+            cpu.regs.gpr[d->c] = cpu.regs.array[SIM_NIOS2_STATUS_REGNUM + d->imm5];
+            NEXT_INSN;
           /* TODO: rdprs */
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x05):  /* ret */
-            if (NIOS2_GET_A(i) != 0x1f || NIOS2_GET_B(i) != 0 ||
-                NIOS2_GET_C(i) != 0 || NIOS2_GET_IMM5(i) != 0)
+          INSN_R(0x05):   /* ret */
+            if (d->a != 0x1f || d->b != 0 ||
+                d->c != 0 || d->imm5 != 0)
               goto illegal_instruction_format;
-            nextpc = cpu.regs.ra;
-            if (nextpc & 3)
+            a = cpu.regs.ra;
+            if (a & 3)
               goto misaligned_destination_address;
+            nextpc = a;
             goto branch_trace;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x03):  /* rol c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+          INSN_R(0x03):   /* rol c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            b = cpu.regs.gpr[NIOS2_GET_B(i)] & 31;
+            b = cpu.regs.gpr[d->b] & 31;
             goto rotate;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x02):  /* roli c,a,imm5 */
-            if (NIOS2_GET_B(i) != 0)
+          INSN_R(0x02):   /* roli c,a,imm5 */
+            if (d->b != 0)
               goto illegal_instruction_format;
-            b = NIOS2_GET_IMM5(i);
+            b = d->imm5;
             goto rotate;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x0b):  /* ror c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+          INSN_R(0x0b):   /* ror c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            b = (32 - (cpu.regs.gpr[NIOS2_GET_B(i)] & 31)) & 31;
+            b = (32 - (cpu.regs.gpr[d->b] & 31)) & 31;
 rotate:
-            a = cpu.regs.gpr[NIOS2_GET_A(i)];
+            a = cpu.regs.gpr[d->a];
             if (b == 0)
               c = a;
             else
               c = (a << b) | (a >> (32 - b));
-            cpu.regs.gpr[NIOS2_GET_C(i)] = c;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x13):  /* sll c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            b = cpu.regs.gpr[NIOS2_GET_B(i)] & 31;
-            cpu.regs.gpr[NIOS2_GET_C(i)] = cpu.regs.gpr[NIOS2_GET_A(i)] << b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x12):  /* slli c,a,imm5 */
-            if (NIOS2_GET_B(i) != 0)
-              goto illegal_instruction_format;
-            b = NIOS2_GET_IMM5(i);
-            cpu.regs.gpr[NIOS2_GET_C(i)] = cpu.regs.gpr[NIOS2_GET_A(i)] << b;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x3b):  /* sra c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            b = cpu.regs.gpr[NIOS2_GET_B(i)] & 31;
+            cpu.regs.gpr[d->c] = c;
+            NEXT_INSN;
+          INSN_R(0x13):   /* sll c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            b = cpu.regs.gpr[d->b] & 31;
+            cpu.regs.gpr[d->c] = cpu.regs.gpr[d->a] << b;
+            NEXT_INSN;
+          INSN_R(0x12):   /* slli c,a,imm5 */
+            if (d->b != 0)
+              goto illegal_instruction_format;
+            b = d->imm5;
+            cpu.regs.gpr[d->c] = cpu.regs.gpr[d->a] << b;
+            NEXT_INSN;
+          INSN_R(0x3b):   /* sra c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            b = cpu.regs.gpr[d->b] & 31;
             goto shift_right_arithmetic;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x3a):  /* srai c,a,imm5 */
-            if (NIOS2_GET_B(i) != 0)
+          INSN_R(0x3a):   /* srai c,a,imm5 */
+            if (d->b != 0)
               goto illegal_instruction_format;
-            b = NIOS2_GET_IMM5(i);
+            b = d->imm5;
 shift_right_arithmetic:
-            cpu.regs.gpr[NIOS2_GET_C(i)] = cpu.regs.gpr[NIOS2_GET_A(i)];
+            cpu.regs.gpr[d->c] = cpu.regs.gpr[d->a];
             for (; b > 0; --b)
-              *(signed32 *) &cpu.regs.gpr[NIOS2_GET_C(i)] /= 2;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x1b):  /* srl c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
+              *(signed32 *) &cpu.regs.gpr[d->c] /= 2;
+            NEXT_INSN;
+          INSN_R(0x1b):   /* srl c,a,b */
+            if (d->imm5 != 0)
               goto illegal_instruction_format;
-            b = cpu.regs.gpr[NIOS2_GET_B(i)] & 31;
+            b = cpu.regs.gpr[d->b] & 31;
             goto shift_right_logical;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x1a):  /* srli c,a,imm5 */
-            if (NIOS2_GET_B(i) != 0)
+          INSN_R(0x1a):   /* srli c,a,imm5 */
+            if (d->b != 0)
               goto illegal_instruction_format;
-            b = NIOS2_GET_IMM5(i);
+            b = d->imm5;
 shift_right_logical:
-            cpu.regs.gpr[NIOS2_GET_C(i)] = cpu.regs.gpr[NIOS2_GET_A(i)];
+            cpu.regs.gpr[d->c] = cpu.regs.gpr[d->a];
             for (; b > 0; --b)
-              cpu.regs.gpr[NIOS2_GET_C(i)] /= 2;
-            break;
-          case NIOS2_OP(0x05):                  /* stb b,sv,a */
-          case NIOS2_OP(0x25):                  /* stbio b,sv,a */
-          case NIOS2_OP(0x0d):                  /* sth b,sv,a */
-          case NIOS2_OP(0x2d):                  /* sthio b,sv,a */
-          case NIOS2_OP(0x15):                  /* stw b,sv,a */
-          case NIOS2_OP(0x35):                  /* stwio b,sv,a */
-            b = cpu.regs.gpr[NIOS2_GET_B(i)];
-            if (opcode & NIOS2_OP(0x10))
-              {
-                c = 4;
-                buf.wu = b;
-              }
-            else if (opcode & NIOS2_OP(0x08))
-              {
-                c = 2;
-                buf.hu = b;
-              }
-            else
-              {
-                c = 1;
-                buf.bu = b;
-              }
-
-            a = cpu.regs.gpr[NIOS2_GET_A(i)] + (signed16) NIOS2_GET_IMM16(i);
-            if ((a & (c - 1)) != 0)
+              cpu.regs.gpr[d->c] /= 2;
+            NEXT_INSN;
+          INSN_I(0x05):   /* stb b,sv,a */
+          INSN_I(0x25):   /* stbio b,sv,a */
+            a = cpu.regs.gpr[d->a] + d->simm;
+            TRANSLATE_DATA(NIOS2_ACCESS_WRITE);
+            flags = (d->opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0;
+            if (avm_store8(a, cpu.regs.gpr[d->b], flags) != 1)
+              goto store_failed;
+            goto store_done;
+          INSN_I(0x0d):   /* sth b,sv,a */
+          INSN_I(0x2d):   /* sthio b,sv,a */
+            a = cpu.regs.gpr[d->a] + d->simm;
+            if ((a & 1) != 0)
               goto misaligned_data_address;
-
-            flags = AVM_DATA | ((opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0);
-            if (avm_write(a, (unsigned char *) &buf, c, AVM_DATA | flags) != c)
-              /* TODO: data access failed */
-              goto nonmpu_region_violation;
-            break;
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x39):  /* sub c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] - cpu.regs.gpr[NIOS2_GET_B(i)];
-            break;
-          /* TODO: sync */
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x2d):  /* trap imm5 */
-            if (NIOS2_GET_A(i) != 0 || NIOS2_GET_B(i) != 0 || NIOS2_GET_C(i) != 0x1d)
+            TRANSLATE_DATA(NIOS2_ACCESS_WRITE);
+            flags = (d->opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0;
+            if (avm_store16(a, cpu.regs.gpr[d->b], flags) != 2)
+              goto store_failed;
+            goto store_done;
+          INSN_I(0x15):   /* stw b,sv,a */
+          INSN_I(0x35):   /* stwio b,sv,a */
+            a = cpu.regs.gpr[d->a] + d->simm;
+            if ((a & 3) != 0)
+              goto misaligned_data_address;
+            TRANSLATE_DATA(NIOS2_ACCESS_WRITE);
+            flags = (d->opcode & NIOS2_OP(0x20)) != 0 ? AVM_NOCACHE : 0;
+            if (avm_store32(a, cpu.regs.gpr[d->b], flags) != 4)
+              goto store_failed;
+store_done:
+            if (nios2_dcache_enabled)
+              cpu.cycles += nios2_dcache_access(a, 1, flags);
+            if (blk->pc == NIOS2_DECODE_INVALID_PC || cpu.state != sim_running)
+              end = d + 1;  /* this block has just been overwritten, or a
+                               watchpoint stops the core */
+            NEXT_INSN;
+store_failed:
+            /* TODO: data access failed */
+            goto nonmpu_region_violation;
+          INSN_R(0x39):   /* sub c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              cpu.regs.gpr[d->a] - cpu.regs.gpr[d->b];
+            NEXT_INSN;
+          INSN_R(0x2d):   /* trap imm5 */
+            if (d->a != 0 || d->b != 0 || d->c != 0x1d)
               goto illegal_instruction_format;
+            if (cpu.features.mmu || cpu.features.mpu)
+              {
+                c = NIOS2_EXCEPTION_TRAP;
+                goto exception;
+              }
             // cpu.regs.estatus = cpu.regs.status;
             // cpu.regs.status &= ~(NIOS2_STATUS_PIE | NIOS2_STATUS_U);
             // cpu.regs.ea = nextpc;
@@ -616,55 +1307,108 @@ shift_right_logical:
             cpu.state = sim_stopped;
             cpu.signal = TARGET_SIGNAL_TRAP;
             nextpc -= 4;
-            break;
-          /* TODO: wrctl */
+            NEXT_INSN;
+          INSN_R(0x2e):   /* wrctl ctlN,a */
+            if (d->b != 0 || d->c != 0)
+              goto illegal_instruction_format;
+            if (cpu.regs.status & NIOS2_STATUS_U)
+              goto supervisor_only_instruction;
+            nios2_write_ctl(d->imm5, cpu.regs.gpr[d->a]);
+            NEXT_INSN;
           /* TODO: wrprs */
-          case NIOS2_OP(0x3a)|NIOS2_OPX(0x1e):  /* xor c,a,b */
-            if (NIOS2_GET_IMM5(i) != 0)
-              goto illegal_instruction_format;
-            cpu.regs.gpr[NIOS2_GET_C(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] ^ cpu.regs.gpr[NIOS2_GET_B(i)];
-            break;
-          case NIOS2_OP(0x3c):                  /* xorhi b,a,uv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] ^ (NIOS2_GET_IMM16(i) << 16);
-            break;
-          case NIOS2_OP(0x1c):                  /* xori b,a,uv */
-            cpu.regs.gpr[NIOS2_GET_B(i)] =
-              cpu.regs.gpr[NIOS2_GET_A(i)] ^ NIOS2_GET_IMM16(i);
-            break;
+          INSN_R(0x1e):   /* xor c,a,b */
+            if (d->imm5 != 0)
+              goto illegal_instruction_format;
+            cpu.regs.gpr[d->c] =
+              cpu.regs.gpr[d->a] ^ cpu.regs.gpr[d->b];
+            NEXT_INSN;
+          INSN_I(0x3c):   /* xorhi b,a,uv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] ^ (d->uimm << 16);
+            NEXT_INSN;
+          INSN_I(0x1c):   /* xori b,a,uv */
+            cpu.regs.gpr[d->b] =
+              cpu.regs.gpr[d->a] ^ d->uimm;
+            NEXT_INSN;
+#if !WITH_THREADED_DISPATCH
           default:
             goto unimplemented_instruction;
         }
+#endif
 
-      magic = 0;
-keep_magic:
-      cpu.regs.zero = 0;
+block_end:
       cpu.regs.pc = nextpc;
+      cpu.insns += end - blk->ops;
+      cpu.cycles += block_cycles(blk, end - blk->ops);
+      if (nios2_icache_enabled)
+        cpu.cycles += nios2_icache_fetch(blk->ppc, (end - blk->ops) * 4);
+      if (blk->branch && end - blk->ops == blk->count)
+        {
+          d = end - 1;
+          ++nios2_timing_stats.branches;
+          cpu.cycles += nios2_timing->branch(d->pc, d->pc + 4 + d->simm,
+                                             nextpc != d->pc + 4);
+        }
+      if (blk->prof)
+        block_profile(blk, end - blk->ops);
+      if (cpu.cycles >= nios2_next_event)
+        nios2_events_process();
       continue;
 
 nonmpu_region_violation:
       sim_printf("nonmpu_region_violation\n");
       goto stop_running;
 unimplemented_instruction:
-      sim_printf("unimplemented_instruction\n");
-      goto stop_running;
+      c = NIOS2_EXCEPTION_UNIMPLEMENTED;
+      goto exception;
 misaligned_data_address:
-      sim_printf("misaligned_data_address\n");
-      goto stop_running;
+      c = NIOS2_EXCEPTION_MISALIGNED_DATA;
+      goto exception;
 misaligned_destination_address:
-      sim_printf("misaligned_destination_address\n");
-      goto stop_running;
+      c = NIOS2_EXCEPTION_MISALIGNED_DESTINATION;
+      goto exception;
 supervisor_only_instruction:
-      sim_printf("supervisor_only_instruction\n");
-      goto stop_running;
+      c = NIOS2_EXCEPTION_SUPERVISOR_ONLY;
+      goto exception;
 illegal_instruction_format:
-      sim_printf("illegal_instruction_format\n");
+      c = NIOS2_EXCEPTION_ILLEGAL;
+exception:
+      /* without MMU/MPU, programs are not expected to handle these */
+      if (!cpu.features.mmu && !cpu.features.mpu)
+        {
+          sim_printf("%s\n", exception_names[c]);
+          goto stop_running;
+        }
+      if (c == NIOS2_EXCEPTION_MISALIGNED_DATA ||
+          c == NIOS2_EXCEPTION_MISALIGNED_DESTINATION)
+        cpu.regs.badaddr = a;
+mmu_fault:
+      /* the ops before d have been run, d raises cause c */
+      cpu.regs.zero = 0;
+      cpu.regs.pc = d->pc;
+      cpu.insns += d - blk->ops;
+      cpu.cycles += block_cycles(blk, d - blk->ops);
+      if (nios2_icache_enabled)
+        cpu.cycles += nios2_icache_fetch(blk->ppc, (d - blk->ops) * 4);
+      if (blk->prof)
+        block_profile(blk, d - blk->ops);
+      nios2_exception(c, d->pc + 4);
+      if (cpu.cycles >= nios2_next_event)
+        nios2_events_process();
+      continue;
 stop_running:
-      if (NIOS2_GET_OP(i) == 0x3a)
-        sim_printf("last instruction: %08x (OP=%02x,OPX=%02x)\n", i, NIOS2_GET_OP(i), NIOS2_GET_OPX(i));
+      if (NIOS2_GET_OP(d->insn) == 0x3a)
+        sim_printf("last instruction: %08x (OP=%02x,OPX=%02x)\n", d->insn, NIOS2_GET_OP(d->insn), NIOS2_GET_OPX(d->insn));
       else
-        sim_printf("last instruction: %08x (OP=%02x)\n", i, NIOS2_GET_OP(i));
+        sim_printf("last instruction: %08x (OP=%02x)\n", d->insn, NIOS2_GET_OP(d->insn));
+      cpu.regs.zero = 0;
+      cpu.regs.pc = d->pc;
+      cpu.insns += d - blk->ops;
+      cpu.cycles += block_cycles(blk, d - blk->ops);
+      if (nios2_icache_enabled)
+        cpu.cycles += nios2_icache_fetch(blk->ppc, (d - blk->ops) * 4);
+      if (blk->prof)
+        block_profile(blk, d - blk->ops);
       cpu.state = sim_stopped;
       cpu.signal = TARGET_SIGNAL_TRAP;
       continue;
@@ -0,0 +1,715 @@
+/**
+ * @file mmu.c
+ * @brief MMU and MPU of NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * MMU
+ *
+ * The TLB is set-associative: the line is picked by the low bits of the
+ * VPN, and an entry matches when its VPN is the same and it is global or
+ * belongs to the current PID (tlbmisc.PID).  Software reads and writes it
+ * through pteaddr/tlbacc/tlbmisc the way the hardware does: a write to
+ * tlbacc with tlbmisc.WE set replaces the entry (line of pteaddr.VPN, way
+ * tlbmisc.WAY) and advances the way, a write of tlbmisc with RD set loads
+ * an entry into the three registers.  An entry whose VPN lies in the
+ * unmapped partitions (0xc0000000 and up) never matches, which is how
+ * operating systems invalidate entries.
+ *
+ * MPU
+ *
+ * Regions are kept as [lo, hi) ranges, whether mpuacc holds a mask or a
+ * limit, and checked in index order.  An address matching no region
+ * raises an MPU region violation.
+ *
+ * Both feed the software TLB declared in sim-nios2.h.  A page is entered
+ * there only when the whole page gets the same answer, so an MPU region
+ * smaller than a page is checked on each access through the slow path.
+ * The software TLB is flushed when the PID changes, when an MPU region or
+ * the MPU enable bit is written, and per page when a TLB entry is
+ * replaced.
+ */
+#define TLB_ENTRIES_MAX   1024
+#define TLB_WAYS_MAX      16
+#define MPU_REGIONS_MAX   32
+
+#define VPN_UNMAPPED      0xc0000u  /* first VPN of the unmapped partitions */
+
+typedef struct
+  {
+    unsigned32 vpn;
+    unsigned32 pid;
+    unsigned32 acc;     /* C, R, W, X, G and PFN, as in tlbacc */
+  }
+tlb_entry_t;
+
+typedef struct
+  {
+    unsigned32 lo;      /* [lo, hi), empty if hi <= lo */
+    unsigned32 hi;
+    unsigned32 base;    /* as written (mpubase.BASE) */
+    unsigned32 acc;     /* as written (mpuacc.MASK/LIMIT, C and PERM) */
+  }
+mpu_region_t;
+
+typedef struct
+  {
+    tlb_entry_t tlb[TLB_ENTRIES_MAX];
+    mpu_region_t regions[2][MPU_REGIONS_MAX];   /* instruction, data */
+  }
+mmu_state_t;
+
+static NIOS2_PER_CORE mmu_state_t mmu;
+static mmu_state_t *saved_mmu;
+
+static NIOS2_PER_CORE unsigned64 stlb_refills;
+static NIOS2_PER_CORE unsigned64 tlb_misses;
+static NIOS2_PER_CORE unsigned64 mmu_faults;
+
+NIOS2_PER_CORE int nios2_mmu_active;
+NIOS2_PER_CORE nios2_stlb_entry_t nios2_stlb[2][NIOS2_STLB_SIZE];
+
+/* MPU permissions (bit n: PERM n) allowing each access in each mode */
+static const unsigned8 mpu_allowed[2][3] =
+  {
+    { 0x3e, 0x0e, 0x06 },   /* supervisor: read, write, execute */
+    { 0x2c, 0x08, 0x04 },   /* user */
+  };
+
+static const unsigned32 tlb_allowed[3] =
+  {
+    NIOS2_TLBACC_R, NIOS2_TLBACC_W, NIOS2_TLBACC_X,
+  };
+
+static const unsigned32 tlb_denied[3] =
+  {
+    NIOS2_EXCEPTION_TLB_READ, NIOS2_EXCEPTION_TLB_WRITE, NIOS2_EXCEPTION_TLB_EXECUTE,
+  };
+
+static void
+stlb_flush(void)
+{
+  int i, n;
+
+  for (i = 0; i < 2; ++i)
+    for (n = 0; n < NIOS2_STLB_SIZE; ++n)
+      {
+        nios2_stlb[i][n].tag[NIOS2_ACCESS_READ] = NIOS2_STLB_INVALID;
+        nios2_stlb[i][n].tag[NIOS2_ACCESS_WRITE] = NIOS2_STLB_INVALID;
+        nios2_stlb[i][n].tag[NIOS2_ACCESS_FETCH] = NIOS2_STLB_INVALID;
+      }
+}
+
+static void
+stlb_flush_vpn(unsigned32 vpn)
+{
+  int i, a;
+
+  for (i = 0; i < 2; ++i)
+    for (a = 0; a < 3; ++a)
+      nios2_stlb[i][vpn & (NIOS2_STLB_SIZE - 1)].tag[a] = NIOS2_STLB_INVALID;
+}
+
+static void
+stlb_fill(unsigned32 va, int access, int user, unsigned32 phys)
+{
+  nios2_stlb_entry_t *e = &nios2_stlb[user][(va >> AVM_PAGE_SHIFT) & (NIOS2_STLB_SIZE - 1)];
+  unsigned32 page = va & ~AVM_PAGE_MASK;
+  int a;
+
+  phys &= ~AVM_PAGE_MASK;
+  for (a = 0; a < 3; ++a)
+    if (e->tag[a] != NIOS2_STLB_INVALID && (e->tag[a] != page || e->phys != phys))
+      break;
+
+  if (a < 3)
+    {
+      /* another page (or another mapping) was cached here */
+      e->tag[NIOS2_ACCESS_READ] = NIOS2_STLB_INVALID;
+      e->tag[NIOS2_ACCESS_WRITE] = NIOS2_STLB_INVALID;
+      e->tag[NIOS2_ACCESS_FETCH] = NIOS2_STLB_INVALID;
+    }
+
+  e->phys = phys;
+  e->tag[access] = page;
+}
+
+static unsigned32
+tlb_lines(void)
+{
+  return cpu.features.tlb_entries / cpu.features.tlb_ways;
+}
+
+static unsigned32
+current_pid(void)
+{
+  return (cpu.regs.tlbmisc >> NIOS2_TLBMISC_PID_SHIFT) &
+         ((1u << cpu.features.pid_bits) - 1);
+}
+
+static tlb_entry_t *
+tlb_entry(unsigned32 vpn, unsigned32 way)
+{
+  return &mmu.tlb[(vpn & (tlb_lines() - 1)) * cpu.features.tlb_ways + way];
+}
+
+static tlb_entry_t *
+tlb_find(unsigned32 vpn)
+{
+  unsigned32 pid = current_pid(), way;
+
+  for (way = 0; way < cpu.features.tlb_ways; ++way)
+    {
+      tlb_entry_t *e = tlb_entry(vpn, way);
+
+      if (e->vpn == vpn && ((e->acc & NIOS2_TLBACC_G) || e->pid == pid))
+        return e;
+    }
+
+  return NULL;
+}
+
+/* 0 with the physical address in *phys, or the exception cause */
+static unsigned32
+mmu_translate(unsigned32 va, int access, int user, unsigned32 *phys)
+{
+  tlb_entry_t *e;
+
+  if (user && va >= 0x80000000u)
+    return (access == NIOS2_ACCESS_FETCH) ? NIOS2_EXCEPTION_SUPERVISOR_INST_ADDR
+                                          : NIOS2_EXCEPTION_SUPERVISOR_DATA_ADDR;
+
+  if (va >= 0xc0000000u)
+    {
+      /* kernel and I/O partitions: not mapped, I/O not cacheable */
+      *phys = (va & 0x1fffffffu) | ((va >= 0xe0000000u) ? 0x80000000u : 0);
+      return 0;
+    }
+
+  e = tlb_find(va >> AVM_PAGE_SHIFT);
+  if (e == NULL)
+    return NIOS2_EXCEPTION_TLB_MISS;
+
+  if (!(e->acc & tlb_allowed[access]))
+    return tlb_denied[access];
+
+  *phys = (((e->acc & NIOS2_TLBACC_PFN_MASK) << AVM_PAGE_SHIFT) & 0x7fffffffu) |
+          ((e->acc & NIOS2_TLBACC_C) ? 0 : 0x80000000u) |
+          (va & AVM_PAGE_MASK);
+  return 0;
+}
+
+/* same as mmu_translate(); *whole is cleared if the rest of the page may
+   get another answer */
+static unsigned32
+mpu_translate(unsigned32 va, int access, int user, unsigned32 *phys, int *whole)
+{
+  int data = (access != NIOS2_ACCESS_FETCH);
+  unsigned32 addr = va & 0x7fffffffu;
+  unsigned32 page_lo = addr & ~AVM_PAGE_MASK, page_hi = page_lo + AVM_PAGE_SIZE;
+  unsigned32 n, count, perm;
+  const mpu_region_t *r = NULL;
+
+  count = data ? cpu.features.mpu_data_regions : cpu.features.mpu_inst_regions;
+  *whole = 1;
+  for (n = 0; n < count; ++n)
+    {
+      r = &mmu.regions[data][n];
+      if (r->lo < page_hi && page_lo < r->hi &&
+          (page_lo < r->lo || r->hi < page_hi))
+        *whole = 0;
+      if (r->lo <= addr && addr < r->hi)
+        break;
+    }
+
+  if (n == count)
+    return data ? NIOS2_EXCEPTION_MPU_DATA : NIOS2_EXCEPTION_MPU_INST;
+
+  perm = (r->acc & NIOS2_MPUACC_PERM_MASK) >> NIOS2_MPUACC_PERM_SHIFT;
+  if (!(mpu_allowed[user][access] & (1u << perm)))
+    return data ? NIOS2_EXCEPTION_MPU_DATA : NIOS2_EXCEPTION_MPU_INST;
+
+  *phys = va | ((r->acc & NIOS2_MPUACC_C) ? 0 : 0x80000000u);
+  return 0;
+}
+
+/* set the registers describing a failed translation */
+static void
+mmu_fault(unsigned32 va, int access, unsigned32 cause)
+{
+  ++mmu_faults;
+  if (cpu.features.mmu && cause == NIOS2_EXCEPTION_TLB_MISS &&
+      (cpu.regs.status & NIOS2_STATUS_EH))
+    {
+      /* double miss: keep what the first one left for the handler */
+      ++tlb_misses;
+      return;
+    }
+
+  cpu.regs.badaddr = va;
+  if (!cpu.features.mmu)
+    return;
+
+  cpu.regs.tlbmisc &= ~(NIOS2_TLBMISC_D | NIOS2_TLBMISC_PERM | NIOS2_TLBMISC_BAD);
+  if (access != NIOS2_ACCESS_FETCH)
+    cpu.regs.tlbmisc |= NIOS2_TLBMISC_D;
+
+  switch (cause)
+    {
+      case NIOS2_EXCEPTION_TLB_MISS:
+        ++tlb_misses;
+        cpu.regs.pteaddr = (cpu.regs.pteaddr & ~NIOS2_PTEADDR_VPN_MASK) |
+                           ((va >> AVM_PAGE_SHIFT) << NIOS2_PTEADDR_VPN_SHIFT);
+        break;
+      case NIOS2_EXCEPTION_TLB_EXECUTE:
+      case NIOS2_EXCEPTION_TLB_READ:
+      case NIOS2_EXCEPTION_TLB_WRITE:
+        cpu.regs.tlbmisc |= NIOS2_TLBMISC_PERM;
+        cpu.regs.pteaddr = (cpu.regs.pteaddr & ~NIOS2_PTEADDR_VPN_MASK) |
+                           ((va >> AVM_PAGE_SHIFT) << NIOS2_PTEADDR_VPN_SHIFT);
+        break;
+      default:  /* supervisor-only address */
+        cpu.regs.tlbmisc |= NIOS2_TLBMISC_BAD;
+        break;
+    }
+}
+
+unsigned32
+nios2_translate_slow(unsigned32 va, int access, unsigned32 *pa)
+{
+  int user = (cpu.regs.status & NIOS2_STATUS_U) ? 1 : 0;
+  int whole = 1;
+  unsigned32 cause;
+
+  ++stlb_refills;
+  if (cpu.features.mmu)
+    cause = mmu_translate(va, access, user, pa);
+  else
+    cause = mpu_translate(va, access, user, pa, &whole);
+
+  if (cause)
+    {
+      mmu_fault(va, access, cause);
+      return cause;
+    }
+
+  if (whole)
+    stlb_fill(va, access, user, *pa);
+  return 0;
+}
+
+/* translation for the debugger: supervisor view, no permission checks
+   and no side effects; returns 0 if va is not mapped */
+int
+nios2_mmu_debug_translate(SIM_ADDR va, SIM_ADDR *pa)
+{
+  tlb_entry_t *e;
+
+  if (!cpu.features.mmu)
+    {
+      *pa = va;
+      return 1;
+    }
+
+  if (va >= 0xc0000000u)
+    {
+      *pa = va & 0x1fffffffu;
+      return 1;
+    }
+
+  e = tlb_find(va >> AVM_PAGE_SHIFT);
+  if (e == NULL)
+    return 0;
+
+  *pa = (((e->acc & NIOS2_TLBACC_PFN_MASK) << AVM_PAGE_SHIFT) & 0x7fffffffu) |
+        (va & AVM_PAGE_MASK);
+  return 1;
+}
+
+static void
+mmu_update(void)
+{
+  int active = cpu.features.mmu ||
+               (cpu.features.mpu && (cpu.regs.config & NIOS2_CONFIG_PE));
+
+  stlb_flush();
+  if (active != nios2_mmu_active)
+    {
+      nios2_mmu_active = active;
+      /* blocks do not cross pages while translating */
+      nios2_decode_flush();
+    }
+}
+
+static void
+tlb_clear(void)
+{
+  unsigned32 n;
+
+  for (n = 0; n < TLB_ENTRIES_MAX; ++n)
+    {
+      mmu.tlb[n].vpn = VPN_UNMAPPED;
+      mmu.tlb[n].pid = 0;
+      mmu.tlb[n].acc = 0;
+    }
+}
+
+void
+nios2_mmu_reset(void)
+{
+  tlb_clear();
+  memset(mmu.regions, 0, sizeof(mmu.regions));
+  stlb_refills = tlb_misses = mmu_faults = 0;
+  mmu_update();
+}
+
+static void
+tlb_write(unsigned32 value)
+{
+  unsigned32 way = (cpu.regs.tlbmisc & NIOS2_TLBMISC_WAY_MASK) >> NIOS2_TLBMISC_WAY_SHIFT;
+  unsigned32 vpn = (cpu.regs.pteaddr & NIOS2_PTEADDR_VPN_MASK) >> NIOS2_PTEADDR_VPN_SHIFT;
+  tlb_entry_t *e;
+
+  way &= cpu.features.tlb_ways - 1;
+  e = tlb_entry(vpn, way);
+  stlb_flush_vpn(e->vpn);
+  e->vpn = vpn;
+  e->pid = current_pid();
+  e->acc = value & (NIOS2_TLBACC_C | NIOS2_TLBACC_R | NIOS2_TLBACC_W |
+                    NIOS2_TLBACC_X | NIOS2_TLBACC_G | NIOS2_TLBACC_PFN_MASK);
+  stlb_flush_vpn(vpn);
+
+  way = (way + 1) & (cpu.features.tlb_ways - 1);
+  cpu.regs.tlbmisc = (cpu.regs.tlbmisc & ~NIOS2_TLBMISC_WAY_MASK) |
+                     (way << NIOS2_TLBMISC_WAY_SHIFT);
+}
+
+static void
+tlbmisc_write(unsigned32 value)
+{
+  unsigned32 pid = current_pid();
+  unsigned32 pid_mask = ((1u << cpu.features.pid_bits) - 1) << NIOS2_TLBMISC_PID_SHIFT;
+
+  if (value & NIOS2_TLBMISC_RD)
+    {
+      unsigned32 way = (value & NIOS2_TLBMISC_WAY_MASK) >> NIOS2_TLBMISC_WAY_SHIFT;
+      unsigned32 vpn = (cpu.regs.pteaddr & NIOS2_PTEADDR_VPN_MASK) >> NIOS2_PTEADDR_VPN_SHIFT;
+      tlb_entry_t *e = tlb_entry(vpn, way & (cpu.features.tlb_ways - 1));
+
+      cpu.regs.tlbacc = (cpu.regs.tlbacc & 0xfe000000u) | e->acc;
+      cpu.regs.pteaddr = (cpu.regs.pteaddr & ~NIOS2_PTEADDR_VPN_MASK) |
+                         (e->vpn << NIOS2_PTEADDR_VPN_SHIFT);
+      value = (value & ~(pid_mask | NIOS2_TLBMISC_RD)) |
+              (e->pid << NIOS2_TLBMISC_PID_SHIFT);
+    }
+
+  cpu.regs.tlbmisc = value & (pid_mask | NIOS2_TLBMISC_WE | NIOS2_TLBMISC_WAY_MASK |
+                              NIOS2_TLBMISC_D | NIOS2_TLBMISC_PERM |
+                              NIOS2_TLBMISC_BAD | NIOS2_TLBMISC_DBL);
+  if (current_pid() != pid)
+    stlb_flush();
+}
+
+static void
+mpu_write(unsigned32 value)
+{
+  unsigned32 index = (cpu.regs.mpubase & NIOS2_MPUBASE_INDEX_MASK) >> NIOS2_MPUBASE_INDEX_SHIFT;
+  int data = (cpu.regs.mpubase & NIOS2_MPUBASE_D) ? 1 : 0;
+  unsigned32 count = data ? cpu.features.mpu_data_regions : cpu.features.mpu_inst_regions;
+  mpu_region_t *r = &mmu.regions[data][index];
+
+  if (index >= count)
+    return;
+
+  if (value & NIOS2_MPUACC_WR)
+    {
+      unsigned32 field = value & NIOS2_MPUACC_MASK_MASK;
+
+      r->base = cpu.regs.mpubase & NIOS2_MPUBASE_BASE_MASK;
+      r->acc = value & (NIOS2_MPUACC_MASK_MASK | NIOS2_MPUACC_C | NIOS2_MPUACC_PERM_MASK);
+      if (cpu.features.mpu_use_limit)
+        {
+          r->lo = r->base;
+          r->hi = field;
+        }
+      else
+        {
+          r->lo = r->base & field;
+          r->hi = r->lo + (~field & 0x7fffffffu) + 1;
+        }
+      stlb_flush();
+    }
+  else if (value & NIOS2_MPUACC_RD)
+    {
+      cpu.regs.mpubase = (cpu.regs.mpubase & ~NIOS2_MPUBASE_BASE_MASK) | r->base;
+      value = r->acc;
+    }
+
+  cpu.regs.mpuacc = value & ~(NIOS2_MPUACC_RD | NIOS2_MPUACC_WR);
+}
+
+/* pteaddr, tlbacc, tlbmisc, config, mpubase and mpuacc */
+void
+nios2_mmu_write_ctl(int n, unsigned32 value)
+{
+  switch (n)
+    {
+      case 8:   /* pteaddr */
+        if (cpu.features.mmu)
+          cpu.regs.pteaddr = value & ~3u;
+        break;
+      case 9:   /* tlbacc: reads return the last entry read */
+        if (cpu.features.mmu && (cpu.regs.tlbmisc & NIOS2_TLBMISC_WE))
+          tlb_write(value);
+        break;
+      case 10:  /* tlbmisc */
+        if (cpu.features.mmu)
+          tlbmisc_write(value);
+        break;
+      case 13:  /* config */
+        if (cpu.features.mpu)
+          {
+            cpu.regs.config = value & NIOS2_CONFIG_PE;
+            mmu_update();
+          }
+        break;
+      case 14:  /* mpubase */
+        if (cpu.features.mpu)
+          cpu.regs.mpubase = value & (NIOS2_MPUBASE_BASE_MASK |
+                                      NIOS2_MPUBASE_INDEX_MASK | NIOS2_MPUBASE_D);
+        break;
+      case 15:  /* mpuacc */
+        if (cpu.features.mpu)
+          mpu_write(value);
+        break;
+    }
+}
+
+void
+nios2_mmu_save(void)
+{
+  if (saved_mmu == NULL)
+    saved_mmu = (mmu_state_t *) malloc(sizeof(mmu_state_t));
+  *saved_mmu = mmu;
+}
+
+/* after the registers have been restored */
+void
+nios2_mmu_restore(void)
+{
+  if (saved_mmu)
+    mmu = *saved_mmu;
+  mmu_update();
+}
+
+static int
+parse_numbers(const char *s, unsigned32 *v, int count)
+{
+  int n = 0;
+  char *end;
+
+  while (n < count && *s)
+    {
+      v[n++] = strtoul(s, &end, 0);
+      if (end == s || (*end != ',' && *end != 0))
+        return -1;
+      s = (*end == ',') ? end + 1 : end;
+    }
+
+  return n;
+}
+
+/* target sim options: --mmu[=ENTRIES,WAYS,PIDBITS], --mpu[=IREGIONS,DREGIONS[,limit]]
+   and --fast-tlb-miss-addr=ADDR; returns 1 if option is not one of them */
+int
+nios2_mmu_configure(const char *option)
+{
+  unsigned32 v[3];
+  int n;
+
+  if (strncmp(option, "--mmu", 5) == 0 && (option[5] == 0 || option[5] == '='))
+    {
+      v[0] = 128;
+      v[1] = 16;
+      v[2] = 8;
+      n = option[5] ? parse_numbers(option + 6, v, 3) : 0;
+      if (n < 0 || v[1] == 0 || v[1] > TLB_WAYS_MAX || (v[1] & (v[1] - 1)) ||
+          v[0] > TLB_ENTRIES_MAX || v[0] % v[1] ||
+          ((v[0] / v[1]) & (v[0] / v[1] - 1)) || v[2] < 1 || v[2] > 14)
+        {
+          sim_printf("bad MMU configuration: %s\n", option);
+          return 0;
+        }
+      cpu.features.mmu = 1;
+      cpu.features.mpu = 0;
+      cpu.features.tlb_entries = v[0];
+      cpu.features.tlb_ways = v[1];
+      cpu.features.pid_bits = v[2];
+      tlb_clear();
+    }
+  else if (strncmp(option, "--mpu", 5) == 0 && (option[5] == 0 || option[5] == '='))
+    {
+      const char *limit = option[5] ? strstr(option, ",limit") : NULL;
+      char buf[64];
+
+      v[0] = v[1] = 8;
+      n = 0;
+      if (option[5])
+        {
+          strncpy(buf, option + 6, sizeof(buf) - 1);
+          buf[sizeof(buf) - 1] = 0;
+          if (limit)
+            buf[limit - option - 6] = 0;
+          n = parse_numbers(buf, v, 2);
+        }
+      if (n < 0 || v[0] > MPU_REGIONS_MAX || v[1] > MPU_REGIONS_MAX)
+        {
+          sim_printf("bad MPU configuration: %s\n", option);
+          return 0;
+        }
+      cpu.features.mpu = 1;
+      cpu.features.mmu = 0;
+      cpu.features.mpu_inst_regions = v[0];
+      cpu.features.mpu_data_regions = v[1];
+      cpu.features.mpu_use_limit = (limit != NULL);
+    }
+  else if (strncmp(option, "--fast-tlb-miss-addr=", 21) == 0)
+    cpu.features.fast_tlb_miss_addr = strtoul(option + 21, NULL, 0);
+  else
+    return 1;
+
+  return 0;
+}
+
+void
+nios2_mmu_info(void)
+{
+  if (!cpu.features.mmu && !cpu.features.mpu)
+    return;
+
+  sim_printf("software TLB refills: %llu, %s exceptions: %llu",
+    (unsigned long long) stlb_refills, cpu.features.mmu ? "MMU" : "MPU",
+    (unsigned long long) mmu_faults);
+  if (cpu.features.mmu)
+    sim_printf(" (TLB misses: %llu)", (unsigned long long) tlb_misses);
+  sim_printf("\n");
+}
+
+static void
+mmu_show_tlb(void)
+{
+  unsigned32 n;
+
+  if (!cpu.features.mmu)
+    {
+      sim_printf("no MMU\n");
+      return;
+    }
+
+  sim_printf("line way  virtual    physical   pid  flags\n");
+  for (n = 0; n < cpu.features.tlb_entries; ++n)
+    {
+      const tlb_entry_t *e = &mmu.tlb[n];
+
+      if (e->vpn >= VPN_UNMAPPED)
+        continue;
+
+      sim_printf("%4u %3u  0x%08x 0x%08x %4u %c%c%c%c%c\n",
+        n / cpu.features.tlb_ways, n % cpu.features.tlb_ways,
+        e->vpn << AVM_PAGE_SHIFT, (e->acc & NIOS2_TLBACC_PFN_MASK) << AVM_PAGE_SHIFT,
+        e->pid,
+        (e->acc & NIOS2_TLBACC_C) ? 'c' : '-', (e->acc & NIOS2_TLBACC_R) ? 'r' : '-',
+        (e->acc & NIOS2_TLBACC_W) ? 'w' : '-', (e->acc & NIOS2_TLBACC_X) ? 'x' : '-',
+        (e->acc & NIOS2_TLBACC_G) ? 'g' : '-');
+    }
+}
+
+static void
+mmu_show_regions(void)
+{
+  static const char *const kinds[2] = { "instruction", "data" };
+  unsigned32 n, count;
+  int data;
+
+  if (!cpu.features.mpu)
+    {
+      sim_printf("no MPU\n");
+      return;
+    }
+
+  sim_printf("MPU %s\n", (cpu.regs.config & NIOS2_CONFIG_PE) ? "enabled" : "disabled");
+  for (data = 0; data < 2; ++data)
+    {
+      count = data ? cpu.features.mpu_data_regions : cpu.features.mpu_inst_regions;
+      for (n = 0; n < count; ++n)
+        {
+          const mpu_region_t *r = &mmu.regions[data][n];
+
+          if (r->hi <= r->lo)
+            continue;
+          sim_printf("%-11s %2u  0x%08x-0x%08x perm %u%s\n", kinds[data], n,
+            r->lo, r->hi - 1,
+            (r->acc & NIOS2_MPUACC_PERM_MASK) >> NIOS2_MPUACC_PERM_SHIFT,
+            (r->acc & NIOS2_MPUACC_C) ? " cacheable" : "");
+        }
+    }
+}
+
+int
+mmu_command(int argc, char *argv[])
+{
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of MMU commands:\n\n"
+      "tlb -- Show the valid TLB entries\n"
+      "regions -- Show the MPU regions\n"
+      "info -- Show the configuration and the translation counters\n"
+      );
+      return 0;
+    }
+
+  if (argc > 2)
+    {
+      sim_printf("too many options for mmu: %s\n", argv[2]);
+      return 0;
+    }
+
+  if (strcmp(argv[1], "tlb") == 0)
+    mmu_show_tlb();
+  else if (strcmp(argv[1], "regions") == 0)
+    mmu_show_regions();
+  else if (strcmp(argv[1], "info") == 0)
+    {
+      if (cpu.features.mmu)
+        sim_printf("MMU: %u TLB entries, %u ways, %u PID bits, "
+                   "fast TLB miss handler at 0x%08x\n",
+          cpu.features.tlb_entries, cpu.features.tlb_ways,
+          cpu.features.pid_bits, cpu.features.fast_tlb_miss_addr);
+      else if (cpu.features.mpu)
+        sim_printf("MPU: %u instruction and %u data regions (%s)\n",
+          cpu.features.mpu_inst_regions, cpu.features.mpu_data_regions,
+          cpu.features.mpu_use_limit ? "base/limit" : "base/mask");
+      else
+        sim_printf("no MMU or MPU\n");
+      nios2_mmu_info();
+    }
+  else
+    return 1;
+
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -0,0 +1,78 @@
+/**
+ * @file nios2-custom.h
+ * @brief Plug-in interface for custom instructions of NiosII simulator
+ * @author kimu_shu
+ */
+
+#ifndef NIOS2_CUSTOM_H
+#define NIOS2_CUSTOM_H
+
+#ifdef __cplusplus
+extern "C" { // }
+#endif
+
+/*
+ * A plug-in is a shared object loaded by "sim custom load FILE [ARGS]".
+ * It exports nios2_custom_init(), which claims custom instruction
+ * numbers (the N field, 0-255) with host->register_insn().  For example:
+ *
+ *   static unsigned int
+ *   crc_step(void *priv, unsigned int insn, unsigned int dataa, unsigned int datab)
+ *   {
+ *     ...
+ *   }
+ *
+ *   int
+ *   nios2_custom_init(nios2_custom_host_t *host, const char *args)
+ *   {
+ *     if (host->abi_version != NIOS2_CUSTOM_ABI_VERSION)
+ *       return -1;
+ *     return host->register_insn(host, 0x10, crc_step, NULL, 1);
+ *   }
+ *
+ * A handler gets the whole instruction word, and the values of rA and rB
+ * when the readra/readrb bits are set (0 otherwise: the operands then
+ * name registers internal to the custom logic, which the plug-in keeps
+ * itself).  The value returned is written to rC when writerc is set.
+ */
+#define NIOS2_CUSTOM_ABI_VERSION  1
+
+#define NIOS2_CUSTOM_N(insn)      (((insn) >> 6) & 0xff)
+#define NIOS2_CUSTOM_A(insn)      (((insn) >> 27) & 0x1f)
+#define NIOS2_CUSTOM_B(insn)      (((insn) >> 22) & 0x1f)
+#define NIOS2_CUSTOM_C(insn)      (((insn) >> 17) & 0x1f)
+#define NIOS2_CUSTOM_READRA       (1u << 16)
+#define NIOS2_CUSTOM_READRB       (1u << 15)
+#define NIOS2_CUSTOM_WRITERC      (1u << 14)
+
+typedef unsigned int nios2_custom_handler_t(void *priv, unsigned int insn,
+                                            unsigned int dataa, unsigned int datab);
+
+typedef struct nios2_custom_host
+  {
+    unsigned int abi_version;
+
+    /* claim custom instruction n; latency is the number of clock cycles
+       the instruction takes (1 for combinational logic).  Returns 0, or
+       -1 if n is out of range or already taken */
+    int (*register_insn)(struct nios2_custom_host *host, unsigned int n,
+                         nios2_custom_handler_t *handler, void *priv,
+                         unsigned int latency);
+
+    /* messages to the GDB console */
+    void (*printf)(const char *fmt, ...);
+  }
+nios2_custom_host_t;
+
+/* exported by the plug-in; returns 0 on success */
+typedef int nios2_custom_init_t(nios2_custom_host_t *host, const char *args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* NIOS2_CUSTOM_H */
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -0,0 +1,456 @@
+/**
+ * @file profile.c
+ * @brief Execution profiler for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libiberty.h"
+#include "bfd.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * The counters themselves live next to the page table: one 32-bit
+ * execution count per instruction word of each page that ran code while
+ * profiling (avm_profile_counters()), and the load/store counts, also
+ * only kept while profiling, per page and per memory section
+ * (avm_section_stats()).  This file only switches profiling on and off
+ * and turns the counters into reports.
+ *
+ * sim/common/sim-profile.c cannot be used as is, since this simulator
+ * does not use the common SIM_DESC framework; the gmon.out written here
+ * is the same BSD format it writes.
+ */
+
+int nios2_profiling;
+
+typedef struct
+  {
+    SIM_ADDR pc;
+    unsigned32 count;
+  }
+profile_sample_t;
+
+typedef struct
+  {
+    SIM_ADDR addr;
+    const char *name;
+    unsigned64 count;
+  }
+profile_func_t;
+
+static void
+out(FILE *file, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  if (file)
+    vfprintf(file, fmt, ap);
+  else
+    {
+      char buf[256];
+
+      vsnprintf(buf, sizeof(buf), fmt, ap);
+      sim_printf("%s", buf);
+    }
+  va_end(ap);
+}
+
+/* gather every non-zero execution counter, in address order */
+static profile_sample_t *
+collect_samples(int *pcount)
+{
+  profile_sample_t *samples = NULL;
+  int count = 0, alloc = 0;
+  unsigned32 i, j, k;
+
+  /* add the pending hits of the translated blocks to the counters */
+  nios2_decode_flush();
+
+  for (i = 0; i < AVM_L1_SIZE; ++i)
+    {
+      avm_page_t *l2 = avm_page_dir[i];
+
+      if (l2 == NULL)
+        continue;
+
+      for (j = 0; j < AVM_L2_SIZE; ++j)
+        {
+          if (l2[j].prof == NULL)
+            continue;
+
+          for (k = 0; k < AVM_PAGE_SIZE / 4; ++k)
+            {
+              if (l2[j].prof[k] == 0)
+                continue;
+
+              if (count == alloc)
+                {
+                  alloc = alloc ? alloc * 2 : 1024;
+                  samples = (profile_sample_t *) realloc(samples, alloc * sizeof(*samples));
+                }
+
+              samples[count].pc = (((i << AVM_L2_BITS) | j) << AVM_PAGE_SHIFT) | (k << 2);
+              samples[count].count = l2[j].prof[k];
+              ++count;
+            }
+        }
+    }
+
+  *pcount = count;
+  return samples;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+  const profile_sample_t *x = (const profile_sample_t *) a;
+  const profile_sample_t *y = (const profile_sample_t *) b;
+
+  if (x->count != y->count)
+    return (x->count < y->count) ? 1 : -1;
+  return (x->pc < y->pc) ? -1 : (x->pc > y->pc);
+}
+
+static int
+compare_funcs_by_addr(const void *a, const void *b)
+{
+  const profile_func_t *x = (const profile_func_t *) a;
+  const profile_func_t *y = (const profile_func_t *) b;
+
+  return (x->addr < y->addr) ? -1 : (x->addr > y->addr);
+}
+
+static int
+compare_funcs_by_count(const void *a, const void *b)
+{
+  const profile_func_t *x = (const profile_func_t *) a;
+  const profile_func_t *y = (const profile_func_t *) b;
+
+  return (x->count < y->count) ? 1 : (x->count > y->count) ? -1 : 0;
+}
+
+/* code symbols of the program, sorted by address */
+static profile_func_t *
+read_functions(struct bfd *abfd, asymbol ***psyms, int *pcount)
+{
+  asymbol **syms;
+  profile_func_t *funcs;
+  long size, n, i;
+  int count = 0;
+
+  *psyms = NULL;
+  *pcount = 0;
+  if (abfd == NULL || !(bfd_get_file_flags(abfd) & HAS_SYMS))
+    return NULL;
+
+  size = bfd_get_symtab_upper_bound(abfd);
+  if (size <= 0)
+    return NULL;
+
+  syms = (asymbol **) malloc(size);
+  n = bfd_canonicalize_symtab(abfd, syms);
+  if (n <= 0)
+    {
+      free(syms);
+      return NULL;
+    }
+
+  funcs = (profile_func_t *) calloc(n, sizeof(*funcs));
+  for (i = 0; i < n; ++i)
+    {
+      asymbol *sym = syms[i];
+
+      if (!(sym->section->flags & SEC_CODE) ||
+          (sym->flags & (BSF_SECTION_SYM | BSF_DEBUGGING | BSF_FILE)) ||
+          !(sym->flags & (BSF_FUNCTION | BSF_GLOBAL | BSF_LOCAL)) ||
+          sym->name[0] == '\0' || sym->name[0] == '.')
+        continue;
+
+      funcs[count].addr = bfd_asymbol_value(sym);
+      funcs[count].name = bfd_asymbol_name(sym);
+      ++count;
+    }
+
+  qsort(funcs, count, sizeof(*funcs), compare_funcs_by_addr);
+  *psyms = syms;
+  *pcount = count;
+  return funcs;
+}
+
+static profile_func_t *
+find_function(profile_func_t *funcs, int count, SIM_ADDR pc)
+{
+  int top = 0, bottom = count;
+
+  while (bottom - top > 1)
+    {
+      int i = (top + bottom) / 2;
+
+      if (pc < funcs[i].addr)
+        bottom = i;
+      else
+        top = i;
+    }
+
+  if (count == 0 || pc < funcs[top].addr)
+    return NULL;
+
+  return &funcs[top];
+}
+
+static int
+profile_report(struct bfd *abfd, const char *path, int limit)
+{
+  FILE *file = NULL;
+  profile_sample_t *samples;
+  profile_func_t *funcs, *f;
+  asymbol **syms;
+  int nsamples, nfuncs, i;
+  unsigned64 total = 0, unknown = 0, loads, stores;
+  double cpi, pct;
+  const char *name;
+  SIM_ADDR base, end;
+
+  if (path)
+    {
+      file = fopen(path, "w");
+      if (file == NULL)
+        {
+          sim_printf("cannot open profile report: %s\n", path);
+          return 1;
+        }
+    }
+
+  samples = collect_samples(&nsamples);
+  funcs = read_functions(abfd, &syms, &nfuncs);
+
+  for (i = 0; i < nsamples; ++i)
+    {
+      total += samples[i].count;
+      f = find_function(funcs, nfuncs, samples[i].pc);
+      if (f)
+        f->count += samples[i].count;
+      else
+        unknown += samples[i].count;
+    }
+
+  /* no per-instruction timing is kept; cycles are estimated from the
+     average cycles per instruction of the whole run */
+  cpi = cpu.insns ? (double) cpu.cycles / cpu.insns : 1.0;
+  pct = total ? 100.0 / total : 0.0;
+
+  out(file, "Profile: %llu instructions, %llu cycles (CPI %.2f)\n",
+      (unsigned long long) total, (unsigned long long) cpu.cycles, cpi);
+
+  qsort(samples, nsamples, sizeof(*samples), compare_samples);
+  out(file, "\nHot spots:\n      count     %%  address     function\n");
+  for (i = 0; i < nsamples && i < limit; ++i)
+    {
+      f = find_function(funcs, nfuncs, samples[i].pc);
+      out(file, "%11u %5.1f  0x%08x  ", samples[i].count,
+          samples[i].count * pct, samples[i].pc);
+      if (f)
+        out(file, "%s+0x%x\n", f->name, samples[i].pc - f->addr);
+      else
+        out(file, "??\n");
+    }
+
+  qsort(funcs, nfuncs, sizeof(*funcs), compare_funcs_by_count);
+  out(file, "\nFunctions:\n      count     cycles(est)     %%  function\n");
+  for (i = 0; i < nfuncs && i < limit && funcs[i].count; ++i)
+    out(file, "%11llu %15.0f %5.1f  %s\n", (unsigned long long) funcs[i].count,
+        funcs[i].count * cpi, funcs[i].count * pct, funcs[i].name);
+  if (unknown)
+    out(file, "%11llu %15.0f %5.1f  ??\n", (unsigned long long) unknown,
+        unknown * cpi, unknown * pct);
+
+  out(file, "\nMemory sections:\n       loads      stores  range                  name\n");
+  for (i = 0; avm_section_stats(i, &name, &base, &end, &loads, &stores); ++i)
+    if (loads || stores)
+      out(file, "%12llu %11llu  0x%08x-0x%08x  %s\n", (unsigned long long) loads,
+          (unsigned long long) stores, base, end - 1, name);
+
+  free(samples);
+  free(funcs);
+  free(syms);
+
+  if (file)
+    {
+      fclose(file);
+      sim_printf("profile report written to %s\n", path);
+    }
+
+  return 0;
+}
+
+static void
+put_word(unsigned char *p, unsigned32 v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/* BSD gmon.out: {lowpc, highpc, size} then 16-bit counts of each word,
+   in the byte order of the target (little endian) */
+static int
+profile_gmon(const char *path)
+{
+  FILE *file;
+  profile_sample_t *samples;
+  int nsamples, i;
+  unsigned32 low, high, buckets, max = 0, scale;
+  unsigned char header[12];
+  unsigned char *hist;
+
+  samples = collect_samples(&nsamples);
+  if (nsamples == 0)
+    {
+      sim_printf("no profile data\n");
+      free(samples);
+      return 0;
+    }
+
+  file = fopen(path, "wb");
+  if (file == NULL)
+    {
+      sim_printf("cannot open profile file: %s\n", path);
+      free(samples);
+      return 1;
+    }
+
+  low = samples[0].pc;
+  high = samples[nsamples - 1].pc + 4;
+  buckets = (high - low) / 4;
+  for (i = 0; i < nsamples; ++i)
+    if (samples[i].count > max)
+      max = samples[i].count;
+
+  /* scale down rather than saturate, so that ratios survive */
+  scale = (max + 0xfffe) / 0xffff;
+
+  hist = (unsigned char *) calloc(buckets, 2);
+  for (i = 0; i < nsamples; ++i)
+    {
+      unsigned32 n = (samples[i].pc - low) / 4;
+      unsigned32 v = samples[i].count / scale;
+
+      if (v == 0)
+        v = 1;
+      hist[n * 2] = v;
+      hist[n * 2 + 1] = v >> 8;
+    }
+
+  put_word(header, low);
+  put_word(header + 4, high);
+  put_word(header + 8, buckets * 2 + sizeof(header));
+  fwrite(header, 1, sizeof(header), file);
+  fwrite(hist, 2, buckets, file);
+
+  if (ferror(file) | fclose(file))
+    sim_printf("cannot write profile file: %s\n", path);
+  else if (scale > 1)
+    sim_printf("profile written to %s (counts scaled by 1/%u)\n", path, scale);
+  else
+    sim_printf("profile written to %s\n", path);
+
+  free(hist);
+  free(samples);
+  return 0;
+}
+
+int
+profile_command(int argc, char *argv[], struct bfd *abfd)
+{
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of profile commands:\n\n"
+      "on -- Start counting executed instructions and memory accesses\n"
+      "off -- Stop counting (counts are kept)\n"
+      "reset -- Clear all counts\n"
+      "report -- Show hot spots, functions and sections (report [FILE] [N])\n"
+      "gmon -- Write counts in gprof format (gmon [FILE])\n"
+      );
+      return 0;
+    }
+
+  int i = 2;
+
+  if (strcmp(argv[1], "on") == 0)
+    {
+      if (i == argc)
+        {
+          /* retranslate so that every block gets its counters */
+          nios2_profiling = 1;
+          nios2_decode_flush();
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "off") == 0)
+    {
+      if (i == argc)
+        {
+          nios2_profiling = 0;
+          nios2_decode_flush();
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "reset") == 0)
+    {
+      if (i == argc)
+        {
+          nios2_decode_flush();
+          avm_profile_clear();
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "report") == 0)
+    {
+      const char *path = NULL;
+      int limit = 20;
+
+      if (i < argc && (argv[i][0] < '0' || argv[i][0] > '9'))
+        path = argv[i++];
+      if (i < argc)
+        limit = strtoul(argv[i++], NULL, 0);
+
+      if (i == argc)
+        {
+          profile_report(abfd, path, limit);
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "gmon") == 0)
+    {
+      const char *path = "gmon.out";
+
+      if (i < argc)
+        path = argv[i++];
+
+      if (i == argc)
+        {
+          profile_gmon(path);
+          return 0;
+        }
+    }
+  else
+    return 1;
+
+  sim_printf("too many options for profile %s: %s\n", argv[1], argv[i]);
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
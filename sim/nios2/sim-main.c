@@ -13,13 +13,14 @@
 #include "sim-main.h"
 #include "sim-nios2.h"
 #include <stdarg.h>
+#include <stdlib.h>
 
 static SIM_OPEN_KIND sim_kind;
 static struct host_callback_struct *sim_callback;
 static struct bfd *sim_bfd;
 static char *sim_name;
 static char sim_cpu[256];
-static char sim_loading;
+static int sim_map_image = 1;
 
 struct feature_t
   {
@@ -28,7 +29,6 @@ struct feature_t
     unsigned hwmulx : 1;  /* embeddedsw.CMacro.HARDWARE_MULX_PRESENT */
   };
 
-static union regset_t regs;
 static struct feature_t feature;
 static unsigned32 cpu_freq;
 
@@ -51,6 +51,7 @@ sim_open (SIM_OPEN_KIND kind, struct host_callback_struct *callback, struct bfd
   sim_callback = callback;
   sim_bfd = abfd;
   sim_name = argv[0];
+  nios2_hostio_init(callback);
 
   if(0)
     {
@@ -58,14 +59,145 @@ sim_open (SIM_OPEN_KIND kind, struct host_callback_struct *callback, struct bfd
       for (p = argv; *p; ++p) sim_printf("argv: %s\n", *p);
     }
 
+  /* target sim [--timing=MODEL] [--native-helpers] [--exception-addr=ADDR]
+                [--mmu[=...]|--mpu[=...]] [--fast-tlb-miss-addr=ADDR]
+                [--cores=N] [--quantum=CYCLES]
+                [--memory-fill=BYTE] [--no-map-image] [--system=FILE] */
+  for (++argv; *argv; ++argv)
+    if (strncmp(*argv, "--timing=", 9) == 0)
+      nios2_set_timing(*argv + 9);
+    else if (strcmp(*argv, "--native-helpers") == 0)
+      nios2_helpers_enable(1);
+    else if (strncmp(*argv, "--exception-addr=", 17) == 0)
+      cpu.features.exception_addr = strtoul(*argv + 17, NULL, 0);
+    else if (strncmp(*argv, "--memory-fill=", 14) == 0)
+      avm_memory_fill = strtoul(*argv + 14, NULL, 0);
+    else if (strcmp(*argv, "--no-map-image") == 0)
+      sim_map_image = 0;
+    else if (strncmp(*argv, "--system=", 9) == 0)
+      {
+        if (nios2_sysdesc_load(*argv + 9) < 0)
+          {
+            avm_clear_sections();
+            nios2_sysdesc_clear();
+            return 0;
+          }
+      }
+    else if (nios2_mmu_configure(*argv))
+      nios2_smp_configure(*argv);
+
+  nios2_smp_start();
   return (SIM_DESC) 1;
 }
 
 void
 sim_close (SIM_DESC sd, int quitting)
 {
+  nios2_hostio_flush();
+  nios2_events_clear();
   avm_clear_sections();
   btrace_free();
+  nios2_custom_clear();
+  nios2_sysdesc_clear();
+  nios2_smp_stop();
+}
+
+/* like sim_load_file(), but read-only sections of an ELF file are mapped
+   from it rather than read, so that only the pages the target touches
+   are ever read; the file must not be rewritten in place while loaded */
+static int
+load_mapped_section (bfd *abfd, asection *s, SIM_ADDR vma, bfd_size_type size)
+{
+  if (!sim_map_image || !(s->flags & SEC_READONLY) ||
+      !(s->flags & SEC_HAS_CONTENTS) ||
+      bfd_get_flavour(abfd) != bfd_target_elf_flavour ||
+      abfd->my_archive != NULL)
+    return 0;
+
+  return avm_map_file(bfd_get_filename(abfd), s->filepos, vma,
+                      AVM_INSTRUCTION | AVM_DATA, size) > 0;
+}
+
+static bfd *
+load_image (char *prog, bfd *abfd)
+{
+  bfd *result = abfd;
+  asection *s;
+  int found = 0;
+
+  if (result == NULL)
+    {
+      result = bfd_openr(prog, 0);
+      if (result == NULL)
+        {
+          sim_printf("%s: can't open \"%s\": %s\n",
+                     sim_name, prog, bfd_errmsg(bfd_get_error()));
+          return NULL;
+        }
+    }
+
+  if (!bfd_check_format(result, bfd_object))
+    {
+      sim_printf("%s: \"%s\" is not an object file: %s\n",
+                 sim_name, prog, bfd_errmsg(bfd_get_error()));
+      if (abfd == NULL)
+        bfd_close(result);
+      return NULL;
+    }
+
+  for (s = result->sections; s; s = s->next)
+    {
+      bfd_size_type size = bfd_get_section_size(s);
+      SIM_ADDR vma = bfd_section_vma(result, s);
+      unsigned char *buffer;
+
+      if (!(s->flags & SEC_LOAD) || size == 0)
+        continue;
+
+      if (sim_kind == SIM_OPEN_DEBUG)
+        sim_printf("Loading section %s, size 0x%lx vma 0x%x\n",
+                   bfd_get_section_name(result, s), (unsigned long) size, vma);
+      found = 1;
+
+      /* kernel images are linked in the unmapped partition */
+      if (cpu.features.mmu && vma >= 0xc0000000u)
+        vma &= 0x1fffffffu;
+
+      if (!nios2_sysdesc_memory && load_mapped_section(result, s, vma, size))
+        continue;
+
+      buffer = (unsigned char *) malloc(size);
+      if (buffer == NULL)
+        {
+          sim_printf("%s: insufficient memory to load \"%s\"\n", sim_name, prog);
+          if (abfd == NULL)
+            bfd_close(result);
+          return NULL;
+        }
+      bfd_get_section_contents(result, s, buffer, 0, size);
+      if (!nios2_sysdesc_memory)
+        avm_add_memory("", vma, AVM_INSTRUCTION | AVM_DATA, buffer, size);
+      else if (avm_write_force(vma, buffer, size, AVM_INSTRUCTION | AVM_DATA) != size)
+        {
+          /* the described memory map must hold the whole image */
+          sim_printf("%s: section %s at 0x%x is outside of the memory map\n",
+                     sim_name, bfd_get_section_name(result, s), vma);
+          free(buffer);
+          if (abfd == NULL)
+            bfd_close(result);
+          return NULL;
+        }
+      free(buffer);
+    }
+
+  if (!found)
+    {
+      sim_printf("%s: no loadable sections \"%s\"\n", sim_name, prog);
+      return NULL;
+    }
+
+  bfd_cache_close(result);
+  return result;
 }
 
 SIM_RC
@@ -74,19 +206,20 @@ sim_load (SIM_DESC sd, char *prog, struct bfd *abfd, int from_tty)
   bfd *prog_bfd;
   SIM_ADDR end;
 
-  sim_loading = 1;
-  prog_bfd = sim_load_file (sd, sim_name, sim_callback, prog, abfd,
-                            sim_kind == SIM_OPEN_DEBUG,
-                            0, sim_write);
+  prog_bfd = load_image(prog, abfd);
 
-  if (avm_end_address(&end, AVM_INSTRUCTION | AVM_DATA) >= 0)
-    avm_add_memory("heap", end, AVM_DATA | AVM_INSTRUCTION, NULL, 0x800000);
-  avm_add_memory("stack", 0x7800000, AVM_DATA | AVM_INSTRUCTION, NULL, 0x800000);
-  sim_loading = 0;
+  /* the default memory map unless a system description gave one */
+  if (!nios2_sysdesc_memory)
+    {
+      if (avm_end_address(&end, AVM_INSTRUCTION | AVM_DATA) >= 0)
+        avm_add_memory("heap", end, AVM_DATA | AVM_INSTRUCTION, NULL, 0x800000);
+      avm_add_memory("stack", 0x7800000, AVM_DATA | AVM_INSTRUCTION, NULL, 0x800000);
+    }
 
   if (prog_bfd == NULL)
     return SIM_RC_FAIL;
 
+  nios2_helpers_load(prog_bfd);
   if (abfd != NULL)
     sim_bfd = abfd;
 
@@ -111,17 +244,83 @@ sim_create_inferior (SIM_DESC sd, struct bfd *abfd, char **argv, char **env)
   cpu.features.hwdiv = 1;
   cpu.features.hwmul = 1;
   cpu.features.hwmulx = 1;
+  nios2_sysdesc_features(&cpu.features);
 
   nios2_reset();
+  nios2_smp_reset();
+  avm_reset_devices();
   // avm_dump_sections(1);
 
   return SIM_RC_OK;
 }
 
+/* with the MMU, GDB sees the virtual addresses of the supervisor;
+   accesses are split at pages and stop at the first unmapped one */
+static int
+sim_access_virtual (SIM_ADDR mem, unsigned char *buf, int length, int write)
+{
+  int done = 0;
+
+  while (done < length)
+    {
+      SIM_ADDR pa;
+      int n = AVM_PAGE_SIZE - ((mem + done) & AVM_PAGE_MASK);
+
+      if (n > length - done)
+        n = length - done;
+      if (!nios2_mmu_debug_translate(mem + done, &pa))
+        break;
+
+      if (write)
+        n = avm_write(pa, buf + done, n, AVM_DATA);
+      else
+        n = avm_read(pa, buf + done, n, AVM_DATA | AVM_INSTRUCTION);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+
+  return done;
+}
+
+/* the translation is that of the selected core */
+struct virtual_access
+  {
+    SIM_ADDR mem;
+    unsigned char *buf;
+    int length;
+    int write;
+    int result;
+  };
+
+static void
+core_access_virtual (void *arg)
+{
+  struct virtual_access *va = (struct virtual_access *) arg;
+
+  va->result = sim_access_virtual(va->mem, va->buf, va->length, va->write);
+}
+
+static int
+sim_access_selected (SIM_ADDR mem, unsigned char *buf, int length, int write)
+{
+  struct virtual_access va;
+
+  va.mem = mem;
+  va.buf = buf;
+  va.length = length;
+  va.write = write;
+  nios2_smp_call(nios2_smp_selected(), core_access_virtual, &va);
+  return va.result;
+}
+
 int
 sim_read (SIM_DESC sd, SIM_ADDR mem, unsigned char *buf, int length)
 {
   // sim_printf("sim_read (mem=0x%x, len=0x%x)\n", mem, length);
+  if (cpu.features.mmu)
+    return sim_access_selected(mem, buf, length, 0);
+
   return avm_read(mem, buf, length, AVM_DATA | AVM_INSTRUCTION);
 }
 
@@ -129,8 +328,8 @@ int
 sim_write (SIM_DESC sd, SIM_ADDR mem, unsigned char *buf, int length)
 {
   // sim_printf("sim_write (mem=0x%x, len=0x%x)\n", mem, length);
-  if (sim_loading)
-    return avm_add_memory("", mem, AVM_INSTRUCTION | AVM_DATA, buf, length);
+  if (cpu.features.mmu)
+    return sim_access_selected(mem, buf, length, 1);
 
   return avm_write(mem, buf, length, AVM_DATA);
 }
@@ -143,7 +342,9 @@ sim_fetch_register (SIM_DESC sd, int regno, unsigned char *buf, int length)
 
   if (regno >= SIM_NIOS2_R0_REGNUM && regno <= SIM_NIOS2_MPUACC_REGNUM)
     {
-      *((unsigned32*) buf) = H2LE4(cpu.regs.array[regno]);
+      nios2_cpu_t *c = nios2_smp_cpu(nios2_smp_selected());
+
+      *((unsigned32*) buf) = H2LE4(c->regs.array[regno]);
       return -1;
     }
 
@@ -155,16 +356,38 @@ sim_store_register (SIM_DESC sd, int regno, unsigned char *buf, int length)
 {
 }
 
+static void
+core_info (void *arg)
+{
+  sim_printf("instructions: %llu\n", (unsigned long long) cpu.insns);
+  sim_printf("cycles:       %llu\n", (unsigned long long) cpu.cycles);
+  nios2_timing_info();
+  nios2_cache_info();
+  nios2_mmu_info();
+}
+
 void
 sim_info (SIM_DESC sd, int verbose)
 {
+  int i;
+
+  if (nios2_smp_cores == 1)
+    core_info(NULL);
+  else
+    for (i = 0; i < nios2_smp_cores; ++i)
+      {
+        sim_printf("core %d:\n", i);
+        nios2_smp_call(i, core_info, NULL);
+      }
+  nios2_helpers_info();
 }
 
 void
 sim_resume (SIM_DESC sd, int step, int siggnal)
 {
   // sim_printf("sim_resume(step=%d)\n", step);
-  nios2_interpret(step);
+  nios2_smp_resume(step);
+  nios2_hostio_flush();
 }
 
 int
@@ -180,8 +403,115 @@ sim_stop_reason (SIM_DESC sd, enum sim_stop *reason, int *sigrc)
   // sim_printf("sim_stop_reason() -> sim_%s, %d\n",
   //   "running\0polling\0exited\0\0stopped\0signalled" + (8 * cpu.state),
   //   cpu.signal);
-  *reason = cpu.state;
-  *sigrc = cpu.signal;
+  nios2_cpu_t *c = nios2_smp_cpu(nios2_smp_stopped());
+
+  *reason = c->state;
+  *sigrc = c->signal;
+}
+
+/* cores are the threads of GDB */
+int
+sim_processor_count (SIM_DESC sd)
+{
+  return nios2_smp_cores;
+}
+
+void
+sim_select_processor (SIM_DESC sd, int n)
+{
+  nios2_smp_select(n);
+}
+
+int
+sim_stopped_processor (SIM_DESC sd)
+{
+  return nios2_smp_stopped();
+}
+
+/* watchpoints; type is that of GDB: 0 write, 1 read, 2 access */
+static int
+sim_watch_args (SIM_ADDR addr, int type, SIM_ADDR *phys, int *avm_type)
+{
+  static const int types[3] =
+    {
+      AVM_WATCH_WRITE, AVM_WATCH_READ, AVM_WATCH_READ | AVM_WATCH_WRITE
+    };
+
+  if (type < 0 || type > 2)
+    return -1;
+
+  *avm_type = types[type];
+  *phys = addr;
+  /* the MMU mapping seen by GDB (see sim_access_virtual) */
+  if (cpu.features.mmu && !nios2_mmu_debug_translate(addr, phys))
+    return -1;
+
+  return 0;
+}
+
+int
+sim_insert_watchpoint (SIM_DESC sd, SIM_ADDR addr, int len, int type)
+{
+  SIM_ADDR phys;
+  int avm_type;
+
+  if (sim_watch_args(addr, type, &phys, &avm_type) < 0)
+    return -1;
+
+  return avm_insert_watch(addr, phys, len, avm_type);
+}
+
+int
+sim_remove_watchpoint (SIM_DESC sd, SIM_ADDR addr, int len, int type)
+{
+  SIM_ADDR phys;
+  int avm_type;
+
+  if (sim_watch_args(addr, type, &phys, &avm_type) < 0)
+    return -1;
+
+  return avm_remove_watch(addr, phys, len, avm_type);
+}
+
+int
+sim_stopped_data_address (SIM_DESC sd, SIM_ADDR *addr)
+{
+  nios2_cpu_t *c = nios2_smp_cpu(nios2_smp_stopped());
+
+  if (!c->watch_hit)
+    return 0;
+
+  *addr = c->watch_addr;
+  return 1;
+}
+
+/* commands about the state of one core run on its thread */
+struct core_command_args
+  {
+    int (*command)(int argc, char *argv[]);
+    int argc;
+    char **argv;
+    int result;
+  };
+
+static void
+core_command (void *arg)
+{
+  struct core_command_args *cc = (struct core_command_args *) arg;
+
+  cc->result = cc->command(cc->argc, cc->argv);
+}
+
+static int
+selected_core_command (int (*command)(int argc, char *argv[]), int argc, char *argv[])
+{
+  struct core_command_args cc;
+
+  cc.command = command;
+  cc.argc = argc;
+  cc.argv = argv;
+  nios2_smp_call(nios2_smp_selected(), core_command, &cc);
+  return cc.result;
 }
 
 void
@@ -206,7 +536,27 @@ sim_do_command (SIM_DESC sd, char *cmd)
     return;
 
   if (strcmp(argv[0], "btrace") == 0)
-    no_cmd = btrace_command(argc, argv);
+    no_cmd = selected_core_command(btrace_command, argc, argv);
+  else if (strcmp(argv[0], "device") == 0)
+    no_cmd = device_command(argc, argv);
+  else if (strcmp(argv[0], "custom") == 0)
+    no_cmd = custom_command(argc, argv);
+  else if (strcmp(argv[0], "helpers") == 0)
+    no_cmd = helpers_command(argc, argv);
+  else if (strcmp(argv[0], "mmu") == 0)
+    no_cmd = selected_core_command(mmu_command, argc, argv);
+  else if (strcmp(argv[0], "smp") == 0)
+    no_cmd = smp_command(argc, argv);
+  else if (strcmp(argv[0], "watch") == 0)
+    no_cmd = watch_command(argc, argv);
+  else if (strcmp(argv[0], "snapshot") == 0)
+    no_cmd = snapshot_command(argc, argv);
+  else if (strcmp(argv[0], "cache") == 0)
+    no_cmd = selected_core_command(cache_command, argc, argv);
+  else if (strcmp(argv[0], "timing") == 0)
+    no_cmd = timing_command(argc, argv);
+  else if (strcmp(argv[0], "profile") == 0)
+    no_cmd = profile_command(argc, argv, sim_bfd);
   else
     sim_printf("unknown simulator command: %s\n", argv[0]);
 
@@ -236,34 +586,6 @@ sim_trace (SIM_DESC sd)
   return 1;
 }
 
-int
-sim_sys_write (int file, SIM_ADDR ptr, int len)
-{
-  int i;
-  char buf;
-
-  if (file != 1 /* stdout */ && file != 2 /* stderr */)
-    return -1;
-
-  for (i = len; i > 0; --i, ++ptr)
-    {
-      if (avm_read(ptr, &buf, 1, AVM_DATA) != 1)
-        buf = 0xff;
-      sim_printf("%c", buf);
-    }
-
-  return len;
-}
-
-int
-sim_sys_read (int file, SIM_ADDR ptr, int len)
-{
-  if (file != 0 /* stdin */)
-    return -1;
-  /* TODO */
-  return -1;
-}
-
 /*
  * vim:et sts=2 sw=2:
  */
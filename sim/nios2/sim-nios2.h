@@ -7,6 +7,9 @@
 #ifndef SIM_NIOS2_H
 #define SIM_NIOS2_H
 
+#include <string.h>
+#include "nios2-custom.h"
+
 #ifdef __cplusplus
 extern "C" { // }
 #endif
@@ -91,11 +94,23 @@ typedef struct
     unsigned32 exception_addr;
     unsigned32 cpuid;
 
+    unsigned32 fast_tlb_miss_addr;
+
     unsigned8 hwdiv;
     unsigned8 hwmul;
     unsigned8 hwmulx;
     unsigned8 mmu;
     unsigned8 mpu;
+
+    /* MMU */
+    unsigned16 tlb_entries;
+    unsigned8 tlb_ways;
+    unsigned8 pid_bits;
+
+    /* MPU */
+    unsigned8 mpu_inst_regions;
+    unsigned8 mpu_data_regions;
+    unsigned8 mpu_use_limit;    /* mpuacc holds a limit instead of a mask */
   }
 nios2_features_t;
 
@@ -104,6 +119,7 @@ enum nios2_btrace_mode
     NIOS2_BTRACE_DISABLED,
     NIOS2_BTRACE_RING,
     NIOS2_BTRACE_LINEAR,
+    NIOS2_BTRACE_STREAM,
   };
 
 typedef struct
@@ -119,6 +135,7 @@ typedef struct
     unsigned32 index;
     unsigned32 size;
     nios2_btrace_entry_t *buffer;
+    struct nios2_btrace_stream *stream;   /* NIOS2_BTRACE_STREAM only */
   }
 nios2_btrace_t;
 
@@ -128,11 +145,39 @@ typedef struct
     nios2_features_t features;
     nios2_btrace_t btrace;
 
+    unsigned64 cycles;      /* CPU clock ticks since reset */
+    unsigned64 insns;       /* instructions retired since reset */
+    unsigned32 irq_lines;   /* levels of the 32 interrupt inputs */
+
     enum sim_stop state;
     int signal;
+    int watch_hit;          /* stopped by a watchpoint (see avm_insert_watch) */
+    unsigned32 watch_addr;  /*   on an access to this debugger address */
+
+    struct nios2_decode_cache *decode;  /* translated blocks (see interp.c) */
   }
 nios2_cpu_t;
 
+/*
+ * Several cores (see smp.c)
+ *
+ * Each simulated core runs on a host thread of its own.  What belongs to
+ * one core (registers, events, TLB, caches, predictor state) is kept in
+ * thread-local variables declared NIOS2_PER_CORE, so `cpu' always names
+ * the core of the calling thread; the translated blocks are too large
+ * for that and hang off `cpu' instead.  Memory, devices and the
+ * configuration made by "sim" commands are shared by all cores.
+ */
+#ifdef HAVE_PTHREAD_H
+#define NIOS2_PER_CORE  __thread
+#else
+#define NIOS2_PER_CORE
+#endif
+#define NIOS2_CORES_MAX 16
+
+extern int nios2_smp_cores;
+extern NIOS2_PER_CORE int nios2_core_id;
+
 #define NIOS2_STATUS_PIE        (1u<<0)
 #define NIOS2_STATUS_U          (1u<<1)
 #define NIOS2_STATUS_EH         (1u<<2)
@@ -143,39 +188,456 @@ nios2_cpu_t;
 #define NIOS2_STATUS_MMI        (1u<<22)
 #define NIOS2_STATUS_RSIE       (1u<<23)
 
+#define NIOS2_EXCEPTION_CAUSE_SHIFT   2
+#define NIOS2_EXCEPTION_RESET         0
+#define NIOS2_EXCEPTION_INTERRUPT     2
+#define NIOS2_EXCEPTION_TRAP          3
+#define NIOS2_EXCEPTION_UNIMPLEMENTED 4
+#define NIOS2_EXCEPTION_ILLEGAL       5
+#define NIOS2_EXCEPTION_MISALIGNED_DATA         6
+#define NIOS2_EXCEPTION_MISALIGNED_DESTINATION  7
+#define NIOS2_EXCEPTION_DIVISION      8
+#define NIOS2_EXCEPTION_SUPERVISOR_INST_ADDR    9
+#define NIOS2_EXCEPTION_SUPERVISOR_ONLY         10
+#define NIOS2_EXCEPTION_SUPERVISOR_DATA_ADDR    11
+#define NIOS2_EXCEPTION_TLB_MISS      12
+#define NIOS2_EXCEPTION_TLB_EXECUTE   13
+#define NIOS2_EXCEPTION_TLB_READ      14
+#define NIOS2_EXCEPTION_TLB_WRITE     15
+#define NIOS2_EXCEPTION_MPU_INST      16
+#define NIOS2_EXCEPTION_MPU_DATA      17
+
+#define NIOS2_PTEADDR_VPN_SHIFT   2
+#define NIOS2_PTEADDR_VPN_MASK    (0xfffffu << NIOS2_PTEADDR_VPN_SHIFT)
+
+#define NIOS2_TLBACC_PFN_MASK     0xfffffu
+#define NIOS2_TLBACC_G            (1u<<20)
+#define NIOS2_TLBACC_X            (1u<<21)
+#define NIOS2_TLBACC_W            (1u<<22)
+#define NIOS2_TLBACC_R            (1u<<23)
+#define NIOS2_TLBACC_C            (1u<<24)
+
+#define NIOS2_TLBMISC_D           (1u<<0)
+#define NIOS2_TLBMISC_PERM        (1u<<1)
+#define NIOS2_TLBMISC_BAD         (1u<<2)
+#define NIOS2_TLBMISC_DBL         (1u<<3)
+#define NIOS2_TLBMISC_PID_SHIFT   4
+#define NIOS2_TLBMISC_WE          (1u<<18)
+#define NIOS2_TLBMISC_RD          (1u<<19)
+#define NIOS2_TLBMISC_WAY_SHIFT   20
+#define NIOS2_TLBMISC_WAY_MASK    (0xfu << NIOS2_TLBMISC_WAY_SHIFT)
+
+#define NIOS2_CONFIG_PE           (1u<<0)
+
+#define NIOS2_MPUBASE_D           (1u<<0)
+#define NIOS2_MPUBASE_INDEX_SHIFT 1
+#define NIOS2_MPUBASE_INDEX_MASK  (0x1fu << NIOS2_MPUBASE_INDEX_SHIFT)
+#define NIOS2_MPUBASE_BASE_MASK   0x7fffffc0u
+#define NIOS2_MPUACC_WR           (1u<<0)
+#define NIOS2_MPUACC_RD           (1u<<1)
+#define NIOS2_MPUACC_PERM_SHIFT   2
+#define NIOS2_MPUACC_PERM_MASK    (7u << NIOS2_MPUACC_PERM_SHIFT)
+#define NIOS2_MPUACC_C            (1u<<5)
+#define NIOS2_MPUACC_MASK_MASK    0xffffffc0u
+
 #define AVM_INSTRUCTION   (1<<12)
 #define AVM_DATA          (1<<13)
 #define AVM_MASTER_MASK   (AVM_INSTRUCTION|AVM_DATA)
 
 #define AVM_READONLY      (1<<16)
 #define AVM_NOCACHE       (1<<17)
+#define AVM_CPU           (1<<18) /* load/store of the CPU (counted) */
+
+/*
+ * Avalon-MM page table
+ *
+ * Two-level table of 4 KiB pages over the 31-bit Avalon address space
+ * (bit 31 is the no-cache bit and selects the same memory).  A page which
+ * lies entirely within one memory section maps straight to host memory;
+ * each pointer is only set when that kind of access is permitted, so a
+ * NULL pointer sends the access to the avm_read()/avm_write() slow path.
+ */
+#define AVM_PAGE_SHIFT    12
+#define AVM_PAGE_SIZE     (1u << AVM_PAGE_SHIFT)
+#define AVM_PAGE_MASK     (AVM_PAGE_SIZE - 1)
+#define AVM_L2_BITS       10
+#define AVM_L2_SIZE       (1u << AVM_L2_BITS)
+#define AVM_L1_BITS       (31 - AVM_PAGE_SHIFT - AVM_L2_BITS)
+#define AVM_L1_SIZE       (1u << AVM_L1_BITS)
+
+typedef struct
+  {
+    unsigned char *read;    /* data master reads */
+    unsigned char *write;   /* data master writes */
+    unsigned char *fetch;   /* instruction master reads */
+    unsigned32 *prof;       /* execution counts of each word (profiling) */
+    unsigned64 loads;       /* fast path accesses (slow ones are counted */
+    unsigned64 stores;      /*   in the memory section) */
+    int code;               /* holds translated code (see avm_protect_code) */
+    int watch;              /* AVM_WATCH_* of the watchpoints on the page */
+  }
+avm_page_t;
 
+#define AVM_WATCH_READ    1
+#define AVM_WATCH_WRITE   2
+
+extern avm_page_t *avm_page_dir[AVM_L1_SIZE];
+
+#define AVM_PAGE(mem) \
+  (&avm_page_dir[((mem) >> (AVM_PAGE_SHIFT + AVM_L2_BITS)) & (AVM_L1_SIZE - 1)] \
+                [((mem) >> AVM_PAGE_SHIFT) & (AVM_L2_SIZE - 1)])
+
+
+/* see timing.c */
+typedef struct
+  {
+    const char *name;
+    const char *description;
+    /* issue cycles of an instruction; *latency is set to the cycles an
+       instruction using its result right after it has to wait */
+    int (*cost)(unsigned32 opcode, unsigned32 insn, int *latency);
+    /* cycles of a conditional branch (NULL: cost() covers them) */
+    int (*branch)(unsigned32 pc, unsigned32 target, int taken);
+    void (*reset)(void);
+  }
+nios2_timing_t;
+
+typedef struct
+  {
+    unsigned64 branches;
+    unsigned64 mispredicts;
+  }
+nios2_timing_stats_t;
+
+typedef struct nios2_event nios2_event_t;
+typedef void nios2_event_handler_t(void *data, unsigned64 now);
+
+typedef struct avm_device avm_device_t;
+
+typedef struct
+  {
+    const char *type;
+    unsigned32 size;        /* span of the register file in bytes */
+    unsigned32 priv_size;   /* size of the model state */
+    void (*reset)(avm_device_t *dev);
+    unsigned32 (*read)(avm_device_t *dev, unsigned32 reg);
+    void (*write)(avm_device_t *dev, unsigned32 reg, unsigned32 value, unsigned32 mask);
+    void (*input)(avm_device_t *dev, const char *arg);
+    /* rebuild what the model state refers to (events, irq) after it was
+       copied back from a snapshot; NULL if there is nothing to do */
+    void (*restore)(avm_device_t *dev);
+  }
+avm_device_class_t;
+
+struct avm_device
+  {
+    const avm_device_class_t *cls;
+    SIM_ADDR base;
+    int irq;                /* -1: not connected */
+    int core;               /* core the irq line goes to */
+    void *priv;
+    void *saved;            /* copy of priv at the snapshot */
+    avm_device_t *next;
+    char name[1];
+  };
+
+/* see custom.c */
+typedef struct
+  {
+    nios2_custom_handler_t *handler;  /* NULL: not claimed */
+    void *priv;
+    unsigned32 latency;
+    int plugin;
+  }
+nios2_custom_slot_t;
 
 enum nios2_sys_magics
   {
     NIOS2_SYS_WRITE = 0x0001,
+    NIOS2_SYS_READ  = 0x0002,
+    NIOS2_SYS_OPEN  = 0x0003,
+    NIOS2_SYS_CLOSE = 0x0004,
+    NIOS2_SYS_LSEEK = 0x0005,
+    NIOS2_SYS_FSTAT = 0x0006,
+    NIOS2_SYS_GETTIMEOFDAY = 0x0007,
     NIOS2_SYS__EXIT = 0x0010,
     NIOS2_SYS_MAGIC = 0xcafe,
   };
 
 extern int nios2_reset(void);
 extern int nios2_interpret(int step);
-extern nios2_cpu_t cpu;
+extern void nios2_exception(unsigned32 cause, unsigned32 ea);
+extern void nios2_write_ctl(int n, unsigned32 value);
+extern NIOS2_PER_CORE nios2_cpu_t cpu;
+extern void nios2_decode_flush(void);
+extern void nios2_decode_invalidate(SIM_ADDR mem, int length);
+extern void nios2_decode_invalidate_local(SIM_ADDR mem, int length);
+extern void nios2_decode_release(void);
 
 extern int avm_add_memory(const char *name, SIM_ADDR base, int flags, unsigned char *buf, int length);
+extern int avm_map_file(const char *path, long offset, SIM_ADDR base, int flags, int length);
+extern unsigned8 avm_memory_fill;
 extern int avm_end_address(SIM_ADDR *pend, int flags);
 extern void avm_clear_sections(void);
 extern int avm_read(SIM_ADDR mem, unsigned char *buf, int length, int flags);
 extern int avm_write(SIM_ADDR mem, unsigned char *buf, int length, int flags);
 extern int avm_write_force(SIM_ADDR mem, unsigned char *buf, int length, int flags);
+extern int avm_add_io(const char *name, SIM_ADDR base, int length, avm_device_t *dev);
+extern void avm_protect_code(SIM_ADDR mem);
+extern void avm_unprotect_code(void);
+extern unsigned32 *avm_profile_counters(SIM_ADDR mem);
+extern void avm_profile_clear(void);
+extern void avm_snapshot_save(void);
+extern int avm_snapshot_restore(void);
+extern void avm_snapshot_drop(void);
+extern int avm_snapshot_info(unsigned32 *bytes, unsigned32 *dirty);
+extern int avm_insert_watch(SIM_ADDR addr, SIM_ADDR phys, int length, int type);
+extern int avm_remove_watch(SIM_ADDR addr, SIM_ADDR phys, int length, int type);
+extern int watch_command(int argc, char *argv[]);
+extern int avm_section_index(SIM_ADDR mem);
+extern int avm_section_stats(int index, const char **name, SIM_ADDR *base, SIM_ADDR *end,
+                             unsigned64 *loads, unsigned64 *stores);
 
+extern int nios2_profiling;
+
+/* CPU loads and stores are only counted while profiling; core 0 counts
+   its fast path accesses in the pages, the other cores count theirs in
+   tables of their own, laid out like avm_page_dir, so that no two
+   threads write one counter (see avm_section_stats) */
+typedef struct
+  {
+    unsigned64 loads;
+    unsigned64 stores;
+  }
+avm_count_t;
+
+extern avm_count_t *avm_core_counts[NIOS2_CORES_MAX][AVM_L1_SIZE];
+extern avm_count_t *avm_core_counts_alloc(SIM_ADDR mem);
+
+static inline avm_count_t *
+avm_core_count(SIM_ADDR mem)
+{
+  avm_count_t *l2 = avm_core_counts[nios2_core_id][(mem >> (AVM_PAGE_SHIFT + AVM_L2_BITS)) & (AVM_L1_SIZE - 1)];
+
+  if (l2 == NULL)
+    l2 = avm_core_counts_alloc(mem);
+  return &l2[(mem >> AVM_PAGE_SHIFT) & (AVM_L2_SIZE - 1)];
+}
+
+#define AVM_COUNT(page, mem, counter) \
+  (!nios2_profiling ? (void) 0 \
+   : nios2_smp_cores == 1 || nios2_core_id == 0 ? (void) ++(page)->counter \
+   : (void) ++avm_core_count(mem)->counter)
+
+/* data accesses of the interpreter; mem must be naturally aligned */
+#define AVM_DEFINE_LOAD(name, type) \
+  static inline int \
+  name(SIM_ADDR mem, type *val, int flags) \
+  { \
+    avm_page_t *page = AVM_PAGE(mem); \
+    if (page->read) \
+      { \
+        AVM_COUNT(page, mem, loads); \
+        memcpy(val, page->read + (mem & AVM_PAGE_MASK), sizeof(type)); \
+        return sizeof(type); \
+      } \
+    return avm_read(mem, (unsigned char *) val, sizeof(type), AVM_DATA | AVM_CPU | flags); \
+  }
+#define AVM_DEFINE_STORE(name, type) \
+  static inline int \
+  name(SIM_ADDR mem, type val, int flags) \
+  { \
+    avm_page_t *page = AVM_PAGE(mem); \
+    if (page->write) \
+      { \
+        AVM_COUNT(page, mem, stores); \
+        memcpy(page->write + (mem & AVM_PAGE_MASK), &val, sizeof(type)); \
+        return sizeof(type); \
+      } \
+    return avm_write(mem, (unsigned char *) &val, sizeof(type), AVM_DATA | AVM_CPU | flags); \
+  }
+
+AVM_DEFINE_LOAD(avm_load8, unsigned8)
+AVM_DEFINE_LOAD(avm_load16, unsigned16)
+AVM_DEFINE_LOAD(avm_load32, unsigned32)
+AVM_DEFINE_STORE(avm_store8, unsigned8)
+AVM_DEFINE_STORE(avm_store16, unsigned16)
+AVM_DEFINE_STORE(avm_store32, unsigned32)
+
+/*
+ * Software TLB (see mmu.c)
+ *
+ * Direct-mapped cache of the page translations in effect, one for each
+ * mode (supervisor, user).  A tag holds the virtual page only while that
+ * kind of access is allowed to it, so a hit needs no other check; a miss
+ * goes to nios2_translate_slow(), which walks the TLB or the MPU regions.
+ */
+#define NIOS2_STLB_BITS     8
+#define NIOS2_STLB_SIZE     (1u << NIOS2_STLB_BITS)
+#define NIOS2_STLB_INVALID  1u    /* never matches a page address */
+
+enum nios2_access
+  {
+    NIOS2_ACCESS_READ,
+    NIOS2_ACCESS_WRITE,
+    NIOS2_ACCESS_FETCH,
+  };
+
+typedef struct
+  {
+    unsigned32 tag[3];    /* virtual page for each nios2_access */
+    unsigned32 phys;      /* physical page (0x80000000: not cacheable) */
+  }
+nios2_stlb_entry_t;
+
+extern NIOS2_PER_CORE int nios2_mmu_active;
+extern NIOS2_PER_CORE nios2_stlb_entry_t nios2_stlb[2][NIOS2_STLB_SIZE];
+extern unsigned32 nios2_translate_slow(unsigned32 va, int access, unsigned32 *pa);
+
+/* 0 with the physical address in *pa, or the exception cause (with the
+   MMU/MPU registers already describing the fault) */
+static inline unsigned32
+nios2_translate(unsigned32 va, int access, unsigned32 *pa)
+{
+  nios2_stlb_entry_t *e =
+    &nios2_stlb[(cpu.regs.status & NIOS2_STATUS_U) ? 1 : 0]
+               [(va >> AVM_PAGE_SHIFT) & (NIOS2_STLB_SIZE - 1)];
+
+  if (e->tag[access] == (va & ~AVM_PAGE_MASK))
+    {
+      *pa = e->phys | (va & AVM_PAGE_MASK);
+      return 0;
+    }
+
+  return nios2_translate_slow(va, access, pa);
+}
+
+extern avm_device_t *avm_add_device(const char *type, const char *name, SIM_ADDR base, int irq);
+extern int avm_device_access(avm_device_t *dev, unsigned32 offset, unsigned char *buf, int length, int write);
+extern void avm_reset_devices(void);
+extern void avm_clear_devices(void);
+extern void avm_save_devices(void);
+extern void avm_restore_devices(void);
+extern int device_command(int argc, char *argv[]);
+extern NIOS2_PER_CORE unsigned64 nios2_next_event;
+extern nios2_event_t *nios2_events_schedule(unsigned64 time, nios2_event_handler_t *handler, void *data);
+extern void nios2_events_deschedule(nios2_event_t *ev);
+extern void nios2_events_process(void);
+extern void nios2_events_clear(void);
+extern void nios2_check_interrupt(void);
+
+struct bfd;
+struct host_callback_struct;
+extern const nios2_timing_t *nios2_timing;
+extern NIOS2_PER_CORE nios2_timing_stats_t nios2_timing_stats;
+extern void nios2_timing_reset(void);
+extern int nios2_set_timing(const char *name);
+extern void nios2_timing_info(void);
+extern int timing_command(int argc, char *argv[]);
+
+enum nios2_dcache_op
+  {
+    NIOS2_DCACHE_FLUSHD,
+    NIOS2_DCACHE_FLUSHDA,
+    NIOS2_DCACHE_INITD,
+    NIOS2_DCACHE_INITDA,
+  };
+
+extern NIOS2_PER_CORE int nios2_icache_enabled;
+extern NIOS2_PER_CORE int nios2_dcache_enabled;
+extern unsigned32 nios2_dcache_access(SIM_ADDR mem, int write, int flags);
+extern unsigned32 nios2_icache_fetch(SIM_ADDR mem, unsigned32 length);
+extern void nios2_dcache_op(int op, SIM_ADDR mem);
+extern void nios2_icache_op(SIM_ADDR mem);
+extern void nios2_cache_reset(void);
+extern void nios2_cache_info(void);
+extern int cache_command(int argc, char *argv[]);
+
+extern int snapshot_command(int argc, char *argv[]);
+
+extern nios2_custom_slot_t nios2_custom_table[256];
+extern unsigned32 nios2_custom_latency(unsigned32 n);
+extern void nios2_custom_clear(void);
+extern int custom_command(int argc, char *argv[]);
+
+extern int nios2_helpers_enabled;
+extern NIOS2_PER_CORE unsigned32 nios2_helper_return;
+extern int nios2_helper_at(SIM_ADDR pc);
+extern int nios2_helper_hook(int helper);
+extern void nios2_helpers_cancel(void);
+extern void nios2_helpers_enable(int enable);
+extern void nios2_helpers_load(struct bfd *abfd);
+extern void nios2_helpers_info(void);
+extern int helpers_command(int argc, char *argv[]);
+
+extern void nios2_mmu_reset(void);
+extern void nios2_mmu_write_ctl(int n, unsigned32 value);
+extern int nios2_mmu_debug_translate(SIM_ADDR va, SIM_ADDR *pa);
+extern void nios2_mmu_save(void);
+extern void nios2_mmu_restore(void);
+extern int nios2_mmu_configure(const char *option);
+extern void nios2_mmu_info(void);
+extern int mmu_command(int argc, char *argv[]);
+
+extern int profile_command(int argc, char *argv[], struct bfd *abfd);
+
+extern void nios2_set_irq(int irq, int level);
+extern void nios2_update_ipending(void);
+
+extern void nios2_hostio_init(struct host_callback_struct *cb);
+extern void nios2_hostio_flush(void);
+extern void sim_sys_call(int magic);
 extern int sim_sys_write(int file, SIM_ADDR ptr, int len);
 extern int sim_sys_read(int file, SIM_ADDR ptr, int len);
 extern void sim_sys__exit(int exitcode);
 
+extern int nios2_smp_running;
+extern int nios2_smp_configure(const char *option);
+extern int nios2_smp_start(void);
+extern void nios2_smp_stop(void);
+extern void nios2_smp_reset(void);
+extern void nios2_smp_resume(int step);
+extern int nios2_smp_stopped(void);
+extern void nios2_smp_select(int core);
+extern int nios2_smp_selected(void);
+extern nios2_cpu_t *nios2_smp_cpu(int core);
+extern void nios2_smp_call(int core, void (*fn)(void *), void *arg);
+extern void nios2_smp_flush_others(void);
+extern void nios2_smp_code_written(SIM_ADDR mem, int length);
+extern void nios2_smp_set_irq(int core, int irq, int level);
+extern void nios2_smp_poll(void);
+extern void nios2_smp_info(void);
+extern int smp_command(int argc, char *argv[]);
+extern void nios2_smp_lock_slow(void);
+extern void nios2_smp_unlock_slow(void);
+
+/* serializes the accesses of the cores to shared state (devices, the
+   slow memory path, the event queues); recursive, free with one core */
+static inline void
+nios2_smp_lock(void)
+{
+  if (nios2_smp_cores > 1)
+    nios2_smp_lock_slow();
+}
+
+static inline void
+nios2_smp_unlock(void)
+{
+  if (nios2_smp_cores > 1)
+    nios2_smp_unlock_slow();
+}
+
+extern int nios2_sysdesc_memory;
+extern int nios2_sysdesc_load(const char *path);
+extern void nios2_sysdesc_features(nios2_features_t *features);
+extern void nios2_sysdesc_clear(void);
+
 extern void btrace_record(unsigned32 from, unsigned32 to);
 extern int btrace_command(int argc, char *argv[]);
 extern int btrace_free(void);
+extern void btrace_save(void);
+extern void btrace_restore(void);
+extern void btrace_drop(void);
 
 #ifdef __cplusplus
 }
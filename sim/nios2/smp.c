@@ -0,0 +1,664 @@
+/**
+ * @file smp.c
+ * @brief Several cores on host threads for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include "libiberty.h"
+#include "gdb/callback.h"
+#include "gdb/signals.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * With "--cores=N", N cores share the memory and the devices.  Each one
+ * interprets on a host thread of its own, core 0 on the thread of GDB.
+ * The cores run freely for a quantum of cycles and then wait for each
+ * other at a barrier, so that none of them gets more than a quantum
+ * ahead.  What a core does to another one is passed on at the latest at
+ * the barrier:
+ *
+ * - stores to pages holding translated code are recorded in a ring, and
+ *   the other cores drop their blocks there;
+ * - the irq of a device wired to another core is recorded, and the
+ *   target core takes it at its next event;
+ * - a core which stops (breakpoint, exit, failed fetch, interrupt from
+ *   GDB) stops all of them.
+ *
+ * Loads and stores to RAM are host accesses to the shared pages, atomic
+ * for aligned words.  Everything on the slow path (devices, such as the
+ * hardware mutex, and host I/O) is serialized by a recursive lock.
+ *
+ * Between runs, the thread of each core waits for work given with
+ * nios2_smp_call(): the state of a core can only be reached from there.
+ */
+#define CODE_RING_SIZE    64
+
+typedef struct
+  {
+    nios2_cpu_t *cpu;         /* `cpu' of the thread */
+    unsigned64 *next_event;   /* `nios2_next_event' of the thread */
+    unsigned32 irq_set;       /* lines changed by other cores */
+    unsigned32 irq_clear;
+    volatile int irq_poke;
+    unsigned32 code_seen;     /* entries of code_ring applied */
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;
+    void (*call)(void *);     /* work to do, NULL: idle */
+    void *arg;
+    int done;
+#endif
+  }
+core_t;
+
+static core_t cores[NIOS2_CORES_MAX];
+static int requested_cores = 1;
+static unsigned32 quantum = 10000;
+static int selected;
+static int stop_core;
+static volatile int stop_requested;
+
+static struct
+  {
+    SIM_ADDR mem;
+    int length;
+  }
+code_ring[CODE_RING_SIZE];
+static unsigned32 code_head;
+
+static NIOS2_PER_CORE nios2_event_t *quantum_event;
+static NIOS2_PER_CORE int stopped_by_barrier;
+
+int nios2_smp_cores = 1;
+int nios2_smp_running;
+NIOS2_PER_CORE int nios2_core_id;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t big_lock;
+static pthread_mutex_t ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctl_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t barrier_cond = PTHREAD_COND_INITIALIZER;
+static unsigned32 barrier_count;
+static unsigned32 barrier_generation;
+
+void
+nios2_smp_lock_slow(void)
+{
+  pthread_mutex_lock(&big_lock);
+}
+
+void
+nios2_smp_unlock_slow(void)
+{
+  pthread_mutex_unlock(&big_lock);
+}
+
+static void
+barrier_wait(void)
+{
+  unsigned32 generation;
+
+  pthread_mutex_lock(&ctl_lock);
+  generation = barrier_generation;
+  if (++barrier_count == (unsigned32) nios2_smp_cores)
+    {
+      barrier_count = 0;
+      ++barrier_generation;
+      pthread_cond_broadcast(&barrier_cond);
+    }
+  else
+    while (generation == barrier_generation)
+      pthread_cond_wait(&barrier_cond, &ctl_lock);
+  pthread_mutex_unlock(&ctl_lock);
+}
+
+static void
+core_post(int core, void (*fn)(void *), void *arg)
+{
+  core_t *c = &cores[core];
+
+  pthread_mutex_lock(&ctl_lock);
+  c->arg = arg;
+  c->done = 0;
+  c->call = fn;
+  pthread_cond_broadcast(&ctl_cond);
+  pthread_mutex_unlock(&ctl_lock);
+}
+
+static void
+core_wait(int core)
+{
+  core_t *c = &cores[core];
+
+  pthread_mutex_lock(&ctl_lock);
+  while (!c->done)
+    pthread_cond_wait(&ctl_cond, &ctl_lock);
+  pthread_mutex_unlock(&ctl_lock);
+}
+
+static NIOS2_PER_CORE int core_quit;
+
+static void
+core_exit(void *arg)
+{
+  nios2_decode_release();
+  core_quit = 1;
+}
+
+static void *
+core_main(void *arg)
+{
+  core_t *c = (core_t *) arg;
+  sigset_t set;
+
+  /* signals (^C) are for the thread of GDB */
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  nios2_core_id = c - cores;
+  c->cpu = &cpu;
+  c->next_event = &nios2_next_event;
+
+  pthread_mutex_lock(&ctl_lock);
+  c->done = 1;
+  pthread_cond_broadcast(&ctl_cond);
+  while (!core_quit)
+    {
+      void (*fn)(void *);
+
+      while (c->call == NULL)
+        pthread_cond_wait(&ctl_cond, &ctl_lock);
+
+      fn = c->call;
+      pthread_mutex_unlock(&ctl_lock);
+      fn(c->arg);
+      pthread_mutex_lock(&ctl_lock);
+
+      c->call = NULL;
+      c->done = 1;
+      pthread_cond_broadcast(&ctl_cond);
+    }
+  pthread_mutex_unlock(&ctl_lock);
+
+  return NULL;
+}
+#else
+#define barrier_wait()  ((void) 0)
+#endif
+
+/* run fn(arg) on the thread of core and wait for it */
+void
+nios2_smp_call(int core, void (*fn)(void *), void *arg)
+{
+#ifdef HAVE_PTHREAD_H
+  if (core != nios2_core_id && nios2_smp_cores > 1)
+    {
+      core_post(core, fn, arg);
+      core_wait(core);
+      return;
+    }
+#endif
+  fn(arg);
+}
+
+nios2_cpu_t *
+nios2_smp_cpu(int core)
+{
+  if (nios2_smp_cores == 1)
+    return &cpu;
+
+  return cores[core].cpu;
+}
+
+/* "--cores=N" and "--quantum=CYCLES"; returns 1 if option is not one of
+   them */
+int
+nios2_smp_configure(const char *option)
+{
+  if (strncmp(option, "--cores=", 8) == 0)
+    {
+      int n = strtol(option + 8, NULL, 0);
+
+#ifndef HAVE_PTHREAD_H
+      if (n != 1)
+        {
+          sim_printf("built without threads, only one core\n");
+          return 0;
+        }
+#endif
+      if (n < 1 || n > NIOS2_CORES_MAX)
+        {
+          sim_printf("bad number of cores: %s (1-%d)\n", option + 8, NIOS2_CORES_MAX);
+          return 0;
+        }
+      requested_cores = n;
+    }
+  else if (strncmp(option, "--quantum=", 10) == 0)
+    {
+      unsigned32 n = strtoul(option + 10, NULL, 0);
+
+      if (n == 0)
+        sim_printf("bad quantum: %s\n", option + 10);
+      else
+        quantum = n;
+    }
+  else
+    return 1;
+
+  return 0;
+}
+
+/* start the threads of the cores asked for by the options */
+int
+nios2_smp_start(void)
+{
+#ifdef HAVE_PTHREAD_H
+  pthread_mutexattr_t mattr;
+  int i;
+
+  cores[0].cpu = &cpu;
+  cores[0].next_event = &nios2_next_event;
+  if (requested_cores == 1)
+    return 0;
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&big_lock, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  for (i = 1; i < requested_cores; ++i)
+    {
+      cores[i].done = 0;
+      cores[i].call = NULL;
+      if (pthread_create(&cores[i].thread, NULL, core_main, &cores[i]) != 0)
+        {
+          sim_printf("cannot start the thread of core %d\n", i);
+          break;
+        }
+      core_wait(i);
+    }
+
+  nios2_smp_cores = i;
+#endif
+  return nios2_smp_cores > 1;
+}
+
+void
+nios2_smp_stop(void)
+{
+#ifdef HAVE_PTHREAD_H
+  int i;
+
+  for (i = 1; i < nios2_smp_cores; ++i)
+    {
+      core_post(i, core_exit, NULL);
+      pthread_join(cores[i].thread, NULL);
+      cores[i].cpu = NULL;
+    }
+
+  if (nios2_smp_cores > 1)
+    pthread_mutex_destroy(&big_lock);
+#endif
+  nios2_smp_cores = 1;
+  selected = 0;
+}
+
+/* bring the translated code and the irq lines of this core up to date */
+static void
+core_catch_up(void)
+{
+  core_t *c = &cores[nios2_core_id];
+
+  nios2_smp_lock();
+  if (code_head - c->code_seen > CODE_RING_SIZE)
+    nios2_decode_invalidate_local(0, 0x7fffffff);
+  else
+    for (; c->code_seen != code_head; ++c->code_seen)
+      nios2_decode_invalidate_local(code_ring[c->code_seen % CODE_RING_SIZE].mem,
+                                    code_ring[c->code_seen % CODE_RING_SIZE].length);
+  c->code_seen = code_head;
+  nios2_smp_unlock();
+
+  nios2_smp_poll();
+}
+
+/* all cores come here once per quantum; returns nonzero if they stop */
+static int
+smp_sync(void)
+{
+  int stop;
+
+  barrier_wait();
+  stop = stop_requested;
+  core_catch_up();
+  /* nobody asks to stop again before all have looked */
+  barrier_wait();
+
+  return stop;
+}
+
+static nios2_event_handler_t quantum_end;
+
+static void
+quantum_end(void *data, unsigned64 now)
+{
+  quantum_event = NULL;
+
+  /* a core which has stopped meanwhile joins from core_run() */
+  if (cpu.state != sim_running)
+    return;
+
+  if (smp_sync())
+    {
+      stopped_by_barrier = 1;
+      cpu.state = sim_stopped;
+      cpu.signal = TARGET_SIGNAL_0;
+      return;
+    }
+
+  quantum_event = nios2_events_schedule(now + quantum, quantum_end, NULL);
+}
+
+static void
+core_run(void *arg)
+{
+  core_catch_up();
+  stopped_by_barrier = 0;
+  quantum_event = nios2_events_schedule(cpu.cycles + quantum, quantum_end, NULL);
+
+  nios2_interpret(0);
+
+  if (quantum_event)
+    nios2_events_deschedule(quantum_event);
+  quantum_event = NULL;
+  if (stopped_by_barrier)
+    return;
+
+  if (cpu.state == sim_running)
+    {
+      /* instruction fetch failed */
+      cpu.state = sim_stopped;
+      cpu.signal = TARGET_SIGNAL_SEGV;
+    }
+
+  nios2_smp_lock();
+  if (stop_core < 0)
+    stop_core = nios2_core_id;
+  stop_requested = 1;
+  nios2_smp_unlock();
+
+  /* the others stop at the end of their quantum */
+  smp_sync();
+}
+
+static void
+core_step(void *arg)
+{
+  core_catch_up();
+  nios2_interpret(1);
+}
+
+void
+nios2_smp_resume(int step)
+{
+#ifdef HAVE_PTHREAD_H
+  int i;
+#endif
+
+  if (nios2_smp_cores == 1)
+    {
+      nios2_interpret(step);
+      return;
+    }
+
+  /* a step only moves the selected core */
+  if (step)
+    {
+      stop_core = selected;
+      nios2_smp_call(selected, core_step, NULL);
+      return;
+    }
+
+#ifdef HAVE_PTHREAD_H
+  stop_core = -1;
+  stop_requested = 0;
+  nios2_smp_running = 1;
+  for (i = 1; i < nios2_smp_cores; ++i)
+    core_post(i, core_run, NULL);
+  core_run(NULL);
+  for (i = 1; i < nios2_smp_cores; ++i)
+    core_wait(i);
+  nios2_smp_running = 0;
+
+  selected = stop_core;
+#endif
+}
+
+/* core which ended the last run */
+int
+nios2_smp_stopped(void)
+{
+  return nios2_smp_cores == 1 ? 0 : stop_core;
+}
+
+void
+nios2_smp_select(int core)
+{
+  if (core >= 0 && core < nios2_smp_cores)
+    selected = core;
+}
+
+int
+nios2_smp_selected(void)
+{
+  return selected;
+}
+
+static void
+core_reset(void *arg)
+{
+  cpu.features = cores[0].cpu->features;
+  nios2_reset();
+}
+
+static void
+core_flush(void *arg)
+{
+  nios2_decode_flush();
+}
+
+/* reset the cores other than core 0 with its features */
+void
+nios2_smp_reset(void)
+{
+  int i;
+
+  for (i = 1; i < nios2_smp_cores; ++i)
+    nios2_smp_call(i, core_reset, NULL);
+
+  for (i = 0; i < nios2_smp_cores; ++i)
+    {
+      cores[i].irq_set = 0;
+      cores[i].irq_clear = 0;
+      cores[i].irq_poke = 0;
+      cores[i].code_seen = code_head;
+    }
+  selected = 0;
+  stop_core = 0;
+}
+
+/* the blocks of all cores go when core 0 flushes between runs */
+void
+nios2_smp_flush_others(void)
+{
+  int i;
+
+  for (i = 1; i < nios2_smp_cores; ++i)
+    nios2_smp_call(i, core_flush, NULL);
+}
+
+/* called for stores through the slow path; only those to pages holding
+   translated code are of interest to the other cores */
+void
+nios2_smp_code_written(SIM_ADDR mem, int length)
+{
+  SIM_ADDR page;
+
+  for (page = mem & ~AVM_PAGE_MASK; page < mem + length; page += AVM_PAGE_SIZE)
+    if (AVM_PAGE(page)->code)
+      break;
+
+  if (page >= mem + length)
+    return;
+
+  nios2_smp_lock();
+  code_ring[code_head % CODE_RING_SIZE].mem = mem;
+  code_ring[code_head % CODE_RING_SIZE].length = length;
+  ++code_head;
+  nios2_smp_unlock();
+}
+
+void
+nios2_smp_set_irq(int core, int irq, int level)
+{
+  core_t *c;
+
+  if (core == nios2_core_id || nios2_smp_cores == 1)
+    {
+      nios2_set_irq(irq, level);
+      return;
+    }
+
+  if (irq < 0 || irq > 31 || core >= nios2_smp_cores)
+    return;
+
+  c = &cores[core];
+  nios2_smp_lock();
+  if (level)
+    {
+      c->irq_set |= 1u << irq;
+      c->irq_clear &= ~(1u << irq);
+    }
+  else
+    {
+      c->irq_clear |= 1u << irq;
+      c->irq_set &= ~(1u << irq);
+    }
+  c->irq_poke = 1;
+  /* take it at the end of the current block of that core; if the core
+     overwrites this, the poke waits for the quantum */
+  *c->next_event = 0;
+  nios2_smp_unlock();
+}
+
+/* apply the irq lines changed by other cores */
+void
+nios2_smp_poll(void)
+{
+  core_t *c = &cores[nios2_core_id];
+  unsigned32 set, clear;
+
+  if (!c->irq_poke)
+    return;
+
+  nios2_smp_lock();
+  set = c->irq_set;
+  clear = c->irq_clear;
+  c->irq_set = 0;
+  c->irq_clear = 0;
+  c->irq_poke = 0;
+  nios2_smp_unlock();
+
+  cpu.irq_lines = (cpu.irq_lines & ~clear) | set;
+  nios2_update_ipending();
+}
+
+void
+nios2_smp_info(void)
+{
+  int i;
+
+  if (nios2_smp_cores == 1)
+    return;
+
+  sim_printf("%d cores, quantum %u cycles, core %d selected\n",
+    nios2_smp_cores, quantum, selected);
+  for (i = 0; i < nios2_smp_cores; ++i)
+    {
+      nios2_cpu_t *c = cores[i].cpu;
+
+      sim_printf("  core %d: cpuid %u, pc 0x%08x, %llu instructions, %llu cycles\n",
+        i, c->regs.cpuid, c->regs.pc,
+        (unsigned long long) c->insns, (unsigned long long) c->cycles);
+    }
+}
+
+int
+smp_command(int argc, char *argv[])
+{
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of smp commands:\n\n"
+      "info -- Show the cores\n"
+      "quantum <cycles> -- Set the cycles the cores run between barriers\n"
+      "core <n> -- Select the core for registers and the btrace, cache and\n"
+      "  mmu commands\n"
+      );
+      return 0;
+    }
+
+  if (strcmp(argv[1], "info") == 0)
+    {
+      if (argc != 2)
+        {
+          sim_printf("wrong number of options for smp %s\n", argv[1]);
+          return 0;
+        }
+
+      if (nios2_smp_cores == 1)
+        sim_printf("1 core\n");
+      else
+        nios2_smp_info();
+    }
+  else if (strcmp(argv[1], "quantum") == 0 || strcmp(argv[1], "core") == 0)
+    {
+      long n;
+
+      if (argc != 3)
+        {
+          sim_printf("wrong number of options for smp %s\n", argv[1]);
+          return 0;
+        }
+
+      n = strtol(argv[2], NULL, 0);
+      if (argv[1][0] == 'q')
+        {
+          if (n <= 0)
+            sim_printf("bad quantum: %s\n", argv[2]);
+          else
+            quantum = n;
+        }
+      else if (n < 0 || n >= nios2_smp_cores)
+        sim_printf("no such core: %s\n", argv[2]);
+      else
+        selected = n;
+    }
+  else
+    return 1;
+
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -0,0 +1,140 @@
+/**
+ * @file snapshot.c
+ * @brief Snapshot and restore of the simulator state
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * A snapshot holds the CPU, the contents of the memory sections, the
+ * state of the devices and the branch trace records.  Memory is copied
+ * once when saving; from then on only the pages written are tracked (see
+ * avm_snapshot_save()), so a restore costs in proportion to what the run
+ * has touched rather than to the size of the memory.  A snapshot can be
+ * restored any number of times.  Pending events are not saved: they
+ * belong to the devices, which schedule them again.
+ *
+ * The timing model, the caches and the profile keep counting across a
+ * restore.
+ */
+
+static nios2_cpu_t saved_cpu;
+
+static int
+snapshot_save(void)
+{
+  saved_cpu = cpu;
+  nios2_mmu_save();
+  avm_snapshot_save();
+  avm_save_devices();
+  btrace_save();
+  return 0;
+}
+
+static int
+snapshot_restore(void)
+{
+  nios2_btrace_t btrace = cpu.btrace;
+  struct nios2_decode_cache *decode = cpu.decode;
+  int pages;
+
+  pages = avm_snapshot_restore();
+  if (pages < 0)
+    {
+      sim_printf("no snapshot\n");
+      return 1;
+    }
+
+  /* the trace buffer belongs to the current "btrace init", the blocks
+     to this thread */
+  cpu = saved_cpu;
+  cpu.btrace = btrace;
+  cpu.decode = decode;
+  btrace_restore();
+  nios2_mmu_restore();
+  nios2_helpers_cancel();
+
+  nios2_events_clear();
+  avm_restore_devices();
+  nios2_update_ipending();
+
+  sim_printf("restored %d page(s)\n", pages);
+  return 0;
+}
+
+static void
+snapshot_drop(void)
+{
+  avm_snapshot_drop();
+  btrace_drop();
+}
+
+static void
+snapshot_info(void)
+{
+  unsigned32 bytes, dirty;
+
+  if (!avm_snapshot_info(&bytes, &dirty))
+    {
+      sim_printf("no snapshot\n");
+      return;
+    }
+
+  sim_printf("snapshot at pc 0x%08x, cycle %llu\n", saved_cpu.regs.pc,
+    (unsigned long long) saved_cpu.cycles);
+  sim_printf("memory: %u bytes saved, %u page(s) written since\n", bytes, dirty);
+}
+
+int
+snapshot_command(int argc, char *argv[])
+{
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of snapshot commands:\n\n"
+      "save -- Save the simulator state (replaces the previous snapshot)\n"
+      "restore -- Go back to the saved state\n"
+      "drop -- Discard the snapshot\n"
+      "info -- Show the snapshot\n"
+      );
+      return 0;
+    }
+
+  if (argc > 2)
+    {
+      sim_printf("too many options for snapshot: %s\n", argv[2]);
+      return 0;
+    }
+
+  /* the state of the other cores is not saved */
+  if (nios2_smp_cores > 1)
+    {
+      sim_printf("snapshot needs a single core\n");
+      return 0;
+    }
+
+  if (strcmp(argv[1], "save") == 0)
+    snapshot_save();
+  else if (strcmp(argv[1], "restore") == 0)
+    snapshot_restore();
+  else if (strcmp(argv[1], "drop") == 0)
+    snapshot_drop();
+  else if (strcmp(argv[1], "info") == 0)
+    snapshot_info();
+  else
+    return 1;
+
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
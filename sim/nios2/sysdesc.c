@@ -0,0 +1,374 @@
+/**
+ * @file sysdesc.c
+ * @brief System description file for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+/*
+ * System description
+ *
+ * "target sim --system=FILE" reads the hardware of one system from an INI
+ * file instead of assuming the default memory map (image sections, then
+ * an 8 MiB heap, and an 8 MiB stack at 0x7800000):
+ *
+ *   # comments start with '#' or ';'
+ *   [cpu]
+ *   reset_addr = 0x00000000     ; default: entry point of the image
+ *   exception_addr = 0x00000020
+ *   hwmul = 1                   ; also hwdiv, hwmulx (default 1)
+ *   cpuid = 0
+ *   mmu = 128,16,8              ; or mpu = 8,8[,limit]; see --mmu/--mpu
+ *   fast_tlb_miss_addr = 0xc0000100
+ *   cores = 2
+ *   quantum = 1000
+ *
+ *   [memory onchip_ram]
+ *   base = 0x00000000
+ *   size = 0x10000
+ *   masters = instruction data  ; default both
+ *   readonly = 0
+ *
+ *   [device jtag_uart]
+ *   type = jtag_uart            ; see "sim device"
+ *   base = 0x00009000
+ *   irq = 0                     ; irq[@core], none if omitted
+ *
+ * Memory is populated on first use, so large regions cost nothing until
+ * the target touches them.  The image is then written into the regions
+ * described, and loading fails for sections outside of them.
+ */
+
+/* set if the description had any memory */
+int nios2_sysdesc_memory;
+
+/* features applied at each sim_create_inferior(), -1 if not given */
+static long sysdesc_reset_addr = -1;
+static int sysdesc_hwdiv = -1;
+static int sysdesc_hwmul = -1;
+static int sysdesc_hwmulx = -1;
+
+enum sysdesc_kind
+  {
+    SYSDESC_NONE,
+    SYSDESC_CPU,
+    SYSDESC_MEMORY,
+    SYSDESC_DEVICE,
+  };
+
+/* the block being read; memory and devices are added at its end, when all
+   of their keys are known */
+struct sysdesc_block
+  {
+    enum sysdesc_kind kind;
+    char name[64];
+    char type[32];
+    char irq[32];
+    unsigned32 base;
+    unsigned32 size;
+    int flags;
+    int has_base;
+  };
+
+static char *
+trim(char *s)
+{
+  char *end;
+
+  while (isspace((unsigned char) *s))
+    ++s;
+  end = s + strlen(s);
+  while (end > s && isspace((unsigned char) end[-1]))
+    --end;
+  *end = 0;
+  return s;
+}
+
+static int
+parse_masters(const char *value)
+{
+  int flags = 0;
+
+  if (strstr(value, "instruction"))
+    flags |= AVM_INSTRUCTION;
+  if (strstr(value, "data"))
+    flags |= AVM_DATA;
+  return flags;
+}
+
+/* "--NAME=VALUE" for the option parsers of the MMU and the cores */
+static int
+configure_option(const char *name, const char *value)
+{
+  char option[128];
+
+  snprintf(option, sizeof(option), "--%s=%s", name, value);
+  if (nios2_mmu_configure(option) == 0)
+    return 0;
+  return nios2_smp_configure(option);
+}
+
+static int
+cpu_key(const char *key, const char *value)
+{
+  unsigned32 n = strtoul(value, NULL, 0);
+
+  if (strcmp(key, "reset_addr") == 0)
+    sysdesc_reset_addr = n;
+  else if (strcmp(key, "exception_addr") == 0)
+    cpu.features.exception_addr = n;
+  else if (strcmp(key, "cpuid") == 0)
+    cpu.features.cpuid = n;
+  else if (strcmp(key, "hwdiv") == 0)
+    sysdesc_hwdiv = (n != 0);
+  else if (strcmp(key, "hwmul") == 0)
+    sysdesc_hwmul = (n != 0);
+  else if (strcmp(key, "hwmulx") == 0)
+    sysdesc_hwmulx = (n != 0);
+  else if (strcmp(key, "mmu") == 0 || strcmp(key, "mpu") == 0 ||
+           strcmp(key, "fast_tlb_miss_addr") == 0)
+    {
+      char name[32];
+      char *p;
+
+      /* the option is spelled with dashes */
+      strcpy(name, key);
+      for (p = name; *p; ++p)
+        if (*p == '_')
+          *p = '-';
+      return configure_option(name, value);
+    }
+  else if (strcmp(key, "cores") == 0 || strcmp(key, "quantum") == 0)
+    return configure_option(key, value);
+  else
+    return 1;
+
+  return 0;
+}
+
+static int
+block_key(struct sysdesc_block *b, const char *key, const char *value)
+{
+  if (b->kind == SYSDESC_CPU)
+    return cpu_key(key, value);
+
+  if (strcmp(key, "base") == 0)
+    {
+      b->base = strtoul(value, NULL, 0);
+      b->has_base = 1;
+    }
+  else if (b->kind == SYSDESC_MEMORY && strcmp(key, "size") == 0)
+    b->size = strtoul(value, NULL, 0);
+  else if (b->kind == SYSDESC_MEMORY && strcmp(key, "masters") == 0)
+    b->flags = (b->flags & ~AVM_MASTER_MASK) | parse_masters(value);
+  else if (b->kind == SYSDESC_MEMORY && strcmp(key, "readonly") == 0)
+    b->flags = strtol(value, NULL, 0) ? (b->flags | AVM_READONLY) : (b->flags & ~AVM_READONLY);
+  else if (b->kind == SYSDESC_DEVICE && strcmp(key, "type") == 0)
+    snprintf(b->type, sizeof(b->type), "%s", value);
+  else if (b->kind == SYSDESC_DEVICE && strcmp(key, "irq") == 0)
+    snprintf(b->irq, sizeof(b->irq), "%s", value);
+  else
+    return 1;
+
+  return 0;
+}
+
+/* add the memory or device of a finished block; returns 0 on success */
+static int
+block_end(struct sysdesc_block *b, const char *path, int line)
+{
+  avm_device_t *dev;
+  const char *at;
+  int core;
+
+  switch (b->kind)
+    {
+    case SYSDESC_MEMORY:
+      if (!b->has_base || b->size == 0 || (b->flags & AVM_MASTER_MASK) == 0)
+        {
+          sim_printf("%s:%d: memory \"%s\" needs a base, a size and a master\n",
+                     path, line, b->name);
+          return -1;
+        }
+      if (avm_add_memory(b->name, b->base, b->flags, NULL, b->size) == 0)
+        {
+          sim_printf("%s:%d: cannot add memory \"%s\" at 0x%x\n",
+                     path, line, b->name, b->base);
+          return -1;
+        }
+      nios2_sysdesc_memory = 1;
+      break;
+
+    case SYSDESC_DEVICE:
+      if (!b->has_base || b->type[0] == 0)
+        {
+          sim_printf("%s:%d: device \"%s\" needs a type and a base\n",
+                     path, line, b->name);
+          return -1;
+        }
+      core = 0;
+      if ((at = strchr(b->irq, '@')) != NULL)
+        {
+          core = strtol(at + 1, NULL, 0);
+          if (core < 0 || core >= NIOS2_CORES_MAX)
+            {
+              sim_printf("%s:%d: no such core: %d\n", path, line, core);
+              return -1;
+            }
+        }
+      dev = avm_add_device(b->type, b->name, b->base,
+                           b->irq[0] ? strtol(b->irq, NULL, 0) : -1);
+      if (dev == NULL)
+        return -1;
+      dev->core = core;
+      break;
+
+    default:
+      break;
+    }
+
+  b->kind = SYSDESC_NONE;
+  return 0;
+}
+
+static int
+block_begin(struct sysdesc_block *b, char *header, const char *path, int line)
+{
+  char *name = header;
+
+  while (*name && !isspace((unsigned char) *name))
+    ++name;
+  if (*name)
+    *name++ = 0;
+  name = trim(name);
+
+  memset(b, 0, sizeof(*b));
+  snprintf(b->name, sizeof(b->name), "%s", name);
+  b->flags = AVM_INSTRUCTION | AVM_DATA;
+
+  if (strcmp(header, "cpu") == 0)
+    b->kind = SYSDESC_CPU;
+  else if (strcmp(header, "memory") == 0)
+    b->kind = SYSDESC_MEMORY;
+  else if (strcmp(header, "device") == 0)
+    b->kind = SYSDESC_DEVICE;
+  else
+    {
+      sim_printf("%s:%d: unknown block: [%s]\n", path, line, header);
+      return -1;
+    }
+
+  if (b->kind != SYSDESC_CPU && b->name[0] == 0)
+    {
+      sim_printf("%s:%d: [%s] needs a name\n", path, line, header);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* read the description from path; returns 0 on success */
+int
+nios2_sysdesc_load(const char *path)
+{
+  struct sysdesc_block block;
+  char buf[256];
+  int line = 0;
+  FILE *fp;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+    {
+      sim_printf("cannot open system description: %s\n", path);
+      return -1;
+    }
+
+  block.kind = SYSDESC_NONE;
+  while (fgets(buf, sizeof(buf), fp))
+    {
+      char *s, *eq;
+
+      ++line;
+      s = buf + strcspn(buf, "#;\r\n");
+      *s = 0;
+      s = trim(buf);
+      if (*s == 0)
+        continue;
+
+      if (*s == '[')
+        {
+          char *close = strchr(s, ']');
+
+          if (close == NULL)
+            {
+              sim_printf("%s:%d: missing ']'\n", path, line);
+              goto error;
+            }
+          *close = 0;
+          if (block_end(&block, path, line) < 0 ||
+              block_begin(&block, trim(s + 1), path, line) < 0)
+            goto error;
+          continue;
+        }
+
+      eq = strchr(s, '=');
+      if (eq == NULL || block.kind == SYSDESC_NONE)
+        {
+          sim_printf("%s:%d: expected key = value in a block\n", path, line);
+          goto error;
+        }
+      *eq = 0;
+      if (block_key(&block, trim(s), trim(eq + 1)))
+        {
+          sim_printf("%s:%d: bad key: %s\n", path, line, trim(s));
+          goto error;
+        }
+    }
+
+  if (block_end(&block, path, line) < 0)
+    goto error;
+
+  fclose(fp);
+  return 0;
+
+error:
+  fclose(fp);
+  return -1;
+}
+
+/* features the description fixes; the others keep their defaults */
+void
+nios2_sysdesc_features(nios2_features_t *features)
+{
+  if (sysdesc_reset_addr >= 0)
+    features->reset_addr = sysdesc_reset_addr;
+  if (sysdesc_hwdiv >= 0)
+    features->hwdiv = sysdesc_hwdiv;
+  if (sysdesc_hwmul >= 0)
+    features->hwmul = sysdesc_hwmul;
+  if (sysdesc_hwmulx >= 0)
+    features->hwmulx = sysdesc_hwmulx;
+}
+
+/* forget the description at sim_close() */
+void
+nios2_sysdesc_clear(void)
+{
+  nios2_sysdesc_memory = 0;
+  sysdesc_reset_addr = -1;
+  sysdesc_hwdiv = -1;
+  sysdesc_hwmul = -1;
+  sysdesc_hwmulx = -1;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
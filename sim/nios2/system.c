@@ -8,7 +8,18 @@
 
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
 #include "libiberty.h"
+#include "gdb/signals.h"
 #include "sim-main.h"
 #include "sim-nios2.h"
 
@@ -21,11 +32,246 @@ struct mm_section_t {
   SIM_ADDR end;
   int flags;
   unsigned char *data;
+  avm_device_t *dev;  /* I/O section if not NULL */
+  unsigned64 loads;   /* CPU accesses through avm_access() */
+  unsigned64 stores;
+  unsigned char *saved; /* contents at the snapshot (see avm_snapshot_save) */
+  unsigned8 *dirty;     /* bitmap of the pages written since then */
+  unsigned8 *filled;    /* bitmap of the populated pages, NULL if all are */
+  unsigned8 *saved_filled;
+  size_t mapoff;        /* offset of data in a file mapping (see avm_map_file) */
   char name[1];
 };
 
 static struct mm_section_t **mm_sects;
 static int mm_sect_count;
+static int avm_snapshot_valid;
+
+/* watched ranges (see avm_insert_watch) */
+struct avm_watch_t {
+  SIM_ADDR addr;  /* as given by the debugger */
+  SIM_ADDR phys;
+  SIM_ADDR end;
+  int type;       /* AVM_WATCH_* */
+};
+
+static struct avm_watch_t *avm_watches;
+static int avm_watch_count;
+
+static void avm_watch_pages(SIM_ADDR phys, SIM_ADDR end);
+
+/* contents of memory added without any (see --memory-fill) */
+unsigned8 avm_memory_fill = 0xff;
+
+/* page table; unused first-level slots share one empty second level */
+static avm_page_t avm_page_none[AVM_L2_SIZE];
+avm_page_t *avm_page_dir[AVM_L1_SIZE];
+
+static avm_page_t *
+avm_page_alloc(SIM_ADDR mem)
+{
+  avm_page_t **l2 = &avm_page_dir[(mem >> (AVM_PAGE_SHIFT + AVM_L2_BITS)) & (AVM_L1_SIZE - 1)];
+
+  if (*l2 == NULL || *l2 == avm_page_none)
+    *l2 = (avm_page_t *) calloc(AVM_L2_SIZE, sizeof(avm_page_t));
+
+  return AVM_PAGE(mem);
+}
+
+/* fast path counts of the cores but 0 (see AVM_COUNT); each core fills
+   its own row, which the others only read while it is stopped */
+avm_count_t *avm_core_counts[NIOS2_CORES_MAX][AVM_L1_SIZE];
+
+avm_count_t *
+avm_core_counts_alloc(SIM_ADDR mem)
+{
+  avm_count_t **l2 = &avm_core_counts[nios2_core_id][(mem >> (AVM_PAGE_SHIFT + AVM_L2_BITS)) & (AVM_L1_SIZE - 1)];
+
+  *l2 = (avm_count_t *) calloc(AVM_L2_SIZE, sizeof(avm_count_t));
+  return *l2;
+}
+
+static void
+avm_core_counts_clear(int release)
+{
+  int core, i;
+
+  for (core = 1; core < NIOS2_CORES_MAX; ++core)
+    for (i = 0; i < AVM_L1_SIZE; ++i)
+      {
+        if (avm_core_counts[core][i] == NULL)
+          continue;
+        if (release)
+          {
+            free(avm_core_counts[core][i]);
+            avm_core_counts[core][i] = NULL;
+          }
+        else
+          memset(avm_core_counts[core][i], 0, AVM_L2_SIZE * sizeof(avm_count_t));
+      }
+}
+
+/*
+ * Snapshot pages
+ *
+ * While a snapshot is held, every page of a memory section is either
+ * clean (same as in s->saved) or dirty.  Clean pages lose their fast
+ * write mapping like code pages do, so the first store to each of them
+ * reaches avm_access(), which marks it dirty and maps it again.  A restore
+ * then copies back the dirty pages only.
+ */
+#define SECTION_PAGE(s, mem)  (((mem) >> AVM_PAGE_SHIFT) - ((s)->base >> AVM_PAGE_SHIFT))
+
+static int
+avm_page_clean(struct mm_section_t *s, SIM_ADDR page)
+{
+  unsigned32 n = SECTION_PAGE(s, page);
+
+  return s->dirty && !(s->dirty[n / 8] & (1u << (n % 8)));
+}
+
+/*
+ * Host memory of the sections
+ *
+ * Sections live in private anonymous mappings, so the host only commits
+ * the pages the target touches.  The pages of a section added without
+ * contents are not even filled up front: they stay out of the page table
+ * until avm_access() fills them with avm_memory_fill on their first use.
+ * Read-only segments of the image are mapped copy-on-write from the file
+ * instead (see avm_map_file).
+ */
+static unsigned char *
+avm_alloc(size_t length)
+{
+#ifdef HAVE_SYS_MMAN_H
+  void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  return (p == MAP_FAILED) ? NULL : (unsigned char *) p;
+#else
+  return (unsigned char *) calloc(1, length);
+#endif
+}
+
+static void
+avm_free(unsigned char *p, size_t length)
+{
+  if (p == NULL)
+    return;
+#ifdef HAVE_SYS_MMAN_H
+  munmap(p, length);
+#else
+  free(p);
+#endif
+}
+
+static int
+avm_page_filled(struct mm_section_t *s, SIM_ADDR page)
+{
+  unsigned32 n = SECTION_PAGE(s, page);
+
+  return !s->filled || (s->filled[n / 8] & (1u << (n % 8)));
+}
+
+/* a page which lies entirely within s can be mapped to host memory;
+   pages shared with another section, or only partially backed, are
+   left to the slow path */
+static int
+avm_page_mappable(struct mm_section_t *s, SIM_ADDR page)
+{
+  return !s->dev && page >= s->base && page + AVM_PAGE_SIZE <= s->end;
+}
+
+static void
+avm_map_page(struct mm_section_t *s, SIM_ADDR page)
+{
+  avm_page_t *p = avm_page_alloc(page);
+  unsigned char *host = s->data + (page - s->base);
+
+  if (!avm_page_filled(s, page))
+    {
+      p->read = p->write = p->fetch = NULL;
+      return;
+    }
+
+  p->read = ((s->flags & AVM_DATA) && !(p->watch & AVM_WATCH_READ)) ? host : NULL;
+  p->write = ((s->flags & AVM_DATA) && !(s->flags & AVM_READONLY) &&
+              !p->code && !(p->watch & AVM_WATCH_WRITE) &&
+              !avm_page_clean(s, page)) ? host : NULL;
+  p->fetch = (s->flags & AVM_INSTRUCTION) ? host : NULL;
+}
+
+static void
+avm_map_pages(struct mm_section_t *s)
+{
+  SIM_ADDR page;
+
+  for (page = (s->base + AVM_PAGE_MASK) & ~AVM_PAGE_MASK;
+       avm_page_mappable(s, page);
+       page += AVM_PAGE_SIZE)
+    avm_map_page(s, page);
+}
+
+static void
+avm_mark_dirty(struct mm_section_t *s, SIM_ADDR mem, int length)
+{
+  SIM_ADDR page;
+
+  for (page = mem & ~AVM_PAGE_MASK; page < mem + length; page += AVM_PAGE_SIZE)
+    {
+      unsigned32 n = SECTION_PAGE(s, page);
+
+      if (s->dirty[n / 8] & (1u << (n % 8)))
+        continue;
+
+      s->dirty[n / 8] |= (1u << (n % 8));
+      if (avm_page_mappable(s, page))
+        avm_map_page(s, page);
+    }
+}
+
+/* populate the pages of s covered by [mem, mem + length) */
+static void
+avm_fill_pages(struct mm_section_t *s, SIM_ADDR mem, int length)
+{
+  SIM_ADDR page;
+
+  for (page = mem & ~AVM_PAGE_MASK; page < mem + length; page += AVM_PAGE_SIZE)
+    {
+      unsigned32 n = SECTION_PAGE(s, page);
+      SIM_ADDR start, end;
+
+      if (s->filled[n / 8] & (1u << (n % 8)))
+        continue;
+
+      s->filled[n / 8] |= (1u << (n % 8));
+      start = (page < s->base) ? s->base : page;
+      end = (page + AVM_PAGE_SIZE > s->end) ? s->end : page + AVM_PAGE_SIZE;
+      memset(s->data + (start - s->base), avm_memory_fill, end - start);
+      if (avm_page_mappable(s, page))
+        avm_map_page(s, page);
+    }
+}
+
+static void
+avm_unmap_pages(void)
+{
+  int i;
+
+  for (i = 0; i < AVM_L1_SIZE; ++i)
+    {
+      if (avm_page_dir[i] != NULL && avm_page_dir[i] != avm_page_none)
+        {
+          int j;
+
+          for (j = 0; j < AVM_L2_SIZE; ++j)
+            free(avm_page_dir[i][j].prof);
+          free(avm_page_dir[i]);
+        }
+      avm_page_dir[i] = avm_page_none;
+    }
+  avm_core_counts_clear(1);
+}
 
 static struct mm_section_t *
 find_mm_section (SIM_ADDR mem, int *pindex)
@@ -57,15 +303,38 @@ find_mm_section (SIM_ADDR mem, int *pindex)
   return NULL;
 }
 
+/* stop the core after the instruction which accesses a watched range */
+static void
+avm_watch_check(SIM_ADDR mem, int length, int type)
+{
+  int i;
+
+  for (i = 0; i < avm_watch_count; ++i)
+    {
+      struct avm_watch_t *w = &avm_watches[i];
+
+      if (!(w->type & type) || mem >= w->end || mem + length <= w->phys)
+        continue;
+
+      cpu.state = sim_stopped;
+      cpu.signal = TARGET_SIGNAL_TRAP;
+      cpu.watch_hit = 1;
+      cpu.watch_addr = w->addr + ((mem > w->phys) ? mem - w->phys : 0);
+      return;
+    }
+}
+
 static int
 avm_access(SIM_ADDR mem, unsigned char *buf, int length, int flags, int mode)
 {
   size_t offset;
   int result = 0;
+  SIM_ADDR start;
 
   if (mem & 0x80000000u)
     flags |= AVM_NOCACHE;
   mem &= ~0x80000000u;
+  start = mem;
 
   while (length > 0)
     {
@@ -91,44 +360,72 @@ avm_access(SIM_ADDR mem, unsigned char *buf, int length, int flags, int mode)
 
       offset = mem - s->base;
 
+      if ((flags & AVM_CPU) && nios2_profiling)
+        {
+          if (mode == READ_MODE)
+            ++s->loads;
+          else
+            ++s->stores;
+        }
+
       /*
       sim_printf("avm_access base=0x%x, offset=0x%x, len=0x%x, %s\n", s->base, offset, sec_len,
         mode == READ_MODE ? "read" : "write");
       */
 
-      if (mode == READ_MODE)
+      if (!s->dev && s->filled)
+        avm_fill_pages(s, mem, sec_len);
+
+      if ((flags & AVM_CPU) && AVM_PAGE(mem)->watch)
+        avm_watch_check(mem, sec_len, mode == READ_MODE ? AVM_WATCH_READ : AVM_WATCH_WRITE);
+
+      if (s->dev)
+        avm_device_access(s->dev, offset, buf, sec_len, mode != READ_MODE);
+      else if (mode == READ_MODE)
         memcpy(buf, s->data + offset, sec_len);
       else
-        memcpy(s->data + offset, buf, sec_len);
+        {
+          memcpy(s->data + offset, buf, sec_len);
+          if (s->dirty)
+            avm_mark_dirty(s, mem, sec_len);
+        }
 
+      mem += sec_len;
       buf += sec_len;
       length -= sec_len;
       result += sec_len;
     }
 
+  /* drop pre-decoded instructions overwritten by this access */
+  if (mode != READ_MODE && result > 0)
+    nios2_decode_invalidate(start, result);
+
   return result;
 }
 
-int
-avm_add_memory(const char *name, SIM_ADDR base, int flags, unsigned char *buf, int length)
+static struct mm_section_t *
+avm_add_section(const char *name, SIM_ADDR base, int flags, int length)
 {
   SIM_ADDR end = base + length;
-  int index;
+  int index, i;
   size_t namelen = strlen(name);
-  size_t memlen = (length + 3) & ~3u;
   struct mm_section_t *s;
 
   if (length <= 0)
-    return 0;
+    return NULL;
 
   if (find_mm_section(base, &index) != NULL)
-    return 0; /* already exist */
+    return NULL; /* already exist */
 
   if (index < mm_sect_count && mm_sects[index]->base < end)
-    return 0; /* overlaps into the next section */
+    return NULL; /* overlaps into the next section */
 
-  if (*name)
-    sim_printf("Adding memory \"%s\", size 0x%x vma 0x%x\n", name, length, base);
+  if (mm_sect_count == 0)
+    {
+      avm_unmap_pages();
+      for (i = 0; i < avm_watch_count; ++i)
+        avm_watch_pages(avm_watches[i].phys, avm_watches[i].end);
+    }
 
   /* add new section pointer */
   ++mm_sect_count;
@@ -142,12 +439,119 @@ avm_add_memory(const char *name, SIM_ADDR base, int flags, unsigned char *buf, i
   s->base = base;
   s->end = end;
   s->flags = flags;
-  s->data = (unsigned char *) malloc(memlen);
-  memset(s->data, 0xff, memlen);
+  s->data = NULL;
+  s->dev = NULL;
+  s->loads = 0;
+  s->stores = 0;
+  s->saved = NULL;
+  s->dirty = NULL;
+  s->filled = NULL;
+  s->saved_filled = NULL;
+  s->mapoff = 0;
+  strcpy(s->name, name);
+  return s;
+}
+
+int
+avm_add_memory(const char *name, SIM_ADDR base, int flags, unsigned char *buf, int length)
+{
+  size_t memlen = (length + 3) & ~3u;
+  unsigned char *data;
+  struct mm_section_t *s;
+
+  if (length <= 0 || (data = avm_alloc(memlen)) == NULL)
+    return 0;
+
+  s = avm_add_section(name, base, flags, length);
+  if (s == NULL)
+    {
+      avm_free(data, memlen);
+      return 0;
+    }
+
+  if (*name)
+    sim_printf("Adding memory \"%s\", size 0x%x vma 0x%x\n", name, length, base);
+
+  s->data = data;
   if (buf)
-    memcpy(s->data, buf, length);
+    {
+      memcpy(data, buf, length);
+      memset(data + length, avm_memory_fill, memlen - length);
+    }
+  else if (avm_memory_fill != 0)
+    {
+      /* fresh anonymous pages are zero already */
+      unsigned32 pages = SECTION_PAGE(s, s->end - 1) + 1;
 
-  strcpy(s->name, name);
+      s->filled = (unsigned8 *) calloc((pages + 7) / 8, 1);
+    }
+
+  avm_map_pages(s);
+  return length;
+}
+
+/* add a section holding length bytes of the file at path from offset on;
+   the file is mapped copy-on-write, so nothing is read before the target
+   touches it.  Returns 0 if the file cannot be mapped this way. */
+int
+avm_map_file(const char *path, long offset, SIM_ADDR base, int flags, int length)
+{
+#ifdef HAVE_SYS_MMAN_H
+  size_t memlen = (length + 3) & ~3u;
+  size_t mapoff = offset & (getpagesize() - 1);
+  struct mm_section_t *s;
+  struct stat st;
+  void *map;
+  int fd;
+
+  if (length <= 0 || offset < 0)
+    return 0;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  /* pages past the end of the file would fault */
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      offset + memlen > (unsigned long) st.st_size)
+    {
+      close(fd);
+      return 0;
+    }
+
+  map = mmap(NULL, mapoff + memlen, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             fd, offset - mapoff);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  s = avm_add_section("", base, flags, length);
+  if (s == NULL)
+    {
+      munmap(map, mapoff + memlen);
+      return 0;
+    }
+
+  s->data = (unsigned char *) map + mapoff;
+  s->mapoff = mapoff;
+  avm_map_pages(s);
+  return length;
+#else
+  return 0;
+#endif
+}
+
+int
+avm_add_io(const char *name, SIM_ADDR base, int length, avm_device_t *dev)
+{
+  struct mm_section_t *s;
+
+  s = avm_add_section(name, base, AVM_DATA | AVM_NOCACHE, length);
+  if (s == NULL)
+    return 0;
+
+  /* no pages are mapped: every access goes through avm_access() */
+  s->dev = dev;
   return length;
 }
 
@@ -178,7 +582,7 @@ avm_dump_sections(int verbose)
       sim_printf("mm_sects[%d]: {range: 0x%08x-0x%08x, flags: 0x%08x, name:\"%s\" }",
         i, (*p)->base, (*p)->end-1, (*p)->flags, (*p)->name);
 
-      if (verbose == 0)
+      if (verbose == 0 || (*p)->dev)
         len = 0;
       else
         len = (*p)->end - (*p)->base;
@@ -199,34 +603,490 @@ avm_clear_sections(void)
 {
   struct mm_section_t **p;
   int i;
+
+  /* translated blocks refer to the profile counters of the pages */
+  nios2_decode_flush();
+
   for (i = 0, p = mm_sects; i < mm_sect_count; ++i, ++p)
     {
       struct mm_section_t *s = *p;
-      free(s->data);
+      size_t memlen = (s->end - s->base + 3) & ~3u;
+
+      if (s->data)
+        avm_free(s->data - s->mapoff, s->mapoff + memlen);
+      avm_free(s->saved, memlen);
+      free(s->dirty);
+      free(s->filled);
+      free(s->saved_filled);
       free(s);
     }
 
   free(mm_sects);
   mm_sects = NULL;
   mm_sect_count = 0;
+  avm_snapshot_valid = 0;
+
+  free(avm_watches);
+  avm_watches = NULL;
+  avm_watch_count = 0;
+
+  avm_unmap_pages();
+  avm_clear_devices();
+}
+
+/* route writes to a page holding translated code through the slow path,
+   which invalidates the translation */
+void
+avm_protect_code(SIM_ADDR mem)
+{
+  avm_page_t *p = AVM_PAGE(mem);
+
+  p->write = NULL;
+  /* the shared empty second level stays untouched */
+  if (p != &avm_page_none[(mem >> AVM_PAGE_SHIFT) & (AVM_L2_SIZE - 1)])
+    p->code = 1;
+}
+
+void
+avm_unprotect_code(void)
+{
+  int i;
+
+  for (i = 0; i < mm_sect_count; ++i)
+    {
+      struct mm_section_t *s = mm_sects[i];
+      SIM_ADDR page;
+
+      for (page = (s->base + AVM_PAGE_MASK) & ~AVM_PAGE_MASK;
+           avm_page_mappable(s, page);
+           page += AVM_PAGE_SIZE)
+        {
+          AVM_PAGE(page)->code = 0;
+          avm_map_page(s, page);
+        }
+    }
+}
+
+/* copy the contents of all memory sections and start tracking the pages
+   written from now on */
+void
+avm_snapshot_save(void)
+{
+  int i;
+
+  for (i = 0; i < mm_sect_count; ++i)
+    {
+      struct mm_section_t *s = mm_sects[i];
+      size_t memlen = (s->end - s->base + 3) & ~3u;
+      unsigned32 n, pages = SECTION_PAGE(s, s->end - 1) + 1;
+
+      if (s->dev)
+        continue;
+
+      if (s->saved == NULL)
+        {
+          s->saved = avm_alloc(memlen);
+          s->dirty = (unsigned8 *) malloc((pages + 7) / 8);
+          if (s->filled)
+            s->saved_filled = (unsigned8 *) malloc((pages + 7) / 8);
+        }
+
+      /* pages never populated need no copy */
+      if (s->filled)
+        {
+          memcpy(s->saved_filled, s->filled, (pages + 7) / 8);
+          for (n = 0; n < pages; ++n)
+            if (s->filled[n / 8] & (1u << (n % 8)))
+              {
+                SIM_ADDR page = ((s->base >> AVM_PAGE_SHIFT) + n) << AVM_PAGE_SHIFT;
+                SIM_ADDR start = (page < s->base) ? s->base : page;
+                SIM_ADDR end = (page + AVM_PAGE_SIZE > s->end) ? s->end : page + AVM_PAGE_SIZE;
+
+                memcpy(s->saved + (start - s->base), s->data + (start - s->base), end - start);
+              }
+        }
+      else
+        memcpy(s->saved, s->data, memlen);
+      memset(s->dirty, 0, (pages + 7) / 8);
+      avm_map_pages(s);
+    }
+
+  avm_snapshot_valid = 1;
+}
+
+/* copy back the pages written since the snapshot; returns their number,
+   or -1 if there is no snapshot */
+int
+avm_snapshot_restore(void)
+{
+  int i, count = 0;
+
+  if (!avm_snapshot_valid)
+    return -1;
+
+  for (i = 0; i < mm_sect_count; ++i)
+    {
+      struct mm_section_t *s = mm_sects[i];
+      unsigned32 n, pages;
+
+      if (s->saved == NULL)
+        continue;   /* added after the snapshot */
+
+      pages = SECTION_PAGE(s, s->end - 1) + 1;
+      for (n = 0; n < pages; ++n)
+        {
+          SIM_ADDR page, start, end;
+
+          if (!(s->dirty[n / 8] & (1u << (n % 8))))
+            continue;
+
+          s->dirty[n / 8] &= ~(1u << (n % 8));
+          page = ((s->base >> AVM_PAGE_SHIFT) + n) << AVM_PAGE_SHIFT;
+          start = (page < s->base) ? s->base : page;
+          end = (page + AVM_PAGE_SIZE > s->end) ? s->end : page + AVM_PAGE_SIZE;
+          if (s->saved_filled && !(s->saved_filled[n / 8] & (1u << (n % 8))))
+            s->filled[n / 8] &= ~(1u << (n % 8));  /* filled again on next use */
+          else
+            memcpy(s->data + (start - s->base), s->saved + (start - s->base), end - start);
+          nios2_decode_invalidate(start, end - start);
+          if (avm_page_mappable(s, page))
+            avm_map_page(s, page);
+          ++count;
+        }
+    }
+
+  return count;
+}
+
+/* release the copies and give the clean pages their fast path back */
+void
+avm_snapshot_drop(void)
+{
+  int i;
+
+  for (i = 0; i < mm_sect_count; ++i)
+    {
+      struct mm_section_t *s = mm_sects[i];
+
+      avm_free(s->saved, (s->end - s->base + 3) & ~3u);
+      free(s->dirty);
+      free(s->saved_filled);
+      s->saved = NULL;
+      s->dirty = NULL;
+      s->saved_filled = NULL;
+      avm_map_pages(s);
+    }
+
+  avm_snapshot_valid = 0;
+}
+
+/* memory held by the snapshot and pages written since */
+int
+avm_snapshot_info(unsigned32 *bytes, unsigned32 *dirty)
+{
+  int i;
+
+  *bytes = 0;
+  *dirty = 0;
+  if (!avm_snapshot_valid)
+    return 0;
+
+  for (i = 0; i < mm_sect_count; ++i)
+    {
+      struct mm_section_t *s = mm_sects[i];
+      unsigned32 n, pages;
+
+      if (s->saved == NULL)
+        continue;
+
+      pages = SECTION_PAGE(s, s->end - 1) + 1;
+      *bytes += s->end - s->base;
+      for (n = 0; n < pages; ++n)
+        if (s->dirty[n / 8] & (1u << (n % 8)))
+          ++*dirty;
+    }
+
+  return 1;
+}
+
+/* execution counter of the instruction at mem, allocated on first use */
+unsigned32 *
+avm_profile_counters(SIM_ADDR mem)
+{
+  avm_page_t *p;
+
+  nios2_smp_lock();
+  p = avm_page_alloc(mem);
+  if (p->prof == NULL)
+    p->prof = (unsigned32 *) calloc(AVM_PAGE_SIZE / 4, sizeof(unsigned32));
+  nios2_smp_unlock();
+
+  return p->prof + ((mem & AVM_PAGE_MASK) >> 2);
+}
+
+void
+avm_profile_clear(void)
+{
+  int i, j;
+
+  for (i = 0; i < AVM_L1_SIZE; ++i)
+    {
+      avm_page_t *l2 = avm_page_dir[i];
+
+      if (l2 == NULL || l2 == avm_page_none)
+        continue;
+
+      for (j = 0; j < AVM_L2_SIZE; ++j)
+        {
+          if (l2[j].prof)
+            memset(l2[j].prof, 0, AVM_PAGE_SIZE / 4 * sizeof(unsigned32));
+          l2[j].loads = 0;
+          l2[j].stores = 0;
+        }
+    }
+
+  avm_core_counts_clear(0);
+
+  for (i = 0; i < mm_sect_count; ++i)
+    {
+      mm_sects[i]->loads = 0;
+      mm_sects[i]->stores = 0;
+    }
+}
+
+/* index of the section holding mem, or -1 */
+int
+avm_section_index(SIM_ADDR mem)
+{
+  int index;
+
+  if (find_mm_section(mem & ~0x80000000u, &index) == NULL)
+    return -1;
+
+  return index;
+}
+
+/* CPU load/store counts of the index-th section while profiling (0 if no
+   such section) */
+int
+avm_section_stats(int index, const char **name, SIM_ADDR *base, SIM_ADDR *end,
+                  unsigned64 *loads, unsigned64 *stores)
+{
+  struct mm_section_t *s;
+  SIM_ADDR page;
+
+  if (index < 0 || index >= mm_sect_count)
+    return 0;
+
+  s = mm_sects[index];
+  *name = s->name;
+  *base = s->base;
+  *end = s->end;
+  *loads = s->loads;
+  *stores = s->stores;
+
+  /* the fast path counts in the pages mapped by avm_map_pages() */
+  for (page = (s->base + AVM_PAGE_MASK) & ~AVM_PAGE_MASK;
+       page >= s->base && page + AVM_PAGE_SIZE <= s->end;
+       page += AVM_PAGE_SIZE)
+    {
+      avm_page_t *p = AVM_PAGE(page);
+      unsigned32 l1 = (page >> (AVM_PAGE_SHIFT + AVM_L2_BITS)) & (AVM_L1_SIZE - 1);
+      int core;
+
+      *loads += p->loads;
+      *stores += p->stores;
+      for (core = 1; core < NIOS2_CORES_MAX; ++core)
+        if (avm_core_counts[core][l1])
+          {
+            avm_count_t *c = &avm_core_counts[core][l1][(page >> AVM_PAGE_SHIFT) & (AVM_L2_SIZE - 1)];
+
+            *loads += c->loads;
+            *stores += c->stores;
+          }
+    }
+
+  return 1;
+}
+
+/*
+ * Watchpoints
+ *
+ * A page holding a watched range loses its fast mapping for the kind of
+ * access watched, like a page of code does for writes, so only the
+ * accesses to such pages reach avm_access() and compare the ranges.  The
+ * other pages keep running at full speed.  A hit stops the core once the
+ * instruction making the access has completed.
+ */
+
+/* set the watch bits of the pages in [phys, end) from the ranges on them */
+static void
+avm_watch_pages(SIM_ADDR phys, SIM_ADDR end)
+{
+  SIM_ADDR page;
+
+  for (page = phys & ~AVM_PAGE_MASK; page < end; page += AVM_PAGE_SIZE)
+    {
+      avm_page_t *p = avm_page_alloc(page);
+      struct mm_section_t *s = find_mm_section(page, NULL);
+      int i;
+
+      p->watch = 0;
+      for (i = 0; i < avm_watch_count; ++i)
+        if (avm_watches[i].phys < page + AVM_PAGE_SIZE && avm_watches[i].end > page)
+          p->watch |= avm_watches[i].type;
+
+      if (s && avm_page_mappable(s, page))
+        avm_map_page(s, page);
+    }
+}
+
+/* watch the type (AVM_WATCH_*) of CPU accesses to length bytes at phys,
+   which the debugger knows as addr; returns 0 on success */
+int
+avm_insert_watch(SIM_ADDR addr, SIM_ADDR phys, int length, int type)
+{
+  struct avm_watch_t *w;
+
+  phys &= ~0x80000000u;
+  if (length <= 0 || (type & (AVM_WATCH_READ | AVM_WATCH_WRITE)) == 0 ||
+      phys + length < phys)
+    return -1;
+
+  nios2_smp_lock();
+  avm_watches = (struct avm_watch_t *)
+    realloc(avm_watches, sizeof(*avm_watches) * (avm_watch_count + 1));
+  w = &avm_watches[avm_watch_count++];
+  w->addr = addr;
+  w->phys = phys;
+  w->end = phys + length;
+  w->type = type;
+  avm_watch_pages(w->phys, w->end);
+  nios2_smp_unlock();
+  return 0;
+}
+
+int
+avm_remove_watch(SIM_ADDR addr, SIM_ADDR phys, int length, int type)
+{
+  int i;
+
+  phys &= ~0x80000000u;
+  nios2_smp_lock();
+  for (i = 0; i < avm_watch_count; ++i)
+    {
+      struct avm_watch_t *w = &avm_watches[i];
+
+      if (w->addr != addr || w->phys != phys || w->end != phys + length ||
+          w->type != type)
+        continue;
+
+      *w = avm_watches[--avm_watch_count];
+      avm_watch_pages(phys, phys + length);
+      nios2_smp_unlock();
+      return 0;
+    }
+  nios2_smp_unlock();
+
+  return -1;
+}
+
+static int
+parse_watch_type(const char *s)
+{
+  if (strcmp(s, "r") == 0)
+    return AVM_WATCH_READ;
+  if (strcmp(s, "w") == 0)
+    return AVM_WATCH_WRITE;
+  if (strcmp(s, "rw") == 0)
+    return AVM_WATCH_READ | AVM_WATCH_WRITE;
+  return 0;
+}
+
+int
+watch_command(int argc, char *argv[])
+{
+  SIM_ADDR addr;
+  int i, length, type;
+
+  if (argc <= 1)
+    {
+      sim_printf(
+      "List of watch commands:\n\n"
+      "add <addr> <length> [r|w|rw] -- Stop after the CPU accesses the range\n"
+      "  (default: w)\n"
+      "remove <addr> <length> [r|w|rw] -- Remove a watchpoint\n"
+      "list -- List watchpoints\n"
+      );
+      return 0;
+    }
+
+  if (strcmp(argv[1], "add") == 0 || strcmp(argv[1], "remove") == 0)
+    {
+      if (argc < 4 || argc > 5)
+        {
+          sim_printf("wrong number of options for watch %s\n", argv[1]);
+          return 0;
+        }
+
+      addr = strtoul(argv[2], NULL, 0);
+      length = strtol(argv[3], NULL, 0);
+      type = (argc > 4) ? parse_watch_type(argv[4]) : AVM_WATCH_WRITE;
+      if (type == 0)
+        sim_printf("unknown watch type: %s\n", argv[4]);
+      else if (argv[1][0] == 'a' ? avm_insert_watch(addr, addr, length, type) < 0
+                                 : avm_remove_watch(addr, addr, length, type) < 0)
+        sim_printf("cannot %s watchpoint at 0x%08x\n", argv[1], addr);
+      return 0;
+    }
+  else if (strcmp(argv[1], "list") == 0)
+    {
+      if (argc > 2)
+        {
+          sim_printf("too many options for watch: %s\n", argv[1]);
+          return 0;
+        }
+
+      for (i = 0; i < avm_watch_count; ++i)
+        sim_printf("0x%08x-0x%08x %s\n", avm_watches[i].addr,
+                   avm_watches[i].addr + (avm_watches[i].end - avm_watches[i].phys) - 1,
+                   (avm_watches[i].type == AVM_WATCH_READ) ? "r" :
+                   (avm_watches[i].type == AVM_WATCH_WRITE) ? "w" : "rw");
+      return 0;
+    }
+
+  return 1;
+}
+
+/* the slow path is taken by one core at a time: it reaches the devices
+   and the snapshot and code tracking of the pages */
+static int
+avm_access_locked(SIM_ADDR mem, unsigned char *buf, int length, int flags, int mode)
+{
+  int result;
+
+  nios2_smp_lock();
+  result = avm_access(mem, buf, length, flags, mode);
+  nios2_smp_unlock();
+  return result;
 }
 
 int
 avm_read(SIM_ADDR mem, unsigned char *buf, int length, int flags)
 {
-  return avm_access(mem, buf, length, flags, READ_MODE);
+  return avm_access_locked(mem, buf, length, flags, READ_MODE);
 }
 
 int
 avm_write(SIM_ADDR mem, unsigned char *buf, int length, int flags)
 {
-  return avm_access(mem, buf, length, flags, WRITE_MODE);
+  return avm_access_locked(mem, buf, length, flags, WRITE_MODE);
 }
 
 int
 avm_write_force(SIM_ADDR mem, unsigned char *buf, int length, int flags)
 {
-  return avm_access(mem, buf, length, flags, FORCE_WRITE_MODE);
+  return avm_access_locked(mem, buf, length, flags, FORCE_WRITE_MODE);
 }
 
 /*
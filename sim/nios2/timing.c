@@ -0,0 +1,318 @@
+/**
+ * @file timing.c
+ * @brief Cycle-approximate timing models for NiosII simulator
+ * @author kimu_shu
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "libiberty.h"
+#include "gdb/remote-sim.h"
+#include "sim-main.h"
+#include "sim-nios2.h"
+
+typedef unsigned32 uint32_t;
+#include "asm_nios2.h"
+
+/*
+ * A timing model gives the issue cost of each instruction and the extra
+ * latency of its result; the interpreter adds them up per translated
+ * block together with the stalls of dependent instructions, so the
+ * static part costs nothing at run time.  Conditional branches are left
+ * to the branch() hook, called once at the end of the block.
+ *
+ * The figures follow the instruction execution performance tables of
+ * the Nios II Processor Reference Handbook, assuming zero-wait-state
+ * memory (caches add their own penalties).
+ */
+
+enum insn_class
+  {
+    CLASS_ALU,
+    CLASS_BRANCH,     /* conditional branches */
+    CLASS_CALL,       /* call, jmpi, br */
+    CLASS_JUMP,       /* jmp, ret, callr */
+    CLASS_CONTROL,    /* trap, break, eret, bret, wrctl, flushp, cache ops */
+    CLASS_RDCTL,
+    CLASS_LOAD,
+    CLASS_LOAD_SUB,   /* byte and halfword loads */
+    CLASS_STORE,
+    CLASS_SHIFT,
+    CLASS_SHIFT_REG,  /* shift/rotate by a register */
+    CLASS_MUL,
+    CLASS_DIV,
+    CLASS_CUSTOM,     /* takes nios2_custom_latency() cycles */
+  };
+
+static enum insn_class
+classify(unsigned32 opcode)
+{
+  switch (opcode)
+    {
+      case NIOS2_OP(0x0e): case NIOS2_OP(0x16): case NIOS2_OP(0x1e):
+      case NIOS2_OP(0x26): case NIOS2_OP(0x2e): case NIOS2_OP(0x36):
+        return CLASS_BRANCH;
+      case NIOS2_OP(0x00): case NIOS2_OP(0x01): case NIOS2_OP(0x06):
+        return CLASS_CALL;
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x05): case NIOS2_OP(0x3a)|NIOS2_OPX(0x0d):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x1d):
+        return CLASS_JUMP;
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x01): case NIOS2_OP(0x3a)|NIOS2_OPX(0x09):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x04): case NIOS2_OP(0x3a)|NIOS2_OPX(0x0c):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x29):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x2d): case NIOS2_OP(0x3a)|NIOS2_OPX(0x2e):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x34): case NIOS2_OP(0x3a)|NIOS2_OPX(0x36):
+      case NIOS2_OP(0x13): case NIOS2_OP(0x1b): case NIOS2_OP(0x33):
+      case NIOS2_OP(0x3b):
+        return CLASS_CONTROL;
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x26):
+        return CLASS_RDCTL;
+      case NIOS2_OP(0x17): case NIOS2_OP(0x37):
+        return CLASS_LOAD;
+      case NIOS2_OP(0x03): case NIOS2_OP(0x07): case NIOS2_OP(0x0b):
+      case NIOS2_OP(0x0f): case NIOS2_OP(0x23): case NIOS2_OP(0x27):
+      case NIOS2_OP(0x2b): case NIOS2_OP(0x2f):
+        return CLASS_LOAD_SUB;
+      case NIOS2_OP(0x05): case NIOS2_OP(0x0d): case NIOS2_OP(0x15):
+      case NIOS2_OP(0x25): case NIOS2_OP(0x2d): case NIOS2_OP(0x35):
+        return CLASS_STORE;
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x02): case NIOS2_OP(0x3a)|NIOS2_OPX(0x12):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x1a): case NIOS2_OP(0x3a)|NIOS2_OPX(0x3a):
+        return CLASS_SHIFT;
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x03): case NIOS2_OP(0x3a)|NIOS2_OPX(0x0b):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x13): case NIOS2_OP(0x3a)|NIOS2_OPX(0x1b):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x3b):
+        return CLASS_SHIFT_REG;
+      case NIOS2_OP(0x24):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x07): case NIOS2_OP(0x3a)|NIOS2_OPX(0x17):
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x1f): case NIOS2_OP(0x3a)|NIOS2_OPX(0x27):
+        return CLASS_MUL;
+      case NIOS2_OP(0x3a)|NIOS2_OPX(0x24): case NIOS2_OP(0x3a)|NIOS2_OPX(0x25):
+        return CLASS_DIV;
+      case NIOS2_OP(0x32):
+        return CLASS_CUSTOM;
+    }
+
+  return CLASS_ALU;
+}
+
+/*
+ * "simple": one cycle per instruction (the behaviour without a model)
+ */
+static int
+simple_cost(unsigned32 opcode, unsigned32 insn, int *latency)
+{
+  *latency = 0;
+  return 1;
+}
+
+/*
+ * Nios II/e: not pipelined, 6 cycles for most instructions, no branch
+ * prediction and no result latency.  Shifts by a register take one cycle
+ * per bit; the shift amount is not known at translation time, so the
+ * average is charged.
+ */
+static int
+e_cost(unsigned32 opcode, unsigned32 insn, int *latency)
+{
+  *latency = 0;
+  switch (classify(opcode))
+    {
+      case CLASS_LOAD_SUB:  return 9;
+      case CLASS_SHIFT:     return 7 + NIOS2_GET_IMM5(insn);
+      case CLASS_SHIFT_REG: return 7 + 16;
+      case CLASS_MUL:       return 6 + 32;  /* no multiplier: shift and add */
+      case CLASS_DIV:       return 6 + 32;
+      case CLASS_CUSTOM:    return 5 + nios2_custom_latency(NIOS2_CUSTOM_N(insn));
+      default:              return 6;
+    }
+}
+
+/*
+ * Nios II/s: 5-stage pipeline, static branch prediction (backward taken,
+ * forward not taken), embedded multipliers.
+ */
+static int
+s_cost(unsigned32 opcode, unsigned32 insn, int *latency)
+{
+  *latency = 0;
+  switch (classify(opcode))
+    {
+      case CLASS_BRANCH:    return 0;   /* see s_branch() */
+      case CLASS_CALL:
+      case CLASS_JUMP:
+      case CLASS_CONTROL:   return 4;
+      case CLASS_LOAD:
+      case CLASS_LOAD_SUB:
+      case CLASS_RDCTL:     *latency = 1; return 1;
+      case CLASS_SHIFT:
+      case CLASS_SHIFT_REG:
+      case CLASS_MUL:       *latency = 2; return 1;
+      case CLASS_DIV:       return 32;
+      case CLASS_CUSTOM:    return nios2_custom_latency(NIOS2_CUSTOM_N(insn));
+      default:              return 1;
+    }
+}
+
+static int
+s_branch(unsigned32 pc, unsigned32 target, int taken)
+{
+  int predicted = (target <= pc);
+
+  if (taken != predicted)
+    {
+      ++nios2_timing_stats.mispredicts;
+      return 5;
+    }
+
+  return taken ? 2 : 1;
+}
+
+/*
+ * Nios II/f: 6-stage pipeline, dynamic branch prediction with a table of
+ * 2-bit counters indexed by the PC and the global branch history.
+ */
+#define F_BHT_BITS      8
+#define F_BHT_SIZE      (1u << F_BHT_BITS)
+
+static NIOS2_PER_CORE unsigned8 f_bht[F_BHT_SIZE];
+static NIOS2_PER_CORE unsigned32 f_history;
+
+static int
+f_cost(unsigned32 opcode, unsigned32 insn, int *latency)
+{
+  *latency = 0;
+  switch (classify(opcode))
+    {
+      case CLASS_BRANCH:    return 0;   /* see f_branch() */
+      case CLASS_CALL:      return 2;
+      case CLASS_JUMP:      return 3;
+      case CLASS_CONTROL:   return 4;
+      case CLASS_LOAD:
+      case CLASS_LOAD_SUB:
+      case CLASS_RDCTL:
+      case CLASS_SHIFT:
+      case CLASS_SHIFT_REG:
+      case CLASS_MUL:       *latency = 2; return 1;
+      case CLASS_DIV:       return 35;
+      case CLASS_CUSTOM:    return nios2_custom_latency(NIOS2_CUSTOM_N(insn));
+      default:              return 1;
+    }
+}
+
+static int
+f_branch(unsigned32 pc, unsigned32 target, int taken)
+{
+  unsigned8 *counter = &f_bht[((pc >> 2) ^ f_history) & (F_BHT_SIZE - 1)];
+  int predicted = (*counter >= 2);
+
+  if (taken && *counter < 3)
+    ++*counter;
+  else if (!taken && *counter > 0)
+    --*counter;
+  f_history = ((f_history << 1) | taken) & (F_BHT_SIZE - 1);
+
+  if (taken != predicted)
+    {
+      ++nios2_timing_stats.mispredicts;
+      return 4;
+    }
+
+  return taken ? 2 : 1;
+}
+
+static void
+f_reset(void)
+{
+  /* weakly not taken */
+  memset(f_bht, 1, sizeof(f_bht));
+  f_history = 0;
+}
+
+static const nios2_timing_t timing_models[] =
+  {
+    { "simple", "1 cycle per instruction", simple_cost, NULL, NULL },
+    { "e", "Nios II/e economy core", e_cost, NULL, NULL },
+    { "s", "Nios II/s standard core", s_cost, s_branch, NULL },
+    { "f", "Nios II/f fast core", f_cost, f_branch, f_reset },
+    { NULL }
+  };
+
+const nios2_timing_t *nios2_timing = &timing_models[0];
+NIOS2_PER_CORE nios2_timing_stats_t nios2_timing_stats;
+
+void
+nios2_timing_reset(void)
+{
+  memset(&nios2_timing_stats, 0, sizeof(nios2_timing_stats));
+  if (nios2_timing->reset)
+    nios2_timing->reset();
+}
+
+int
+nios2_set_timing(const char *name)
+{
+  const nios2_timing_t *t;
+
+  for (t = timing_models; t->name; ++t)
+    if (strcmp(t->name, name) == 0)
+      {
+        nios2_timing = t;
+        nios2_timing_reset();
+        /* block costs are computed at translation */
+        nios2_decode_flush();
+        return 0;
+      }
+
+  sim_printf("unknown timing model: %s\n", name);
+  return 1;
+}
+
+void
+nios2_timing_info(void)
+{
+  sim_printf("timing model: %s (%s)\n", nios2_timing->name, nios2_timing->description);
+  if (nios2_timing->branch)
+    sim_printf("branches:     %llu (%llu mispredicted)\n",
+      (unsigned long long) nios2_timing_stats.branches,
+      (unsigned long long) nios2_timing_stats.mispredicts);
+  if (cpu.insns)
+    sim_printf("CPI:          %.3f\n", (double) cpu.cycles / cpu.insns);
+}
+
+int
+timing_command(int argc, char *argv[])
+{
+  const nios2_timing_t *t;
+
+  if (argc <= 1)
+    {
+      sim_printf("instructions: %llu\n", (unsigned long long) cpu.insns);
+      sim_printf("cycles:       %llu\n", (unsigned long long) cpu.cycles);
+      nios2_timing_info();
+      return 0;
+    }
+
+  if (strcmp(argv[1], "list") == 0 && argc == 2)
+    {
+      for (t = timing_models; t->name; ++t)
+        sim_printf("%c %-8s %s\n", (t == nios2_timing) ? '*' : ' ',
+          t->name, t->description);
+      return 0;
+    }
+
+  if (argc == 2)
+    {
+      nios2_set_timing(argv[1]);
+      return 0;
+    }
+
+  sim_printf("too many options for timing: %s\n", argv[2]);
+  return 0;
+}
+
+/*
+ * vim:et sts=2 sw=2:
+ */
@@ -5,6 +5,8 @@
  */
 
 #include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
 #include "gdb/callback.h"
@@ -17,9 +19,188 @@
 #include "sim-nios2.h"
 #include "sim-main.h"
 
+/*
+ * Trace file format
+ *
+ * A trace file starts with an 8-byte magic and a 32-bit version, and
+ * is followed by any number of chunks.  A chunk is a 32-bit byte length
+ * and a 32-bit record count followed by the encoded records.  All words
+ * are little endian.
+ *
+ * Each record (from, to) is stored as two unsigned LEB128 numbers:
+ * "from" relative to the "to" of the previous record (the length of the
+ * sequential run in between) and "to" relative to "from" (the branch
+ * displacement).  A difference is divided by 4 so that word-aligned values
+ * lose their zero bits (odd ones keep them in the top bits), then
+ * zigzag-encoded so that small negative values stay small; most records
+ * fit in 2 or 3 bytes instead of 8.
+ * The delta base is reset at each chunk, so chunks decode on their own.
+ *
+ * The stream mode appends records to a chunk in memory and writes it out
+ * whenever it fills up, so the RAM used does not depend on the length of
+ * the run.
+ */
+#define BTRACE_MAGIC            "NIOS2BT"
+#define BTRACE_VERSION          1
+#define BTRACE_RECORD_MAX       10    /* two 5-byte LEB128 numbers */
+#define BTRACE_CHUNK_DEFAULT    (64*1024)
+
+struct nios2_btrace_stream
+  {
+    FILE *file;
+    unsigned32 last;        /* "to" of the previous record */
+    unsigned32 count;       /* records in the current chunk */
+    unsigned32 length;      /* bytes in the current chunk */
+    unsigned32 size;        /* chunk capacity */
+    unsigned64 total;       /* records written so far */
+    unsigned char *chunk;
+  };
+
 static int btrace_init(enum nios2_btrace_mode mode, unsigned32 size);
 static int btrace_show(unsigned32 limit);
 
+static unsigned32
+btrace_delta(unsigned32 a, unsigned32 b)
+{
+  unsigned32 v = a - b;
+
+  /* divide by 4 keeping the sign; the low bits go to the top two bits */
+  v = (unsigned32) ((signed32) v >> 2) ^ (v << 30);
+  return (v << 1) ^ (unsigned32) ((signed32) v >> 31);
+}
+
+static unsigned32
+btrace_undelta(unsigned32 v, unsigned32 b)
+{
+  unsigned32 low;
+
+  v = (v >> 1) ^ -(v & 1);
+  low = (v >> 30) ^ (((v >> 29) & 1) ? 3 : 0);
+  return b + ((v << 2) | low);
+}
+
+static unsigned char *
+btrace_put(unsigned char *p, unsigned32 v)
+{
+  while (v >= 0x80)
+    {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  *p++ = v;
+  return p;
+}
+
+static const unsigned char *
+btrace_get(const unsigned char *p, const unsigned char *end, unsigned32 *v)
+{
+  int shift;
+
+  *v = 0;
+  for (shift = 0; p < end && shift < 35; shift += 7)
+    {
+      *v |= (unsigned32) (*p & 0x7f) << shift;
+      if (!(*p++ & 0x80))
+        return p;
+    }
+
+  return NULL;
+}
+
+static void
+btrace_put_word(unsigned char *p, unsigned32 v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static unsigned32
+btrace_get_word(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned32) p[3] << 24);
+}
+
+static struct nios2_btrace_stream *
+stream_open(const char *path, unsigned32 size)
+{
+  struct nios2_btrace_stream *st;
+  unsigned char header[12];
+
+  st = (struct nios2_btrace_stream *) calloc(1, sizeof(*st));
+  if (st == NULL)
+    return NULL;
+
+  if (size < 256)
+    size = 256;
+  st->size = size;
+  st->chunk = (unsigned char *) malloc(size);
+  st->file = fopen(path, "wb");
+  if (st->chunk == NULL || st->file == NULL)
+    {
+      sim_printf("cannot open trace file: %s\n", path);
+      if (st->file)
+        fclose(st->file);
+      free(st->chunk);
+      free(st);
+      return NULL;
+    }
+
+  memcpy(header, BTRACE_MAGIC, 8);
+  btrace_put_word(header + 8, BTRACE_VERSION);
+  fwrite(header, 1, sizeof(header), st->file);
+  return st;
+}
+
+static void
+stream_flush(struct nios2_btrace_stream *st)
+{
+  unsigned char header[8];
+
+  if (st->count == 0)
+    return;
+
+  btrace_put_word(header, st->length);
+  btrace_put_word(header + 4, st->count);
+  fwrite(header, 1, sizeof(header), st->file);
+  fwrite(st->chunk, 1, st->length, st->file);
+
+  st->total += st->count;
+  st->last = 0;
+  st->count = 0;
+  st->length = 0;
+}
+
+static void
+stream_put(struct nios2_btrace_stream *st, unsigned32 from, unsigned32 to)
+{
+  unsigned char *p;
+
+  if (st->length + BTRACE_RECORD_MAX > st->size)
+    stream_flush(st);
+
+  p = st->chunk + st->length;
+  p = btrace_put(p, btrace_delta(from, st->last));
+  p = btrace_put(p, btrace_delta(to, from));
+  st->length = p - st->chunk;
+  st->last = to;
+  ++st->count;
+}
+
+static int
+stream_close(struct nios2_btrace_stream *st)
+{
+  int err;
+
+  stream_flush(st);
+  err = ferror(st->file);
+  err |= fclose(st->file);
+  free(st->chunk);
+  free(st);
+  return err;
+}
+
 static int btrace_init(enum nios2_btrace_mode mode, unsigned32 size)
 {
   unsigned32 bytes;
@@ -44,8 +225,177 @@ static int btrace_init(enum nios2_btrace_mode mode, unsigned32 size)
   return 0;
 }
 
+static int btrace_init_stream(const char *path, unsigned32 size)
+{
+  btrace_free();
+  cpu.btrace.stream = stream_open(path, size);
+  if (cpu.btrace.stream == NULL)
+    {
+      cpu.btrace.mode = NIOS2_BTRACE_DISABLED;
+      return 1;
+    }
+
+  cpu.btrace.mode = NIOS2_BTRACE_STREAM;
+  cpu.btrace.index = 0;
+  cpu.btrace.size = 0;
+  return 0;
+}
+
+/* write the records held in memory to a trace file, oldest first */
+static int btrace_dump(const char *path)
+{
+  struct nios2_btrace_stream *st;
+  unsigned32 count, index;
+
+  if (cpu.btrace.mode == NIOS2_BTRACE_STREAM)
+    {
+      stream_flush(cpu.btrace.stream);
+      fflush(cpu.btrace.stream->file);
+      sim_printf("%llu records streamed\n",
+        (unsigned long long) cpu.btrace.stream->total);
+      return 0;
+    }
+
+  if (cpu.btrace.mode == NIOS2_BTRACE_DISABLED || cpu.btrace.buffer == NULL)
+    {
+      sim_printf("no trace data\n");
+      return 0;
+    }
+
+  if (path == NULL)
+    {
+      sim_printf("no trace file specified\n");
+      return 0;
+    }
+
+  st = stream_open(path, BTRACE_CHUNK_DEFAULT);
+  if (st == NULL)
+    return 1;
+
+  count = cpu.btrace.index;
+  index = 0;
+  if (cpu.btrace.mode == NIOS2_BTRACE_RING &&
+      cpu.btrace.buffer[cpu.btrace.index].to != 0xffffffff)
+    {
+      /* the ring has wrapped around */
+      count = cpu.btrace.size;
+      index = cpu.btrace.index;
+    }
+
+  for (; count > 0; --count, ++index)
+    {
+      index %= cpu.btrace.size;
+      stream_put(st, cpu.btrace.buffer[index].from, cpu.btrace.buffer[index].to);
+    }
+
+  count = st->total + st->count;
+  if (stream_close(st))
+    {
+      sim_printf("cannot write trace file: %s\n", path);
+      return 1;
+    }
+
+  sim_printf("%u records written to %s\n", count, path);
+  return 0;
+}
+
+/* read a trace file into a ring buffer keeping the last "limit" records */
+static int btrace_load(const char *path, unsigned32 limit)
+{
+  FILE *file;
+  unsigned char header[12];
+  unsigned char *chunk = NULL;
+  unsigned64 total = 0;
+  unsigned32 length, count;
+  long start;
+
+  file = fopen(path, "rb");
+  if (file == NULL)
+    {
+      sim_printf("cannot open trace file: %s\n", path);
+      return 1;
+    }
+
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, BTRACE_MAGIC, 8) != 0 ||
+      btrace_get_word(header + 8) != BTRACE_VERSION)
+    {
+      sim_printf("not a trace file: %s\n", path);
+      fclose(file);
+      return 1;
+    }
+
+  /* count the records from the chunk headers */
+  start = ftell(file);
+  while (fread(header, 1, 8, file) == 8)
+    {
+      total += btrace_get_word(header + 4);
+      if (fseek(file, btrace_get_word(header), SEEK_CUR) != 0)
+        break;
+    }
+
+  if (total == 0)
+    {
+      sim_printf("no records in %s\n", path);
+      fclose(file);
+      return 0;
+    }
+
+  if (total < limit)
+    limit = total;
+  if (btrace_init(NIOS2_BTRACE_RING, limit))
+    {
+      fclose(file);
+      return 1;
+    }
+
+  fseek(file, start, SEEK_SET);
+  while (fread(header, 1, 8, file) == 8)
+    {
+      const unsigned char *p, *end;
+      unsigned32 from, to = 0;
+
+      length = btrace_get_word(header);
+      count = btrace_get_word(header + 4);
+      chunk = (unsigned char *) realloc(chunk, length ? length : 1);
+      if (chunk == NULL || fread(chunk, 1, length, file) != length)
+        break;
+
+      for (p = chunk, end = chunk + length; count > 0 && p; --count)
+        {
+          p = btrace_get(p, end, &from);
+          if (p == NULL)
+            break;
+          from = btrace_undelta(from, to);
+          p = btrace_get(p, end, &to);
+          if (p == NULL)
+            break;
+          to = btrace_undelta(to, from);
+          btrace_record(from, to);
+        }
+
+      if (count > 0)
+        {
+          sim_printf("broken chunk in trace file: %s\n", path);
+          break;
+        }
+    }
+
+  free(chunk);
+  fclose(file);
+  sim_printf("%llu records in %s, last %u loaded\n",
+    (unsigned long long) total, path, limit);
+  return 0;
+}
+
 static int btrace_show(unsigned32 limit)
 {
+  if (cpu.btrace.mode == NIOS2_BTRACE_STREAM)
+    {
+      sim_printf("trace is streamed to a file (see btrace dump/load)\n");
+      return 0;
+    }
+
   if (cpu.btrace.mode == NIOS2_BTRACE_DISABLED || cpu.btrace.buffer == NULL)
     {
       sim_printf("no trace data\n");
@@ -72,6 +422,12 @@ static int btrace_show(unsigned32 limit)
 
 void btrace_record(unsigned32 from, unsigned32 to)
 {
+  if (cpu.btrace.mode == NIOS2_BTRACE_STREAM)
+    {
+      stream_put(cpu.btrace.stream, from, to);
+      return;
+    }
+
   if (cpu.btrace.mode == NIOS2_BTRACE_DISABLED ||
       cpu.btrace.index >= cpu.btrace.size)
     return;
@@ -85,11 +441,56 @@ void btrace_record(unsigned32 from, unsigned32 to)
     cpu.btrace.index = 0;
 }
 
+/*
+ * Snapshot of the records held in memory.  A restore only applies when
+ * the buffer has not been re-initialized since; a stream cannot be
+ * rewound, so it keeps the records of the abandoned run.
+ */
+static nios2_btrace_t btrace_saved;
+
+void btrace_save(void)
+{
+  free(btrace_saved.buffer);
+  btrace_saved = cpu.btrace;
+  btrace_saved.stream = NULL;
+  btrace_saved.buffer = NULL;
+  if (cpu.btrace.buffer == NULL)
+    return;
+
+  btrace_saved.buffer = (nios2_btrace_entry_t *)
+    malloc(cpu.btrace.size * sizeof(nios2_btrace_entry_t));
+  memcpy(btrace_saved.buffer, cpu.btrace.buffer,
+    cpu.btrace.size * sizeof(nios2_btrace_entry_t));
+}
+
+void btrace_restore(void)
+{
+  if (btrace_saved.buffer == NULL ||
+      cpu.btrace.mode != btrace_saved.mode ||
+      cpu.btrace.size != btrace_saved.size)
+    return;
+
+  cpu.btrace.index = btrace_saved.index;
+  memcpy(cpu.btrace.buffer, btrace_saved.buffer,
+    cpu.btrace.size * sizeof(nios2_btrace_entry_t));
+}
+
+void btrace_drop(void)
+{
+  free(btrace_saved.buffer);
+  memset(&btrace_saved, 0, sizeof(btrace_saved));
+}
+
 int btrace_free(void)
 {
+  int err = 0;
+
+  if (cpu.btrace.stream)
+    err = stream_close(cpu.btrace.stream);
+  cpu.btrace.stream = NULL;
   free(cpu.btrace.buffer);
   cpu.btrace.buffer = NULL;
-  return 0;
+  return err;
 }
 
 int btrace_command(int argc, char *argv[])
@@ -99,9 +500,12 @@ int btrace_command(int argc, char *argv[])
       sim_printf(
       "List of branch-trace commands:\n\n"
       "init -- Initialize and enable branch trace\n"
+      "        (init [ring|linear] [SIZE], init stream FILE [CHUNK])\n"
       "show -- Show trace data\n"
+      "dump -- Write trace data to a file (flush the file when streaming)\n"
+      "load -- Read trace data from a file to show (load FILE [SIZE])\n"
       );
-      return;
+      return 0;
     }
 
   int i = 1;
@@ -122,8 +526,28 @@ int btrace_command(int argc, char *argv[])
           mode = NIOS2_BTRACE_LINEAR;
           ++i;
         }
+      else if (i < argc && strcmp(argv[i], "stream") == 0)
+        {
+          const char *path;
 
-      if (i < argc)
+          if (++i == argc)
+            {
+              sim_printf("no trace file specified\n");
+              return 0;
+            }
+          path = argv[i++];
+          size = BTRACE_CHUNK_DEFAULT;
+          if (i < argc)
+            size = strtoul(argv[i++], NULL, 0);
+          if (i == argc)
+            {
+              btrace_init_stream(path, size);
+              return 0;
+            }
+          mode = NIOS2_BTRACE_STREAM;
+        }
+
+      if (i < argc && mode != NIOS2_BTRACE_STREAM)
         size = strtoul(argv[i++], NULL, 0);
 
       if (i == argc)
@@ -146,6 +570,42 @@ int btrace_command(int argc, char *argv[])
           return 0;
         }
     }
+  else if (strcmp(argv[1], "dump") == 0)
+    {
+      const char *path = NULL;
+      ++i;
+
+      if (i < argc)
+        path = argv[i++];
+
+      if (i == argc)
+        {
+          btrace_dump(path);
+          return 0;
+        }
+    }
+  else if (strcmp(argv[1], "load") == 0)
+    {
+      unsigned32 limit = -1;
+      ++i;
+
+      if (i == argc)
+        {
+          sim_printf("no trace file specified\n");
+          return 0;
+        }
+
+      const char *path = argv[i++];
+
+      if (i < argc)
+        limit = strtoul(argv[i++], NULL, 0);
+
+      if (i == argc)
+        {
+          btrace_load(path, limit);
+          return 0;
+        }
+    }
   else
     return 1;
 